@@ -0,0 +1,194 @@
+/*
+ * kiwi - general-purpose high-performance operating system
+ *
+ * Copyright (c) 2025 Omar Elghoul
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* LZ4 block format shared between the kernel and the host tools
+ *
+ * header-only for the same reason as xxhash.h - lz4_compress() is a greedy
+ * single-pass compressor with a small hash table, lz4_decompress() checks
+ * every length and offset against both buffers so a corrupt block can't
+ * write outside the output. blocks from either side can be decoded by any
+ * other LZ4 implementation and the other way around */
+
+#pragma once
+
+#include <kiwi/types.h>
+#include <string.h>
+
+#define LZ4_MIN_MATCH           4
+#define LZ4_LAST_LITERALS       5       /* the last bytes of a block are always literals */
+#define LZ4_MATCH_LIMIT         12      /* no match may start within this many bytes of the end */
+#define LZ4_MAX_OFFSET          65535
+#define LZ4_HASH_BITS           12
+#define LZ4_SKIP_TRIGGER        6       /* search faster through data that doesn't match */
+
+static inline u32 lz4_read32(const u8 *p) {
+    u32 value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static inline u32 lz4_hash(u32 sequence) {
+    return (sequence * 2654435761U) >> (32 - LZ4_HASH_BITS);
+}
+
+/* writes a length that didn't fit its 4-bit field as a run of 255s */
+static inline usize lz4_write_length(u8 *dst, usize op, usize capacity, usize length) {
+    for(; length >= 255; length -= 255) {
+        if(op >= capacity) return 0;
+        dst[op++] = 255;
+    }
+
+    if(op >= capacity) return 0;
+    dst[op++] = (u8) length;
+    return op;
+}
+
+static inline usize lz4_emit(u8 *dst, usize op, usize capacity, const u8 *literals,
+    usize literal_length, usize offset, usize match_length) {
+    if(op >= capacity) return 0;
+
+    usize token = op++;
+    dst[token] = (literal_length >= 15 ? 15 : literal_length) << 4;
+    if(literal_length >= 15 && !(op = lz4_write_length(dst, op, capacity, literal_length - 15)))
+        return 0;
+
+    if(literal_length > capacity - op) return 0;
+    memcpy(dst + op, literals, literal_length);
+    op += literal_length;
+
+    if(!match_length) return op; // the last sequence only has literals
+
+    if(capacity - op < 2) return 0;
+    dst[op++] = offset & 0xFF;
+    dst[op++] = offset >> 8;
+
+    match_length -= LZ4_MIN_MATCH;
+    dst[token] |= match_length >= 15 ? 15 : match_length;
+    if(match_length >= 15 && !(op = lz4_write_length(dst, op, capacity, match_length - 15)))
+        return 0;
+
+    return op;
+}
+
+/* returns the compressed size, zero if it doesn't fit in capacity */
+static inline usize lz4_compress(const void *source, usize size, void *destination, usize capacity) {
+    const u8 *src = (const u8 *) source;
+    u8 *dst = (u8 *) destination;
+    u32 table[1 << LZ4_HASH_BITS];
+    usize ip = 0, anchor = 0, op = 0;
+
+    memset(table, 0, sizeof(table));
+
+    if(size > LZ4_MATCH_LIMIT) {
+        usize limit = size - LZ4_MATCH_LIMIT;
+        usize match_end = size - LZ4_LAST_LITERALS;
+
+        while(ip < limit) {
+            u32 sequence = lz4_read32(src + ip);
+            u32 h = lz4_hash(sequence);
+            usize ref = table[h];
+            table[h] = (u32) ip;
+
+            if(ref >= ip || ip - ref > LZ4_MAX_OFFSET || lz4_read32(src + ref) != sequence) {
+                ip += 1 + ((ip - anchor) >> LZ4_SKIP_TRIGGER);
+                continue;
+            }
+
+            usize length = LZ4_MIN_MATCH;
+            while(ip + length < match_end && src[ref + length] == src[ip + length])
+                length++;
+
+            op = lz4_emit(dst, op, capacity, src + anchor, ip - anchor, ip - ref, length);
+            if(!op) return 0;
+
+            ip += length;
+            anchor = ip;
+            if(ip - 2 < limit) table[lz4_hash(lz4_read32(src + ip - 2))] = (u32) (ip - 2);
+        }
+    }
+
+    return lz4_emit(dst, op, capacity, src + anchor, size - anchor, 0, 0);
+}
+
+static inline int lz4_read_length(const u8 *src, usize *ip, usize size, usize *length) {
+    u8 byte;
+    do {
+        if(*ip >= size) return -1;
+        byte = src[(*ip)++];
+        *length += byte;
+    } while(byte == 255);
+
+    return 0;
+}
+
+/* returns the decompressed size, zero if the block is malformed or doesn't
+ * fit in capacity */
+static inline usize lz4_decompress(const void *source, usize size, void *destination,
+    usize capacity) {
+    const u8 *src = (const u8 *) source;
+    u8 *dst = (u8 *) destination;
+    usize ip = 0, op = 0;
+
+    while(ip < size) {
+        u8 token = src[ip++];
+
+        usize literal_length = token >> 4;
+        if(literal_length == 15 && lz4_read_length(src, &ip, size, &literal_length))
+            return 0;
+
+        if(literal_length > size - ip || literal_length > capacity - op)
+            return 0;
+
+        memcpy(dst + op, src + ip, literal_length);
+        ip += literal_length;
+        op += literal_length;
+
+        if(ip == size) break;
+
+        if(size - ip < 2) return 0;
+        usize offset = src[ip] | (src[ip + 1] << 8);
+        ip += 2;
+        if(!offset || offset > op) return 0;
+
+        usize match_length = token & 15;
+        if(match_length == 15 && lz4_read_length(src, &ip, size, &match_length))
+            return 0;
+
+        match_length += LZ4_MIN_MATCH;
+        if(match_length > capacity - op) return 0;
+
+        // matches may overlap what they produce, which repeats a short pattern
+        const u8 *match = dst + op - offset;
+        if(offset >= match_length) {
+            memcpy(dst + op, match, match_length);
+        } else {
+            for(usize i = 0; i < match_length; i++)
+                dst[op + i] = match[i];
+        }
+
+        op += match_length;
+    }
+
+    return op;
+}
@@ -0,0 +1,638 @@
+/*
+ * kiwi - general-purpose high-performance operating system
+ *
+ * Copyright (c) 2025 Omar Elghoul
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* xxHash family shared between the kernel and the host tools
+ *
+ * this is header-only on purpose: the kernel is built freestanding without SSE
+ * while pulse is built for the host, so each side compiles the same code with
+ * its own flags - the kernel gets the scalar path and the host additionally
+ * gets SSE2, and AVX2 behind a runtime check (see pulse/hash.c)
+ *
+ * xxh64() is the classic XXH64, xxh3_64() and xxh3_128() are XXH3 and all
+ * three produce the same values as the reference implementation */
+
+#pragma once
+
+#include <kiwi/types.h>
+
+#if defined(__SSE2__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define XXH3_HAVE_SSE2          1
+#if defined(__GNUC__) && defined(__x86_64__)
+#define XXH3_HAVE_AVX2          1
+#endif
+#endif
+
+#define XXH_PRIME32_1           0x9E3779B1U
+#define XXH_PRIME32_2           0x85EBCA77U
+#define XXH_PRIME32_3           0xC2B2AE3DU
+#define XXH_PRIME64_1           0x9E3779B185EBCA87ULL
+#define XXH_PRIME64_2           0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME64_3           0x165667B19E3779F9ULL
+#define XXH_PRIME64_4           0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME64_5           0x27D4EB2F165667C5ULL
+
+#define XXH3_SECRET_SIZE        192
+#define XXH3_SECRET_SIZE_MIN    136
+#define XXH3_STRIPE_LEN         64
+#define XXH3_SECRET_CONSUME     8
+#define XXH3_ACC_COUNT          8
+#define XXH3_MID_SIZE_MAX       240
+
+typedef struct Hash128 {
+    u64 low;
+    u64 high;
+} Hash128;
+
+/* the long-input loop is the only part worth vectorizing, so it is split out
+ * into an engine that callers can select at runtime */
+typedef struct XXH3Engine {
+    const char *name;
+    void (*accumulate)(u64 *acc, const u8 *input, const u8 *secret, usize stripes);
+    void (*scramble)(u64 *acc, const u8 *secret);
+} XXH3Engine;
+
+static const u8 xxh3_default_secret[XXH3_SECRET_SIZE] __attribute__((aligned(64))) = {
+    0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c, 0xf7, 0x21, 0xad, 0x1c,
+    0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb, 0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f,
+    0xcb, 0x79, 0xe6, 0x4e, 0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+    0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6, 0x81, 0x3a, 0x26, 0x4c,
+    0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb, 0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3,
+    0x71, 0x64, 0x48, 0x97, 0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+    0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7, 0xc7, 0x0b, 0x4f, 0x1d,
+    0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31, 0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64,
+    0xea, 0xc5, 0xac, 0x83, 0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+    0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26, 0x29, 0xd4, 0x68, 0x9e,
+    0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc, 0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce,
+    0x45, 0xcb, 0x3a, 0x8f, 0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e,
+};
+
+/* all loads go through memcpy so unaligned input is fine on every target and
+ * the compiler still emits a single mov */
+static inline u64 xxh_read64(const void *p) {
+    u64 value;
+    __builtin_memcpy(&value, p, sizeof(value));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    value = __builtin_bswap64(value);
+#endif
+    return value;
+}
+
+static inline u32 xxh_read32(const void *p) {
+    u32 value;
+    __builtin_memcpy(&value, p, sizeof(value));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    value = __builtin_bswap32(value);
+#endif
+    return value;
+}
+
+static inline void xxh_write64(void *p, u64 value) {
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    value = __builtin_bswap64(value);
+#endif
+    __builtin_memcpy(p, &value, sizeof(value));
+}
+
+static inline u64 xxh_rotl64(u64 x, u8 r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline u32 xxh_rotl32(u32 x, u8 r) {
+    return (x << r) | (x >> (32 - r));
+}
+
+static inline Hash128 xxh_mul128(u64 a, u64 b) {
+    unsigned __int128 product = (unsigned __int128) a * b;
+    Hash128 result = { (u64) product, (u64) (product >> 64) };
+    return result;
+}
+
+static inline u64 xxh_mul128_fold64(u64 a, u64 b) {
+    Hash128 product = xxh_mul128(a, b);
+    return product.low ^ product.high;
+}
+
+/*
+ * XXH64
+ */
+
+static inline u64 xxh64_round(u64 acc, u64 input) {
+    acc += input * XXH_PRIME64_2;
+    acc = xxh_rotl64(acc, 31);
+    return acc * XXH_PRIME64_1;
+}
+
+static inline u64 xxh64_merge_round(u64 hash, u64 value) {
+    hash ^= xxh64_round(0, value);
+    return hash * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+static inline u64 xxh64_avalanche(u64 hash) {
+    hash ^= hash >> 33;
+    hash *= XXH_PRIME64_2;
+    hash ^= hash >> 29;
+    hash *= XXH_PRIME64_3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+static inline u64 xxh64(const void *data, usize len, u64 seed) {
+    const u8 *p = (const u8 *) data;
+    const u8 *const end = p + len;
+    u64 hash;
+
+    if(len >= 32) {
+        u64 v1 = seed + XXH_PRIME64_1 + XXH_PRIME64_2;
+        u64 v2 = seed + XXH_PRIME64_2;
+        u64 v3 = seed;
+        u64 v4 = seed - XXH_PRIME64_1;
+
+        const u8 *limit = end - 32;
+        do {
+            v1 = xxh64_round(v1, xxh_read64(p));
+            v2 = xxh64_round(v2, xxh_read64(p + 8));
+            v3 = xxh64_round(v3, xxh_read64(p + 16));
+            v4 = xxh64_round(v4, xxh_read64(p + 24));
+            p += 32;
+        } while(p <= limit);
+
+        hash = xxh_rotl64(v1, 1) + xxh_rotl64(v2, 7) + xxh_rotl64(v3, 12) + xxh_rotl64(v4, 18);
+        hash = xxh64_merge_round(hash, v1);
+        hash = xxh64_merge_round(hash, v2);
+        hash = xxh64_merge_round(hash, v3);
+        hash = xxh64_merge_round(hash, v4);
+    } else {
+        hash = seed + XXH_PRIME64_5;
+    }
+
+    hash += len;
+
+    while(p + 8 <= end) {
+        hash ^= xxh64_round(0, xxh_read64(p));
+        hash = xxh_rotl64(hash, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+        p += 8;
+    }
+
+    if(p + 4 <= end) {
+        hash ^= (u64) xxh_read32(p) * XXH_PRIME64_1;
+        hash = xxh_rotl64(hash, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+        p += 4;
+    }
+
+    while(p < end) {
+        hash ^= (*p) * XXH_PRIME64_5;
+        hash = xxh_rotl64(hash, 11) * XXH_PRIME64_1;
+        p++;
+    }
+
+    return xxh64_avalanche(hash);
+}
+
+/*
+ * XXH3 - short inputs
+ */
+
+static inline u64 xxh3_avalanche(u64 hash) {
+    hash ^= hash >> 37;
+    hash *= 0x165667919E3779F9ULL;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+static inline u64 xxh3_rrmxmx(u64 hash, u64 len) {
+    hash ^= xxh_rotl64(hash, 49) ^ xxh_rotl64(hash, 24);
+    hash *= 0x9FB21C651E98DF25ULL;
+    hash ^= (hash >> 35) + len;
+    hash *= 0x9FB21C651E98DF25ULL;
+    hash ^= hash >> 28;
+    return hash;
+}
+
+static inline u64 xxh3_mix16(const u8 *input, const u8 *secret, u64 seed) {
+    u64 low = xxh_read64(input);
+    u64 high = xxh_read64(input + 8);
+    return xxh_mul128_fold64(low ^ (xxh_read64(secret) + seed),
+        high ^ (xxh_read64(secret + 8) - seed));
+}
+
+static inline u64 xxh3_64_0to16(const u8 *input, usize len, const u8 *secret, u64 seed) {
+    if(len > 8) {
+        u64 flip1 = (xxh_read64(secret + 24) ^ xxh_read64(secret + 32)) + seed;
+        u64 flip2 = (xxh_read64(secret + 40) ^ xxh_read64(secret + 48)) - seed;
+        u64 low = xxh_read64(input) ^ flip1;
+        u64 high = xxh_read64(input + len - 8) ^ flip2;
+        u64 acc = len + __builtin_bswap64(low) + high + xxh_mul128_fold64(low, high);
+        return xxh3_avalanche(acc);
+    }
+
+    if(len >= 4) {
+        seed ^= (u64) __builtin_bswap32((u32) seed) << 32;
+        u32 input1 = xxh_read32(input);
+        u32 input2 = xxh_read32(input + len - 4);
+        u64 flip = (xxh_read64(secret + 8) ^ xxh_read64(secret + 16)) - seed;
+        u64 input64 = input2 + ((u64) input1 << 32);
+        return xxh3_rrmxmx(input64 ^ flip, len);
+    }
+
+    if(len) {
+        u32 combined = ((u32) input[0] << 16) | ((u32) input[len >> 1] << 24) |
+            ((u32) input[len - 1]) | ((u32) len << 8);
+        u64 flip = (xxh_read32(secret) ^ xxh_read32(secret + 4)) + seed;
+        return xxh64_avalanche((u64) combined ^ flip);
+    }
+
+    return xxh64_avalanche(seed ^ (xxh_read64(secret + 56) ^ xxh_read64(secret + 64)));
+}
+
+static inline u64 xxh3_64_17to128(const u8 *input, usize len, const u8 *secret, u64 seed) {
+    u64 acc = len * XXH_PRIME64_1;
+
+    if(len > 32) {
+        if(len > 64) {
+            if(len > 96) {
+                acc += xxh3_mix16(input + 48, secret + 96, seed);
+                acc += xxh3_mix16(input + len - 64, secret + 112, seed);
+            }
+            acc += xxh3_mix16(input + 32, secret + 64, seed);
+            acc += xxh3_mix16(input + len - 48, secret + 80, seed);
+        }
+        acc += xxh3_mix16(input + 16, secret + 32, seed);
+        acc += xxh3_mix16(input + len - 32, secret + 48, seed);
+    }
+
+    acc += xxh3_mix16(input, secret, seed);
+    acc += xxh3_mix16(input + len - 16, secret + 16, seed);
+    return xxh3_avalanche(acc);
+}
+
+static inline u64 xxh3_64_129to240(const u8 *input, usize len, const u8 *secret, u64 seed) {
+    u64 acc = len * XXH_PRIME64_1;
+    usize rounds = len / 16;
+
+    for(usize i = 0; i < 8; i++)
+        acc += xxh3_mix16(input + 16 * i, secret + 16 * i, seed);
+
+    acc = xxh3_avalanche(acc);
+
+    for(usize i = 8; i < rounds; i++)
+        acc += xxh3_mix16(input + 16 * i, secret + 16 * (i - 8) + 3, seed);
+
+    acc += xxh3_mix16(input + len - 16, secret + XXH3_SECRET_SIZE_MIN - 17, seed);
+    return xxh3_avalanche(acc);
+}
+
+static inline Hash128 xxh3_mix32(Hash128 acc, const u8 *input1, const u8 *input2,
+    const u8 *secret, u64 seed) {
+    acc.low += xxh3_mix16(input1, secret, seed);
+    acc.low ^= xxh_read64(input2) + xxh_read64(input2 + 8);
+    acc.high += xxh3_mix16(input2, secret + 16, seed);
+    acc.high ^= xxh_read64(input1) + xxh_read64(input1 + 8);
+    return acc;
+}
+
+static inline Hash128 xxh3_128_0to16(const u8 *input, usize len, const u8 *secret, u64 seed) {
+    Hash128 result;
+
+    if(len > 8) {
+        u64 flip_low = (xxh_read64(secret + 32) ^ xxh_read64(secret + 40)) - seed;
+        u64 flip_high = (xxh_read64(secret + 48) ^ xxh_read64(secret + 56)) + seed;
+        u64 input_low = xxh_read64(input);
+        u64 input_high = xxh_read64(input + len - 8);
+
+        Hash128 m = xxh_mul128(input_low ^ input_high ^ flip_low, XXH_PRIME64_1);
+        m.low += (u64) (len - 1) << 54;
+        input_high ^= flip_high;
+        m.high += input_high + (u64) (u32) input_high * (XXH_PRIME32_2 - 1);
+        m.low ^= __builtin_bswap64(m.high);
+
+        Hash128 h = xxh_mul128(m.low, XXH_PRIME64_2);
+        h.high += m.high * XXH_PRIME64_2;
+        result.low = xxh3_avalanche(h.low);
+        result.high = xxh3_avalanche(h.high);
+        return result;
+    }
+
+    if(len >= 4) {
+        seed ^= (u64) __builtin_bswap32((u32) seed) << 32;
+        u32 input_low = xxh_read32(input);
+        u32 input_high = xxh_read32(input + len - 4);
+        u64 input64 = input_low + ((u64) input_high << 32);
+        u64 flip = (xxh_read64(secret + 16) ^ xxh_read64(secret + 24)) + seed;
+
+        Hash128 m = xxh_mul128(input64 ^ flip, XXH_PRIME64_1 + ((u64) len << 2));
+        m.high += m.low << 1;
+        m.low ^= m.high >> 3;
+        m.low ^= m.low >> 35;
+        m.low *= 0x9FB21C651E98DF25ULL;
+        m.low ^= m.low >> 28;
+        result.low = m.low;
+        result.high = xxh3_avalanche(m.high);
+        return result;
+    }
+
+    if(len) {
+        u32 combined_low = ((u32) input[0] << 16) | ((u32) input[len >> 1] << 24) |
+            ((u32) input[len - 1]) | ((u32) len << 8);
+        u32 combined_high = xxh_rotl32(__builtin_bswap32(combined_low), 13);
+        u64 flip_low = (xxh_read32(secret) ^ xxh_read32(secret + 4)) + seed;
+        u64 flip_high = (xxh_read32(secret + 8) ^ xxh_read32(secret + 12)) - seed;
+        result.low = xxh64_avalanche(combined_low ^ flip_low);
+        result.high = xxh64_avalanche(combined_high ^ flip_high);
+        return result;
+    }
+
+    result.low = xxh64_avalanche(seed ^ xxh_read64(secret + 64) ^ xxh_read64(secret + 72));
+    result.high = xxh64_avalanche(seed ^ xxh_read64(secret + 80) ^ xxh_read64(secret + 88));
+    return result;
+}
+
+static inline Hash128 xxh3_128_finalize(Hash128 acc, usize len, u64 seed) {
+    Hash128 result;
+    u64 low = acc.low + acc.high;
+    u64 high = acc.low * XXH_PRIME64_1 + acc.high * XXH_PRIME64_4 +
+        (len - seed) * XXH_PRIME64_2;
+    result.low = xxh3_avalanche(low);
+    result.high = 0 - xxh3_avalanche(high);
+    return result;
+}
+
+static inline Hash128 xxh3_128_17to128(const u8 *input, usize len, const u8 *secret, u64 seed) {
+    Hash128 acc = { len * XXH_PRIME64_1, 0 };
+
+    if(len > 32) {
+        if(len > 64) {
+            if(len > 96)
+                acc = xxh3_mix32(acc, input + 48, input + len - 64, secret + 96, seed);
+            acc = xxh3_mix32(acc, input + 32, input + len - 48, secret + 64, seed);
+        }
+        acc = xxh3_mix32(acc, input + 16, input + len - 32, secret + 32, seed);
+    }
+
+    acc = xxh3_mix32(acc, input, input + len - 16, secret, seed);
+    return xxh3_128_finalize(acc, len, seed);
+}
+
+static inline Hash128 xxh3_128_129to240(const u8 *input, usize len, const u8 *secret, u64 seed) {
+    Hash128 acc = { len * XXH_PRIME64_1, 0 };
+    usize rounds = len / 32;
+
+    for(usize i = 0; i < 4; i++)
+        acc = xxh3_mix32(acc, input + 32 * i, input + 32 * i + 16, secret + 32 * i, seed);
+
+    acc.low = xxh3_avalanche(acc.low);
+    acc.high = xxh3_avalanche(acc.high);
+
+    for(usize i = 4; i < rounds; i++)
+        acc = xxh3_mix32(acc, input + 32 * i, input + 32 * i + 16,
+            secret + 3 + 32 * (i - 4), seed);
+
+    acc = xxh3_mix32(acc, input + len - 16, input + len - 32,
+        secret + XXH3_SECRET_SIZE_MIN - 17 - 16, 0 - seed);
+    return xxh3_128_finalize(acc, len, seed);
+}
+
+/*
+ * XXH3 - long inputs
+ */
+
+static inline void xxh3_accumulate_scalar(u64 *acc, const u8 *input, const u8 *secret,
+    usize stripes) {
+    for(usize s = 0; s < stripes; s++) {
+        const u8 *in = input + s * XXH3_STRIPE_LEN;
+        const u8 *key = secret + s * XXH3_SECRET_CONSUME;
+
+        for(int i = 0; i < XXH3_ACC_COUNT; i++) {
+            u64 data = xxh_read64(in + 8 * i);
+            u64 keyed = data ^ xxh_read64(key + 8 * i);
+            acc[i ^ 1] += data;
+            acc[i] += (u64) (u32) keyed * (keyed >> 32);
+        }
+    }
+}
+
+static inline void xxh3_scramble_scalar(u64 *acc, const u8 *secret) {
+    for(int i = 0; i < XXH3_ACC_COUNT; i++) {
+        u64 value = acc[i];
+        value ^= value >> 47;
+        value ^= xxh_read64(secret + 8 * i);
+        acc[i] = value * XXH_PRIME32_1;
+    }
+}
+
+static const XXH3Engine xxh3_engine_scalar = {
+    "scalar", xxh3_accumulate_scalar, xxh3_scramble_scalar
+};
+
+#ifdef XXH3_HAVE_SSE2
+static inline void xxh3_accumulate_sse2(u64 *acc, const u8 *input, const u8 *secret,
+    usize stripes) {
+    __m128i *xacc = (__m128i *) acc;
+
+    for(usize s = 0; s < stripes; s++) {
+        const __m128i *in = (const __m128i *) (input + s * XXH3_STRIPE_LEN);
+        const __m128i *key = (const __m128i *) (secret + s * XXH3_SECRET_CONSUME);
+
+        for(int i = 0; i < XXH3_STRIPE_LEN / 16; i++) {
+            __m128i data = _mm_loadu_si128(in + i);
+            __m128i keyed = _mm_xor_si128(data, _mm_loadu_si128(key + i));
+            __m128i keyed_high = _mm_shuffle_epi32(keyed, _MM_SHUFFLE(0, 3, 0, 1));
+            __m128i product = _mm_mul_epu32(keyed, keyed_high);
+            __m128i swapped = _mm_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2));
+            xacc[i] = _mm_add_epi64(product, _mm_add_epi64(xacc[i], swapped));
+        }
+    }
+}
+
+static inline void xxh3_scramble_sse2(u64 *acc, const u8 *secret) {
+    __m128i *xacc = (__m128i *) acc;
+    const __m128i *key = (const __m128i *) secret;
+    const __m128i prime = _mm_set1_epi32((int) XXH_PRIME32_1);
+
+    for(int i = 0; i < XXH3_STRIPE_LEN / 16; i++) {
+        __m128i value = _mm_xor_si128(xacc[i], _mm_srli_epi64(xacc[i], 47));
+        __m128i keyed = _mm_xor_si128(value, _mm_loadu_si128(key + i));
+        __m128i keyed_high = _mm_shuffle_epi32(keyed, _MM_SHUFFLE(0, 3, 0, 1));
+        __m128i product_low = _mm_mul_epu32(keyed, prime);
+        __m128i product_high = _mm_mul_epu32(keyed_high, prime);
+        xacc[i] = _mm_add_epi64(product_low, _mm_slli_epi64(product_high, 32));
+    }
+}
+
+static const XXH3Engine xxh3_engine_sse2 = {
+    "sse2", xxh3_accumulate_sse2, xxh3_scramble_sse2
+};
+#endif
+
+#ifdef XXH3_HAVE_AVX2
+__attribute__((target("avx2")))
+static inline void xxh3_accumulate_avx2(u64 *acc, const u8 *input, const u8 *secret,
+    usize stripes) {
+    __m256i *xacc = (__m256i *) acc;
+
+    for(usize s = 0; s < stripes; s++) {
+        const __m256i *in = (const __m256i *) (input + s * XXH3_STRIPE_LEN);
+        const __m256i *key = (const __m256i *) (secret + s * XXH3_SECRET_CONSUME);
+
+        for(int i = 0; i < XXH3_STRIPE_LEN / 32; i++) {
+            __m256i data = _mm256_loadu_si256(in + i);
+            __m256i keyed = _mm256_xor_si256(data, _mm256_loadu_si256(key + i));
+            __m256i keyed_high = _mm256_shuffle_epi32(keyed, _MM_SHUFFLE(0, 3, 0, 1));
+            __m256i product = _mm256_mul_epu32(keyed, keyed_high);
+            __m256i swapped = _mm256_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2));
+            xacc[i] = _mm256_add_epi64(product, _mm256_add_epi64(xacc[i], swapped));
+        }
+    }
+}
+
+__attribute__((target("avx2")))
+static inline void xxh3_scramble_avx2(u64 *acc, const u8 *secret) {
+    __m256i *xacc = (__m256i *) acc;
+    const __m256i *key = (const __m256i *) secret;
+    const __m256i prime = _mm256_set1_epi32((int) XXH_PRIME32_1);
+
+    for(int i = 0; i < XXH3_STRIPE_LEN / 32; i++) {
+        __m256i value = _mm256_xor_si256(xacc[i], _mm256_srli_epi64(xacc[i], 47));
+        __m256i keyed = _mm256_xor_si256(value, _mm256_loadu_si256(key + i));
+        __m256i keyed_high = _mm256_shuffle_epi32(keyed, _MM_SHUFFLE(0, 3, 0, 1));
+        __m256i product_low = _mm256_mul_epu32(keyed, prime);
+        __m256i product_high = _mm256_mul_epu32(keyed_high, prime);
+        xacc[i] = _mm256_add_epi64(product_low, _mm256_slli_epi64(product_high, 32));
+    }
+}
+
+static const XXH3Engine xxh3_engine_avx2 = {
+    "avx2", xxh3_accumulate_avx2, xxh3_scramble_avx2
+};
+#endif
+
+/* best engine that is known to work without checking the CPU at runtime */
+#ifdef XXH3_HAVE_SSE2
+#define XXH3_ENGINE_DEFAULT     (&xxh3_engine_sse2)
+#else
+#define XXH3_ENGINE_DEFAULT     (&xxh3_engine_scalar)
+#endif
+
+static inline void xxh3_hash_long(u64 *acc, const u8 *input, usize len, const u8 *secret,
+    const XXH3Engine *engine) {
+    const usize stripes_per_block = (XXH3_SECRET_SIZE - XXH3_STRIPE_LEN) / XXH3_SECRET_CONSUME;
+    const usize block_len = XXH3_STRIPE_LEN * stripes_per_block;
+    const usize blocks = (len - 1) / block_len;
+
+    acc[0] = XXH_PRIME32_3;
+    acc[1] = XXH_PRIME64_1;
+    acc[2] = XXH_PRIME64_2;
+    acc[3] = XXH_PRIME64_3;
+    acc[4] = XXH_PRIME64_4;
+    acc[5] = XXH_PRIME32_2;
+    acc[6] = XXH_PRIME64_5;
+    acc[7] = XXH_PRIME32_1;
+
+    for(usize i = 0; i < blocks; i++) {
+        engine->accumulate(acc, input + i * block_len, secret, stripes_per_block);
+        engine->scramble(acc, secret + XXH3_SECRET_SIZE - XXH3_STRIPE_LEN);
+    }
+
+    usize stripes = ((len - 1) - block_len * blocks) / XXH3_STRIPE_LEN;
+    engine->accumulate(acc, input + blocks * block_len, secret, stripes);
+
+    // the last stripe always ends exactly at the end of the input
+    engine->accumulate(acc, input + len - XXH3_STRIPE_LEN,
+        secret + XXH3_SECRET_SIZE - XXH3_STRIPE_LEN - 7, 1);
+}
+
+static inline u64 xxh3_merge_accs(const u64 *acc, const u8 *secret, u64 start) {
+    u64 result = start;
+    for(int i = 0; i < 4; i++) {
+        result += xxh_mul128_fold64(acc[2 * i] ^ xxh_read64(secret + 16 * i),
+            acc[2 * i + 1] ^ xxh_read64(secret + 16 * i + 8));
+    }
+    return xxh3_avalanche(result);
+}
+
+static inline void xxh3_derive_secret(u8 *secret, u64 seed) {
+    for(int i = 0; i < XXH3_SECRET_SIZE / 16; i++) {
+        xxh_write64(secret + 16 * i, xxh_read64(xxh3_default_secret + 16 * i) + seed);
+        xxh_write64(secret + 16 * i + 8, xxh_read64(xxh3_default_secret + 16 * i + 8) - seed);
+    }
+}
+
+/*
+ * XXH3 - public entry points
+ */
+
+static inline u64 xxh3_64_engine(const void *data, usize len, u64 seed,
+    const XXH3Engine *engine) {
+    const u8 *input = (const u8 *) data;
+    const u8 *secret = xxh3_default_secret;
+
+    if(len <= 16) return xxh3_64_0to16(input, len, secret, seed);
+    if(len <= 128) return xxh3_64_17to128(input, len, secret, seed);
+    if(len <= XXH3_MID_SIZE_MAX) return xxh3_64_129to240(input, len, secret, seed);
+
+    u64 acc[XXH3_ACC_COUNT] __attribute__((aligned(32)));
+    u8 custom[XXH3_SECRET_SIZE] __attribute__((aligned(32)));
+
+    if(seed) {
+        xxh3_derive_secret(custom, seed);
+        secret = custom;
+    }
+
+    xxh3_hash_long(acc, input, len, secret, engine);
+    return xxh3_merge_accs(acc, secret + 11, len * XXH_PRIME64_1);
+}
+
+static inline Hash128 xxh3_128_engine(const void *data, usize len, u64 seed,
+    const XXH3Engine *engine) {
+    const u8 *input = (const u8 *) data;
+    const u8 *secret = xxh3_default_secret;
+
+    if(len <= 16) return xxh3_128_0to16(input, len, secret, seed);
+    if(len <= 128) return xxh3_128_17to128(input, len, secret, seed);
+    if(len <= XXH3_MID_SIZE_MAX) return xxh3_128_129to240(input, len, secret, seed);
+
+    u64 acc[XXH3_ACC_COUNT] __attribute__((aligned(32)));
+    u8 custom[XXH3_SECRET_SIZE] __attribute__((aligned(32)));
+
+    if(seed) {
+        xxh3_derive_secret(custom, seed);
+        secret = custom;
+    }
+
+    xxh3_hash_long(acc, input, len, secret, engine);
+
+    Hash128 result;
+    result.low = xxh3_merge_accs(acc, secret + 11, len * XXH_PRIME64_1);
+    result.high = xxh3_merge_accs(acc, secret + XXH3_SECRET_SIZE - 64 - 11,
+        ~(len * XXH_PRIME64_2));
+    return result;
+}
+
+static inline u64 xxh3_64(const void *data, usize len, u64 seed) {
+    return xxh3_64_engine(data, len, seed, XXH3_ENGINE_DEFAULT);
+}
+
+static inline Hash128 xxh3_128(const void *data, usize len, u64 seed) {
+    return xxh3_128_engine(data, len, seed, XXH3_ENGINE_DEFAULT);
+}
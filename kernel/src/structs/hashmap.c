@@ -23,6 +23,7 @@
  */
 
 #include <kiwi/structs/hashmap.h>
+#include <kiwi/xxhash.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -30,86 +31,6 @@
 #define GROWTH_LOAD_FACTOR              75 /* percent */
 #define SHRINK_LOAD_FACTOR              25 /* percent */
 
-static inline u64 rotl64(u64 x, u8 r) {
-    return (x << r) | (x >> (64 - r));
-}
-
-static u64 xxhash64_string(const char *str) {
-    usize len = strlen(str);
-    const u64 prime1 = 11400714785074694791ULL;
-    const u64 prime2 = 14029467366897019727ULL;
-    const u64 prime3 = 1609587929392839161ULL;
-    const u64 prime4 = 9650029242287828579ULL;
-    const u64 prime5 = 2870177450012600261ULL;
-    const u64 seed = 0x9E3779B185EBCA87ULL;
-
-    const u8 *p = (const u8 *) str;
-    const u8 *const end = p + len;
-    u64 hash;
-
-    if (len >= 32) {
-        u64 v1 = seed + prime1 + prime2;
-        u64 v2 = seed + prime2;
-        u64 v3 = seed + 0;
-        u64 v4 = seed - prime1;
-
-        const u8 *limit = end - 32;
-        do {
-            v1 += (*(u64*)p)  *prime2;
-            v1 = rotl64(v1, 31);
-            v1 *= prime1;
-            p += 8;
-
-            v2 += (*(u64*)p)  *prime2;
-            v2 = rotl64(v2, 31);
-            v2 *= prime1;
-            p += 8;
-
-            v3 += (*(u64*)p)  *prime2;
-            v3 = rotl64(v3, 31);
-            v3 *= prime1;
-            p += 8;
-
-            v4 += (*(u64*)p)  *prime2;
-            v4 = rotl64(v4, 31);
-            v4 *= prime1;
-            p += 8;
-        } while (p <= limit);
-
-        hash = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
-    } else {
-        hash = seed + prime5;
-    }
-
-    while (p + 8 <= end) {
-        u64 k1 = *(u64 *)p;
-        k1 *= prime2; k1 = rotl64(k1, 31); k1 *= prime1;
-        hash ^= k1;
-        hash = rotl64(hash, 27)  *prime1 + prime4;
-        p += 8;
-    }
-
-    if (p + 4 <= end) {
-        hash ^= (*(u32 *)p) * prime1;
-        hash = rotl64(hash, 23) * prime2 + prime3;
-        p += 4;
-    }
-
-    while (p < end) {
-        hash ^= (*p) * prime5;
-        hash = rotl64(hash, 11)  *prime1;
-        p++;
-    }
-
-    hash ^= hash >> 33;
-    hash *= prime2;
-    hash ^= hash >> 29;
-    hash *= prime3;
-    hash ^= hash >> 32;
-
-    return hash;
-}
-
 static int hashmap_resize(Hashmap *map, u64 new_bucket_count) {
     HashmapEntry **new_buckets = (HashmapEntry **) calloc(new_bucket_count, sizeof(HashmapEntry *));
     if(!new_buckets) {
@@ -282,7 +203,7 @@ int hashmap_put_string(Hashmap *map, const char *key, u64 value) {
         return -1;
     }
 
-    u64 hash = xxhash64_string(key) + strlen(key);
+    u64 hash = xxh3_64(key, strlen(key), 0);
     return hashmap_put(map, hash, value);
 }
 
@@ -291,6 +212,6 @@ int hashmap_get_string(Hashmap *map, const char *key, u64 *value) {
         return -1;
     }
 
-    u64 hash = xxhash64_string(key) + strlen(key);
+    u64 hash = xxh3_64(key, strlen(key), 0);
     return hashmap_get(map, hash, value);
 }
@@ -0,0 +1,787 @@
+/*
+ * pulse - a highly scalable SSD-first file system with predictable logarithmic
+ * bounds across all operations
+ * 
+ * Copyright (c) 2025 Omar Elghoul
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <pulse/pulse.h>
+#include <pulse/cli.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* every workload runs on a freshly formatted scratch image and records the
+ * latency of each operation, the results can be written out as JSON so two
+ * builds can be compared with a plain diff */
+
+#define BENCH_DEFAULT_IMAGE     "bench.img"
+#define BENCH_IMAGE_SIZE        (1024ULL * 1024 * 1024)     /* per unit of scale */
+#define BENCH_MAX_WORKLOADS     32
+
+#define BENCH_ALLOC_OPS         65536
+#define BENCH_INODE_OPS         4096
+#define BENCH_DIR_FILES         2048
+#define BENCH_DEEP_LEVELS       16
+#define BENCH_DEEP_FILES        64
+#define BENCH_DEEP_LOOKUPS      65536
+#define BENCH_SEQ_SIZE          (64ULL * 1024 * 1024)
+#define BENCH_SEQ_CHUNK         (128 * 1024)
+#define BENCH_RANDOM_OPS        4096
+#define BENCH_RANDOM_SIZE       4096
+#define BENCH_MOUNTS            32
+
+typedef struct BenchResult {
+    const char *name;
+    u64 ops;
+    u64 bytes;              // payload moved by the workload, zero if it moves none
+    double seconds;
+    u64 p50_ns;
+    u64 p99_ns;
+    u64 max_ns;
+    IOStats io;             // block I/O done by the workload
+
+    u64 *samples;
+    u64 sample_count;
+    u64 start_ns;
+    IOStats start_io;
+} BenchResult;
+
+static BenchResult results[BENCH_MAX_WORKLOADS];
+static int result_count;
+static const char *bench_image;
+static IOStats retired_io;      // counted by the volumes bench_unmount() let go of
+
+static inline u64 bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* block I/O is counted per volume, so what the volumes unmounted so far did
+ * is added to the current one's and a workload that remounts still adds up */
+static void bench_io(IOStats *io) {
+    memcpy(io, &retired_io, sizeof(IOStats));
+    if(!mountpoint) return;
+
+    io->reads += mountpoint->io_stats.reads;
+    io->writes += mountpoint->io_stats.writes;
+    io->bytes_read += mountpoint->io_stats.bytes_read;
+    io->bytes_written += mountpoint->io_stats.bytes_written;
+}
+
+/* syncs first so the write-back is still counted against the volume */
+static int bench_unmount(void) {
+    if(sync_volume(mountpoint)) return 1;
+
+    retired_io.reads += mountpoint->io_stats.reads;
+    retired_io.writes += mountpoint->io_stats.writes;
+    retired_io.bytes_read += mountpoint->io_stats.bytes_read;
+    retired_io.bytes_written += mountpoint->io_stats.bytes_written;
+    return unmount_current();
+}
+
+static BenchResult *bench_begin(const char *name, u64 ops) {
+    if(result_count == BENCH_MAX_WORKLOADS) return NULL;
+
+    BenchResult *result = &results[result_count];
+    memset(result, 0, sizeof(BenchResult));
+    result->name = name;
+    result->samples = malloc(ops * sizeof(u64));
+    if(!result->samples) return NULL;
+
+    result_count++;
+    bench_io(&result->start_io);
+    result->start_ns = bench_now();
+    return result;
+}
+
+static inline void bench_sample(BenchResult *result, u64 start_ns) {
+    result->samples[result->sample_count++] = bench_now() - start_ns;
+}
+
+static int bench_compare(const void *a, const void *b) {
+    u64 x = *(const u64 *) a, y = *(const u64 *) b;
+    return x < y ? -1 : x > y;
+}
+
+static void bench_end(BenchResult *result, u64 bytes) {
+    result->seconds = (bench_now() - result->start_ns) / 1e9;
+    result->ops = result->sample_count;
+    result->bytes = bytes;
+
+    IOStats io;
+    bench_io(&io);
+    result->io.reads = io.reads - result->start_io.reads;
+    result->io.writes = io.writes - result->start_io.writes;
+    result->io.bytes_read = io.bytes_read - result->start_io.bytes_read;
+    result->io.bytes_written = io.bytes_written - result->start_io.bytes_written;
+
+    if(result->sample_count) {
+        qsort(result->samples, result->sample_count, sizeof(u64), bench_compare);
+        result->p50_ns = result->samples[(result->sample_count - 1) * 50 / 100];
+        result->p99_ns = result->samples[(result->sample_count - 1) * 99 / 100];
+        result->max_ns = result->samples[result->sample_count - 1];
+    }
+
+    free(result->samples);
+    result->samples = NULL;
+}
+
+/* allocates and frees single blocks once with the bitmap math generated for
+ * the volume's fanout and block size and once with the generic set, which
+ * reads both from the volume - the difference is what specializing saves */
+static int bench_alloc(u64 scale) {
+    static const char *names[2][2] = { {"alloc", "free"}, {"alloc-generic", "free-generic"} };
+    const BitmapMath *chosen = mountpoint->bitmap_math;
+    u64 ops = BENCH_ALLOC_OPS * scale;
+    u64 *blocks = malloc(ops * sizeof(u64));
+    if(!blocks) return 1;
+
+    for(int generic = 0; generic < 2; generic++) {
+        mountpoint->bitmap_math = generic ? &bitmap_math_generic : chosen;
+
+        BenchResult *result = bench_begin(names[generic][0], ops);
+        if(!result) goto fail;
+
+        for(u64 i = 0; i < ops; i++) {
+            u64 start = bench_now();
+            blocks[i] = allocate_block(mountpoint);
+            bench_sample(result, start);
+            if(blocks[i] == -1) goto fail;
+        }
+
+        bench_end(result, 0);
+
+        result = bench_begin(names[generic][1], ops);
+        if(!result) goto fail;
+
+        for(u64 i = 0; i < ops; i++) {
+            u64 start = bench_now();
+            int status = free_block(mountpoint, blocks[i]);
+            bench_sample(result, start);
+            if(status) goto fail;
+        }
+
+        bench_end(result, 0);
+    }
+
+    mountpoint->bitmap_math = chosen;
+    free(blocks);
+    return 0;
+
+fail:
+    mountpoint->bitmap_math = chosen;
+    free(blocks);
+    return 1;
+}
+
+static int bench_inodes(u64 scale) {
+    u64 ops = BENCH_INODE_OPS * scale;
+    u64 *inodes = malloc(ops * sizeof(u64));
+    Inode *inode = malloc(mountpoint->block_size);
+    if(!inodes || !inode) goto fail;
+
+    BenchResult *result = bench_begin("inode-create", ops);
+    if(!result) goto fail;
+
+    for(u64 i = 0; i < ops; i++) {
+        u64 start = bench_now();
+        inodes[i] = create_inode(mountpoint, INODE_MODE_TYPE_REG | INODE_MODE_U_R | INODE_MODE_U_W);
+        bench_sample(result, start);
+        if(!inodes[i]) goto fail;
+    }
+
+    bench_end(result, 0);
+
+    result = bench_begin("inode-read", ops);
+    if(!result) goto fail;
+
+    for(u64 i = 0; i < ops; i++) {
+        u64 start = bench_now();
+        int status = read_inode(mountpoint, inodes[i], inode);
+        bench_sample(result, start);
+        if(status) goto fail;
+    }
+
+    bench_end(result, 0);
+
+    result = bench_begin("inode-write", ops);
+    if(!result) goto fail;
+
+    for(u64 i = 0; i < ops; i++) {
+        if(read_inode(mountpoint, inodes[i], inode)) goto fail;
+        inode->uid = i;
+
+        u64 start = bench_now();
+        int status = write_inode(mountpoint, inodes[i], inode);
+        bench_sample(result, start);
+        if(status) goto fail;
+    }
+
+    bench_end(result, 0);
+
+    for(u64 i = 0; i < ops; i++)
+        free_block(mountpoint, inodes[i]);
+
+    free(inodes);
+    free(inode);
+    return 0;
+
+fail:
+    free(inodes);
+    free(inode);
+    return 1;
+}
+
+static int bench_directories(u64 scale) {
+    u64 files = BENCH_DIR_FILES * scale;
+    char path[64];
+
+    if(!create_file(mountpoint, "/dir", INODE_MODE_TYPE_DIR | INODE_MODE_U_RWX))
+        return 1;
+
+    BenchResult *result = bench_begin("dir-create", files);
+    if(!result) return 1;
+
+    for(u64 i = 0; i < files; i++) {
+        sprintf(path, "/dir/file%" PRIu64 "", i);
+        u64 start = bench_now();
+        u64 inode = create_file(mountpoint, path,
+            INODE_MODE_TYPE_REG | INODE_MODE_U_R | INODE_MODE_U_W);
+        bench_sample(result, start);
+        if(!inode) return 1;
+    }
+
+    bench_end(result, 0);
+
+    // look files up in a different order than they were created
+    result = bench_begin("dir-lookup", files);
+    if(!result) return 1;
+
+    for(u64 i = 0; i < files; i++) {
+        sprintf(path, "/dir/file%" PRIu64 "", (i * 7919) % files);
+        u64 start = bench_now();
+        u64 inode = resolve(mountpoint, path);
+        bench_sample(result, start);
+        if(!inode) return 1;
+    }
+
+    bench_end(result, 0);
+
+    result = bench_begin("dir-unlink", files);
+    if(!result) return 1;
+
+    for(u64 i = 0; i < files; i++) {
+        sprintf(path, "/dir/file%" PRIu64 "", i);
+        u64 start = bench_now();
+        int status = remove_file(mountpoint, path);
+        bench_sample(result, start);
+        if(status) return 1;
+    }
+
+    bench_end(result, 0);
+    return remove_file(mountpoint, "/dir");
+}
+
+/* the same deep paths looked up by walking every component and through the
+ * path index */
+static int bench_deep_paths(u64 scale) {
+    u64 lookups = BENCH_DEEP_LOOKUPS * scale;
+    char path[BENCH_DEEP_LEVELS * 4 + 32] = "";
+
+    for(int level = 0; level < BENCH_DEEP_LEVELS; level++) {
+        sprintf(path + strlen(path), "/d%d", level);
+        if(!create_file(mountpoint, path, INODE_MODE_TYPE_DIR | INODE_MODE_U_RWX))
+            return 1;
+    }
+
+    usize depth = strlen(path);
+    for(u64 i = 0; i < BENCH_DEEP_FILES; i++) {
+        sprintf(path + depth, "/file%" PRIu64 "", i);
+        if(!create_file(mountpoint, path, INODE_MODE_TYPE_REG | INODE_MODE_U_R | INODE_MODE_U_W))
+            return 1;
+    }
+
+    for(int indexed = 0; indexed < 2; indexed++) {
+        if(path_index_enable(mountpoint, indexed)) return 1;
+
+        BenchResult *result = bench_begin(indexed ? "deep-index" : "deep-walk", lookups);
+        if(!result) return 1;
+
+        for(u64 i = 0; i < lookups; i++) {
+            sprintf(path + depth, "/file%" PRIu64 "", (i * 7919) % BENCH_DEEP_FILES);
+            u64 start = bench_now();
+            u64 inode = resolve(mountpoint, path);
+            bench_sample(result, start);
+            if(!inode) return 1;
+        }
+
+        bench_end(result, 0);
+    }
+
+    if(path_index_enable(mountpoint, 0)) return 1;
+
+    for(u64 i = 0; i < BENCH_DEEP_FILES; i++) {
+        sprintf(path + depth, "/file%" PRIu64 "", i);
+        if(remove_file(mountpoint, path)) return 1;
+    }
+
+    for(int level = BENCH_DEEP_LEVELS; level > 0; level--) {
+        *strrchr(path, '/') = 0;
+        if(remove_file(mountpoint, path)) return 1;
+    }
+
+    return 0;
+}
+
+static int bench_file_io(u64 scale) {
+    u64 size = BENCH_SEQ_SIZE * scale;
+    u64 chunks = size / BENCH_SEQ_CHUNK;
+    u64 random_ops = BENCH_RANDOM_OPS * scale;
+
+    u8 *buffer = malloc(BENCH_SEQ_CHUNK);
+    if(!buffer) return 1;
+
+    for(u64 i = 0; i < BENCH_SEQ_CHUNK; i++)
+        buffer[i] = (u8) (i * 2654435761U >> 24);
+
+    u64 inode = create_file(mountpoint, "/data",
+        INODE_MODE_TYPE_REG | INODE_MODE_U_R | INODE_MODE_U_W);
+    if(!inode) goto fail;
+
+    BenchResult *result = bench_begin("seq-write", chunks);
+    if(!result) goto fail;
+
+    for(u64 i = 0; i < chunks; i++) {
+        u64 start = bench_now();
+        int status = write_to_inode(mountpoint, inode, buffer, i * BENCH_SEQ_CHUNK,
+            BENCH_SEQ_CHUNK);
+        bench_sample(result, start);
+        if(status) goto fail;
+    }
+
+    bench_end(result, size);
+
+    result = bench_begin("seq-read", chunks);
+    if(!result) goto fail;
+
+    for(u64 i = 0; i < chunks; i++) {
+        u64 start = bench_now();
+        int status = read_from_inode(mountpoint, inode, buffer, i * BENCH_SEQ_CHUNK,
+            BENCH_SEQ_CHUNK);
+        bench_sample(result, start);
+        if(status) goto fail;
+    }
+
+    bench_end(result, size);
+
+    // the same pseudo-random offsets for every run so results stay comparable
+    u64 slots = size / BENCH_RANDOM_SIZE;
+    u64 state = 0x9E3779B97F4A7C15ULL;
+
+    result = bench_begin("rand-write", random_ops);
+    if(!result) goto fail;
+
+    for(u64 i = 0; i < random_ops; i++) {
+        state ^= state << 13; state ^= state >> 7; state ^= state << 17;
+        u64 offset = (state % slots) * BENCH_RANDOM_SIZE;
+
+        u64 start = bench_now();
+        int status = write_to_inode(mountpoint, inode, buffer, offset, BENCH_RANDOM_SIZE);
+        bench_sample(result, start);
+        if(status) goto fail;
+    }
+
+    bench_end(result, random_ops * BENCH_RANDOM_SIZE);
+
+    result = bench_begin("rand-read", random_ops);
+    if(!result) goto fail;
+
+    for(u64 i = 0; i < random_ops; i++) {
+        state ^= state << 13; state ^= state >> 7; state ^= state << 17;
+        u64 offset = (state % slots) * BENCH_RANDOM_SIZE;
+
+        u64 start = bench_now();
+        int status = read_from_inode(mountpoint, inode, buffer, offset, BENCH_RANDOM_SIZE);
+        bench_sample(result, start);
+        if(status) goto fail;
+    }
+
+    bench_end(result, random_ops * BENCH_RANDOM_SIZE);
+
+    free(buffer);
+    return remove_file(mountpoint, "/data");
+
+fail:
+    free(buffer);
+    return 1;
+}
+
+static int bench_mount(u64 scale) {
+    BenchResult *result = bench_begin("mount", BENCH_MOUNTS);
+    if(!result) return 1;
+
+    for(int i = 0; i < BENCH_MOUNTS; i++) {
+        if(bench_unmount()) return 1;
+
+        u64 start = bench_now();
+        int status = mount_current(bench_image);
+        bench_sample(result, start);
+        if(status) return 1;
+    }
+
+    bench_end(result, 0);
+    return 0;
+}
+
+static int bench_check(u64 scale) {
+    BenchResult *result = bench_begin("check", 1);
+    if(!result) return 1;
+
+    CheckReport report;
+    u64 start = bench_now();
+    int status = check_volume(mountpoint, 1, &report);
+    bench_sample(result, start);
+    bench_end(result, report.bytes_read);
+
+    if(status) return 1;
+    return (report.leaked_blocks || report.missing_blocks || report.cross_linked_blocks ||
+        report.layer_errors || report.structure_errors);
+}
+
+/* sequential throughput and space overhead at every block size, each on its
+ * own freshly formatted image - the data is read back after a remount so the
+ * inode cache starts out cold. the last image is left mounted */
+static int bench_block_sizes(const char *image, u64 scale, usize fanout) {
+    static char names[2 * 8][24];
+    u64 size = BENCH_SEQ_SIZE * scale;
+    u64 chunks = size / BENCH_SEQ_CHUNK;
+    int name = 0;
+
+    u8 *buffer = malloc(BENCH_SEQ_CHUNK);
+    if(!buffer) return 1;
+
+    for(u64 i = 0; i < BENCH_SEQ_CHUNK; i++)
+        buffer[i] = (u8) (i * 2654435761U >> 24);
+
+    for(usize block_size = 4096; block_size <= 512 * 1024; block_size *= 2) {
+        CheckReport empty, full;
+        if(mountpoint && unmount_current()) goto fail;
+
+        printf(ESC_BOLD_CYAN "bench:" ESC_RESET " %zu KB blocks\n", block_size >> 10);
+        if(format(image, BENCH_IMAGE_SIZE * scale, block_size, fanout) || mount_current(image) ||
+            check_volume(mountpoint, 1, &empty))
+            goto fail;
+
+        u64 inode = create_file(mountpoint, "/data",
+            INODE_MODE_TYPE_REG | INODE_MODE_U_R | INODE_MODE_U_W);
+        if(!inode) goto fail;
+
+        snprintf(names[name], sizeof(names[name]), "seq-write-%zuk", block_size >> 10);
+        BenchResult *result = bench_begin(names[name++], chunks);
+        if(!result) goto fail;
+
+        for(u64 i = 0; i < chunks; i++) {
+            u64 start = bench_now();
+            int status = write_to_inode(mountpoint, inode, buffer, i * BENCH_SEQ_CHUNK,
+                BENCH_SEQ_CHUNK);
+            bench_sample(result, start);
+            if(status) goto fail;
+        }
+
+        // delayed data counts towards the write
+        if(sync_volume(mountpoint)) goto fail;
+        bench_end(result, size);
+
+        if(unmount_current() || mount_current(image)) goto fail;
+
+        snprintf(names[name], sizeof(names[name]), "seq-read-%zuk", block_size >> 10);
+        result = bench_begin(names[name++], chunks);
+        if(!result) goto fail;
+
+        for(u64 i = 0; i < chunks; i++) {
+            u64 start = bench_now();
+            int status = read_from_inode(mountpoint, inode, buffer, i * BENCH_SEQ_CHUNK,
+                BENCH_SEQ_CHUNK);
+            bench_sample(result, start);
+            if(status) goto fail;
+        }
+
+        bench_end(result, size);
+
+        // whatever the file took beyond its data is extent tree and inode
+        if(check_volume(mountpoint, 1, &full)) goto fail;
+
+        u64 fixed = empty.allocated_blocks * block_size;
+        u64 metadata = (full.allocated_blocks - empty.allocated_blocks) * block_size - size;
+        printf("    %zu KB blocks: %" PRIu64 " KB superblock and bitmap, %" PRIu64 " KB metadata for %" PRIu64 " MB of data (%.3f%%)\n",
+            block_size >> 10, fixed >> 10, metadata >> 10, size >> 20, metadata * 100.0 / size);
+    }
+
+    free(buffer);
+    return 0;
+
+fail:
+    free(buffer);
+    return 1;
+}
+
+/* the same sequential fill and random overwrites on a volume with each data
+ * allocator. write amplification is every byte written to the device over the
+ * payload, the log pays for its cleaner in that number. the last image is left
+ * mounted */
+static int bench_allocators(const char *image, u64 scale, usize block_size, usize fanout) {
+    static const struct {
+        const char *name;
+        usize allocator;
+    } allocators[] = {
+        {"lowest", SUPER_TUNING_ALLOCATOR_LOWEST},
+        {"log", SUPER_TUNING_ALLOCATOR_LOG},
+    };
+
+    static char names[3 * 2][24];
+    u64 size = BENCH_SEQ_SIZE * scale;
+    u64 chunks = size / BENCH_SEQ_CHUNK;
+    u64 random_ops = BENCH_RANDOM_OPS * scale;
+    int name = 0;
+
+    u8 *buffer = malloc(BENCH_SEQ_CHUNK);
+    if(!buffer) return 1;
+
+    for(u64 i = 0; i < BENCH_SEQ_CHUNK; i++)
+        buffer[i] = (u8) (i * 2654435761U >> 24);
+
+    for(int a = 0; a < sizeof(allocators) / sizeof(allocators[0]); a++) {
+        if(mountpoint && unmount_current()) goto fail;
+
+        // the volume is kept small so the overwrites fill the log and the cleaner has work
+        printf(ESC_BOLD_CYAN "bench:" ESC_RESET " %s allocator\n", allocators[a].name);
+        if(format_volume(image, size * 2, block_size, fanout, 0, allocators[a].allocator) ||
+            mount_current(image))
+            goto fail;
+
+        u64 inode = create_file(mountpoint, "/data",
+            INODE_MODE_TYPE_REG | INODE_MODE_U_R | INODE_MODE_U_W);
+        if(!inode) goto fail;
+
+        snprintf(names[name], sizeof(names[name]), "fill-%s", allocators[a].name);
+        BenchResult *result = bench_begin(names[name++], chunks);
+        if(!result) goto fail;
+
+        for(u64 i = 0; i < chunks; i++) {
+            u64 start = bench_now();
+            int status = write_to_inode(mountpoint, inode, buffer, i * BENCH_SEQ_CHUNK,
+                BENCH_SEQ_CHUNK);
+            bench_sample(result, start);
+            if(status) goto fail;
+        }
+
+        if(sync_volume(mountpoint)) goto fail;
+        bench_end(result, size);
+
+        u64 writes = mountpoint->data_writes, jumps = mountpoint->data_write_jumps;
+        snprintf(names[name], sizeof(names[name]), "overwrite-%s", allocators[a].name);
+        result = bench_begin(names[name++], random_ops);
+        if(!result) goto fail;
+
+        u64 seed = 0x9e3779b97f4a7c15ULL;
+        for(u64 i = 0; i < random_ops; i++) {
+            seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+            u64 offset = (seed >> 33) % (size / BENCH_RANDOM_SIZE) * BENCH_RANDOM_SIZE;
+
+            u64 start = bench_now();
+            int status = write_to_inode(mountpoint, inode, buffer, offset, BENCH_RANDOM_SIZE);
+            bench_sample(result, start);
+            if(status) goto fail;
+        }
+
+        if(sync_volume(mountpoint)) goto fail;
+        bench_end(result, random_ops * BENCH_RANDOM_SIZE);
+
+        writes = mountpoint->data_writes - writes;
+        jumps = mountpoint->data_write_jumps - jumps;
+        u64 written = result->io.bytes_written;
+
+        if(mountpoint->log_mode) {
+            CleanReport report;
+            snprintf(names[name], sizeof(names[name]), "clean-%s", allocators[a].name);
+            result = bench_begin(names[name++], 1);
+            if(!result) goto fail;
+
+            u64 start = bench_now();
+            int status = clean_log(mountpoint, 16, &report) || sync_volume(mountpoint);
+            bench_sample(result, start);
+            if(status) goto fail;
+
+            bench_end(result, report.moved_blocks * block_size);
+            written += result->io.bytes_written;
+        }
+
+        printf("    %s: %.2fx write amplification, %" PRIu64 " of %" PRIu64 " data writes not sequential\n",
+            allocators[a].name, written / (double) (random_ops * BENCH_RANDOM_SIZE), jumps, writes);
+    }
+
+    free(buffer);
+    return 0;
+
+fail:
+    free(buffer);
+    return 1;
+}
+
+static int bench_write_json(const char *path, u64 scale) {
+    FILE *file = !strcmp(path, "-") ? stdout : fopen(path, "w");
+    if(!file) return 1;
+
+    fprintf(file, "{\n");
+    fprintf(file, "  \"block_size\": %u,\n", mountpoint->block_size);
+    fprintf(file, "  \"fanout\": %u,\n", mountpoint->fanout);
+    fprintf(file, "  \"volume_size\": %" PRIu64 ",\n", mountpoint->superblock->volume_size);
+    fprintf(file, "  \"scale\": %" PRIu64 ",\n", scale);
+    fprintf(file, "  \"hash_engine\": \"%s\",\n", hash_engine()->name);
+    fprintf(file, "  \"workloads\": [\n");
+
+    for(int i = 0; i < result_count; i++) {
+        BenchResult *r = &results[i];
+        fprintf(file, "    {\"name\": \"%s\", \"ops\": %" PRIu64 ", \"seconds\": %.6f, "
+            "\"ops_per_sec\": %.1f, \"bytes\": %" PRIu64 ", \"p50_ns\": %" PRIu64 ", \"p99_ns\": %" PRIu64 ", "
+            "\"max_ns\": %" PRIu64 ", \"reads\": %" PRIu64 ", \"writes\": %" PRIu64 ", \"bytes_read\": %" PRIu64 ", "
+            "\"bytes_written\": %" PRIu64 "}%s\n",
+            r->name, r->ops, r->seconds, r->seconds > 0 ? r->ops / r->seconds : 0, r->bytes,
+            r->p50_ns, r->p99_ns, r->max_ns, r->io.reads, r->io.writes, r->io.bytes_read,
+            r->io.bytes_written, i + 1 < result_count ? "," : "");
+    }
+
+    fprintf(file, "  ]\n}\n");
+    if(file != stdout) fclose(file);
+    return 0;
+}
+
+static void bench_print(void) {
+    printf("    %-14s %9s %12s %10s %10s %10s %10s %9s\n", "workload", "ops", "ops/s",
+        "p50 us", "p99 us", "MB/s", "reads", "writes");
+
+    for(int i = 0; i < result_count; i++) {
+        BenchResult *r = &results[i];
+        printf("    %-14s %9" PRIu64 " %12.1f %10.2f %10.2f %10.1f %10" PRIu64 " %9" PRIu64 "\n", r->name, r->ops,
+            r->seconds > 0 ? r->ops / r->seconds : 0, r->p50_ns / 1e3, r->p99_ns / 1e3,
+            r->seconds > 0 ? (r->bytes / (1024.0 * 1024)) / r->seconds : 0,
+            r->io.reads, r->io.writes);
+    }
+}
+
+int bench_command(int argc, char **argv) {
+    const char *image = BENCH_DEFAULT_IMAGE;
+    const char *json = NULL;
+    u64 scale = 1;
+    usize block_size = DEFAULT_BLOCK_SIZE;
+    usize fanout = DEFAULT_FANOUT_FACTOR;
+    int sizes = 0;
+    int allocators = 0;
+    int usage = 0;
+
+    for(int i = 1; i < argc && !usage; i++) {
+        if(!strcmp(argv[i], "-o") && i + 1 < argc) json = argv[++i];
+        else if(!strcmp(argv[i], "-s") && i + 1 < argc) scale = strtoull(argv[++i], NULL, 10);
+        else if(!strcmp(argv[i], "-b") && i + 1 < argc) block_size = strtoull(argv[++i], NULL, 10);
+        else if(!strcmp(argv[i], "-f") && i + 1 < argc) fanout = strtoull(argv[++i], NULL, 10);
+        else if(!strcmp(argv[i], "-a")) sizes = 1;
+        else if(!strcmp(argv[i], "-l")) allocators = 1;
+        else if(argv[i][0] != '-') image = argv[i];
+        else usage = 1;
+    }
+
+    if(usage || !scale) {
+        printf(ESC_BOLD_CYAN "usage:" ESC_RESET " bench <-o json|-> <-s scale|1> <-b blocksize|4096> "
+            "<-f fanout|16> <-a> <-l> <scratch image|bench.img>\n");
+        printf(ESC_BOLD_CYAN "flags:" ESC_RESET " -a  compare sequential I/O and overhead across all block sizes\n");
+        printf("       -l  compare write amplification of the lowest free and log allocators\n");
+        printf(ESC_BOLD_CYAN "example:" ESC_RESET " bench -o results.json -s 2 /tmp/bench.img\n");
+        return 1;
+    }
+
+    if(mountpoint && mountpoint->name) {
+        printf(ESC_BOLD_RED "bench:" ESC_RESET " unmount %s first\n", mountpoint->name);
+        return 1;
+    }
+
+    bench_image = image;
+    int status = 0;
+
+    if(sizes) {
+        if(bench_block_sizes(image, scale, fanout)) {
+            printf(ESC_BOLD_RED "bench:" ESC_RESET " block size workload failed\n");
+            status = 1;
+        }
+
+        goto report;
+    }
+
+    if(allocators) {
+        if(bench_allocators(image, scale, block_size, fanout)) {
+            printf(ESC_BOLD_RED "bench:" ESC_RESET " allocator workload failed\n");
+            status = 1;
+        }
+
+        goto report;
+    }
+
+    printf(ESC_BOLD_CYAN "bench:" ESC_RESET " formatting scratch image %s\n", image);
+    if(format(image, BENCH_IMAGE_SIZE * scale, block_size, fanout) || mount_current(image)) {
+        printf(ESC_BOLD_RED "bench:" ESC_RESET " failed to prepare %s\n", image);
+        return 1;
+    }
+
+    struct {
+        const char *name;
+        int (*function)(u64 scale);
+    } workloads[] = {
+        {"allocation", bench_alloc},
+        {"inodes", bench_inodes},
+        {"directories", bench_directories},
+        {"deep paths", bench_deep_paths},
+        {"file I/O", bench_file_io},
+        {"mount", bench_mount},
+        {"check", bench_check},
+    };
+
+    for(int i = 0; i < sizeof(workloads) / sizeof(workloads[0]); i++) {
+        printf(ESC_BOLD_CYAN "bench:" ESC_RESET " running %s workload\n", workloads[i].name);
+        if(workloads[i].function(scale)) {
+            printf(ESC_BOLD_RED "bench:" ESC_RESET " %s workload failed\n", workloads[i].name);
+            status = 1;
+        }
+    }
+
+report:
+    bench_print();
+
+    if(json && mountpoint && bench_write_json(json, scale)) {
+        printf(ESC_BOLD_RED "bench:" ESC_RESET " failed to write %s\n", json);
+        status = 1;
+    }
+
+    unmount_current();
+    result_count = 0;
+    return status;
+}
@@ -0,0 +1,115 @@
+/*
+ * pulse - a highly scalable SSD-first file system with predictable logarithmic
+ * bounds across all operations
+ * 
+ * Copyright (c) 2025 Omar Elghoul
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+#include <pulse/libpulse.h>
+#include <pulse/cli.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sched.h>
+
+/* one thread per cpu we are allowed to run on, which can be far fewer than
+ * the machine has */
+long default_threads(void) {
+    cpu_set_t set;
+    if(!sched_getaffinity(0, sizeof(set), &set))
+        return CPU_COUNT(&set);
+
+    return sysconf(_SC_NPROCESSORS_ONLN);
+}
+
+int check_command(int argc, char **argv) {
+    long threads = default_threads();
+    const char *image = NULL;
+
+    for(int i = 1; i < argc; i++) {
+        if(!strcmp(argv[i], "-j") && i + 1 < argc) {
+            threads = strtol(argv[++i], NULL, 10);
+        } else if(argv[i][0] != '-' && !image) {
+            image = argv[i];
+        } else {
+            threads = 0;
+            break;
+        }
+    }
+
+    if(threads <= 0 || threads > 1024) {
+        printf(ESC_BOLD_CYAN "usage:" ESC_RESET " check <-j threads|cpus> <image|mounted>\n");
+        printf(ESC_BOLD_CYAN "example:" ESC_RESET " check -j 8 /path/to/image.hdd\n");
+        return 1;
+    }
+
+    if(image && !(mountpoint && mountpoint->name)) {
+        char *mount_argv[] = { "mount", (char *) image };
+        if(mount_command(2, mount_argv)) return 1;
+    }
+
+    if(!mountpoint || !mountpoint->name) {
+        printf(ESC_BOLD_RED "check:" ESC_RESET " no disk image is mounted\n");
+        return 1;
+    }
+
+    printf(ESC_BOLD_CYAN "check:" ESC_RESET " checking %s with %ld thread%s\n",
+        mountpoint->name, threads, threads > 1 ? "s" : "");
+
+    CheckReport report;
+    if(pulse_check(mountpoint, threads, &report)) {
+        printf(ESC_BOLD_RED "check:" ESC_RESET " failed to check %s\n", mountpoint->name);
+        return 1;
+    }
+
+    printf("    📂 %" PRIu64 " inodes, %" PRIu64 " directories, %" PRIu64 " entries\n",
+        report.inodes, report.directories, report.entries);
+    printf("    🧱 %" PRIu64 " blocks referenced, %" PRIu64 " allocated\n",
+        report.referenced_blocks, report.allocated_blocks);
+    printf("    ⏱️  read %" PRIu64 " MB in %.2f s (%.1f MB/s)\n", report.bytes_read >> 20, report.seconds,
+        report.seconds > 0 ? (report.bytes_read / (1024.0 * 1024)) / report.seconds : 0);
+
+    u64 errors = report.leaked_blocks + report.missing_blocks + report.cross_linked_blocks +
+        report.layer_errors + report.structure_errors;
+
+    if(errors) {
+        printf(ESC_BOLD_RED "check:" ESC_RESET " %" PRIu64 " error%s on %s: %" PRIu64 " leaked, %" PRIu64 " missing, "
+            "%" PRIu64 " cross-linked, %" PRIu64 " bitmap layer, %" PRIu64 " structure\n", errors, errors > 1 ? "s" : "",
+            mountpoint->name, report.leaked_blocks, report.missing_blocks,
+            report.cross_linked_blocks, report.layer_errors, report.structure_errors);
+        return 1;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    mountpoint->superblock->last_check_time = now.tv_sec * 1000000000ULL + now.tv_nsec;
+    if(write_superblock(mountpoint)) {
+        printf(ESC_BOLD_RED "check:" ESC_RESET " failed to update the superblock on %s\n",
+            mountpoint->name);
+        return 1;
+    }
+
+    printf(ESC_BOLD_GREEN "check:" ESC_RESET " ✅ %s is clean\n", mountpoint->name);
+    return 0;
+}
@@ -68,14 +68,23 @@ struct Command commands[] = {
     {"exit", "exit the command line interface", exit_command},
     {"help", "show this help message", help_command},
     {"mount", "mount a disk image", mount_command},
-    {"umount", "unmount a disk image", NULL},
+    {"umount", "unmount a disk image", umount_command},
     {"create", "create a new disk image", create_command},
     {"format", "format a disk image", NULL},
-    {"info", "show information about a mounted image", NULL},
-    {"sync", "sync the file system to the disk image", NULL},
-    {"check", "check the file system for errors", NULL},
+    {"info", "show a mounted image and the I/O it took by class", info_command},
+    {"import", "copy a directory tree from the host into the image", import_command},
+    {"ls", "list a directory with the attributes of every entry", ls_command},
+    {"sync", "sync the file system to the disk image", sync_command},
+    {"dedup", "set the deduplication budget or show how much it saves", dedup_command},
+    {"paths", "turn the path index on or off or show how often it hits", paths_command},
+    {"clean", "empty the least used segments of a log-structured image", clean_command},
+    {"defrag", "rewrite fragmented files into contiguous runs", defrag_command},
+    {"check", "check the file system for errors", check_command},
     {"repair", "repair the file system", NULL},
     {"test", "run development tests", test_command},
+    {"bench", "run benchmark workloads on a scratch image", bench_command},
+    {"trace", "record every block read and write to a file", trace_command},
+    {"replay", "re-issue a recorded block trace against an image", replay_command},
 };
 
 int exit_command(int argc, char **argv) {
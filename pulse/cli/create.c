@@ -30,25 +30,39 @@
 #include <string.h>
 
 int create_command(int argc, char **argv) {
-    if(argc < 2 || argc > 6) {
-        printf(ESC_BOLD_CYAN "usage:" ESC_RESET " create <flags|null> <image> <size|10m> <blocksize|4096> <fanout|16>\n");
+    if(argc < 2 || argc > 7) {
+        printf(ESC_BOLD_CYAN "usage:" ESC_RESET " create <flags|null> <image> <size|10m> <blocksize|4096> <fanout|16> <inodesize|0>\n");
         printf(ESC_BOLD_CYAN "flags:" ESC_RESET " -m, --mount  mount after creation\n");
+        printf(ESC_BOLD_CYAN "       " ESC_RESET " -l, --log    append file data at a log head instead of the lowest free block\n");
+        printf(ESC_BOLD_CYAN "inodes:" ESC_RESET " a nonzero inode size packs that many bytes per inode into tables\n");
         printf(ESC_BOLD_CYAN "example:" ESC_RESET " create -m /path/to/image.hdd 50G\n");
         return 1;
     }
 
-    int mount = !strcmp(argv[1], "-m") || !strcmp(argv[1], "--mount");
+    // single letter flags can be combined, as in -ml
+    int mount = 0, log = 0;
+    if(!strcmp(argv[1], "--mount")) {
+        mount = 1;
+    } else if(!strcmp(argv[1], "--log")) {
+        log = 1;
+    } else if(argv[1][0] == '-') {
+        for(const char *flag = argv[1] + 1; *flag; flag++) {
+            if(*flag == 'm') mount = 1;
+            else if(*flag == 'l') log = 1;
+        }
+    }
 
     if(mount && mountpoint && mountpoint->name) {
         printf(ESC_BOLD_RED "create:" ESC_RESET " unmount %s first\n", mountpoint->name);
         return 1;
     }
 
-    int img_index = mount ? 2 : 1;
+    int img_index = (mount || log) ? 2 : 1;
 
-    usize size = img_index+1 < argc ? atoi(argv[img_index+1]) : 1024*1024*10;
+    usize size = img_index+1 < argc ? strtoull(argv[img_index+1], NULL, 10) : 1024*1024*10;
     usize block_size = img_index+2 < argc ? atoi(argv[img_index+2]) : DEFAULT_BLOCK_SIZE;
     usize fanout = img_index+3 < argc ? atoi(argv[img_index+3]) : DEFAULT_FANOUT_FACTOR;
+    usize inode_size = img_index+4 < argc ? atoi(argv[img_index+4]) : 0;
 
     if(img_index+1 < argc) {
         char unit = argv[img_index+1][strlen(argv[img_index+1]) - 1];
@@ -64,6 +78,10 @@ int create_command(int argc, char **argv) {
         case 'G':
             size *= 1024*1024*1024;
             break;
+        case 't':
+        case 'T':
+            size *= 1024ULL*1024*1024*1024;
+            break;
         case 'm':
         case 'M':
         default:
@@ -87,12 +105,19 @@ int create_command(int argc, char **argv) {
         return 1;
     }
 
+    if(inode_size && (inode_size < INODE_MIN_SIZE || inode_size > block_size / 2 ||
+        (inode_size & (inode_size - 1)) || block_size / inode_size > (1ULL << INODE_SLOT_SHIFT))) {
+        printf(ESC_BOLD_RED "create:" ESC_RESET " invalid inode size %zu\n", inode_size);
+        return 1;
+    }
+
     printf(ESC_BOLD_CYAN "create:" ESC_RESET " creating disk image %s with size %zu %s\n",
         argv[img_index],
-        size >= 1024*1024*1024 ? size/(1024*1024*1024) : size >= 1024*1024 ? size/(1024*1024) : size >= 1024 ? size/1024 : size,
-        size >= 1024*1024*1024 ? "GB" : size >= 1024*1024 ? "MB" : size >= 1024 ? "KB" : "B");
+        size >> 40 ? size >> 40 : size >> 30 ? size >> 30 : size >> 20 ? size >> 20 : size >> 10 ? size >> 10 : size,
+        size >> 40 ? "TB" : size >> 30 ? "GB" : size >> 20 ? "MB" : size >> 10 ? "KB" : "B");
     
-    int status = format(argv[img_index], size, block_size, fanout);
+    int status = format_volume(argv[img_index], size, block_size, fanout, inode_size,
+        log ? SUPER_TUNING_ALLOCATOR_LOG : SUPER_TUNING_ALLOCATOR_LOWEST);
     if(status) {
         printf(ESC_BOLD_RED "create:" ESC_RESET " failed to create disk image %s\n", argv[img_index]);
         return status;
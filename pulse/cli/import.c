@@ -0,0 +1,363 @@
+/*
+ * pulse - a highly scalable SSD-first file system with predictable logarithmic
+ * bounds across all operations
+ * 
+ * Copyright (c) 2025 Omar Elghoul
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <pulse/libpulse.h>
+#include <pulse/cli.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#define IMPORT_CHUNK_SIZE       (4ULL << 20)    /* file data copied per write */
+
+/* a host tree is imported by a pool of threads that share a queue of
+ * directories - each one sizes the directory's hash map for everything it is
+ * about to hold, gives every file its exact size in blocks before the data
+ * goes in and copies the data in large writes, so the image is filled about
+ * as fast as the device takes it */
+
+typedef struct ImportDir {
+    char *host;
+    char *path;
+    u64 inode;
+    struct ImportDir *next;
+} ImportDir;
+
+typedef struct Import {
+    Mountpoint *volume;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    ImportDir *queue;
+    u64 busy;               // directories queued or being imported
+    int failed;
+
+    u64 files;
+    u64 directories;
+    u64 skipped;            // anything that is neither a file nor a directory
+    u64 bytes;
+} Import;
+
+static u64 import_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void import_fail(Import *import, const char *what, const char *path) {
+    printf(ESC_BOLD_RED "import:" ESC_RESET " failed to %s %s\n", what, path);
+    pthread_mutex_lock(&import->lock);
+    import->failed = 1;
+    pthread_mutex_unlock(&import->lock);
+}
+
+static int import_queue(Import *import, const char *host, const char *path, u64 inode) {
+    ImportDir *dir = calloc(1, sizeof(ImportDir));
+    if(dir) {
+        dir->host = strdup(host);
+        dir->path = strdup(path);
+    }
+
+    if(!dir || !dir->host || !dir->path) {
+        if(dir) {
+            free(dir->host);
+            free(dir->path);
+        }
+
+        free(dir);
+        return -1;
+    }
+
+    dir->inode = inode;
+
+    pthread_mutex_lock(&import->lock);
+    dir->next = import->queue;
+    import->queue = dir;
+    import->busy++;
+    pthread_cond_signal(&import->wake);
+    pthread_mutex_unlock(&import->lock);
+    return 0;
+}
+
+/* the whole size is allocated before the first write, so the file gets one
+ * run of blocks however the threads interleave - a file that changed size on
+ * the host since it was looked at is trimmed to what was read */
+static int import_file(Import *import, const char *host, const char *path, const struct stat *st,
+    u8 *buffer) {
+    int fd = open(host, O_RDONLY);
+    if(fd < 0) return -1;
+
+    u64 inode = pulse_create(import->volume, path, INODE_MODE_TYPE_REG | (st->st_mode & 07777));
+    if(!inode) {
+        close(fd);
+        return -1;
+    }
+
+    u64 size = st->st_size;
+    if(size >= import->volume->block_size && pulse_allocate(import->volume, inode, 0, size)) {
+        close(fd);
+        return -1;
+    }
+
+    u64 offset = 0;
+    for(;;) {
+        ssize_t count = read(fd, buffer, IMPORT_CHUNK_SIZE);
+        if(count < 0) {
+            close(fd);
+            return -1;
+        }
+
+        if(!count) break;
+
+        if(pulse_write(import->volume, inode, buffer, offset, count)) {
+            close(fd);
+            return -1;
+        }
+
+        offset += count;
+    }
+
+    close(fd);
+    if(offset != size && pulse_truncate(import->volume, inode, offset))
+        return -1;
+
+    __atomic_fetch_add(&import->files, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&import->bytes, offset, __ATOMIC_RELAXED);
+    return 0;
+}
+
+static void import_dir(Import *import, ImportDir *dir, u8 *buffer) {
+    DIR *handle = opendir(dir->host);
+    if(!handle) {
+        import_fail(import, "open", dir->host);
+        return;
+    }
+
+    // the names are read first so the directory can be sized for all of them
+    char **names = NULL;
+    u64 count = 0, capacity = 0;
+    struct dirent *entry;
+    while((entry = readdir(handle))) {
+        if(!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, ".."))
+            continue;
+
+        if(count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            char **grown = realloc(names, capacity * sizeof(char *));
+            if(!grown) break;
+            names = grown;
+        }
+
+        if(!(names[count] = strdup(entry->d_name))) break;
+        count++;
+    }
+
+    int complete = !entry;
+    closedir(handle);
+
+    if(!complete || pulse_reserve_entries(import->volume, dir->inode, count)) {
+        import_fail(import, "read", dir->host);
+        count = 0;
+    }
+
+    usize host_length = strlen(dir->host);
+    usize path_length = strlen(dir->path);
+    for(u64 i = 0; i < count && !__atomic_load_n(&import->failed, __ATOMIC_RELAXED); i++) {
+        usize name_length = strlen(names[i]);
+        char *host = malloc(host_length + name_length + 2);
+        char *path = malloc(path_length + name_length + 2);
+        if(!host || !path) {
+            free(host);
+            free(path);
+            import_fail(import, "import", dir->host);
+            break;
+        }
+
+        sprintf(host, "%s/%s", dir->host, names[i]);
+        sprintf(path, "%s/%s", strcmp(dir->path, "/") ? dir->path : "", names[i]);
+
+        struct stat st;
+        if(name_length >= DIR_MAX_FILE_NAME || lstat(host, &st)) {
+            import_fail(import, "import", host);
+        } else if(S_ISDIR(st.st_mode)) {
+            u64 inode = pulse_create(import->volume, path, INODE_MODE_TYPE_DIR | (st.st_mode & 07777));
+            if(!inode || import_queue(import, host, path, inode))
+                import_fail(import, "import", host);
+            else
+                __atomic_fetch_add(&import->directories, 1, __ATOMIC_RELAXED);
+        } else if(S_ISREG(st.st_mode)) {
+            if(import_file(import, host, path, &st, buffer))
+                import_fail(import, "import", host);
+        } else {
+            __atomic_fetch_add(&import->skipped, 1, __ATOMIC_RELAXED);
+        }
+
+        free(host);
+        free(path);
+    }
+
+    for(u64 i = 0; i < count; i++)
+        free(names[i]);
+    free(names);
+}
+
+/* workers leave once the queue is empty and nobody is still importing a
+ * directory that could add to it */
+static void *import_main(void *arg) {
+    Import *import = arg;
+    u8 *buffer = malloc(IMPORT_CHUNK_SIZE);
+
+    for(;;) {
+        pthread_mutex_lock(&import->lock);
+        while(!import->queue && import->busy)
+            pthread_cond_wait(&import->wake, &import->lock);
+
+        ImportDir *dir = import->queue;
+        if(dir) import->queue = dir->next;
+        pthread_mutex_unlock(&import->lock);
+        if(!dir) break;
+
+        if(!buffer) import_fail(import, "import", dir->host);
+        else if(!__atomic_load_n(&import->failed, __ATOMIC_RELAXED)) import_dir(import, dir, buffer);
+
+        free(dir->host);
+        free(dir->path);
+        free(dir);
+
+        pthread_mutex_lock(&import->lock);
+        if(!--import->busy) pthread_cond_broadcast(&import->wake);
+        pthread_mutex_unlock(&import->lock);
+    }
+
+    free(buffer);
+    return NULL;
+}
+
+int import_command(int argc, char **argv) {
+    long threads = default_threads();
+    const char *host = NULL, *image = NULL, *path = "/";
+
+    for(int i = 1; i < argc; i++) {
+        if(!strcmp(argv[i], "-j") && i + 1 < argc) {
+            threads = strtol(argv[++i], NULL, 10);
+        } else if(!strcmp(argv[i], "-p") && i + 1 < argc && argv[i + 1][0] == '/') {
+            path = argv[++i];
+        } else if(argv[i][0] != '-' && !host) {
+            host = argv[i];
+        } else if(argv[i][0] != '-' && !image) {
+            image = argv[i];
+        } else {
+            threads = 0;
+            break;
+        }
+    }
+
+    if(!host || threads <= 0 || threads > 1024) {
+        printf(ESC_BOLD_CYAN "usage:" ESC_RESET " import <-j threads|cpus> <-p path|/> <hostdir> <image|mounted>\n");
+        printf(ESC_BOLD_CYAN "example:" ESC_RESET " import -j 8 -p /boot ./guest/boot /path/to/image.hdd\n");
+        return 1;
+    }
+
+    // an image named here is mounted for the import and unmounted after it,
+    // which is what gets the data to the disk when run from a script
+    int mounted = 0;
+    if(image && !(mountpoint && mountpoint->name)) {
+        if(mount_current(image)) return 1;
+        mounted = 1;
+    }
+
+    if(!mountpoint || !mountpoint->name) {
+        printf(ESC_BOLD_RED "import:" ESC_RESET " no disk image is mounted\n");
+        return 1;
+    }
+
+    struct stat st;
+    u64 root = pulse_lookup(mountpoint, path);
+    PulseStat root_stat;
+    if(stat(host, &st) || !S_ISDIR(st.st_mode) || !root || pulse_stat(mountpoint, root, &root_stat) ||
+        !INODE_MODE_TYPE_IS_DIR(root_stat.mode)) {
+        printf(ESC_BOLD_RED "import:" ESC_RESET " %s and %s have to be directories\n", host, path);
+        if(mounted) unmount_current();
+        return 1;
+    }
+
+    Import import;
+    memset(&import, 0, sizeof(Import));
+    import.volume = mountpoint;
+    pthread_mutex_init(&import.lock, NULL);
+    pthread_cond_init(&import.wake, NULL);
+
+    pthread_t *workers = malloc(threads * sizeof(pthread_t));
+    int status = !workers || import_queue(&import, host, path, root);
+
+    u64 started = import_now();
+    long running = 0;
+    while(!status && running < threads && !pthread_create(&workers[running], NULL, import_main, &import))
+        running++;
+
+    if(!running) {
+        status = 1;
+
+        // nobody is left to empty the queue
+        while(import.queue) {
+            ImportDir *dir = import.queue;
+            import.queue = dir->next;
+            free(dir->host);
+            free(dir->path);
+            free(dir);
+        }
+    }
+
+    for(long i = 0; i < running; i++)
+        pthread_join(workers[i], NULL);
+
+    if(!status && !import.failed && pulse_sync(mountpoint)) {
+        printf(ESC_BOLD_RED "import:" ESC_RESET " failed to sync %s\n", mountpoint->name);
+        status = 1;
+    }
+
+    double seconds = (import_now() - started) / 1e9;
+    free(workers);
+    pthread_mutex_destroy(&import.lock);
+    pthread_cond_destroy(&import.wake);
+
+    if(status || import.failed) {
+        printf(ESC_BOLD_RED "import:" ESC_RESET " importing %s into %s failed\n", host, mountpoint->name);
+        if(mounted) unmount_current();
+        return 1;
+    }
+
+    printf(ESC_BOLD_GREEN "import:" ESC_RESET " %" PRIu64 " files and %" PRIu64 " directories, %" PRIu64 " MB in %.2f s "
+        "(%.1f MB/s) with %ld thread%s", import.files, import.directories, import.bytes >> 20, seconds,
+        seconds > 0 ? (import.bytes / (1024.0 * 1024)) / seconds : 0, running, running > 1 ? "s" : "");
+    if(import.skipped) printf(", skipped %" PRIu64 " special files", import.skipped);
+    printf("\n");
+
+    return mounted && unmount_current() ? 1 : 0;
+}
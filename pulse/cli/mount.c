@@ -23,280 +23,416 @@
  * SOFTWARE.
  */
 
-#include <pulse/pulse.h>
+#include <pulse/libpulse.h>
 #include <pulse/cli.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 
+/* the volume the shell is working on, the library itself keeps no global
+ * state and the CLI is just another client of it */
 Mountpoint *mountpoint = NULL;
 
 int mount_command(int argc, char **argv) {
-    if(argc != 2) {
-        printf(ESC_BOLD_CYAN "usage:" ESC_RESET " mount <image>\n");
-        printf(ESC_BOLD_CYAN "example:" ESC_RESET " mount /path/to/image.hdd\n");
+    const char *image = NULL;
+    int discard = DISCARD_BATCHED, valid = 1;
+
+    for(int i = 1; i < argc && valid; i++) {
+        if(!strcmp(argv[i], "-d") && i + 1 < argc) {
+            i++;
+            if(!strcmp(argv[i], "off")) discard = DISCARD_OFF;
+            else if(!strcmp(argv[i], "online")) discard = DISCARD_ONLINE;
+            else if(!strcmp(argv[i], "batched")) discard = DISCARD_BATCHED;
+            else valid = 0;
+        } else if(argv[i][0] != '-' && !image) {
+            image = argv[i];
+        } else {
+            valid = 0;
+        }
+    }
+
+    if(!valid || !image) {
+        printf(ESC_BOLD_CYAN "usage:" ESC_RESET " mount <-d off|online|batched> <image>\n");
+        printf(ESC_BOLD_CYAN "example:" ESC_RESET " mount -d online /path/to/image.hdd\n");
         return 1;
     }
 
-    if(mountpoint && mountpoint->name) {
-        printf(ESC_BOLD_RED "mount:" ESC_RESET " unmount %s first\n", mountpoint->name);
+    printf(ESC_BOLD_CYAN "mount:" ESC_RESET " mounting disk image %s\n", image);
+
+    if(mount_current(image))
+        return 1;
+
+    if(pulse_discard(mountpoint, discard)) {
+        printf(ESC_BOLD_RED "mount:" ESC_RESET " failed to set the discard mode\n");
+        unmount_current();
         return 1;
     }
 
-    if(mountpoint) {
-        free(mountpoint);
-        mountpoint = NULL;
+    printf(ESC_BOLD_GREEN "mount:" ESC_RESET " ✅ mounted disk image %s\n", image);
+    return 0;
+}
+
+int umount_command(int argc, char **argv) {
+    if(argc != 1) {
+        printf(ESC_BOLD_CYAN "usage:" ESC_RESET " umount\n");
+        return 1;
+    }
+
+    if(!mountpoint) {
+        printf(ESC_BOLD_RED "umount:" ESC_RESET " no disk image is mounted\n");
+        return 1;
+    }
+
+    char *name = strdup(mountpoint->name);
+    if(unmount_current()) {
+        printf(ESC_BOLD_RED "umount:" ESC_RESET " failed to unmount %s\n", name ? name : "disk image");
+        free(name);
+        return 1;
+    }
+
+    printf(ESC_BOLD_GREEN "umount:" ESC_RESET " ✅ unmounted %s\n", name ? name : "disk image");
+    free(name);
+    return 0;
+}
+
+int sync_command(int argc, char **argv) {
+    if(argc != 1) {
+        printf(ESC_BOLD_CYAN "usage:" ESC_RESET " sync\n");
+        return 1;
     }
 
-    mountpoint = malloc(sizeof(Mountpoint));
     if(!mountpoint) {
-        printf(ESC_BOLD_RED "mount:" ESC_RESET " failed to allocate memory for mountpoint\n");
+        printf(ESC_BOLD_RED "sync:" ESC_RESET " no disk image is mounted\n");
         return 1;
     }
 
-    mountpoint->superblock = malloc(512*1024); // max block size
-    if(!mountpoint->superblock) {
-        printf(ESC_BOLD_RED "mount:" ESC_RESET " failed to allocate memory for superblock\n");
-        free(mountpoint);
-        mountpoint = NULL;
+    IOStats *stats = &mountpoint->io_stats;
+    u64 discards = stats->discards, discarded = stats->bytes_discarded;
+    if(pulse_sync(mountpoint)) {
+        printf(ESC_BOLD_RED "sync:" ESC_RESET " failed to sync %s\n", mountpoint->name);
         return 1;
     }
 
-    printf(ESC_BOLD_CYAN "mount:" ESC_RESET " mounting disk image %s\n", argv[1]);
+    printf(ESC_BOLD_GREEN "sync:" ESC_RESET " ✅ synced %s, discarded %" PRIu64 " KB in %" PRIu64 " range%s\n",
+        mountpoint->name, (stats->bytes_discarded - discarded) >> 10, stats->discards - discards,
+        stats->discards - discards == 1 ? "" : "s");
+    return 0;
+}
+
+/* device I/O is counted per volume from the moment it is mounted, so the
+ * reads of the mount itself show up here too - 'info -r' starts the counting
+ * over for this volume */
+int info_command(int argc, char **argv) {
+    if(argc > 2 || (argc == 2 && strcmp(argv[1], "-r"))) {
+        printf(ESC_BOLD_CYAN "usage:" ESC_RESET " info <-r>\n");
+        printf(ESC_BOLD_CYAN "flags:" ESC_RESET " -r  reset the I/O counters after showing them\n");
+        return 1;
+    }
 
-    char *duplicate = strdup(argv[1]);
-    if(!duplicate) {
-        printf(ESC_BOLD_RED "mount:" ESC_RESET " failed to allocate memory for image name\n");
-        free(mountpoint);
-        mountpoint = NULL;
+    if(!mountpoint) {
+        printf(ESC_BOLD_RED "info:" ESC_RESET " no disk image is mounted\n");
         return 1;
     }
 
-    char *token = strtok(duplicate, "/");
-    while(token) {
-        char *next = strtok(NULL, "/");
-        if(!next) break;
-        token = next;
+    printf(ESC_BOLD_GREEN "info:" ESC_RESET " %s, %" PRIu64 " blocks of %u bytes (%" PRIu64 " MB), "
+        "fanout %u, %u bitmap layers%s\n", mountpoint->name, mountpoint->superblock->volume_size,
+        mountpoint->block_size, (mountpoint->superblock->volume_size * mountpoint->block_size) >> 20,
+        mountpoint->fanout, mountpoint->bitmap_layers, mountpoint->log_mode ? ", log-structured" : "");
+
+    printf("   " ESC_BOLD "%-12s %10s %12s %10s %12s" ESC_RESET "\n", "class", "reads", "KB read",
+        "writes", "KB written");
+
+    IOStats *io = &mountpoint->io_stats;
+    for(int i = 0; i < IO_CLASSES; i++) {
+        IOClassStats stats;
+        stats.reads = __atomic_load_n(&io->classes[i].reads, __ATOMIC_RELAXED);
+        stats.writes = __atomic_load_n(&io->classes[i].writes, __ATOMIC_RELAXED);
+        stats.bytes_read = __atomic_load_n(&io->classes[i].bytes_read, __ATOMIC_RELAXED);
+        stats.bytes_written = __atomic_load_n(&io->classes[i].bytes_written, __ATOMIC_RELAXED);
+        if(!stats.reads && !stats.writes) continue;
+
+        // bitmap layers are numbered from the bottom one up
+        char name[16];
+        if(i >= IO_BITMAP && i < IO_BITMAP + BITMAP_MAX_LAYERS)
+            snprintf(name, sizeof(name), "bitmap %d", i - IO_BITMAP);
+        else
+            snprintf(name, sizeof(name), "%s", io_class_name(i));
+
+        printf("   %-12s %10" PRIu64 " %12" PRIu64 " %10" PRIu64 " %12" PRIu64 "\n", name, stats.reads,
+            stats.bytes_read >> 10, stats.writes, stats.bytes_written >> 10);
     }
 
-    if(!token)
-        token = argv[1];
+    u64 bytes_read = __atomic_load_n(&io->bytes_read, __ATOMIC_RELAXED);
+    u64 bytes_written = __atomic_load_n(&io->bytes_written, __ATOMIC_RELAXED);
+    u64 logical_read = __atomic_load_n(&io->logical_read, __ATOMIC_RELAXED);
+    u64 logical_written = __atomic_load_n(&io->logical_written, __ATOMIC_RELAXED);
+
+    printf("   %-12s %10" PRIu64 " %12" PRIu64 " %10" PRIu64 " %12" PRIu64 "\n", "total",
+        __atomic_load_n(&io->reads, __ATOMIC_RELAXED), bytes_read >> 10,
+        __atomic_load_n(&io->writes, __ATOMIC_RELAXED), bytes_written >> 10);
+    printf("   %-12s %10s %12" PRIu64 " %10s %12" PRIu64 "\n", "logical", "", logical_read >> 10,
+        "", logical_written >> 10);
+
+    // writes still sitting in the caches are logical bytes with no device
+    // bytes yet, a sync before this gives the real write amplification
+    printf("   read amplification ");
+    if(logical_read) printf("%.2fx", (double) bytes_read / logical_read);
+    else printf("-");
+    printf(", write amplification ");
+    if(logical_written) printf("%.2fx\n", (double) bytes_written / logical_written);
+    else printf("-\n");
+
+    if(argc == 2) reset_io_stats(io);
+    return 0;
+}
+
+int dedup_command(int argc, char **argv) {
+    char *end = NULL;
+    u64 budget = 0;
+
+    if(argc == 2 && strcmp(argv[1], "off"))
+        budget = strtoull(argv[1], &end, 10) << 20;
 
-    mountpoint->name = token;
+    if(argc > 2 || (argc == 2 && end && (*end || !budget))) {
+        printf(ESC_BOLD_CYAN "usage:" ESC_RESET " dedup <off|budget in MB>\n");
+        printf(ESC_BOLD_CYAN "example:" ESC_RESET " dedup 64\n");
+        return 1;
+    }
 
-    /* open the disk image */
-    mountpoint->disk = fopen(argv[1], "rb+");
-    if(!mountpoint->disk) {
-        printf(ESC_BOLD_RED "mount:" ESC_RESET " failed to open disk image %s\n", argv[1]);
-        free(mountpoint);
-        mountpoint = NULL;
+    if(!mountpoint) {
+        printf(ESC_BOLD_RED "dedup:" ESC_RESET " no disk image is mounted\n");
         return 1;
     }
 
-    /* search for the superblock according to the block sizes */
-    mountpoint->block_size = 4096; // smallest block size
-    while(mountpoint->block_size <= 512*1024) {
-        if(!read_block(mountpoint->disk, SUPERBLOCK_BLOCK_NUMBER,
-            mountpoint->block_size, 1, mountpoint->superblock)) {
-            
-            u8 *magic = (u8 *)&mountpoint->superblock->magic;
+    if(argc == 2 && pulse_dedup(mountpoint, budget)) {
+        printf(ESC_BOLD_RED "dedup:" ESC_RESET " failed to set the budget to %s\n", argv[1]);
+        return 1;
+    }
 
-            if((!memcmp(&mountpoint->superblock->magic, SUPER_MAGIC_STRING, 7) &&
-                magic[7] == SUPER_MAGIC_VERSION) &&
-                mountpoint->superblock->major_revision == SUPER_MAJOR_REVISION &&
-                mountpoint->superblock->minor_revision == SUPER_MINOR_REVISION &&
-                mountpoint->superblock->patch == SUPER_PATCH_REVISION) {
+    DedupReport report;
+    if(pulse_dedup_report(mountpoint, &report)) {
+        printf(ESC_BOLD_RED "dedup:" ESC_RESET " failed to read the dedup state\n");
+        return 1;
+    }
 
-                break;
-            }
-        } else {
-            printf(ESC_BOLD_RED "mount:" ESC_RESET " failed to read superblock on %s\n", argv[1]);
-            fclose(mountpoint->disk);
-            free(mountpoint);
-            mountpoint = NULL;
-            return 1;
-        }
+    if(!report.budget) {
+        printf(ESC_BOLD_GREEN "dedup:" ESC_RESET " deduplication is off on %s\n", mountpoint->name);
+    } else {
+        printf(ESC_BOLD_GREEN "dedup:" ESC_RESET " %" PRIu64 " of %" PRIu64 " fingerprints indexed in a %" PRIu64 " MB budget\n",
+            report.entries, report.capacity, report.budget >> 20);
+        printf(ESC_BOLD_GREEN "dedup:" ESC_RESET " %" PRIu64 " of %" PRIu64 " blocks written since mount were duplicates "
+            "(%.2fx)\n", report.matched, report.checked,
+            report.checked > report.matched ? (double) report.checked / (report.checked - report.matched) : 1.0);
+    }
 
-        mountpoint->block_size *= 2;
+    // clones and deduplicated blocks both end up in the shared extent table
+    printf(ESC_BOLD_GREEN "dedup:" ESC_RESET " %" PRIu64 " shared blocks save %" PRIu64 " KB on the volume\n",
+        report.shared_blocks, (report.saved_blocks * mountpoint->block_size) >> 10);
+    return 0;
+}
+
+int paths_command(int argc, char **argv) {
+    int enabled = -1;
+    if(argc == 2 && !strcmp(argv[1], "on")) enabled = 1;
+    else if(argc == 2 && !strcmp(argv[1], "off")) enabled = 0;
+
+    if(argc > 2 || (argc == 2 && enabled < 0)) {
+        printf(ESC_BOLD_CYAN "usage:" ESC_RESET " paths <on|off>\n");
+        printf(ESC_BOLD_CYAN "example:" ESC_RESET " paths on\n");
+        return 1;
+    }
+
+    if(!mountpoint) {
+        printf(ESC_BOLD_RED "paths:" ESC_RESET " no disk image is mounted\n");
+        return 1;
     }
 
-    if(mountpoint->block_size > 512*1024) {
-        printf(ESC_BOLD_RED "mount:" ESC_RESET " failed to find superblock in %s\n", argv[1]);
-        fclose(mountpoint->disk);
-        free(mountpoint);
-        mountpoint = NULL;
+    if(enabled >= 0 && pulse_path_index(mountpoint, enabled)) {
+        printf(ESC_BOLD_RED "paths:" ESC_RESET " failed to turn the path index %s\n", argv[1]);
         return 1;
     }
 
-    u64 checksum = mountpoint->superblock->checksum;
-    mountpoint->superblock->checksum = 0;
-    u64 calculated = xxhash64(mountpoint->superblock, mountpoint->superblock->superblock_size);
-    if(calculated != checksum) {
-        printf(ESC_BOLD_RED "mount:" ESC_RESET " invalid superblock checksum on %s\n", argv[1]);
-        fclose(mountpoint->disk);
-        free(mountpoint);
-        mountpoint = NULL;
+    PathIndexReport report;
+    if(pulse_path_index_report(mountpoint, &report)) {
+        printf(ESC_BOLD_RED "paths:" ESC_RESET " failed to read the path index state\n");
         return 1;
     }
 
-    // allocate memory
-    mountpoint->data_block = malloc(mountpoint->block_size);
-    if(!mountpoint->data_block) {
-        printf(ESC_BOLD_RED "mount:" ESC_RESET " failed to allocate memory for disk image %s\n", argv[1]);
-        fclose(mountpoint->disk);
-        free(mountpoint);
-        mountpoint = NULL;
+    if(!report.enabled) {
+        printf(ESC_BOLD_GREEN "paths:" ESC_RESET " the path index is off on %s\n", mountpoint->name);
+        return 0;
+    }
+
+    printf(ESC_BOLD_GREEN "paths:" ESC_RESET " %" PRIu64 " of up to %" PRIu64 " paths indexed, %" PRIu64 " of %" PRIu64 " "
+        "deep lookups since mount took one probe\n", report.entries, report.capacity, report.hits,
+        report.hits + report.misses);
+    return 0;
+}
+
+int clean_command(int argc, char **argv) {
+    char *end = NULL;
+    u64 segments = 16;
+
+    if(argc == 2)
+        segments = strtoull(argv[1], &end, 10);
+
+    if(argc > 2 || (argc == 2 && (*end || !segments))) {
+        printf(ESC_BOLD_CYAN "usage:" ESC_RESET " clean <segments|16>\n");
+        printf(ESC_BOLD_CYAN "example:" ESC_RESET " clean 64\n");
         return 1;
     }
 
-    mountpoint->metadata_block = malloc(mountpoint->block_size);
-    if(!mountpoint->metadata_block) {
-        printf(ESC_BOLD_RED "mount:" ESC_RESET " failed to allocate memory for disk image %s\n", argv[1]);
-        fclose(mountpoint->disk);
-        free(mountpoint->data_block);
-        free(mountpoint);
-        mountpoint = NULL;
+    if(!mountpoint) {
+        printf(ESC_BOLD_RED "clean:" ESC_RESET " no disk image is mounted\n");
         return 1;
     }
 
-    mountpoint->bitmap_block = malloc(mountpoint->block_size);
-    if(!mountpoint->bitmap_block) {
-        printf(ESC_BOLD_RED "mount:" ESC_RESET " failed to allocate memory for disk image %s\n", argv[1]);
-        fclose(mountpoint->disk);
-        free(mountpoint->data_block);
-        free(mountpoint->metadata_block);
-        free(mountpoint);
-        mountpoint = NULL;
+    if(!mountpoint->log_mode) {
+        printf(ESC_BOLD_RED "clean:" ESC_RESET " %s was not created with a log\n", mountpoint->name);
         return 1;
     }
 
-    mountpoint->highest_layer_bitmap = malloc(mountpoint->block_size);
-    if(!mountpoint->highest_layer_bitmap) {
-        printf(ESC_BOLD_RED "mount:" ESC_RESET " failed to allocate memory for disk image %s\n", argv[1]);
-        fclose(mountpoint->disk);
-        free(mountpoint->data_block);
-        free(mountpoint->metadata_block);
-        free(mountpoint->bitmap_block);
-        free(mountpoint);
-        mountpoint = NULL;
+    CleanReport report;
+    if(pulse_clean(mountpoint, segments, &report)) {
+        printf(ESC_BOLD_RED "clean:" ESC_RESET " failed to clean %s\n", mountpoint->name);
         return 1;
     }
 
-    // find the fanout and bitmap depth
-    u16 bitmap_limit;
-
-    switch(mountpoint->superblock->tuning & SUPER_TUNING_FANOUT_FACTOR_MASK) {
-    case SUPER_TUNING_FANOUT_FACTOR_8:
-        mountpoint->fanout = 8;
-        break;
-    case SUPER_TUNING_FANOUT_FACTOR_16:
-        mountpoint->fanout = 16;
-        break;
-    case SUPER_TUNING_FANOUT_FACTOR_32:
-        mountpoint->fanout = 32;
-        break;
-    case SUPER_TUNING_FANOUT_FACTOR_64:
-        mountpoint->fanout = 64;
-        break;
-    default:
-        printf(ESC_BOLD_RED "mount:" ESC_RESET " invalid fanout factor on %s\n", argv[1]);
-        fclose(mountpoint->disk);
-        free(mountpoint);
-        mountpoint = NULL;
+    printf(ESC_BOLD_GREEN "clean:" ESC_RESET " emptied %" PRIu64 " of %" PRIu64 " segments by moving %" PRIu64 " KB, "
+        "%" PRIu64 " segments are free\n", report.emptied, report.segments,
+        (report.moved_blocks * mountpoint->block_size) >> 10, report.free_segments);
+    return 0;
+}
+
+int defrag_command(int argc, char **argv) {
+    const char *path = NULL;
+    u64 threshold = DEFRAG_MIN_EXTENTS, rate = 0;
+    int background = 0, stop = 0, usage = 0;
+
+    for(int i = 1; i < argc && !usage; i++) {
+        char *end = NULL;
+        if(!strcmp(argv[i], "-t") && i + 1 < argc) {
+            threshold = strtoull(argv[++i], &end, 10);
+            usage = *end || !threshold;
+        } else if(!strcmp(argv[i], "-r") && i + 1 < argc) {
+            rate = strtoull(argv[++i], &end, 10) << 20;
+            usage = *end != 0;
+        } else if(!strcmp(argv[i], "-b")) background = 1;
+        else if(!strcmp(argv[i], "-s")) stop = 1;
+        else if(argv[i][0] == '/' && !path) path = argv[i];
+        else usage = 1;
+    }
+
+    if(usage || (background && (stop || path))) {
+        printf(ESC_BOLD_CYAN "usage:" ESC_RESET " defrag <-t extents|%d> <-r MB/s|unlimited> <-b|-s> <path|/>\n",
+            DEFRAG_MIN_EXTENTS);
+        printf(ESC_BOLD_CYAN "flags:" ESC_RESET " -b  keep defragmenting the volume in the background\n");
+        printf("       -s  stop defragmenting in the background\n");
+        printf(ESC_BOLD_CYAN "example:" ESC_RESET " defrag -t 16 -r 64 /var\n");
         return 1;
     }
 
-    switch(mountpoint->superblock->tuning & SUPER_TUNING_BITMAP_LIMIT_MASK) {
-    case SUPER_TUNING_BITMAP_LIMIT_4096:
-        bitmap_limit = 4096;
-        break;
-    case SUPER_TUNING_BITMAP_LIMIT_8192:
-        bitmap_limit = 8192;
-        break;
-    case SUPER_TUNING_BITMAP_LIMIT_16384:
-        bitmap_limit = 16384;
-        break;
-    case SUPER_TUNING_BITMAP_LIMIT_32768:
-        bitmap_limit = 32768;
-        break;
-    default:
-        printf(ESC_BOLD_RED "mount:" ESC_RESET " invalid bitmap limit on %s\n", argv[1]);
-        fclose(mountpoint->disk);
-        free(mountpoint);
-        mountpoint = NULL;
+    if(!mountpoint) {
+        printf(ESC_BOLD_RED "defrag:" ESC_RESET " no disk image is mounted\n");
         return 1;
     }
 
-    u64 bitmap_size_bits = mountpoint->superblock->volume_size;
-    u64 highest_layer = bitmap_size_bits;
+    if(stop) {
+        pulse_defrag_stop(mountpoint);
+        printf(ESC_BOLD_GREEN "defrag:" ESC_RESET " stopped defragmenting %s in the background\n", mountpoint->name);
+        return 0;
+    }
+
+    if(background) {
+        if(pulse_defrag_start(mountpoint, threshold, rate)) {
+            printf(ESC_BOLD_RED "defrag:" ESC_RESET " failed to start defragmenting in the background\n");
+            return 1;
+        }
 
-    mountpoint->bitmap_layers = 1;
+        printf(ESC_BOLD_GREEN "defrag:" ESC_RESET " files with %" PRIu64 " extents or more on %s are rewritten "
+            "every %llu seconds\n", threshold, mountpoint->name, DEFRAG_INTERVAL / 1000000000ULL);
+        return 0;
+    }
 
-    while(highest_layer > bitmap_limit) {
-        highest_layer /= mountpoint->fanout;
-        bitmap_size_bits += highest_layer;
-        mountpoint->bitmap_layers++;
+    DefragReport report;
+    if(pulse_defrag(mountpoint, path, threshold, rate, &report)) {
+        printf(ESC_BOLD_RED "defrag:" ESC_RESET " failed to defragment %s\n", path ? path : mountpoint->name);
+        return 1;
     }
 
-    mountpoint->highest_layer_size = highest_layer;
+    printf(ESC_BOLD_GREEN "defrag:" ESC_RESET " rewrote %" PRIu64 " of %" PRIu64 " fragmented files, %" PRIu64 " extents "
+        "became %" PRIu64 " by moving %" PRIu64 " KB\n", report.defragmented, report.files, report.extents_before,
+        report.extents_after, (report.moved_blocks * mountpoint->block_size) >> 10);
+    return 0;
+}
 
-    // cache the highest layer bitmap
-    if(read_block(mountpoint->disk, mountpoint->superblock->bitmap_block,
-        mountpoint->block_size, 1, mountpoint->highest_layer_bitmap)) {
-        printf(ESC_BOLD_RED "mount:" ESC_RESET " failed to read bitmap on %s\n", argv[1]);
-        fclose(mountpoint->disk);
-        free(mountpoint->data_block);
-        free(mountpoint->metadata_block);
-        free(mountpoint->bitmap_block);
-        free(mountpoint->highest_layer_bitmap);
-        free(mountpoint);
-        mountpoint = NULL;
+int ls_command(int argc, char **argv) {
+    const char *path = argc == 2 ? argv[1] : "/";
+    if(argc > 2 || path[0] != '/') {
+        printf(ESC_BOLD_CYAN "usage:" ESC_RESET " ls <path|/>\n");
+        printf(ESC_BOLD_CYAN "example:" ESC_RESET " ls /var\n");
         return 1;
     }
 
-    // and the starting offset and sizes of each layer
-    mountpoint->layer_starts = calloc(mountpoint->bitmap_layers, sizeof(u64));
-    if(!mountpoint->layer_starts) {
-        printf(ESC_BOLD_RED "mount:" ESC_RESET " failed to allocate memory for disk image %s\n", argv[1]);
-        fclose(mountpoint->disk);
-        free(mountpoint->data_block);
-        free(mountpoint->metadata_block);
-        free(mountpoint->bitmap_block);
-        free(mountpoint->highest_layer_bitmap);
-        free(mountpoint);
-        mountpoint = NULL;
+    if(!mountpoint) {
+        printf(ESC_BOLD_RED "ls:" ESC_RESET " no disk image is mounted\n");
         return 1;
     }
 
-    mountpoint->layer_sizes = calloc(mountpoint->bitmap_layers, sizeof(u64));
-    if(!mountpoint->layer_sizes) {
-        printf(ESC_BOLD_RED "mount:" ESC_RESET " failed to allocate memory for disk image %s\n", argv[1]);
-        fclose(mountpoint->disk);
-        free(mountpoint->data_block);
-        free(mountpoint->metadata_block);
-        free(mountpoint->bitmap_block);
-        free(mountpoint->highest_layer_bitmap);
-        free(mountpoint->layer_starts);
-        free(mountpoint);
-        mountpoint = NULL;
+    u64 dir = pulse_lookup(mountpoint, path);
+    PulseStat stat;
+    if(!dir || pulse_stat(mountpoint, dir, &stat) || !INODE_MODE_TYPE_IS_DIR(stat.mode)) {
+        printf(ESC_BOLD_RED "ls:" ESC_RESET " %s is not a directory\n", path);
         return 1;
     }
 
-    for(int i = mountpoint->bitmap_layers-1; i >= 0; i--) {
-        if(i == mountpoint->bitmap_layers-1) {
-            mountpoint->layer_starts[i] = 0;
-            mountpoint->layer_sizes[i] = mountpoint->highest_layer_size;
-        } else {
-            if(i == mountpoint->bitmap_layers-2) {
-                mountpoint->layer_starts[i] = mountpoint->highest_layer_size;
-            } else {
-                mountpoint->layer_starts[i] = mountpoint->layer_starts[i+1] * mountpoint->fanout;
+    PulseDirEntry *entries = malloc(DIR_PREFETCH_BATCH * sizeof(PulseDirEntry));
+    if(!entries) return 1;
+
+    u64 cookie = 0, count, total = 0;
+    while(cookie != DIR_COOKIE_END) {
+        if(pulse_readdir_plus(mountpoint, dir, &cookie, entries, DIR_PREFETCH_BATCH, &count)) {
+            printf(ESC_BOLD_RED "ls:" ESC_RESET " failed to read %s\n", path);
+            free(entries);
+            return 1;
+        }
+
+        for(u64 i = 0; i < count; i++) {
+            u32 mode = entries[i].stat.mode;
+            char permissions[11] = "-rwxrwxrwx";
+            if(INODE_MODE_TYPE_IS_DIR(mode)) permissions[0] = 'd';
+            for(int bit = 0; bit < 9; bit++) {
+                if(!(mode & (0x100 >> bit))) permissions[bit + 1] = '-';
             }
 
-            mountpoint->layer_sizes[i] = mountpoint->layer_sizes[i+1] * mountpoint->fanout;
+            printf("%s %4" PRIu64 " %12" PRIu64 "  %s\n", permissions, entries[i].stat.link_count,
+                entries[i].stat.size, entries[i].name);
         }
+
+        total += count;
     }
 
-    printf(ESC_BOLD_GREEN "mount:" ESC_RESET " ✅ mounted disk image %s\n", argv[1]);
+    printf(ESC_BOLD_GREEN "ls:" ESC_RESET " %" PRIu64 " entries in %s\n", total, path);
+    free(entries);
     return 0;
 }
+
+/* mounts an image as the shell's current volume without the chatter, errors
+ * are still printed */
+int mount_current(const char *path) {
+    if(mountpoint) {
+        printf(ESC_BOLD_RED "mount:" ESC_RESET " unmount %s first\n", mountpoint->name);
+        return 1;
+    }
+
+    mountpoint = pulse_mount(path);
+    return mountpoint ? 0 : 1;
+}
+
+int unmount_current(void) {
+    if(!mountpoint) return -1;
+
+    int status = pulse_unmount(mountpoint);
+    mountpoint = NULL;
+    return status;
+}
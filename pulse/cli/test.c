@@ -23,12 +23,14 @@
  * SOFTWARE.
  */
 
-#include <pulse/pulse.h>
+#include <pulse/libpulse.h>
 #include <pulse/cli.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
+#include <pthread.h>
 #include <sys/stat.h>
 
 struct Test {
@@ -37,21 +39,1961 @@ struct Test {
     int (*function)();
 };
 
+struct HashVector {
+    usize length;
+    u64 seed;
+    u64 xxh64;
+    u64 xxh3_64;
+    Hash128 xxh3_128;
+};
+
+/* reference values from the upstream xxHash implementation, the input is the
+ * byte sequence generated by hash_test_input() */
+static const struct HashVector hash_vectors[] = {
+    {    0, 0x0000000000000000ULL, 0xEF46DB3751D8E999ULL, 0x2D06800538D394C2ULL, {0x6001C324468D497FULL, 0x99AA06D3014798D8ULL}},
+    {    1, 0x0000000000000000ULL, 0xE934A84ADB052768ULL, 0xC44BDFF4074EECDBULL, {0xC44BDFF4074EECDBULL, 0xA6CD5E9392000F6AULL}},
+    {    3, 0x0000000000000000ULL, 0xA9CF36B41F9E7D09ULL, 0xE14090F554A5EA90ULL, {0xE14090F554A5EA90ULL, 0x977FCBC0448B49F6ULL}},
+    {    4, 0x0000000000000000ULL, 0x435F59A33B7EB3D1ULL, 0x2E8D078A566E9749ULL, {0x4EE6926F0426173EULL, 0x4E82B36688C5328FULL}},
+    {    8, 0x0000000000000000ULL, 0x538CAC3B18F9EF8EULL, 0xCD1C7F88482FCAEFULL, {0x79D85ADAEEFD615EULL, 0x7B4966A681F18D57ULL}},
+    {    9, 0x0000000000000000ULL, 0x8205BFAA3589D37EULL, 0xBFE43DEF699FA9E3ULL, {0xEE5940D4DF4715AEULL, 0x200D098A7113E15FULL}},
+    {   16, 0x0000000000000000ULL, 0x2B72A043E551FE02ULL, 0x81E9EB8634460BB9ULL, {0x37286A19CF622308ULL, 0x78E8AB538D3ACAABULL}},
+    {   17, 0x0000000000000000ULL, 0xB4EC706896CCAB83ULL, 0x9998430FD0A655BEULL, {0x33BED349EC1C0CE7ULL, 0x1EA709ADA2B9C32EULL}},
+    {  128, 0x0000000000000000ULL, 0xDAA58C0AB1409B40ULL, 0x75ECA5C5D5594884ULL, {0xE1F0636051CCD2BEULL, 0x5AC741C59C95D36AULL}},
+    {  129, 0x0000000000000000ULL, 0xA4223E65B568A709ULL, 0xA05DA42E7A4E4667ULL, {0xCFB3FED667226458ULL, 0x1240F4D960139642ULL}},
+    {  240, 0x0000000000000000ULL, 0x574D1998DF49A15AULL, 0x5EB2467C8C9E3969ULL, {0xB2E6947C477A4AB0ULL, 0x640A6149838A7599ULL}},
+    {  241, 0x0000000000000000ULL, 0x92C1342E5E6E89B9ULL, 0x2D431E984C441F15ULL, {0x2D431E984C441F15ULL, 0xE817E20E53E42A8CULL}},
+    { 1024, 0x0000000000000000ULL, 0xE27E39A28E1B5640ULL, 0xE99DEF1145F12936ULL, {0xE99DEF1145F12936ULL, 0xDF4C8B9FF9715101ULL}},
+    { 4096, 0x0000000000000000ULL, 0xA591D40F991BF106ULL, 0x9BF67F8DEFF876AEULL, {0x9BF67F8DEFF876AEULL, 0x3203F3B99AD3538DULL}},
+    {    0, 0x9E3779B185EBCA87ULL, 0x6EC6D05F61C7E7A7ULL, 0x07F70F819703314DULL, {0xF9ECE1036ECBB2EDULL, 0x45EF6DDC7AFB225AULL}},
+    {    1, 0x9E3779B185EBCA87ULL, 0x60508B0CED72C717ULL, 0x719AE0FC4EB5DB08ULL, {0x719AE0FC4EB5DB08ULL, 0xCDD5FBBA588C5DA7ULL}},
+    {    3, 0x9E3779B185EBCA87ULL, 0xE48F87D9B2410B5EULL, 0x6EB5627691A16D9DULL, {0x6EB5627691A16D9DULL, 0x8C4E0F49E5D8B107ULL}},
+    {    4, 0x9E3779B185EBCA87ULL, 0x845C53E4CAC7CA2CULL, 0xB0CAE675E8AF58F9ULL, {0x327844CC9B4C1880ULL, 0x8C8AB1E4517541F3ULL}},
+    {    8, 0x9E3779B185EBCA87ULL, 0x9FF4E541B4CB78EEULL, 0x320F50E08268628DULL, {0xF5D78D49A25048E4ULL, 0x6E06925BC63C25FBULL}},
+    {    9, 0x9E3779B185EBCA87ULL, 0xE718058887E7B8FAULL, 0x279BB644E9F72784ULL, {0xFACE39554823DDFEULL, 0x253BBF4CC22556D7ULL}},
+    {   16, 0x9E3779B185EBCA87ULL, 0x849882AF47AB20D1ULL, 0xE14A0605E4B3EC0AULL, {0x0A780D6318B72B34ULL, 0x4FC5AD20359F6C23ULL}},
+    {   17, 0x9E3779B185EBCA87ULL, 0x0192A87A3D73211BULL, 0x8459FD97F38B3DF7ULL, {0xB7A7C759217D849CULL, 0x832F7607686A13A0ULL}},
+    {  128, 0x9E3779B185EBCA87ULL, 0x0F4A28EAA64544C5ULL, 0x691AC78D4D2A3418ULL, {0x0BC4D4C8AFC2E678ULL, 0x4B8ECA7C85290B95ULL}},
+    {  129, 0x9E3779B185EBCA87ULL, 0xBF4EF6E7DE57EAC2ULL, 0x73433C0A4D86B981ULL, {0x2A581D76A5135E70ULL, 0x6914ED856B99E2EBULL}},
+    {  240, 0x9E3779B185EBCA87ULL, 0x9D8056D19F7F62FCULL, 0x2C2D3375EAE2AA31ULL, {0xB4B33216864EBB92ULL, 0x3FF4166378AC54B1ULL}},
+    {  241, 0x9E3779B185EBCA87ULL, 0xB21D2C26C3BD0349ULL, 0xE32B84674CA7209FULL, {0xE32B84674CA7209FULL, 0x732D7ACB9E11F3F9ULL}},
+    { 1024, 0x9E3779B185EBCA87ULL, 0x286610DDBDD67606ULL, 0x11786188AF27CE37ULL, {0x11786188AF27CE37ULL, 0x51C03DE0D648BEA9ULL}},
+    { 4096, 0x9E3779B185EBCA87ULL, 0xB7B8040D5E8F4AFBULL, 0xF14207ABB4A65391ULL, {0xF14207ABB4A65391ULL, 0xB21C380724CA7C95ULL}},
+};
+
+static void hash_test_input(u8 *buffer, usize size) {
+    for(usize i = 0; i < size; i++)
+        buffer[i] = (u8) ((u32) (i * 2654435761U) >> 24);
+}
+
+static int hash_engine_count(const XXH3Engine **engines) {
+    int count = 0;
+    engines[count++] = &xxh3_engine_scalar;
+#ifdef XXH3_HAVE_SSE2
+    engines[count++] = &xxh3_engine_sse2;
+#endif
+#ifdef XXH3_HAVE_AVX2
+    if(__builtin_cpu_supports("avx2"))
+        engines[count++] = &xxh3_engine_avx2;
+#endif
+    return count;
+}
+
+static int test_hash_vectors() {
+    const XXH3Engine *engines[3];
+    int engine_count = hash_engine_count(engines);
+
+    u8 *input = malloc(8192);
+    if(!input) return 1;
+    hash_test_input(input, 8192);
+
+    int failures = 0;
+    for(int i = 0; i < sizeof(hash_vectors) / sizeof(hash_vectors[0]); i++) {
+        const struct HashVector *v = &hash_vectors[i];
+
+        if(xxh64(input, v->length, v->seed) != v->xxh64) {
+            printf(ESC_BOLD_RED "test:" ESC_RESET " xxh64 mismatch for length %zu seed 0x%" PRIx64 "\n",
+                v->length, v->seed);
+            failures++;
+        }
+
+        for(int j = 0; j < engine_count; j++) {
+            u64 h64 = xxh3_64_engine(input, v->length, v->seed, engines[j]);
+            Hash128 h128 = xxh3_128_engine(input, v->length, v->seed, engines[j]);
+
+            if(h64 != v->xxh3_64) {
+                printf(ESC_BOLD_RED "test:" ESC_RESET " xxh3_64 (%s) mismatch for length %zu seed 0x%" PRIx64 "\n",
+                    engines[j]->name, v->length, v->seed);
+                failures++;
+            }
+
+            if(h128.low != v->xxh3_128.low || h128.high != v->xxh3_128.high) {
+                printf(ESC_BOLD_RED "test:" ESC_RESET " xxh3_128 (%s) mismatch for length %zu seed 0x%" PRIx64 "\n",
+                    engines[j]->name, v->length, v->seed);
+                failures++;
+            }
+        }
+    }
+
+    printf("    🛠️ checked %d vectors against %d engine%s, dispatching to %s\n",
+        (int) (sizeof(hash_vectors) / sizeof(hash_vectors[0])), engine_count,
+        engine_count > 1 ? "s" : "", hash_engine()->name);
+
+    free(input);
+    return failures ? 1 : 0;
+}
+
+static int test_hash_throughput() {
+    const XXH3Engine *engines[3];
+    int engine_count = hash_engine_count(engines);
+    const usize size = 16 * 1024 * 1024;
+    const usize sizes[] = { 16, 64, 256, 4096, size };
+
+    // the input start moves around a little so nothing can be hoisted out of
+    // the loop, and so unaligned loads are part of the measurement
+    u8 *input = malloc(size + 64);
+    if(!input) return 1;
+    hash_test_input(input, size + 64);
+
+    volatile u64 sink = 0;
+    for(int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        // hash roughly 256 MB per configuration regardless of the input size
+        usize rounds = (256 * 1024 * 1024) / sizes[i];
+
+        for(int j = 0; j < engine_count; j++) {
+            struct timespec start, end;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            for(usize k = 0; k < rounds; k++)
+                sink += xxh3_64_engine(input + (k & 63), sizes[i], 0, engines[j]);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+
+            double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+            printf("    🛠️ xxh3_64 %-6s %8zu bytes: %8.2f GB/s\n", engines[j]->name, sizes[i],
+                (double) sizes[i] * rounds / elapsed / (1024.0 * 1024 * 1024));
+
+            if(sizes[i] <= XXH3_MID_SIZE_MAX)
+                break;  // short inputs never touch the engine
+        }
+    }
+
+    free(input);
+    return 0;
+}
+
 static int test_create() {
     mkdir("test", S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH);
     char *args[] = { "create", "test/test.img", "2g" };
 
-    int status = create_command(sizeof(args) / sizeof(args[0]), args);
-    if(status) return status;
+    int status = create_command(sizeof(args) / sizeof(args[0]), args);
+    if(status) return status;
+    return 0;
+}
+
+static int test_mount() {
+    char *args[] = { "mount", "test/test.img" };
+
+    int status = mount_command(sizeof(args) / sizeof(args[0]), args);
+    if(status) return status;
+    return 0;
+}
+
+static int test_check() {
+    char *args[] = { "check" };
+
+    return check_command(sizeof(args) / sizeof(args[0]), args);
+}
+
+/* creates a directory full of files of different sizes, reads them back,
+ * then removes everything and expects check to find a clean file system */
+static int test_files() {
+    const int file_count = 300;
+    const u64 sizes[] = { 0, 100, 3000, 5000, 3 * 4096 + 17, 1024 * 1024 };
+    const int size_count = sizeof(sizes) / sizeof(sizes[0]);
+    char path[64];
+
+    u8 *data = malloc(sizes[size_count-1]);
+    u8 *readback = malloc(sizes[size_count-1]);
+    if(!data || !readback) {
+        free(data);
+        free(readback);
+        return 1;
+    }
+
+    if(!create_file(mountpoint, "/files", INODE_MODE_TYPE_DIR | INODE_MODE_U_RWX)) {
+        printf(ESC_BOLD_RED "test:" ESC_RESET " failed to create directory /files\n");
+        goto fail;
+    }
+
+    printf(ESC_BOLD_CYAN "test:" ESC_RESET " writing %d files...\n", file_count);
+
+    for(int i = 0; i < file_count; i++) {
+        u64 size = sizes[i % size_count];
+        sprintf(path, "/files/file%d", i);
+
+        u64 inode = create_file(mountpoint, path,
+            INODE_MODE_TYPE_REG | INODE_MODE_U_R | INODE_MODE_U_W);
+        if(!inode) {
+            printf(ESC_BOLD_RED "test:" ESC_RESET " failed to create %s\n", path);
+            goto fail;
+        }
+
+        for(u64 j = 0; j < size; j++)
+            data[j] = (u8) (i * 31 + j * 7);
+
+        // write in odd-sized pieces so partial blocks and inline data get moved
+        for(u64 offset = 0; offset < size; offset += 1500) {
+            u64 chunk = size - offset < 1500 ? size - offset : 1500;
+            if(write_to_inode(mountpoint, inode, data + offset, offset, chunk)) {
+                printf(ESC_BOLD_RED "test:" ESC_RESET " failed to write %s\n", path);
+                goto fail;
+            }
+        }
+    }
+
+    for(int i = 0; i < file_count; i++) {
+        u64 size = sizes[i % size_count];
+        sprintf(path, "/files/file%d", i);
+
+        u64 inode = resolve(mountpoint, path);
+        if(!inode || (size && read_from_inode(mountpoint, inode, readback, 0, size))) {
+            printf(ESC_BOLD_RED "test:" ESC_RESET " failed to read back %s\n", path);
+            goto fail;
+        }
+
+        for(u64 j = 0; j < size; j++) {
+            if(readback[j] != (u8) (i * 31 + j * 7)) {
+                printf(ESC_BOLD_RED "test:" ESC_RESET " %s differs at offset %" PRIu64 "\n", path, j);
+                goto fail;
+            }
+        }
+    }
+
+    CheckReport report;
+    if(check_volume(mountpoint, 4, &report) || report.entries != file_count + 1 ||
+        report.leaked_blocks || report.missing_blocks || report.cross_linked_blocks ||
+        report.layer_errors || report.structure_errors) {
+        printf(ESC_BOLD_RED "test:" ESC_RESET " check failed with %" PRIu64 " files written\n",
+            report.entries);
+        goto fail;
+    }
+
+    for(int i = 0; i < file_count; i++) {
+        sprintf(path, "/files/file%d", i);
+        if(remove_file(mountpoint, path) || resolve(mountpoint, path)) {
+            printf(ESC_BOLD_RED "test:" ESC_RESET " failed to remove %s\n", path);
+            goto fail;
+        }
+    }
+
+    if(remove_file(mountpoint, "/files") || resolve(mountpoint, "/files")) {
+        printf(ESC_BOLD_RED "test:" ESC_RESET " failed to remove /files\n");
+        goto fail;
+    }
+
+    free(data);
+    free(readback);
+
+    char *args[] = { "check" };
+    return check_command(sizeof(args) / sizeof(args[0]), args);
+
+fail:
+    free(data);
+    free(readback);
+    return 1;
+}
+
+/* writes a file, unmounts with the umount command and mounts the image again
+ * with mount_current(), the file has to come back and the mount has to show up
+ * in the new volume's block I/O counters */
+static int test_remount() {
+    const char *text = "still here after a remount";
+    usize length = strlen(text) + 1;
+    char readback[64];
+
+    u64 inode = create_file(mountpoint, "/remount",
+        INODE_MODE_TYPE_REG | INODE_MODE_U_R | INODE_MODE_U_W);
+    if(!inode || write_to_inode(mountpoint, inode, text, 0, length)) {
+        printf(ESC_BOLD_RED "test:" ESC_RESET " failed to write /remount\n");
+        return 1;
+    }
+
+    char *umount_args[] = { "umount" };
+    if(umount_command(sizeof(umount_args) / sizeof(umount_args[0]), umount_args))
+        return 1;
+
+    if(mount_current("test/test.img"))
+        return 1;
+
+    if(!mountpoint->io_stats.reads) {
+        printf(ESC_BOLD_RED "test:" ESC_RESET " mounting did not count any block reads\n");
+        return 1;
+    }
+
+    inode = resolve(mountpoint, "/remount");
+    if(!inode || read_from_inode(mountpoint, inode, readback, 0, length) ||
+        memcmp(readback, text, length)) {
+        printf(ESC_BOLD_RED "test:" ESC_RESET " /remount did not survive the remount\n");
+        return 1;
+    }
+
+    if(remove_file(mountpoint, "/remount")) {
+        printf(ESC_BOLD_RED "test:" ESC_RESET " failed to remove /remount\n");
+        return 1;
+    }
+
+    char *args[] = { "check" };
+    return check_command(sizeof(args) / sizeof(args[0]), args);
+}
+
+#define TEST_THREADS            8
+#define TEST_THREAD_FILES       24
+
+struct ThreadTest {
+    Mountpoint *volume;
+    int id;
+    int status;
+};
+
+/* every thread creates, fills, verifies and removes its own files through
+ * the locked API while the other threads do the same on the same volumes */
+static void *test_thread_worker(void *arg) {
+    struct ThreadTest *test = (struct ThreadTest *) arg;
+    const u64 size = 5 * 4096 + 123;
+    char path[64];
+
+    u8 *data = malloc(size);
+    u8 *readback = malloc(size);
+    if(!data || !readback) goto fail;
+
+    for(int i = 0; i < TEST_THREAD_FILES; i++) {
+        sprintf(path, "/thread%d-%d", test->id, i);
+        u64 inode = pulse_create(test->volume, path,
+            INODE_MODE_TYPE_REG | INODE_MODE_U_R | INODE_MODE_U_W);
+        if(!inode) goto fail;
+
+        for(u64 j = 0; j < size; j++)
+            data[j] = (u8) (test->id * 59 + i * 31 + j * 7);
+
+        for(u64 offset = 0; offset < size; offset += 3000) {
+            u64 chunk = size - offset < 3000 ? size - offset : 3000;
+            if(pulse_write(test->volume, inode, data + offset, offset, chunk)) goto fail;
+        }
+    }
+
+    for(int i = 0; i < TEST_THREAD_FILES; i++) {
+        sprintf(path, "/thread%d-%d", test->id, i);
+        u64 inode = pulse_lookup(test->volume, path);
+        PulseStat stat;
+        if(!inode || pulse_stat(test->volume, inode, &stat) || stat.size != size ||
+            pulse_read(test->volume, inode, readback, 0, size))
+            goto fail;
+
+        for(u64 j = 0; j < size; j++) {
+            if(readback[j] != (u8) (test->id * 59 + i * 31 + j * 7)) goto fail;
+        }
+
+        if(pulse_remove(test->volume, path) || pulse_lookup(test->volume, path)) goto fail;
+    }
+
+    free(data);
+    free(readback);
+    test->status = 0;
+    return NULL;
+
+fail:
+    printf(ESC_BOLD_RED "test:" ESC_RESET " thread %d failed on %s\n", test->id, path);
+    free(data);
+    free(readback);
+    test->status = 1;
+    return NULL;
+}
+
+/* shares two scratch images between several threads, both have to come out
+ * clean - the mounted volume is left alone for the tests that follow */
+static int test_threads() {
+    const char *images[] = { "test/thread0.img", "test/thread1.img" };
+    Mountpoint *volumes[2] = { NULL, NULL };
+    int status = 0;
+
+    for(int i = 0; i < 2; i++) {
+        if(format(images[i], 256 * 1024 * 1024, 4096, 16) ||
+            !(volumes[i] = pulse_mount(images[i]))) {
+            status = 1;
+            goto done;
+        }
+    }
+
+    pthread_t threads[TEST_THREADS];
+    struct ThreadTest tests[TEST_THREADS];
+    int started = 0;
+
+    for(int i = 0; i < TEST_THREADS; i++) {
+        tests[i].volume = volumes[i % 2];
+        tests[i].id = i;
+        tests[i].status = 1;
+        if(pthread_create(&threads[i], NULL, test_thread_worker, &tests[i])) {
+            status = 1;
+            break;
+        }
+
+        started++;
+    }
+
+    for(int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+        status |= tests[i].status;
+    }
+
+    for(int i = 0; i < 2; i++) {
+        CheckReport report;
+        if(pulse_check(volumes[i], 4, &report) || report.entries || report.leaked_blocks ||
+            report.missing_blocks || report.cross_linked_blocks || report.layer_errors ||
+            report.structure_errors) {
+            printf(ESC_BOLD_RED "test:" ESC_RESET " %s is not clean after the threads\n",
+                volumes[i]->name);
+            status = 1;
+        }
+    }
+
+done:
+    for(int i = 0; i < 2; i++) {
+        if(volumes[i] && pulse_unmount(volumes[i])) status = 1;
+    }
+
+    return status;
+}
+
+/* small writes to one file should only dirty its cached inode, and inodes
+ * pushed out of a tiny cache have to come back intact after a remount */
+static int test_inode_cache() {
+    const char *image = "test/icache.img";
+    const int file_count = 100;
+    char path[64], data[16], readback[16];
+
+    if(format(image, 256 * 1024 * 1024, 4096, 16)) return 1;
+
+    Mountpoint *volume = pulse_mount(image);
+    if(!volume) return 1;
+
+    // shrink the cache so the files below keep evicting each other
+    icache_destroy(volume);
+    if(icache_init(volume, 16)) goto fail;
+
+    u64 inode = pulse_create(volume, "/small", INODE_MODE_TYPE_REG | INODE_MODE_U_R | INODE_MODE_U_W);
+    if(!inode) goto fail;
+
+    u64 writes = volume->io_stats.writes;
+    for(int i = 0; i < 64; i++) {
+        memset(data, i, sizeof(data));
+        if(pulse_write(volume, inode, data, i * sizeof(data), sizeof(data))) goto fail;
+    }
+
+    if(volume->io_stats.writes != writes) {
+        printf(ESC_BOLD_RED "test:" ESC_RESET " %" PRIu64 " block writes for inline data\n",
+            volume->io_stats.writes - writes);
+        goto fail;
+    }
+
+    for(int i = 0; i < file_count; i++) {
+        sprintf(path, "/cached%d", i);
+        u64 file = pulse_create(volume, path, INODE_MODE_TYPE_REG | INODE_MODE_U_R | INODE_MODE_U_W);
+        memset(data, i, sizeof(data));
+        if(!file || pulse_write(volume, file, data, 0, sizeof(data))) goto fail;
+    }
+
+    if(pulse_unmount(volume)) return 1;
+    if(!(volume = pulse_mount(image))) return 1;
+
+    for(int i = 0; i < file_count; i++) {
+        sprintf(path, "/cached%d", i);
+        u64 file = pulse_lookup(volume, path);
+        memset(data, i, sizeof(data));
+        if(!file || pulse_read(volume, file, readback, 0, sizeof(readback)) ||
+            memcmp(data, readback, sizeof(data))) {
+            printf(ESC_BOLD_RED "test:" ESC_RESET " %s did not survive the remount\n", path);
+            goto fail;
+        }
+    }
+
+    PulseStat stat;
+    inode = pulse_lookup(volume, "/small");
+    if(!inode || pulse_stat(volume, inode, &stat) || stat.size != 64 * sizeof(data)) goto fail;
+
+    CheckReport report;
+    if(pulse_check(volume, 1, &report) || report.leaked_blocks || report.missing_blocks ||
+        report.cross_linked_blocks || report.layer_errors || report.structure_errors)
+        goto fail;
+
+    return pulse_unmount(volume) ? 1 : 0;
+
+fail:
+    pulse_unmount(volume);
+    return 1;
+}
+
+/* two logs appended to in lockstep would interleave block by block if every
+ * write allocated on the spot; with delayed allocation each should come out
+ * as a single extent once flushed, and read back intact after a remount */
+static int test_delayed_allocation() {
+    const char *image = "test/delalloc.img";
+    const char *paths[] = { "/log0", "/log1" };
+    const int chunk_count = 256;
+    u64 inodes[2];
+    u8 chunk[1000], readback[1000];
+
+    if(format(image, 256 * 1024 * 1024, 4096, 16)) return 1;
+
+    Mountpoint *volume = pulse_mount(image);
+    if(!volume) return 1;
+
+    for(int f = 0; f < 2; f++) {
+        inodes[f] = pulse_create(volume, paths[f], INODE_MODE_TYPE_REG | INODE_MODE_U_R | INODE_MODE_U_W);
+        if(!inodes[f]) goto fail;
+    }
+
+    for(int i = 0; i < chunk_count; i++) {
+        for(int f = 0; f < 2; f++) {
+            memset(chunk, i * 2 + f, sizeof(chunk));
+            if(pulse_write(volume, inodes[f], chunk, (u64)i * sizeof(chunk), sizeof(chunk))) goto fail;
+        }
+    }
+
+    if(pulse_unmount(volume)) return 1;
+    if(!(volume = pulse_mount(image))) return 1;
+
+    Inode *inode_buf = malloc(volume->block_size);
+    if(!inode_buf) goto fail;
+
+    for(int f = 0; f < 2; f++) {
+        ExtentNode *leaves;
+        u64 count;
+        if(read_inode(volume, inodes[f], inode_buf) ||
+            extent_collect(volume, inode_buf->extent_tree_root, &leaves, &count)) {
+            free(inode_buf);
+            goto fail;
+        }
+
+        free(leaves);
+        if(count != 1) {
+            printf(ESC_BOLD_RED "test:" ESC_RESET " %s has %" PRIu64 " extents but expected 1\n", paths[f], count);
+            free(inode_buf);
+            goto fail;
+        }
+
+        for(int i = 0; i < chunk_count; i++) {
+            memset(chunk, i * 2 + f, sizeof(chunk));
+            if(pulse_read(volume, inodes[f], readback, (u64)i * sizeof(chunk), sizeof(readback)) ||
+                memcmp(chunk, readback, sizeof(chunk))) {
+                printf(ESC_BOLD_RED "test:" ESC_RESET " %s is corrupt at offset %" PRIu64 "\n", paths[f],
+                    (u64)i * sizeof(chunk));
+                free(inode_buf);
+                goto fail;
+            }
+        }
+    }
+
+    free(inode_buf);
+
+    // a file that isn't written again still gets its delayed data out in time
+    memset(chunk, 0xa5, sizeof(chunk));
+    if(pulse_write(volume, inodes[0], chunk, (u64)chunk_count * sizeof(chunk), sizeof(chunk)) ||
+        !__atomic_load_n(&volume->pending_bytes, __ATOMIC_RELAXED))
+        goto fail;
+
+    for(int waited = 0; __atomic_load_n(&volume->pending_bytes, __ATOMIC_RELAXED); waited++) {
+        if(waited * 100000000ULL > 2 * WRITEBACK_TIMEOUT) {
+            printf(ESC_BOLD_RED "test:" ESC_RESET " delayed data of %s was never written back\n",
+                paths[0]);
+            goto fail;
+        }
+
+        usleep(100000);
+    }
+
+    CheckReport report;
+    if(pulse_check(volume, 1, &report) || report.leaked_blocks || report.missing_blocks ||
+        report.cross_linked_blocks || report.layer_errors || report.structure_errors)
+        goto fail;
+
+    return pulse_unmount(volume) ? 1 : 0;
+
+fail:
+    pulse_unmount(volume);
+    return 1;
+}
+
+/* removing a file and syncing should punch its blocks out of the image, but
+ * blocks that were handed out again before the sync must keep their data */
+static int test_discard() {
+    const char *image = "test/discard.img";
+    const u64 big_size = 4 << 20, small_size = 256 << 10;
+    struct stat before, after;
+
+    if(format(image, 64 * 1024 * 1024, 4096, 16)) return 1;
+
+    Mountpoint *volume = pulse_mount(image);
+    if(!volume) return 1;
+
+    u8 *data = malloc(big_size);
+    if(!data) goto fail;
+
+    memset(data, 0x5A, big_size);
+    u64 inode = pulse_create(volume, "/big", INODE_MODE_TYPE_REG | INODE_MODE_U_R | INODE_MODE_U_W);
+    if(!inode || pulse_write(volume, inode, data, 0, big_size) || pulse_sync(volume) ||
+        stat(image, &before))
+        goto fail;
+
+    u64 discards = volume->io_stats.discards;
+    if(pulse_remove(volume, "/big")) goto fail;
+
+    // lands on the lowest free blocks, which are the ones /big just gave up
+    for(u64 i = 0; i < small_size; i++) data[i] = i * 7;
+    inode = pulse_create(volume, "/small", INODE_MODE_TYPE_REG | INODE_MODE_U_R | INODE_MODE_U_W);
+    if(!inode || pulse_write(volume, inode, data, 0, small_size) || pulse_sync(volume) ||
+        stat(image, &after))
+        goto fail;
+
+    if(volume->discard_mode == DISCARD_OFF) {
+        printf("    ⚠️  %s does not support discarding, skipping\n", image);
+    } else if(volume->io_stats.discards == discards ||
+        (u64)(before.st_blocks - after.st_blocks) * 512 < big_size - small_size - (256 << 10)) {
+        printf(ESC_BOLD_RED "test:" ESC_RESET " image went from %" PRIu64 " to %" PRIu64 " KB on disk\n",
+            (u64) before.st_blocks / 2, (u64) after.st_blocks / 2);
+        goto fail;
+    }
+
+    if(pulse_unmount(volume)) {
+        free(data);
+        return 1;
+    }
+
+    if(!(volume = pulse_mount(image)) || !(inode = pulse_lookup(volume, "/small")))
+        goto fail;
+
+    u8 *readback = data + small_size;
+    if(pulse_read(volume, inode, readback, 0, small_size) || memcmp(data, readback, small_size)) {
+        printf(ESC_BOLD_RED "test:" ESC_RESET " /small lost its data to a discard\n");
+        goto fail;
+    }
+
+    free(data);
+    data = NULL;
+
+    CheckReport report;
+    if(pulse_check(volume, 1, &report) || report.leaked_blocks || report.missing_blocks ||
+        report.cross_linked_blocks || report.layer_errors || report.structure_errors)
+        goto fail;
+
+    return pulse_unmount(volume) ? 1 : 0;
+
+fail:
+    free(data);
+    if(volume) pulse_unmount(volume);
+    return 1;
+}
+
+/* a clone shares every data block with its source, so making one should only
+ * write a few metadata blocks - writing to either file afterwards must leave
+ * the other one untouched, and the blocks go away with the last owner */
+static int test_clone() {
+    const char *image = "test/clone.img";
+    const u64 size = 4 << 20, patch_offset = 1 << 20, patch_size = 10000;
+    CheckReport report;
+
+    if(format(image, 64 * 1024 * 1024, 4096, 16)) return 1;
+
+    Mountpoint *volume = pulse_mount(image);
+    if(!volume) return 1;
+
+    u8 *data = malloc(size * 2);
+    if(!data) goto fail;
+
+    u8 *readback = data + size;
+    for(u64 i = 0; i < size; i++) data[i] = i * 13;
+
+    u64 original = pulse_create(volume, "/original", INODE_MODE_TYPE_REG | INODE_MODE_U_R | INODE_MODE_U_W);
+    if(!original || pulse_write(volume, original, data, 0, size) || pulse_sync(volume))
+        goto fail;
+
+    u64 written = volume->io_stats.bytes_written;
+    u64 clone = pulse_clone(volume, "/original", "/clone");
+    if(!clone || pulse_sync(volume)) goto fail;
+
+    written = volume->io_stats.bytes_written - written;
+    if(written > 16 * volume->block_size) {
+        printf(ESC_BOLD_RED "test:" ESC_RESET " cloning %" PRIu64 " KB wrote %" PRIu64 " KB\n", size >> 10, written >> 10);
+        goto fail;
+    }
+
+    memset(readback, 0xEE, patch_size);
+    if(pulse_write(volume, clone, readback, patch_offset, patch_size)) goto fail;
+
+    if(pulse_unmount(volume)) {
+        free(data);
+        return 1;
+    }
+
+    if(!(volume = pulse_mount(image))) goto fail;
+
+    if(pulse_read(volume, original, readback, 0, size) || memcmp(data, readback, size)) {
+        printf(ESC_BOLD_RED "test:" ESC_RESET " writing to the clone changed the original\n");
+        goto fail;
+    }
+
+    memset(data + patch_offset, 0xEE, patch_size);
+    if(pulse_read(volume, clone, readback, 0, size) || memcmp(data, readback, size)) {
+        printf(ESC_BOLD_RED "test:" ESC_RESET " the clone does not read back as written\n");
+        goto fail;
+    }
+
+    free(data);
+    data = NULL;
+
+    if(pulse_check(volume, 1, &report) || report.leaked_blocks || report.missing_blocks ||
+        report.cross_linked_blocks || report.layer_errors || report.structure_errors)
+        goto fail;
+
+    // the clone keeps the shared blocks alive on its own
+    u64 allocated = report.allocated_blocks;
+    if(pulse_remove(volume, "/original") || pulse_check(volume, 1, &report) ||
+        report.leaked_blocks || report.missing_blocks || report.structure_errors ||
+        allocated - report.allocated_blocks > 8)
+        goto fail;
+
+    if(pulse_remove(volume, "/clone") || pulse_check(volume, 1, &report) || report.leaked_blocks ||
+        report.missing_blocks || report.structure_errors || volume->shared_count)
+        goto fail;
+
+    return pulse_unmount(volume) ? 1 : 0;
+
+fail:
+    free(data);
+    if(volume) pulse_unmount(volume);
+    return 1;
+}
+
+/* a log written to a compressed file should take a fraction of its size on
+ * disk and read back intact after a remount, an overwrite in the middle and a
+ * truncate that lands inside a cluster */
+static int test_compress() {
+    const char *image = "test/compress.img";
+    const u64 size = 2 << 20, patch_offset = 300000, patch_size = 5000, cut = 1000003;
+    CheckReport report;
+
+    if(format(image, 64 * 1024 * 1024, 4096, 16)) return 1;
+
+    Mountpoint *volume = pulse_mount(image);
+    if(!volume) return 1;
+
+    u8 *data = malloc(size * 2);
+    if(!data) goto fail;
+
+    u8 *readback = data + size;
+    for(u64 i = 0, line = 0; i < size; line++)
+        i += snprintf((char *) data + i, size - i, "%08" PRIu64 " INFO request %" PRIu64 " served in %" PRIu64 " ms\n",
+            line * 7, line, line % 97);
+
+    if(pulse_check(volume, 1, &report)) goto fail;
+    u64 allocated = report.allocated_blocks;
+
+    u64 inode = pulse_create(volume, "/log", INODE_MODE_TYPE_REG | INODE_MODE_U_R | INODE_MODE_U_W |
+        INODE_MODE_COMPRESSED);
+    if(!inode) goto fail;
+
+    for(u64 offset = 0; offset < size; offset += 4000) {
+        u64 chunk = size - offset < 4000 ? size - offset : 4000;
+        if(pulse_write(volume, inode, data + offset, offset, chunk)) goto fail;
+    }
+
+    if(pulse_sync(volume) || pulse_check(volume, 1, &report)) goto fail;
+
+    u64 used = report.allocated_blocks - allocated;
+    if(used * volume->block_size > size / 2) {
+        printf(ESC_BOLD_RED "test:" ESC_RESET " a %" PRIu64 " KB log took %" PRIu64 " KB compressed\n",
+            size >> 10, (used * volume->block_size) >> 10);
+        goto fail;
+    }
+
+    printf(ESC_BOLD_CYAN "test:" ESC_RESET " %" PRIu64 " KB log stored in %" PRIu64 " KB\n", size >> 10,
+        (used * volume->block_size) >> 10);
+
+    for(u64 i = 0; i < patch_size; i++) readback[i] = rand();
+    memcpy(data + patch_offset, readback, patch_size);
+    if(pulse_write(volume, inode, readback, patch_offset, patch_size) || pulse_unmount(volume)) {
+        free(data);
+        return 1;
+    }
+
+    if(!(volume = pulse_mount(image))) goto fail;
+
+    if(pulse_read(volume, inode, readback, 0, size) || memcmp(data, readback, size)) {
+        printf(ESC_BOLD_RED "test:" ESC_RESET " the compressed file does not read back as written\n");
+        goto fail;
+    }
+
+    // growing again after the truncate must not bring back the old data
+    memset(data + cut, 0, size - cut);
+    if(pulse_truncate(volume, inode, cut) || pulse_truncate(volume, inode, size) ||
+        pulse_read(volume, inode, readback, 0, size) || memcmp(data, readback, size)) {
+        printf(ESC_BOLD_RED "test:" ESC_RESET " truncating the compressed file kept stale data\n");
+        goto fail;
+    }
+
+    free(data);
+    data = NULL;
+
+    if(pulse_check(volume, 1, &report) || report.leaked_blocks || report.missing_blocks ||
+        report.cross_linked_blocks || report.layer_errors || report.structure_errors)
+        goto fail;
+
+    if(pulse_remove(volume, "/log") || pulse_check(volume, 1, &report) || report.leaked_blocks ||
+        report.missing_blocks || report.allocated_blocks != allocated)
+        goto fail;
+
+    return pulse_unmount(volume) ? 1 : 0;
+
+fail:
+    free(data);
+    if(volume) pulse_unmount(volume);
+    return 1;
+}
+
+/* writing the same data into a second file with dedup on should only cost
+ * metadata, across a remount too since the index is kept on disk - the copies
+ * must still be separate files when one of them is overwritten */
+static int test_dedup() {
+    const char *image = "test/dedup.img";
+    const u64 size = 2 << 20, patch_offset = 100000, patch_size = 20000;
+    const char *paths[] = {"/layer", "/copy", "/again"};
+    CheckReport report;
+    DedupReport dedup;
+
+    if(format(image, 64 * 1024 * 1024, 4096, 16)) return 1;
+
+    Mountpoint *volume = pulse_mount(image);
+    if(!volume) return 1;
+
+    u8 *data = malloc(size * 2);
+    if(!data || pulse_dedup(volume, 4 << 20) || pulse_check(volume, 1, &report)) goto fail;
+
+    u8 *readback = data + size;
+    for(u64 i = 0; i < size; i++) data[i] = rand();
+    u64 allocated = report.allocated_blocks;
+
+    for(int f = 0; f < 3; f++) {
+        u64 inode = pulse_create(volume, paths[f], INODE_MODE_TYPE_REG | INODE_MODE_U_R | INODE_MODE_U_W);
+        if(!inode || pulse_write(volume, inode, data, 0, size) || pulse_sync(volume) ||
+            pulse_check(volume, 1, &report))
+            goto fail;
+
+        // the first file stores the data, the others only add an inode and extents
+        u64 used = report.allocated_blocks - allocated;
+        if(f && used > 8) {
+            printf(ESC_BOLD_RED "test:" ESC_RESET " a duplicate of %" PRIu64 " KB took %" PRIu64 " blocks\n",
+                size >> 10, used);
+            goto fail;
+        }
+
+        allocated = report.allocated_blocks;
+
+        // the index and the budget have to survive a remount
+        if(f == 1 && (pulse_unmount(volume) || !(volume = pulse_mount(image)))) {
+            volume = NULL;
+            goto fail;
+        }
+    }
+
+    if(pulse_dedup_report(volume, &dedup) || dedup.budget != 4 << 20 ||
+        dedup.saved_blocks < 2 * size / volume->block_size)
+        goto fail;
+
+    printf(ESC_BOLD_CYAN "test:" ESC_RESET " %" PRIu64 " KB saved by %" PRIu64 " shared blocks\n",
+        (dedup.saved_blocks * volume->block_size) >> 10, dedup.shared_blocks);
+
+    u64 copy = pulse_lookup(volume, "/copy");
+    for(u64 i = 0; i < patch_size; i++) readback[i] = rand();
+    if(!copy || pulse_write(volume, copy, readback, patch_offset, patch_size)) goto fail;
+
+    u64 original = pulse_lookup(volume, "/layer");
+    if(!original || pulse_read(volume, original, readback, 0, size) || memcmp(data, readback, size)) {
+        printf(ESC_BOLD_RED "test:" ESC_RESET " writing to a duplicate changed the original\n");
+        goto fail;
+    }
+
+    free(data);
+    data = NULL;
+
+    if(pulse_check(volume, 1, &report) || report.leaked_blocks || report.missing_blocks ||
+        report.cross_linked_blocks || report.layer_errors || report.structure_errors)
+        goto fail;
+
+    // turning dedup off drops the index along with its blocks on disk
+    for(int f = 0; f < 3; f++) {
+        if(pulse_remove(volume, paths[f])) goto fail;
+    }
+
+    if(pulse_dedup(volume, 0) || pulse_sync(volume) || pulse_check(volume, 1, &report) ||
+        report.leaked_blocks || report.missing_blocks || volume->shared_count ||
+        volume->superblock->dedup_block)
+        goto fail;
+
+    return pulse_unmount(volume) ? 1 : 0;
+
+fail:
+    free(data);
+    if(volume) pulse_unmount(volume);
+    return 1;
+}
+
+static int test_inode_tables() {
+    const char *image = "test/inodes.img";
+    const int files = 256;
+    u64 inodes[256];
+    char path[32], note[64], readback[64];
+    CheckReport report;
+    PulseStat stat;
+
+    // 16K blocks hold 32 inodes of 512 bytes, each with room for a short file
+    if(format_volume(image, 64 * 1024 * 1024, 16384, 16, 512, SUPER_TUNING_ALLOCATOR_LOWEST)) return 1;
+
+    Mountpoint *volume = pulse_mount(image);
+    if(!volume || pulse_check(volume, 1, &report)) goto fail;
+    u64 allocated = report.allocated_blocks;
+
+    for(int i = 0; i < files; i++) {
+        sprintf(path, "/note%d", i);
+        int length = sprintf(note, "note number %d", i);
+        inodes[i] = pulse_create(volume, path, INODE_MODE_TYPE_REG | INODE_MODE_U_R | INODE_MODE_U_W);
+        if(!inodes[i] || pulse_write(volume, inodes[i], note, 0, length)) goto fail;
+    }
+
+    if(pulse_check(volume, 1, &report)) goto fail;
+
+    u64 used = report.allocated_blocks - allocated;
+    u64 free_slots = volume->inode_slot_count;
+    if(used > files / 8) {
+        printf(ESC_BOLD_RED "test:" ESC_RESET " %d small files took %" PRIu64 " blocks\n", files, used);
+        goto fail;
+    }
+
+    if(pulse_unmount(volume) || !(volume = pulse_mount(image))) {
+        volume = NULL;
+        goto fail;
+    }
+
+    // one table read brings in the inodes next to the one asked for
+    u64 reads = volume->io_stats.reads;
+    for(int i = 0; i < files; i++) {
+        int length = sprintf(note, "note number %d", i);
+        if(pulse_stat(volume, inodes[i], &stat) || stat.size != length) goto fail;
+    }
+
+    reads = volume->io_stats.reads - reads;
+    printf(ESC_BOLD_CYAN "test:" ESC_RESET " %d small files in %" PRIu64 " blocks, stat read %" PRIu64 " blocks\n",
+        files, used, reads);
+
+    if(reads > files / 8) goto fail;
+
+    for(int i = 0; i < files; i++) {
+        int length = sprintf(note, "note number %d", i);
+        if(pulse_read(volume, inodes[i], readback, 0, length) || memcmp(note, readback, length))
+            goto fail;
+    }
+
+    // freed slots are reused before any new table, even after a remount
+    for(int i = 0; i < files; i += 2) {
+        sprintf(path, "/note%d", i);
+        if(pulse_remove(volume, path)) goto fail;
+    }
+
+    if(pulse_unmount(volume) || !(volume = pulse_mount(image))) {
+        volume = NULL;
+        goto fail;
+    }
+
+    for(int i = 0; i < files; i += 2) {
+        sprintf(path, "/again%d", i);
+        if(!pulse_create(volume, path, INODE_MODE_TYPE_REG | INODE_MODE_U_R | INODE_MODE_U_W))
+            goto fail;
+    }
+
+    if(volume->inode_slot_count != free_slots || pulse_check(volume, 1, &report) ||
+        report.leaked_blocks || report.missing_blocks || report.cross_linked_blocks ||
+        report.layer_errors || report.structure_errors)
+        goto fail;
+
+    return pulse_unmount(volume) ? 1 : 0;
+
+fail:
+    if(volume) pulse_unmount(volume);
+    return 1;
+}
+
+static int test_block_sizes() {
+    const char *image = "test/sizes.img";
+    const u64 size = (1 << 20) + 1234;
+    CheckReport report;
+
+    u8 *data = malloc(size * 2);
+    if(!data) return 1;
+
+    u8 *readback = data + size;
+    for(u64 i = 0; i < size; i++) data[i] = rand();
+
+    // every size the superblock can describe, each on a fresh image
+    for(usize block_size = 4096; block_size <= 512 * 1024; block_size *= 2) {
+        if(format(image, 256 * 1024 * 1024, block_size, 16)) goto fail;
+
+        Mountpoint *volume = pulse_mount(image);
+        if(!volume || volume->block_size != block_size) {
+            if(volume) pulse_unmount(volume);
+            goto fail;
+        }
+
+        u64 inode = pulse_create(volume, "/object", INODE_MODE_TYPE_REG | INODE_MODE_U_R | INODE_MODE_U_W);
+        if(!inode || pulse_write(volume, inode, data, 0, size) || pulse_unmount(volume) ||
+            !(volume = pulse_mount(image))) {
+            if(volume) pulse_unmount(volume);
+            goto fail;
+        }
+
+        if(pulse_read(volume, inode, readback, 0, size) || memcmp(data, readback, size) ||
+            pulse_check(volume, 1, &report) || report.leaked_blocks || report.missing_blocks ||
+            report.cross_linked_blocks || report.layer_errors || report.structure_errors ||
+            pulse_remove(volume, "/object") || pulse_check(volume, 1, &report) ||
+            report.referenced_blocks != report.allocated_blocks) {
+            printf(ESC_BOLD_RED "test:" ESC_RESET " %zu KB blocks failed\n", block_size >> 10);
+            pulse_unmount(volume);
+            goto fail;
+        }
+
+        if(pulse_unmount(volume)) goto fail;
+    }
+
+    free(data);
+    return 0;
+
+fail:
+    free(data);
+    return 1;
+}
+
+/* allocated blocks that were never written read as zeros, and a punched or
+ * never written range holds no blocks at all */
+static int test_sparse() {
+    const char *image = "test/sparse.img";
+    const u64 reserved = 8 * 1024 * 1024;
+    const u64 far = 48 * 1024 * 1024;
+    CheckReport report;
+
+    u8 *expected = calloc(2, reserved);
+    if(!expected) return 1;
+
+    u8 *readback = expected + reserved;
+    Mountpoint *volume = NULL;
+
+    if(format(image, 64 * 1024 * 1024, 4096, 16)) goto fail;
+
+    volume = pulse_mount(image);
+    u64 inode = volume ? pulse_create(volume, "/sparse", INODE_MODE_TYPE_REG | INODE_MODE_U_R | INODE_MODE_U_W) : 0;
+    if(!inode || pulse_check(volume, 1, &report)) goto fail;
+    u64 allocated = report.allocated_blocks;
+
+    // reserving space writes extent nodes, not the data
+    u64 written = volume->io_stats.bytes_written;
+    if(pulse_allocate(volume, inode, 0, reserved) || pulse_check(volume, 1, &report)) goto fail;
+
+    written = volume->io_stats.bytes_written - written;
+    u64 reserved_blocks = report.allocated_blocks - allocated;
+    printf(ESC_BOLD_CYAN "test:" ESC_RESET " reserved %" PRIu64 " blocks writing %" PRIu64 " bytes\n",
+        reserved_blocks, written);
+
+    if(reserved_blocks < reserved / 4096 || written >= reserved / 16 ||
+        pulse_read(volume, inode, readback, 0, reserved) || memcmp(expected, readback, reserved))
+        goto fail;
+
+    // writes that cover blocks partially leave the rest of them zeroed
+    for(u64 i = 0; i < 3 * 4096; i++) expected[40960 + 100 + i] = i * 7 + 1;
+    if(pulse_write(volume, inode, expected + 40960 + 100, 40960 + 100, 3 * 4096) ||
+        pulse_read(volume, inode, readback, 0, reserved) || memcmp(expected, readback, reserved))
+        goto fail;
+
+    // a hole in the middle frees its whole blocks, less a few for the split
+    // extent tree, and zeros the edges
+    for(u64 i = 0; i < reserved; i++) expected[i] = i % 251 + 1;
+    if(pulse_write(volume, inode, expected, 0, reserved) || pulse_sync(volume) ||
+        pulse_check(volume, 1, &report))
+        goto fail;
+
+    allocated = report.allocated_blocks;
+    memset(expected + (1 << 20) + 100, 0, 2 << 20);
+    if(pulse_punch(volume, inode, (1 << 20) + 100, 2 << 20) || pulse_check(volume, 1, &report) ||
+        allocated - report.allocated_blocks < (2 << 20) / 4096 - 8 ||
+        pulse_read(volume, inode, readback, 0, reserved) || memcmp(expected, readback, reserved))
+        goto fail;
+
+    // one block far past the end doesn't fill the gap before it
+    allocated = report.allocated_blocks;
+    if(pulse_write(volume, inode, expected, far, 4096) || pulse_sync(volume) ||
+        pulse_check(volume, 1, &report) || report.allocated_blocks - allocated > 4)
+        goto fail;
+
+    if(pulse_unmount(volume) || !(volume = pulse_mount(image))) {
+        volume = NULL;
+        goto fail;
+    }
+
+    PulseStat stat;
+    if(pulse_stat(volume, inode, &stat) || stat.size != far + 4096 ||
+        pulse_read(volume, inode, readback, 0, reserved) || memcmp(expected, readback, reserved) ||
+        pulse_read(volume, inode, readback, far, 4096) || memcmp(expected, readback, 4096) ||
+        pulse_read(volume, inode, readback, far - reserved, reserved))
+        goto fail;
+
+    for(u64 i = 0; i < reserved; i++) {
+        if(readback[i]) goto fail;
+    }
+
+    if(pulse_check(volume, 1, &report) || report.leaked_blocks || report.missing_blocks ||
+        report.cross_linked_blocks || report.layer_errors || report.structure_errors ||
+        pulse_remove(volume, "/sparse") || pulse_check(volume, 1, &report) ||
+        report.referenced_blocks != report.allocated_blocks)
+        goto fail;
+
+    free(expected);
+    return pulse_unmount(volume) ? 1 : 0;
+
+fail:
+    free(expected);
+    if(volume) pulse_unmount(volume);
+    return 1;
+}
+
+/* counts the blocks of an extent tree on either side of the data zone, leaves
+ * and the nodes holding them separately */
+typedef struct ZoneCount {
+    u64 data_zone;
+    u64 nodes_above;
+    u64 leaves_below;
+    u64 leaves_above;
+} ZoneCount;
+
+static int zone_count_node(const ExtentNode *node, u64 node_block, void *context) {
+    ZoneCount *count = (ZoneCount *) context;
+    if(node_block >= count->data_zone) count->nodes_above++;
+
+    if(!node->children && node->block_count) {
+        if(node->block < count->data_zone) count->leaves_below++;
+        else count->leaves_above++;
+    }
+
     return 0;
 }
 
-static int test_mount() {
-    char *args[] = { "mount", "test/test.img" };
+static int zone_count(Mountpoint *volume, u64 inode, ZoneCount *count) {
+    Inode *inode_buf = malloc(volume->block_size);
+    if(!inode_buf || read_inode(volume, inode, inode_buf)) {
+        free(inode_buf);
+        return -1;
+    }
 
-    int status = mount_command(sizeof(args) / sizeof(args[0]), args);
-    if(status) return status;
+    if(INODE_BLOCK(volume, inode) >= count->data_zone) count->nodes_above++;
+
+    int status = inode_buf->extent_tree_root && extent_walk(volume->disk, &volume->io_stats,
+        volume->block_size, inode_buf->extent_tree_root, scratch_buffer(SCRATCH_EXTENT, volume->block_size),
+        zone_count_node, count);
+
+    free(inode_buf);
+    return status;
+}
+
+/* inodes, extent nodes and directory blocks stay below the data zone while
+ * file contents go above it, until one side runs out of room */
+static int test_zones() {
+    const char *image = "test/zones.img";
+    const int files = 256;
+    const u64 size = 20000;
+    char path[32];
+    u64 inodes[256];
+    CheckReport report;
+    ZoneCount meta, data;
+
+    u8 *buffer = malloc(size);
+    if(!buffer) return 1;
+    for(u64 i = 0; i < size; i++) buffer[i] = rand();
+
+    if(format(image, 64 * 1024 * 1024, 4096, 16)) goto fail_free;
+
+    Mountpoint *volume = pulse_mount(image);
+    if(!volume) goto fail_free;
+
+    u64 dir = pulse_create(volume, "/dir", INODE_MODE_TYPE_DIR | INODE_MODE_U_R | INODE_MODE_U_W | INODE_MODE_U_X);
+    if(!dir) goto fail;
+
+    // interleaved the way an unpacked archive would be
+    for(int i = 0; i < files; i++) {
+        sprintf(path, "/dir/file%d", i);
+        inodes[i] = pulse_create(volume, path, INODE_MODE_TYPE_REG | INODE_MODE_U_R | INODE_MODE_U_W);
+        if(!inodes[i] || pulse_write(volume, inodes[i], buffer, 0, size)) goto fail;
+    }
+
+    if(pulse_sync(volume)) goto fail;
+
+    memset(&meta, 0, sizeof(ZoneCount));
+    memset(&data, 0, sizeof(ZoneCount));
+    meta.data_zone = data.data_zone = volume->data_zone;
+
+    if(zone_count(volume, dir, &meta)) goto fail;
+    for(int i = 0; i < files; i++) {
+        if(zone_count(volume, inodes[i], &data)) goto fail;
+    }
+
+    printf(ESC_BOLD_CYAN "test:" ESC_RESET " data zone at block %" PRIu64 ", %" PRIu64 " of %" PRIu64 " data extents "
+        "above it, %" PRIu64 " metadata blocks above it\n", volume->data_zone, data.leaves_above,
+        data.leaves_above + data.leaves_below, meta.nodes_above + meta.leaves_above + data.nodes_above);
+
+    if(meta.nodes_above || meta.leaves_above || !meta.leaves_below || data.nodes_above ||
+        data.leaves_below || !data.leaves_above)
+        goto fail;
+
+    // a file bigger than the data zone spills into the metadata zone
+    u64 big = pulse_create(volume, "/big", INODE_MODE_TYPE_REG | INODE_MODE_U_R | INODE_MODE_U_W);
+    if(!big) goto fail;
+
+    for(u64 at = 0; at < 56 * 1024 * 1024; at += size) {
+        if(pulse_write(volume, big, buffer, at, size)) goto fail;
+    }
+
+    memset(&data, 0, sizeof(ZoneCount));
+    data.data_zone = volume->data_zone;
+    if(pulse_sync(volume) || zone_count(volume, big, &data) || !data.leaves_below ||
+        pulse_check(volume, 1, &report) || report.leaked_blocks || report.missing_blocks ||
+        report.cross_linked_blocks || report.layer_errors || report.structure_errors)
+        goto fail;
+
+    free(buffer);
+    return pulse_unmount(volume) ? 1 : 0;
+
+fail:
+    pulse_unmount(volume);
+fail_free:
+    free(buffer);
+    return 1;
+}
+
+/* the block a file keeps the data at offset in, zero if it has none */
+static u64 block_at(Mountpoint *volume, u64 inode, u64 offset) {
+    ExtentNode leaf;
+    Inode *inode_buf = malloc(volume->block_size);
+    u64 block = 0;
+
+    if(inode_buf && !read_inode(volume, inode, inode_buf) && inode_buf->extent_tree_root &&
+        !extent_find(volume, inode_buf->extent_tree_root, offset, &leaf, NULL) &&
+        offset >= leaf.start_offset && offset < leaf.start_offset + leaf.length)
+        block = leaf.block + (offset - leaf.start_offset) / volume->block_size;
+
+    free(inode_buf);
+    return block;
+}
+
+static int test_log() {
+    const char *image = "test/log.img";
+    const int files = 4;
+    const u64 size = 512 * 1024;
+    const int overwrites = 2048;
+    u64 inodes[4];
+    char path[32];
+    CheckReport report;
+    CleanReport clean;
+
+    u8 *contents = malloc(files * size + 4096);
+    if(!contents) return 1;
+
+    u8 *readback = contents + files * size;
+    Mountpoint *volume = NULL;
+
+    // 16 MB leave 15 segments of 1 MB above the data zone for the log
+    if(format_volume(image, 16 * 1024 * 1024, 4096, 16, 0, SUPER_TUNING_ALLOCATOR_LOG))
+        goto fail;
+
+    volume = pulse_mount(image);
+    if(!volume || !volume->log_mode ||
+        !pulse_create(volume, "/log", INODE_MODE_TYPE_DIR | INODE_MODE_U_R | INODE_MODE_U_W | INODE_MODE_U_X))
+        goto fail;
+
+    for(u64 i = 0; i < files * size; i++) contents[i] = rand();
+    for(int f = 0; f < files; f++) {
+        sprintf(path, "/log/file%d", f);
+        inodes[f] = pulse_create(volume, path, INODE_MODE_TYPE_REG | INODE_MODE_U_R | INODE_MODE_U_W);
+        if(!inodes[f] || pulse_write(volume, inodes[f], contents + f * size, 0, size)) goto fail;
+    }
+
+    if(pulse_sync(volume)) goto fail;
+
+    // an overwrite goes to the head and the block it replaces is freed
+    u64 old_block = block_at(volume, inodes[0], 0);
+    if(!old_block || pulse_write(volume, inodes[0], contents, 0, 4096)) goto fail;
+
+    u64 new_block = block_at(volume, inodes[0], 0);
+    if(!new_block || new_block == old_block || block_status(volume, old_block) ||
+        new_block + 1 != volume->log_head) {
+        printf(ESC_BOLD_RED "test:" ESC_RESET " overwrite stayed at block %" PRIu64 " instead of "
+            "moving to the head\n", old_block);
+        goto fail;
+    }
+
+    // random overwrites go out in order on the device
+    u64 writes = volume->data_writes, jumps = volume->data_write_jumps;
+    for(int i = 0; i < overwrites; i++) {
+        int f = rand() % files;
+        u64 at = (rand() % (size / 4096)) * 4096;
+        for(u64 b = 0; b < 4096; b++) contents[f * size + at + b] = rand();
+        if(pulse_write(volume, inodes[f], contents + f * size + at, at, 4096)) goto fail;
+    }
+
+    writes = volume->data_writes - writes;
+    jumps = volume->data_write_jumps - jumps;
+    printf(ESC_BOLD_CYAN "test:" ESC_RESET " %d random overwrites took %" PRIu64 " data writes, "
+        "%" PRIu64 " of them not where the last one ended\n", overwrites, writes, jumps);
+
+    if(jumps * 32 > writes) goto fail;
+
+    // most of the log is stale by now and the cleaner packs what is left
+    if(pulse_clean(volume, 16, &clean)) goto fail;
+
+    printf(ESC_BOLD_CYAN "test:" ESC_RESET " cleaner emptied %" PRIu64 " of %" PRIu64 " segments by moving "
+        "%" PRIu64 " blocks, %" PRIu64 " segments free\n", clean.emptied, clean.segments, clean.moved_blocks,
+        clean.free_segments);
+
+    if(!clean.emptied || !clean.moved_blocks || clean.free_segments < 10) goto fail;
+
+    // the head picks up where it was after a remount
+    u64 head = volume->log_head;
+    if(pulse_unmount(volume) || !(volume = pulse_mount(image))) {
+        volume = NULL;
+        goto fail;
+    }
+
+    if(volume->log_head != head) goto fail;
+
+    for(int f = 0; f < files; f++) {
+        for(u64 at = 0; at < size; at += 4096) {
+            if(pulse_read(volume, inodes[f], readback, at, 4096) ||
+                memcmp(readback, contents + f * size + at, 4096)) {
+                printf(ESC_BOLD_RED "test:" ESC_RESET " file %d differs at %" PRIu64 " after cleaning\n", f, at);
+                goto fail;
+            }
+        }
+    }
+
+    if(pulse_check(volume, 1, &report) || report.leaked_blocks || report.missing_blocks ||
+        report.cross_linked_blocks || report.layer_errors || report.structure_errors)
+        goto fail;
+
+    free(contents);
+    return pulse_unmount(volume) ? 1 : 0;
+
+fail:
+    if(volume) pulse_unmount(volume);
+    free(contents);
+    return 1;
+}
+
+static int test_defrag() {
+    const char *image = "test/defrag.img";
+    const u64 size = 1024 * 1024;
+    const u64 chunk = 16 * 1024;
+    u64 inodes[2];
+    CheckReport report;
+    DefragReport defrag;
+    Inode *inode_buf = NULL;
+
+    u8 *contents = malloc(2 * size + chunk);
+    if(!contents) return 1;
+
+    u8 *readback = contents + 2 * size;
+    Mountpoint *volume = NULL;
+
+    if(format(image, 64 * 1024 * 1024, 4096, 16)) goto fail;
+
+    volume = pulse_mount(image);
+    inode_buf = volume ? malloc(volume->block_size) : NULL;
+    if(!inode_buf) goto fail;
+
+    // two files written a chunk at a time in turns, each chunk made to reach
+    // the disk before the other file's, end up interleaved
+    for(int f = 0; f < 2; f++) {
+        inodes[f] = pulse_create(volume, f ? "/second" : "/first",
+            INODE_MODE_TYPE_REG | INODE_MODE_U_R | INODE_MODE_U_W);
+        if(!inodes[f]) goto fail;
+    }
+
+    for(u64 i = 0; i < 2 * size; i++) contents[i] = rand();
+    for(u64 at = 0; at < size; at += chunk) {
+        for(int f = 0; f < 2; f++) {
+            if(pulse_write(volume, inodes[f], contents + f * size + at, at, chunk) || pulse_sync(volume))
+                goto fail;
+        }
+    }
+
+    // a clone shares every block of the second file, which keeps it in place
+    if(!pulse_clone(volume, "/second", "/clone") || read_inode(volume, inodes[0], inode_buf))
+        goto fail;
+
+    u64 fragmented = inode_buf->extent_count;
+    if(fragmented < DEFRAG_MIN_EXTENTS) {
+        printf(ESC_BOLD_RED "test:" ESC_RESET " interleaved writes left only %" PRIu64 " extents\n", fragmented);
+        goto fail;
+    }
+
+    // the copying is held to 4 MB a second, a megabyte takes a quarter of one
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if(pulse_defrag(volume, NULL, DEFRAG_MIN_EXTENTS, 4 << 20, &defrag)) goto fail;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf(ESC_BOLD_CYAN "test:" ESC_RESET " rewrote %" PRIu64 " of %" PRIu64 " files, %" PRIu64 " extents became "
+        "%" PRIu64 " in %.2f seconds\n", defrag.defragmented, defrag.files, defrag.extents_before,
+        defrag.extents_after, seconds);
+
+    if(defrag.defragmented != 1 || defrag.extents_before != fragmented || defrag.extents_after != 1 ||
+        defrag.moved_blocks != size / 4096 || seconds < 0.2)
+        goto fail;
+
+    if(read_inode(volume, inodes[0], inode_buf) || inode_buf->extent_count != 1) goto fail;
+
+    // a second pass has nothing left to do
+    if(pulse_defrag(volume, "/first", DEFRAG_MIN_EXTENTS, 0, &defrag) || defrag.defragmented)
+        goto fail;
+
+    // the background thread stops without waiting out its interval
+    if(pulse_defrag_start(volume, DEFRAG_MIN_EXTENTS, 0) || pulse_defrag_stop(volume))
+        goto fail;
+
+    for(int f = 0; f < 2; f++) {
+        for(u64 at = 0; at < size; at += chunk) {
+            if(pulse_read(volume, inodes[f], readback, at, chunk) ||
+                memcmp(readback, contents + f * size + at, chunk)) {
+                printf(ESC_BOLD_RED "test:" ESC_RESET " file %d differs at %" PRIu64 " after defrag\n", f, at);
+                goto fail;
+            }
+        }
+    }
+
+    if(pulse_check(volume, 1, &report) || report.leaked_blocks || report.missing_blocks ||
+        report.cross_linked_blocks || report.layer_errors || report.structure_errors)
+        goto fail;
+
+    // the new tree is what the disk holds after a remount
+    if(pulse_unmount(volume) || !(volume = pulse_mount(image))) {
+        volume = NULL;
+        goto fail;
+    }
+
+    if(read_inode(volume, inodes[0], inode_buf) || inode_buf->extent_count != 1 ||
+        pulse_read(volume, inodes[0], readback, size - chunk, chunk) ||
+        memcmp(readback, contents + size - chunk, chunk))
+        goto fail;
+
+    free(inode_buf);
+    free(contents);
+    return pulse_unmount(volume) ? 1 : 0;
+
+fail:
+    if(volume) pulse_unmount(volume);
+    free(inode_buf);
+    free(contents);
+    return 1;
+}
+
+/* the report after a lookup, which has to have found expected */
+static int paths_lookup(Mountpoint *volume, const char *path, u64 expected, PathIndexReport *report) {
+    return pulse_lookup(volume, path) != expected || pulse_path_index_report(volume, report);
+}
+
+static int test_paths() {
+    const char *image = "test/paths.img";
+    const char *deep = "/a/b/c/d/e/f/g/h/file";
+    char path[64] = "";
+    PathIndexReport report;
+    CheckReport check;
+
+    if(format(image, 32 * 1024 * 1024, 4096, 16)) return 1;
+
+    Mountpoint *volume = pulse_mount(image);
+    if(!volume || pulse_path_index(volume, 1)) goto fail;
+
+    for(const char *c = "abcdefgh"; *c; c++) {
+        sprintf(path + strlen(path), "/%c", *c);
+        if(!pulse_create(volume, path, INODE_MODE_TYPE_DIR | INODE_MODE_U_R | INODE_MODE_U_W | INODE_MODE_U_X))
+            goto fail;
+    }
+
+    u64 file = pulse_create(volume, deep, INODE_MODE_TYPE_REG | INODE_MODE_U_R | INODE_MODE_U_W);
+    if(!file) goto fail;
+
+    // the first lookup walks the tree, the next ones probe the index however
+    // the path is spelled - creating the tree has indexed the parents already,
+    // and a single component is never indexed
+    if(pulse_path_index_report(volume, &report)) goto fail;
+    u64 parents = report.entries;
+
+    if(paths_lookup(volume, deep, file, &report) || report.hits || report.entries != parents + 1 ||
+        paths_lookup(volume, deep, file, &report) || report.hits != 1 ||
+        paths_lookup(volume, "a//b/./c/d/e/f/g/h/file/", file, &report) || report.hits != 2 ||
+        !pulse_lookup(volume, "/a") || pulse_path_index_report(volume, &report) ||
+        report.entries != parents + 1)
+        goto fail;
+
+    // the index goes to the disk on sync and comes back on mount
+    if(pulse_unmount(volume) || !(volume = pulse_mount(image)) || !volume->superblock->path_index_block ||
+        paths_lookup(volume, deep, file, &report) || report.hits != 1 || !report.entries)
+        goto fail;
+
+    // a removed path is gone from both copies, and whatever takes its place
+    // next is found instead
+    if(pulse_remove(volume, deep) || volume->superblock->path_index_block ||
+        paths_lookup(volume, deep, 0, &report))
+        goto fail;
+
+    u64 again = pulse_create(volume, deep, INODE_MODE_TYPE_REG | INODE_MODE_U_R | INODE_MODE_U_W);
+    if(!again || paths_lookup(volume, deep, again, &report) || paths_lookup(volume, deep, again, &report))
+        goto fail;
+
+    if(pulse_sync(volume) || pulse_check(volume, 1, &check) || check.leaked_blocks || check.missing_blocks ||
+        check.cross_linked_blocks || check.structure_errors)
+        goto fail;
+
+    // off takes the copy on the disk with it
+    if(pulse_path_index(volume, 0) || volume->superblock->path_index_block ||
+        paths_lookup(volume, deep, again, &report) || report.enabled ||
+        pulse_check(volume, 1, &check) || check.leaked_blocks || check.missing_blocks)
+        goto fail;
+
+    return pulse_unmount(volume) ? 1 : 0;
+
+fail:
+    if(volume) pulse_unmount(volume);
+    return 1;
+}
+
+/* reads the whole directory in batches of batch entries, counting how often
+ * each fNNN name shows up and checking its attributes against a stat - grow
+ * creates that many more files once the first batch is in */
+static int readdir_all(Mountpoint *volume, u64 dir, u64 batch, u8 *seen, u64 grow) {
+    PulseDirEntry *entries = malloc(batch * sizeof(PulseDirEntry));
+    u64 cookie = 0, count;
+    char path[32];
+    int status = 1;
+    if(!entries) return 1;
+
+    while(cookie != DIR_COOKIE_END) {
+        if(pulse_readdir_plus(volume, dir, &cookie, entries, batch, &count)) goto done;
+
+        for(u64 i = 0; i < count; i++) {
+            PulseStat stat;
+            u64 index = strtoull(entries[i].name + 1, NULL, 10);
+            if(index >= 1024 || pulse_stat(volume, entries[i].stat.inode, &stat) ||
+                memcmp(&stat, &entries[i].stat, sizeof(PulseStat) - 2 * sizeof(u64)) ||
+                stat.size != index * 7)
+                goto done;
+
+            seen[index]++;
+        }
+
+        for(; grow; grow--) {
+            sprintf(path, "/d/f%" PRIu64, 511 + grow);
+            u64 file = pulse_create(volume, path, INODE_MODE_TYPE_REG | INODE_MODE_U_R | INODE_MODE_U_W);
+            if(!file || pulse_truncate(volume, file, (511 + grow) * 7)) goto done;
+        }
+    }
+
+    status = 0;
+
+done:
+    free(entries);
+    return status;
+}
+
+static int test_readdir() {
+    const char *image = "test/readdir.img";
+    u8 seen[1024];
+    char path[32];
+
+    if(format(image, 64 * 1024 * 1024, 4096, 16)) return 1;
+
+    Mountpoint *volume = pulse_mount(image);
+    if(!volume) return 1;
+
+    u64 dir = pulse_create(volume, "/d", INODE_MODE_TYPE_DIR | INODE_MODE_U_R | INODE_MODE_U_W | INODE_MODE_U_X);
+    if(!dir) goto fail;
+
+    for(u64 i = 0; i < 512; i++) {
+        sprintf(path, "/d/f%" PRIu64, i);
+        u64 file = pulse_create(volume, path, INODE_MODE_TYPE_REG | INODE_MODE_U_R | INODE_MODE_U_W);
+        if(!file || pulse_truncate(volume, file, i * 7)) goto fail;
+    }
+
+    // every entry once, with the attributes a stat gives
+    memset(seen, 0, sizeof(seen));
+    if(readdir_all(volume, dir, 7, seen, 0)) goto fail;
+    for(u64 i = 0; i < 1024; i++) {
+        if(seen[i] != (i < 512)) goto fail;
+    }
+
+    // growing the hash map between batches moves every entry, yet none of
+    // the old ones is lost or handed out twice
+    memset(seen, 0, sizeof(seen));
+    if(readdir_all(volume, dir, 16, seen, 512)) goto fail;
+    for(u64 i = 0; i < 1024; i++) {
+        if(seen[i] > 1 || (i < 512 && !seen[i])) goto fail;
+    }
+
+    // a cold listing fetches the inodes of a batch in a few large reads, so
+    // it costs little more than reading the names alone
+    if(pulse_unmount(volume) || !(volume = pulse_mount(image))) goto fail;
+
+    DirectoryEntry *names = malloc(DIR_PREFETCH_BATCH * sizeof(DirectoryEntry));
+    u64 cookie = 0, count, listed = 0;
+    u64 reads = volume->io_stats.reads;
+    while(names && cookie != DIR_COOKIE_END &&
+        !dir_read(volume, dir, &cookie, names, DIR_PREFETCH_BATCH, &count))
+        listed += count;
+
+    free(names);
+    u64 name_reads = volume->io_stats.reads - reads;
+    if(listed != 1024 || pulse_unmount(volume) || !(volume = pulse_mount(image))) goto fail;
+
+    memset(seen, 0, sizeof(seen));
+    reads = volume->io_stats.reads;
+    if(readdir_all(volume, dir, DIR_PREFETCH_BATCH, seen, 0)) goto fail;
+    u64 inode_reads = volume->io_stats.reads - reads - name_reads;
+
+    printf(ESC_BOLD_CYAN "test:" ESC_RESET " listed %" PRIu64 " entries with %" PRIu64 " reads for the names "
+        "and %" PRIu64 " for the inodes\n", listed, name_reads, inode_reads);
+    if(inode_reads > listed / 8) goto fail;
+
+    return pulse_unmount(volume) ? 1 : 0;
+
+fail:
+    if(volume) pulse_unmount(volume);
+    return 1;
+}
+
+static u8 import_byte(u64 seed, u64 offset) {
+    return (u8) (seed * 31 + offset * 7);
+}
+
+static int import_host_file(const char *path, u64 size, u64 seed) {
+    FILE *file = fopen(path, "wb");
+    if(!file) return 1;
+
+    for(u64 j = 0; j < size; j++)
+        fputc(import_byte(seed, j), file);
+
+    return fclose(file) ? 1 : 0;
+}
+
+/* imports a small host tree with a file over several chunks, a fifo that
+ * has to be skipped and nested directories, then reads all of it back */
+static int test_import() {
+    const u64 sizes[] = { 0, 100, 5000, 64 * 1024 + 3, 9 * 1024 * 1024 + 5 };
+    const int size_count = sizeof(sizes) / sizeof(sizes[0]);
+    char host[64], path[64];
+
+    mkdir("test/import", S_IRWXU);
+    mkfifo("test/import/fifo", S_IRUSR | S_IWUSR);
+    for(int d = 0; d < 8; d++) {
+        sprintf(host, "test/import/d%d", d);
+        mkdir(host, S_IRWXU);
+        sprintf(host, "test/import/d%d/sub", d);
+        mkdir(host, S_IRWXU);
+
+        for(int f = 0; f < size_count; f++) {
+            if(f == size_count - 1 && d) continue; // one big file is enough
+            sprintf(host, "test/import/d%d/%sf%d", d, f % 2 ? "sub/" : "", f);
+            if(import_host_file(host, sizes[f], d * size_count + f)) return 1;
+        }
+    }
+
+    if(!pulse_create(mountpoint, "/imported", INODE_MODE_TYPE_DIR | INODE_MODE_U_RWX))
+        return 1;
+
+    char *args[] = { "import", "-j", "4", "-p", "/imported", "test/import" };
+    if(import_command(sizeof(args) / sizeof(args[0]), args)) return 1;
+
+    u8 *readback = malloc(sizes[size_count - 1]);
+    Inode *inode_buf = malloc(mountpoint->block_size);
+    if(!readback || !inode_buf) goto fail;
+
+    for(int d = 0; d < 8; d++) {
+        for(int f = 0; f < size_count; f++) {
+            if(f == size_count - 1 && d) continue;
+            sprintf(path, "/imported/d%d/%sf%d", d, f % 2 ? "sub/" : "", f);
+
+            PulseStat stat;
+            u64 inode = pulse_lookup(mountpoint, path);
+            if(!inode || pulse_stat(mountpoint, inode, &stat) || stat.size != sizes[f] ||
+                pulse_read(mountpoint, inode, readback, 0, sizes[f])) {
+                printf(ESC_BOLD_RED "test:" ESC_RESET " %s was not imported\n", path);
+                goto fail;
+            }
+
+            for(u64 j = 0; j < sizes[f]; j++) {
+                if(readback[j] != import_byte(d * size_count + f, j)) {
+                    printf(ESC_BOLD_RED "test:" ESC_RESET " %s differs at offset %" PRIu64 "\n", path, j);
+                    goto fail;
+                }
+            }
+
+            // the size was allocated up front, so the file is a single run
+            ExtentNode *leaves;
+            u64 count;
+            if(sizes[f] < mountpoint->block_size) continue;
+            if(read_inode(mountpoint, inode, inode_buf) ||
+                extent_collect(mountpoint, inode_buf->extent_tree_root, &leaves, &count))
+                goto fail;
+
+            free(leaves);
+            if(count != 1) {
+                printf(ESC_BOLD_RED "test:" ESC_RESET " %s has %" PRIu64 " extents but expected 1\n", path, count);
+                goto fail;
+            }
+        }
+    }
+
+    free(readback);
+    free(inode_buf);
+    if(pulse_lookup(mountpoint, "/imported/fifo")) return 1;
+
+    char *check[] = { "check" };
+    return check_command(sizeof(check) / sizeof(check[0]), check);
+
+fail:
+    free(readback);
+    free(inode_buf);
+    return 1;
+}
+
+/* a small workload is recorded and replayed on a blank image of the same size,
+ * which has to see exactly the reads and writes the volume did */
+// only the traced volume makes it into the trace, a second one mounted next to it does not
+static int test_trace() {
+    const char *image = "test/untraced.img";
+    const u64 size = 256 * 1024 + 17;
+    u8 *data = malloc(size);
+    if(!data) return 1;
+
+    for(u64 i = 0; i < size; i++)
+        data[i] = import_byte(47, i);
+
+    Mountpoint *other = format(image, 16 * 1024 * 1024, 4096, 16) ? NULL : pulse_mount(image);
+    if(!other) {
+        free(data);
+        return 1;
+    }
+
+    u64 reads = mountpoint->io_stats.reads, writes = mountpoint->io_stats.writes;
+    if(trace_start(mountpoint, "test/io.trace")) {
+        pulse_unmount(other);
+        free(data);
+        return 1;
+    }
+
+    u64 inode = pulse_create(mountpoint, "/traced", INODE_MODE_TYPE_REG | INODE_MODE_U_RWX);
+    u64 other_inode = pulse_create(other, "/untraced", INODE_MODE_TYPE_REG | INODE_MODE_U_RWX);
+    int status = !inode || !other_inode || pulse_write(mountpoint, inode, data, 0, size) ||
+        pulse_write(other, other_inode, data, 0, size) || pulse_sync(mountpoint) ||
+        pulse_read(mountpoint, inode, data, 0, size);
+    status |= pulse_unmount(other) != 0;
+
+    u64 records = 0;
+    status |= trace_stop(&records) != 0;
+    free(data);
+    if(status) return 1;
+
+    reads = mountpoint->io_stats.reads - reads;
+    writes = mountpoint->io_stats.writes - writes;
+    if(!writes || records != reads + writes) {
+        printf(ESC_BOLD_RED "test:" ESC_RESET " traced %" PRIu64 " records but the volume did %" PRIu64 " I/Os\n",
+            records, reads + writes);
+        return 1;
+    }
+
+    FILE *disk = fopen("test/replay.hdd", "w+b");
+    if(!disk) return 1;
+    if(ftruncate(fileno(disk), mountpoint->superblock->volume_size * mountpoint->block_size)) {
+        fclose(disk);
+        return 1;
+    }
+
+    ReplayReport report;
+    status = trace_replay("test/io.trace", disk, 0, &report);
+    fclose(disk);
+    if(status || report.reads != reads || report.writes != writes ||
+        !report.class_ops[IO_DATA] || !report.class_ops[IO_INODE]) {
+        printf(ESC_BOLD_RED "test:" ESC_RESET " replayed %" PRIu64 " reads and %" PRIu64 " writes, "
+            "expected %" PRIu64 " and %" PRIu64 "\n", report.reads, report.writes, reads, writes);
+        return 1;
+    }
+
+    printf(ESC_BOLD_CYAN "test:" ESC_RESET " replayed %" PRIu64 " reads and %" PRIu64 " writes in %.3f s\n",
+        report.reads, report.writes, report.seconds);
+    return 0;
+}
+
+/* every device byte lands in exactly one class of the volume it was for, and
+ * only what goes through pulse_read() and pulse_write() counts as logical - a
+ * second volume doing I/O at the same time keeps its own counters */
+static int test_io_classes() {
+    const char *image = "test/counted.img";
+    const u64 size = 1024 * 1024 + 100;
+    u8 *data = malloc(size);
+    if(!data) return 1;
+
+    Mountpoint *other = format(image, 64 * 1024 * 1024, 4096, 16) ? NULL : pulse_mount(image);
+    if(!other) {
+        free(data);
+        return 1;
+    }
+
+    memset(data, 0x5a, size);
+    reset_io_stats(&mountpoint->io_stats);
+
+    u64 inode = pulse_create(mountpoint, "/counted", INODE_MODE_TYPE_REG | INODE_MODE_U_RWX);
+    u64 other_inode = pulse_create(other, "/counted", INODE_MODE_TYPE_REG | INODE_MODE_U_RWX);
+    int status = !inode || !other_inode || pulse_write(mountpoint, inode, data, 0, size) ||
+        pulse_write(other, other_inode, data, 0, size) || pulse_sync(mountpoint) ||
+        pulse_sync(other) || pulse_read(mountpoint, inode, data, 4096, size - 4096);
+    free(data);
+    if(status) goto fail;
+
+    IOStats stats;
+    memcpy(&stats, &mountpoint->io_stats, sizeof(IOStats));
+
+    u64 reads = 0, writes = 0, bytes_read = 0, bytes_written = 0;
+    for(int i = 0; i < IO_CLASSES; i++) {
+        reads += stats.classes[i].reads;
+        writes += stats.classes[i].writes;
+        bytes_read += stats.classes[i].bytes_read;
+        bytes_written += stats.classes[i].bytes_written;
+    }
+
+    if(reads != stats.reads || writes != stats.writes || bytes_read != stats.bytes_read ||
+        bytes_written != stats.bytes_written) {
+        printf(ESC_BOLD_RED "test:" ESC_RESET " the classes add up to %" PRIu64 " reads and %" PRIu64 " writes "
+            "but %" PRIu64 " and %" PRIu64 " were done\n", reads, writes, stats.reads, stats.writes);
+        goto fail;
+    }
+
+    if(stats.logical_written != size || stats.logical_read != size - 4096 ||
+        stats.classes[IO_DATA].bytes_written < size || !stats.classes[IO_INODE].writes ||
+        stats.classes[IO_DATA].bytes_written >= 2 * size) {
+        printf(ESC_BOLD_RED "test:" ESC_RESET " counted %" PRIu64 " logical bytes written and %" PRIu64 " of file data\n",
+            stats.logical_written, stats.classes[IO_DATA].bytes_written);
+        goto fail;
+    }
+
+    // resetting the shell's volume leaves the other one counting
+    char *args[] = { "info", "-r" };
+    if(info_command(sizeof(args) / sizeof(args[0]), args)) goto fail;
+
+    if(mountpoint->io_stats.logical_written || other->io_stats.logical_written != size) {
+        printf(ESC_BOLD_RED "test:" ESC_RESET " info -r did not reset just %s\n", mountpoint->name);
+        goto fail;
+    }
+
+    return pulse_unmount(other) ? 1 : 0;
+
+fail:
+    pulse_unmount(other);
+    return 1;
+}
+
+/* a sync writes runs of dirty inodes with one vectored write each, and an
+ * unaligned read of a file in one extent is a single read however many
+ * blocks it spans */
+static int test_vectored() {
+    const int file_count = 64;
+    const u64 size = 64 * 4096 + 300;
+    char path[64];
+    u8 *data = malloc(size);
+    if(!data) return 1;
+
+    for(u64 i = 0; i < size; i++)
+        data[i] = import_byte(49, i);
+
+    u64 inode = pulse_create(mountpoint, "/vectored", INODE_MODE_TYPE_REG | INODE_MODE_U_RWX);
+    if(!inode || pulse_allocate(mountpoint, inode, 0, size) ||
+        pulse_write(mountpoint, inode, data, 0, size) || pulse_sync(mountpoint))
+        goto fail;
+
+    u8 *readback = data + 100;
+    u64 reads = mountpoint->io_stats.classes[IO_DATA].reads;
+    if(pulse_read(mountpoint, inode, readback, 100, size - 300))
+        goto fail;
+
+    reads = mountpoint->io_stats.classes[IO_DATA].reads - reads;
+    for(u64 i = 0; i < size - 300; i++) {
+        if(readback[i] != import_byte(49, i + 100)) {
+            printf(ESC_BOLD_RED "test:" ESC_RESET " vectored read differs at offset %" PRIu64 "\n", i + 100);
+            goto fail;
+        }
+    }
+
+    if(reads != 1) {
+        printf(ESC_BOLD_RED "test:" ESC_RESET " %" PRIu64 " reads for one extent, expected 1\n", reads);
+        goto fail;
+    }
+
+    for(int i = 0; i < file_count; i++) {
+        sprintf(path, "/vectored%d", i);
+        if(!pulse_create(mountpoint, path, INODE_MODE_TYPE_REG | INODE_MODE_U_RWX)) goto fail;
+    }
+
+    u64 writes = mountpoint->io_stats.classes[IO_INODE].writes;
+    if(pulse_sync(mountpoint)) goto fail;
+
+    writes = mountpoint->io_stats.classes[IO_INODE].writes - writes;
+    if(writes > file_count / 2) {
+        printf(ESC_BOLD_RED "test:" ESC_RESET " %" PRIu64 " inode writes to sync %d new files\n", writes, file_count);
+        goto fail;
+    }
+
+    free(data);
     return 0;
+
+fail:
+    free(data);
+    return 1;
+}
+
+/* a terabyte image has a bitmap of many chunks for the format threads to
+ * share - the volume has to come up with only its metadata in use */
+static int test_huge_format() {
+    const char *image = "test/huge.img";
+    const u64 size = 1ULL << 40;
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if(format(image, size, 4096, 16)) return 1;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    Mountpoint *volume = pulse_mount(image);
+    if(!volume) return 1;
+
+    u64 root = volume->superblock->root_inode;
+    int status = volume->superblock->volume_size != size / 4096 ||
+        block_status(volume, 0) != 1 || block_status(volume, root) != 1 ||
+        block_status(volume, root + 1) != 0 || block_status(volume, size / 4096 - 1) != 0 ||
+        !pulse_create(volume, "/file", INODE_MODE_TYPE_REG | INODE_MODE_U_RWX);
+
+    if(pulse_unmount(volume)) status = 1;
+    unlink(image);
+
+    printf(ESC_BOLD_CYAN "test:" ESC_RESET " formatted 1 TB in %.3f s\n",
+        (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+    return status;
 }
 
 static int test_allocate_blocks() {
@@ -64,15 +2006,15 @@ static int test_allocate_blocks() {
     int random = rand() % test_count;
 
     for(int i = 0; i < test_count; i++) {
-        block = allocate_block();
+        block = allocate_block(mountpoint);
         if(block == -1) {
             printf(ESC_BOLD_RED "test:" ESC_RESET " failed to allocate block\n");
             return 1;
         }
-        printf("    🛠️ allocated block %llu\n", block);
+        printf("    🛠️ allocated block %" PRIu64 "\n", block);
 
         if(i > 0 && block != expected) {
-            printf(ESC_BOLD_RED "test:" ESC_RESET " allocated block %llu but expected %llu\n", block, expected);
+            printf(ESC_BOLD_RED "test:" ESC_RESET " allocated block %" PRIu64 " but expected %" PRIu64 "\n", block, expected);
             return 1;
         }
 
@@ -83,17 +2025,35 @@ static int test_allocate_blocks() {
         }
     }
 
-    printf("    🛠️ attempt to free and reallocate block %llu\n", free_test);
-    free_block(free_test);
+    printf("    🛠️ attempt to free and reallocate block %" PRIu64 "\n", free_test);
+    free_block(mountpoint, free_test);
 
-    block = allocate_block();
+    block = allocate_block(mountpoint);
     if(block == -1) {
         printf(ESC_BOLD_RED "test:" ESC_RESET " failed to allocate block\n");
         return 1;
     }
 
     if(block != free_test) {
-        printf(ESC_BOLD_RED "test:" ESC_RESET " allocated block %llu but expected %llu\n", block, free_test);
+        printf(ESC_BOLD_RED "test:" ESC_RESET " allocated block %" PRIu64 " but expected %" PRIu64 "\n", block, free_test);
+        return 1;
+    }
+
+    return 0;
+}
+
+/* blocks allocated by the previous test aren't referenced by any inode, so
+ * check must find every one of them as leaked and nothing else */
+static int test_check_leaks() {
+    CheckReport report;
+    u64 expected = mountpoint->fanout * 256;
+
+    if(check_volume(mountpoint, 4, &report)) return 1;
+
+    if(report.leaked_blocks != expected || report.missing_blocks || report.cross_linked_blocks ||
+        report.layer_errors || report.structure_errors) {
+        printf(ESC_BOLD_RED "test:" ESC_RESET " found %" PRIu64 " leaked blocks but expected %" PRIu64 "\n",
+            report.leaked_blocks, expected);
         return 1;
     }
 
@@ -101,13 +2061,39 @@ static int test_allocate_blocks() {
 }
 
 int test_dump_root() {
-    return dump_inode(resolve("/"));
+    return dump_inode(mountpoint, resolve(mountpoint, "/"));
 }
 
 struct Test tests[] = {
+    {"hash", "checking hash test vectors", test_hash_vectors},
+    {"hashbench", "measuring hash throughput", test_hash_throughput},
     {"create", "creating new disk image", test_create},
     {"mount", "mounting disk image", test_mount},
+    {"check", "checking a clean file system", test_check},
+    {"files", "creating, reading and removing files", test_files},
+    {"remount", "unmounting and mounting the image again", test_remount},
+    {"threads", "sharing two volumes between threads", test_threads},
+    {"icache", "coalescing inode writes in the inode cache", test_inode_cache},
+    {"delalloc", "delaying allocation of appended data", test_delayed_allocation},
+    {"discard", "discarding freed blocks on sync", test_discard},
+    {"clone", "cloning files with shared extents", test_clone},
+    {"compress", "compressing file data in clusters", test_compress},
+    {"dedup", "deduplicating blocks written twice", test_dedup},
+    {"inodes", "packing small inodes into tables", test_inode_tables},
+    {"blocksizes", "storing files at every block size", test_block_sizes},
+    {"sparse", "preallocating and punching holes in files", test_sparse},
+    {"zones", "keeping metadata apart from file data", test_zones},
+    {"log", "appending file data to a log and cleaning it", test_log},
+    {"defrag", "rewriting fragmented files into one run", test_defrag},
+    {"paths", "resolving deep paths through the path index", test_paths},
+    {"readdir", "listing directories in batches with attributes", test_readdir},
+    {"import", "importing a host directory tree with several threads", test_import},
+    {"trace", "recording block I/O and replaying it on another image", test_trace},
+    {"ioclasses", "counting block I/O by class against logical bytes", test_io_classes},
+    {"vectored", "reading extents and syncing inodes with vectored I/O", test_vectored},
+    {"hugeformat", "formatting a terabyte image in chunks", test_huge_format},
     {"allocate", "allocating blocks", test_allocate_blocks},
+    {"leaks", "checking for leaked blocks", test_check_leaks},
     {"dumproot", "dumping root inode", test_dump_root},
 };
 
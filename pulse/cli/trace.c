@@ -0,0 +1,129 @@
+/*
+ * pulse - a highly scalable SSD-first file system with predictable logarithmic
+ * bounds across all operations
+ * 
+ * Copyright (c) 2025 Omar Elghoul
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <pulse/libpulse.h>
+#include <pulse/cli.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+int trace_command(int argc, char **argv) {
+    if(argc != 2) {
+        printf(ESC_BOLD_CYAN "usage:" ESC_RESET " trace <file|off>\n");
+        printf(ESC_BOLD_CYAN "note:" ESC_RESET " only block I/O of the mounted volume is recorded\n");
+        printf(ESC_BOLD_CYAN "example:" ESC_RESET " trace /tmp/build.trace\n");
+        return 1;
+    }
+
+    if(!strcmp(argv[1], "off")) {
+        u64 records = 0;
+        int status = trace_stop(&records);
+        if(status > 0) {
+            printf(ESC_BOLD_RED "trace:" ESC_RESET " nothing is being traced\n");
+            return 1;
+        } else if(status) {
+            printf(ESC_BOLD_RED "trace:" ESC_RESET " failed to write the trace\n");
+            return 1;
+        }
+
+        printf(ESC_BOLD_GREEN "trace:" ESC_RESET " recorded %" PRIu64 " block reads and writes\n", records);
+        return 0;
+    }
+
+    if(!mountpoint) {
+        printf(ESC_BOLD_RED "trace:" ESC_RESET " no disk image is mounted\n");
+        return 1;
+    }
+
+    int status = trace_start(mountpoint, argv[1]);
+    if(status > 0) {
+        printf(ESC_BOLD_RED "trace:" ESC_RESET " already tracing, 'trace off' first\n");
+        return 1;
+    } else if(status) {
+        printf(ESC_BOLD_RED "trace:" ESC_RESET " failed to create %s\n", argv[1]);
+        return 1;
+    }
+
+    printf(ESC_BOLD_GREEN "trace:" ESC_RESET " recording block I/O of %s to %s\n", mountpoint->name, argv[1]);
+    return 0;
+}
+
+int replay_command(int argc, char **argv) {
+    const char *path = NULL, *image = NULL;
+    int paced = 1, usage = 0;
+
+    for(int i = 1; i < argc && !usage; i++) {
+        if(!strcmp(argv[i], "-m")) paced = 0;
+        else if(argv[i][0] != '-' && !path) path = argv[i];
+        else if(argv[i][0] != '-' && !image) image = argv[i];
+        else usage = 1;
+    }
+
+    if(usage || !path || !image) {
+        printf(ESC_BOLD_CYAN "usage:" ESC_RESET " replay <-m> <trace> <image>\n");
+        printf(ESC_BOLD_CYAN "flags:" ESC_RESET " -m  replay at maximum speed instead of the recorded times\n");
+        printf(ESC_BOLD_CYAN "example:" ESC_RESET " replay -m /tmp/build.trace /tmp/scratch.hdd\n");
+        return 1;
+    }
+
+    // writes put zeros over whatever the image holds
+    if(mountpoint && mountpoint->name && !strcmp(mountpoint->name, image)) {
+        printf(ESC_BOLD_RED "replay:" ESC_RESET " %s is mounted, replay against a copy\n", image);
+        return 1;
+    }
+
+    FILE *disk = fopen(image, "r+b");
+    if(!disk) {
+        printf(ESC_BOLD_RED "replay:" ESC_RESET " failed to open %s\n", image);
+        return 1;
+    }
+
+    ReplayReport report;
+    int status = trace_replay(path, disk, paced, &report);
+    if(fclose(disk)) status = -1;
+
+    if(status) {
+        printf(ESC_BOLD_RED "replay:" ESC_RESET " failed after %" PRIu64 " records of %s\n",
+            report.records, path);
+        return 1;
+    }
+
+    double mb = (report.bytes_read + report.bytes_written) / 1048576.0;
+    printf(ESC_BOLD_GREEN "replay:" ESC_RESET " %" PRIu64 " reads, %" PRIu64 " writes, %.1f MB in %.3f s (%.1f MB/s)\n",
+        report.reads, report.writes, mb, report.seconds, report.seconds > 0 ? mb / report.seconds : 0.0);
+
+    u64 bitmap = 0;
+    for(int i = IO_BITMAP; i < IO_BITMAP + BITMAP_MAX_LAYERS; i++)
+        bitmap += report.class_ops[i];
+
+    for(int i = 0; i < IO_CLASSES; i++) {
+        if(i > IO_BITMAP && i < IO_BITMAP + BITMAP_MAX_LAYERS) continue;
+
+        u64 ops = i == IO_BITMAP ? bitmap : report.class_ops[i];
+        if(ops) printf("   %-12s %" PRIu64 "\n", io_class_name(i), ops);
+    }
+
+    return 0;
+}
@@ -0,0 +1,600 @@
+/*
+ * pulse - a highly scalable SSD-first file system with predictable logarithmic
+ * bounds across all operations
+ * 
+ * Copyright (c) 2025 Omar Elghoul
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <pulse/libpulse.h>
+#include <string.h>
+#include <time.h>
+
+/* takes an inode's lock through the inode cache, which also keeps the inode
+ * in memory for as long as the lock is held - fails if the inode has been
+ * removed while waiting for the lock */
+static CachedInode *inode_lock(Mountpoint *volume, u64 inode, int write) {
+    CachedInode *cached = icache_get(volume, inode, 1);
+    if(!cached) return NULL;
+
+    if(write) pthread_rwlock_wrlock(&cached->lock);
+    else pthread_rwlock_rdlock(&cached->lock);
+
+    if(cached->flags & ICACHE_DROPPED) {
+        pthread_rwlock_unlock(&cached->lock);
+        icache_put(volume, cached);
+        return NULL;
+    }
+
+    return cached;
+}
+
+static void inode_unlock(Mountpoint *volume, CachedInode *cached) {
+    pthread_rwlock_unlock(&cached->lock);
+    icache_put(volume, cached);
+}
+
+static u64 api_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* relatime: the access time only moves if it is older than the last change
+ * or a day old, and it reaches the disk whenever the inode is written back
+ * for another reason - readers share the lock, hence the atomics */
+static void inode_accessed(CachedInode *cached) {
+    u64 now = api_now();
+    Inode *inode = cached->data;
+    u64 accessed = __atomic_load_n(&inode->accessed_time, __ATOMIC_RELAXED);
+    if(accessed > inode->modified_time && accessed > inode->changed_time &&
+        now - accessed < 86400000000000ULL)
+        return;
+
+    __atomic_store_n(&inode->accessed_time, now, __ATOMIC_RELAXED);
+    __atomic_or_fetch(&cached->flags, ICACHE_TIMES, __ATOMIC_RELAXED);
+}
+
+/* writers flush their own delayed data once it is too old, this catches the
+ * files nobody writes to again - it looks every half timeout, so nothing
+ * waits much longer than WRITEBACK_TIMEOUT to reach the disk */
+static void *writeback_main(void *arg) {
+    Mountpoint *volume = arg;
+
+    pthread_mutex_lock(&volume->writeback_lock);
+    while(!volume->writeback_stop) {
+        u64 wake = api_now() + WRITEBACK_TIMEOUT / 2;
+        struct timespec ts = { wake / 1000000000ULL, wake % 1000000000ULL };
+        pthread_cond_timedwait(&volume->writeback_wake, &volume->writeback_lock, &ts);
+        if(volume->writeback_stop) break;
+        pthread_mutex_unlock(&volume->writeback_lock);
+
+        pthread_rwlock_rdlock(&volume->volume_lock);
+        icache_flush_expired(volume, api_now());
+        pthread_rwlock_unlock(&volume->volume_lock);
+
+        pthread_mutex_lock(&volume->writeback_lock);
+    }
+
+    pthread_mutex_unlock(&volume->writeback_lock);
+    return NULL;
+}
+
+/* a background pass runs with whatever was asked for last, the thread is
+ * woken early only to stop it */
+static void *defrag_main(void *arg) {
+    Mountpoint *volume = arg;
+
+    pthread_mutex_lock(&volume->writeback_lock);
+    while(!volume->defrag_stop) {
+        u64 wake = api_now() + DEFRAG_INTERVAL;
+        struct timespec ts = { wake / 1000000000ULL, wake % 1000000000ULL };
+        pthread_cond_timedwait(&volume->defrag_wake, &volume->writeback_lock, &ts);
+        if(volume->defrag_stop) break;
+
+        u64 threshold = volume->defrag_threshold, rate = volume->defrag_rate;
+        pthread_mutex_unlock(&volume->writeback_lock);
+
+        DefragReport report;
+        pulse_defrag(volume, NULL, threshold, rate, &report);
+
+        pthread_mutex_lock(&volume->writeback_lock);
+    }
+
+    pthread_mutex_unlock(&volume->writeback_lock);
+    return NULL;
+}
+
+/* a volume that can't get its writeback thread still works, its delayed data
+ * just waits for the next write or sync */
+Mountpoint *pulse_mount(const char *path) {
+    if(!path) return NULL;
+
+    Mountpoint *volume = mount_image(path);
+    if(!volume) return NULL;
+
+    pthread_mutex_init(&volume->writeback_lock, NULL);
+    pthread_cond_init(&volume->writeback_wake, NULL);
+    pthread_cond_init(&volume->defrag_wake, NULL);
+    volume->writeback_running =
+        !pthread_create(&volume->writeback_thread, NULL, writeback_main, volume);
+    return volume;
+}
+
+int pulse_unmount(Mountpoint *volume) {
+    if(!volume) return -1;
+
+    pulse_defrag_stop(volume);
+
+    if(volume->writeback_running) {
+        pthread_mutex_lock(&volume->writeback_lock);
+        volume->writeback_stop = 1;
+        pthread_cond_signal(&volume->writeback_wake);
+        pthread_mutex_unlock(&volume->writeback_lock);
+        pthread_join(volume->writeback_thread, NULL);
+    }
+
+    pthread_mutex_destroy(&volume->writeback_lock);
+    pthread_cond_destroy(&volume->writeback_wake);
+    pthread_cond_destroy(&volume->defrag_wake);
+
+    // waits for every call in flight, the handle is gone afterwards
+    pthread_rwlock_wrlock(&volume->volume_lock);
+    pthread_rwlock_unlock(&volume->volume_lock);
+    return unmount(volume);
+}
+
+u64 pulse_lookup(Mountpoint *volume, const char *path) {
+    if(!volume || !path) return 0;
+
+    pthread_rwlock_rdlock(&volume->volume_lock);
+    pthread_rwlock_rdlock(&volume->namespace_lock);
+    u64 inode = resolve(volume, path);
+    pthread_rwlock_unlock(&volume->namespace_lock);
+    pthread_rwlock_unlock(&volume->volume_lock);
+    return inode;
+}
+
+u64 pulse_create(Mountpoint *volume, const char *path, u32 mode) {
+    if(!volume || !path) return 0;
+
+    pthread_rwlock_rdlock(&volume->volume_lock);
+    pthread_rwlock_wrlock(&volume->namespace_lock);
+    u64 inode = create_file(volume, path, mode);
+    pthread_rwlock_unlock(&volume->namespace_lock);
+    pthread_rwlock_unlock(&volume->volume_lock);
+    return inode;
+}
+
+int pulse_remove(Mountpoint *volume, const char *path) {
+    if(!volume || !path) return -1;
+
+    pthread_rwlock_rdlock(&volume->volume_lock);
+    pthread_rwlock_wrlock(&volume->namespace_lock);
+
+    // the file's data goes away with it, so wait out readers and writers
+    int status = -1;
+    u64 inode = resolve(volume, path);
+    CachedInode *cached = inode ? inode_lock(volume, inode, 1) : NULL;
+    if(cached) {
+        status = remove_file(volume, path);
+        inode_unlock(volume, cached);
+    }
+
+    pthread_rwlock_unlock(&volume->namespace_lock);
+    pthread_rwlock_unlock(&volume->volume_lock);
+    return status;
+}
+
+/* makes room in a directory for entries names before they are created, for
+ * callers that know how many are coming */
+int pulse_reserve_entries(Mountpoint *volume, u64 dir, u64 entries) {
+    if(!volume || !dir) return -1;
+
+    pthread_rwlock_rdlock(&volume->volume_lock);
+    pthread_rwlock_wrlock(&volume->namespace_lock);
+    int status = dir_reserve(volume, dir, entries);
+    pthread_rwlock_unlock(&volume->namespace_lock);
+    pthread_rwlock_unlock(&volume->volume_lock);
+    return status;
+}
+
+/* the source is locked for the whole clone, so writers can't change blocks
+ * that are about to become shared */
+u64 pulse_clone(Mountpoint *volume, const char *source, const char *path) {
+    if(!volume || !source || !path) return 0;
+
+    pthread_rwlock_rdlock(&volume->volume_lock);
+    pthread_rwlock_wrlock(&volume->namespace_lock);
+
+    u64 inode = 0;
+    u64 original = resolve(volume, source);
+    CachedInode *cached = original ? inode_lock(volume, original, 1) : NULL;
+    if(cached) {
+        inode = clone_file(volume, source, path);
+        inode_unlock(volume, cached);
+    }
+
+    pthread_rwlock_unlock(&volume->namespace_lock);
+    pthread_rwlock_unlock(&volume->volume_lock);
+    return inode;
+}
+
+static void stat_fill(PulseStat *stat, u64 inode, Inode *buf) {
+    memset(stat, 0, sizeof(PulseStat));
+    stat->inode = inode;
+    stat->mode = buf->mode;
+    stat->size = buf->size;
+    stat->link_count = buf->link_count;
+    stat->created_time = buf->created_time;
+    stat->modified_time = buf->modified_time;
+    stat->accessed_time = __atomic_load_n(&buf->accessed_time, __ATOMIC_RELAXED);
+    stat->changed_time = buf->changed_time;
+}
+
+int pulse_stat(Mountpoint *volume, u64 inode, PulseStat *stat) {
+    if(!volume || !inode || !stat) return -1;
+
+    // directory sizes and times change under the namespace lock
+    pthread_rwlock_rdlock(&volume->volume_lock);
+    pthread_rwlock_rdlock(&volume->namespace_lock);
+    CachedInode *cached = inode_lock(volume, inode, 0);
+    if(cached) {
+        stat_fill(stat, inode, cached->data);
+        inode_unlock(volume, cached);
+    }
+
+    pthread_rwlock_unlock(&volume->namespace_lock);
+    pthread_rwlock_unlock(&volume->volume_lock);
+    return cached ? 0 : -1;
+}
+
+/* the next batch of a directory with every entry's attributes, as if each
+ * had been stat'ed - the inodes behind a batch are prefetched together in
+ * block order first, so a listing costs a few large reads instead of one
+ * small read per entry */
+int pulse_readdir_plus(Mountpoint *volume, u64 dir, u64 *cookie, PulseDirEntry *entries, u64 max,
+    u64 *count) {
+    if(!volume || !dir || !cookie || !entries || !count) return -1;
+
+    *count = 0;
+    DirectoryEntry *found = malloc(max * sizeof(DirectoryEntry) + 1);
+    u64 *inodes = malloc(DIR_PREFETCH_BATCH * sizeof(u64));
+    if(!found || !inodes) {
+        free(found);
+        free(inodes);
+        return -1;
+    }
+
+    pthread_rwlock_rdlock(&volume->volume_lock);
+    pthread_rwlock_rdlock(&volume->namespace_lock);
+
+    u64 read;
+    int status = dir_read(volume, dir, cookie, found, max, &read);
+    for(u64 i = 0; !status && i < read; i++) {
+        if(!(i % DIR_PREFETCH_BATCH)) {
+            u64 batch = read - i < DIR_PREFETCH_BATCH ? read - i : DIR_PREFETCH_BATCH;
+            for(u64 j = 0; j < batch; j++)
+                inodes[j] = found[i + j].inode;
+            icache_prefetch(volume, inodes, batch); // only a hint, misses load one by one
+        }
+
+        CachedInode *cached = inode_lock(volume, found[i].inode, 0);
+        if(!cached) {
+            status = -1;
+            break;
+        }
+
+        stat_fill(&entries[i].stat, found[i].inode, cached->data);
+        inode_unlock(volume, cached);
+        memcpy(entries[i].name, found[i].name, DIR_MAX_FILE_NAME);
+    }
+
+    if(!status) *count = read;
+
+    pthread_rwlock_unlock(&volume->namespace_lock);
+    pthread_rwlock_unlock(&volume->volume_lock);
+    free(found);
+    free(inodes);
+    return status;
+}
+
+int pulse_read(Mountpoint *volume, u64 inode, void *buf, u64 offset, u64 size) {
+    if(!volume || !inode || !buf) return -1;
+
+    pthread_rwlock_rdlock(&volume->volume_lock);
+    int status = -1;
+    CachedInode *cached = inode_lock(volume, inode, 0);
+    if(cached) {
+        if(!INODE_MODE_TYPE_IS_DIR(cached->data->mode))
+            status = read_from_inode(volume, inode, buf, offset, size);
+        if(!status) {
+            inode_accessed(cached);
+            __atomic_fetch_add(&volume->io_stats.logical_read, size, __ATOMIC_RELAXED);
+        }
+        inode_unlock(volume, cached);
+    }
+
+    pthread_rwlock_unlock(&volume->volume_lock);
+    return status;
+}
+
+int pulse_write(Mountpoint *volume, u64 inode, const void *buf, u64 offset, u64 size) {
+    if(!volume || !inode || !buf) return -1;
+
+    pthread_rwlock_rdlock(&volume->volume_lock);
+    int status = -1;
+    CachedInode *cached = inode_lock(volume, inode, 1);
+    if(cached) {
+        if(!INODE_MODE_TYPE_IS_DIR(cached->data->mode))
+            status = write_to_inode(volume, inode, buf, offset, size);
+        if(!status) __atomic_fetch_add(&volume->io_stats.logical_written, size, __ATOMIC_RELAXED);
+        inode_unlock(volume, cached);
+    }
+
+    pthread_rwlock_unlock(&volume->volume_lock);
+    return status;
+}
+
+int pulse_truncate(Mountpoint *volume, u64 inode, u64 size) {
+    if(!volume || !inode) return -1;
+
+    pthread_rwlock_rdlock(&volume->volume_lock);
+    int status = -1;
+    CachedInode *cached = inode_lock(volume, inode, 1);
+    if(cached) {
+        if(!INODE_MODE_TYPE_IS_DIR(cached->data->mode))
+            status = truncate_inode(volume, inode, size);
+        inode_unlock(volume, cached);
+    }
+
+    pthread_rwlock_unlock(&volume->volume_lock);
+    return status;
+}
+
+/* reserves blocks for [offset, offset + size) that read as zeros until written */
+int pulse_allocate(Mountpoint *volume, u64 inode, u64 offset, u64 size) {
+    if(!volume || !inode) return -1;
+
+    pthread_rwlock_rdlock(&volume->volume_lock);
+    int status = -1;
+    CachedInode *cached = inode_lock(volume, inode, 1);
+    if(cached) {
+        if(!INODE_MODE_TYPE_IS_DIR(cached->data->mode))
+            status = preallocate_inode(volume, inode, offset, size);
+        inode_unlock(volume, cached);
+    }
+
+    pthread_rwlock_unlock(&volume->volume_lock);
+    return status;
+}
+
+/* turns [offset, offset + size) into a hole without changing the size */
+int pulse_punch(Mountpoint *volume, u64 inode, u64 offset, u64 size) {
+    if(!volume || !inode) return -1;
+
+    pthread_rwlock_rdlock(&volume->volume_lock);
+    int status = -1;
+    CachedInode *cached = inode_lock(volume, inode, 1);
+    if(cached) {
+        if(!INODE_MODE_TYPE_IS_DIR(cached->data->mode))
+            status = punch_inode(volume, inode, offset, size);
+        inode_unlock(volume, cached);
+    }
+
+    pthread_rwlock_unlock(&volume->volume_lock);
+    return status;
+}
+
+int pulse_check(Mountpoint *volume, u32 threads, CheckReport *report) {
+    if(!volume || !report) return -1;
+
+    // the checker walks the whole volume and needs it to hold still
+    pthread_rwlock_wrlock(&volume->volume_lock);
+    int status = check_volume(volume, threads, report);
+    pthread_rwlock_unlock(&volume->volume_lock);
+    return status;
+}
+
+/* writes back the inode cache and issues the batched discards */
+int pulse_sync(Mountpoint *volume) {
+    if(!volume) return -1;
+
+    pthread_rwlock_wrlock(&volume->volume_lock);
+    int status = sync_volume(volume);
+    pthread_rwlock_unlock(&volume->volume_lock);
+    return status;
+}
+
+int pulse_discard(Mountpoint *volume, DiscardMode mode) {
+    if(!volume) return -1;
+    return discard_set_mode(volume, mode);
+}
+
+/* the budget is stored with the volume, so dedup stays on across mounts until
+ * it is set back to zero - which also drops the index */
+int pulse_dedup(Mountpoint *volume, u64 budget) {
+    if(!volume) return -1;
+
+    pthread_rwlock_wrlock(&volume->volume_lock);
+    int status = dedup_set_budget(volume, budget);
+    pthread_rwlock_unlock(&volume->volume_lock);
+    return status;
+}
+
+int pulse_dedup_report(Mountpoint *volume, DedupReport *report) {
+    if(!volume) return -1;
+    return dedup_report(volume, report);
+}
+
+/* the index is written and dropped with the superblock, so it changes alone */
+int pulse_path_index(Mountpoint *volume, int enabled) {
+    if(!volume) return -1;
+
+    pthread_rwlock_wrlock(&volume->volume_lock);
+    int status = path_index_enable(volume, enabled);
+    pthread_rwlock_unlock(&volume->volume_lock);
+    return status;
+}
+
+int pulse_path_index_report(Mountpoint *volume, PathIndexReport *report) {
+    if(!volume) return -1;
+    return path_index_report(volume, report);
+}
+
+/* the cleaner rewrites extent trees all over the volume, so it runs alone */
+int pulse_clean(Mountpoint *volume, u64 segments, CleanReport *report) {
+    if(!volume || !report) return -1;
+
+    pthread_rwlock_wrlock(&volume->volume_lock);
+    int status = clean_log(volume, segments, report);
+    pthread_rwlock_unlock(&volume->volume_lock);
+    return status;
+}
+
+typedef struct DefragWalk {
+    u64 threshold;
+    u64 *inodes;
+    u64 count;
+    u64 capacity;
+} DefragWalk;
+
+/* the extent count read here may be changing under a writer, it only picks
+ * the candidates and is looked at again with the inode locked */
+static int defrag_candidate(Mountpoint *volume, u64 inode, const Inode *buffer, void *context) {
+    DefragWalk *walk = context;
+    if(buffer->extent_count < walk->threshold) return 0;
+
+    if(walk->count == walk->capacity) {
+        u64 capacity = walk->capacity ? walk->capacity * 2 : 64;
+        u64 *grown = realloc(walk->inodes, capacity * sizeof(u64));
+        if(!grown) return -1;
+
+        walk->inodes = grown;
+        walk->capacity = capacity;
+    }
+
+    walk->inodes[walk->count++] = inode;
+    return 0;
+}
+
+/* waits out the time the last copy would have taken at rate, cut short if
+ * the background thread is being stopped */
+static void defrag_pause(Mountpoint *volume, u64 bytes, u64 rate) {
+    if(!rate || !bytes) return;
+
+    u64 wake = api_now() + bytes * 1000000000ULL / rate;
+    struct timespec ts = { wake / 1000000000ULL, wake % 1000000000ULL };
+
+    pthread_mutex_lock(&volume->writeback_lock);
+    while(!volume->defrag_stop && api_now() < wake) {
+        if(pthread_cond_timedwait(&volume->defrag_wake, &volume->writeback_lock, &ts))
+            break;
+    }
+    pthread_mutex_unlock(&volume->writeback_lock);
+}
+
+/* the candidates are picked with the namespace locked and rewritten one at a
+ * time with only their own inode locked, so the rest of the volume stays in
+ * use and a file is only held up while it is being copied - a path of NULL
+ * goes over the whole volume, and a directory over everything below it */
+int pulse_defrag(Mountpoint *volume, const char *path, u64 threshold, u64 rate, DefragReport *report) {
+    if(!volume || !report) return -1;
+
+    memset(report, 0, sizeof(DefragReport));
+    DefragWalk walk = { threshold, NULL, 0, 0 };
+    int status = -1;
+
+    pthread_rwlock_rdlock(&volume->volume_lock);
+    pthread_rwlock_rdlock(&volume->namespace_lock);
+
+    u64 inode = resolve(volume, path ? path : "/");
+    CachedInode *cached = inode ? inode_lock(volume, inode, 0) : NULL;
+    if(cached) {
+        int dir = INODE_MODE_TYPE_IS_DIR(cached->data->mode);
+        if(!dir) status = defrag_candidate(volume, inode, cached->data, &walk);
+        inode_unlock(volume, cached);
+
+        if(dir) status = dir_walk(volume, inode, defrag_candidate, &walk);
+    }
+
+    pthread_rwlock_unlock(&volume->namespace_lock);
+    pthread_rwlock_unlock(&volume->volume_lock);
+
+    for(u64 i = 0; !status && i < walk.count; i++) {
+        u64 moved = report->moved_blocks;
+
+        pthread_rwlock_rdlock(&volume->volume_lock);
+        cached = inode_lock(volume, walk.inodes[i], 1);
+        if(cached) {
+            status = defrag_inode(volume, walk.inodes[i], threshold, report);
+            inode_unlock(volume, cached);
+        }
+        pthread_rwlock_unlock(&volume->volume_lock);
+
+        defrag_pause(volume, (report->moved_blocks - moved) * volume->block_size, rate);
+
+        pthread_mutex_lock(&volume->writeback_lock);
+        int stopping = volume->defrag_stop;
+        pthread_mutex_unlock(&volume->writeback_lock);
+        if(stopping) break;
+    }
+
+    free(walk.inodes);
+    return status;
+}
+
+/* starts the background defragmenter, or changes what it does if it runs */
+int pulse_defrag_start(Mountpoint *volume, u64 threshold, u64 rate) {
+    if(!volume) return -1;
+
+    pthread_mutex_lock(&volume->writeback_lock);
+    volume->defrag_threshold = threshold;
+    volume->defrag_rate = rate;
+
+    int status = 0;
+    if(!volume->defrag_running) {
+        volume->defrag_stop = 0;
+        volume->defrag_running =
+            !pthread_create(&volume->defrag_thread, NULL, defrag_main, volume);
+        status = volume->defrag_running ? 0 : -1;
+    }
+
+    pthread_mutex_unlock(&volume->writeback_lock);
+    return status;
+}
+
+int pulse_defrag_stop(Mountpoint *volume) {
+    if(!volume) return -1;
+
+    pthread_mutex_lock(&volume->writeback_lock);
+    int running = volume->defrag_running;
+    volume->defrag_stop = 1;
+    pthread_cond_broadcast(&volume->defrag_wake);
+    pthread_mutex_unlock(&volume->writeback_lock);
+
+    if(running) pthread_join(volume->defrag_thread, NULL);
+
+    pthread_mutex_lock(&volume->writeback_lock);
+    volume->defrag_running = 0;
+    volume->defrag_stop = 0;
+    pthread_mutex_unlock(&volume->writeback_lock);
+    return 0;
+}
@@ -26,39 +26,192 @@
 #include <pulse/pulse.h>
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/uio.h>
+
+// only exposed by limits.h with _XOPEN_SOURCE, Linux and the BSDs all use 1024
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+/* counts a finished transfer against the volume it was for, I/O that belongs
+ * to no mounted volume (format, replay) passes no stats and isn't counted */
+static inline void count_io(IOStats *stats, int write, u64 bytes, IOClass io_class) {
+    if(!stats) return;
+
+    if(write) {
+        __atomic_fetch_add(&stats->writes, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&stats->bytes_written, bytes, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&stats->classes[io_class].writes, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&stats->classes[io_class].bytes_written, bytes, __ATOMIC_RELAXED);
+    } else {
+        __atomic_fetch_add(&stats->reads, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&stats->bytes_read, bytes, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&stats->classes[io_class].reads, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&stats->classes[io_class].bytes_read, bytes, __ATOMIC_RELAXED);
+    }
+}
 
-int read_block(FILE *disk, u64 block, u16 block_size, usize count, void *buffer) {
+/* block I/O goes through pread()/pwrite() on the underlying descriptor
+ * instead of fseek() + fread() so that it carries no shared file position
+ * and can be used from several threads at once */
+int read_block(FILE *disk, IOStats *stats, u64 block, u32 block_size, usize count, void *buffer,
+    IOClass io_class) {
     if(!disk || !buffer) return 1;
 
-    if(fseek(disk, block * block_size, SEEK_SET) != 0) {
-        perror("fseek");
-        return -1;
-    }
+    int fd = fileno(disk);
+    u8 *p = (u8 *) buffer;
+    usize remaining = (usize) block_size * count;
+    off_t offset = (off_t) block * block_size;
 
-    if(fread(buffer, block_size, count, disk) != count) {
-        perror("fread");
-        return -1;
+    while(remaining) {
+        ssize_t status = pread(fd, p, remaining, offset);
+        if(status < 0) {
+            if(errno == EINTR) continue;
+            perror("pread");
+            return -1;
+        }
+
+        if(!status) {
+            fprintf(stderr, "pread: unexpected end of file\n");
+            return -1;
+        }
+
+        p += status;
+        offset += status;
+        remaining -= status;
     }
 
+    count_io(stats, 0, (u64) block_size * count, io_class);
+    if(stats && __atomic_load_n(&trace_stats, __ATOMIC_RELAXED) == stats)
+        trace_record(TRACE_OP_READ, block, block_size, count, io_class);
     return 0;
 }
 
-int write_block(FILE *disk, u64 block, u16 block_size, usize count, const void *buffer) {
+int write_block(FILE *disk, IOStats *stats, u64 block, u32 block_size, usize count,
+    const void *buffer, IOClass io_class) {
     if(!disk || !buffer) return 1;
 
-    if(fseek(disk, block * block_size, SEEK_SET) != 0) {
-        perror("fseek");
-        return -1;
+    int fd = fileno(disk);
+    const u8 *p = (const u8 *) buffer;
+    usize remaining = (usize) block_size * count;
+    off_t offset = (off_t) block * block_size;
+
+    while(remaining) {
+        ssize_t status = pwrite(fd, p, remaining, offset);
+        if(status < 0) {
+            if(errno == EINTR) continue;
+            perror("pwrite");
+            return -1;
+        }
+
+        p += status;
+        offset += status;
+        remaining -= status;
     }
 
-    if(fwrite(buffer, block_size, count, disk) != count) {
-        perror("fwrite");
-        return -1;
+    count_io(stats, 1, (u64) block_size * count, io_class);
+    if(stats && __atomic_load_n(&trace_stats, __ATOMIC_RELAXED) == stats)
+        trace_record(TRACE_OP_WRITE, block, block_size, count, io_class);
+    return 0;
+}
+
+/* a run of blocks on the disk moved to or from several buffers with preadv()
+ * and pwritev(), so blocks that are next to each other on the disk cost one
+ * system call wherever they are in memory. every buffer holds whole blocks and
+ * the vector is used up on the way, short transfers advance it in place */
+static int transfer_vector(int fd, struct iovec *vector, int count, off_t offset, int write) {
+    while(count) {
+        int batch = count < IOV_MAX ? count : IOV_MAX;
+        ssize_t status = write ? pwritev(fd, vector, batch, offset) : preadv(fd, vector, batch, offset);
+        if(status < 0) {
+            if(errno == EINTR) continue;
+            perror(write ? "pwritev" : "preadv");
+            return -1;
+        }
+
+        if(!status) {
+            fprintf(stderr, "preadv: unexpected end of file\n");
+            return -1;
+        }
+
+        offset += status;
+        while(count && status >= (ssize_t) vector->iov_len) {
+            status -= vector->iov_len;
+            vector++;
+            count--;
+        }
+
+        if(count) {
+            vector->iov_base = (u8 *) vector->iov_base + status;
+            vector->iov_len -= status;
+        }
     }
 
     return 0;
 }
 
+static usize vector_size(const struct iovec *vector, int count) {
+    usize size = 0;
+    for(int i = 0; i < count; i++)
+        size += vector[i].iov_len;
+    return size;
+}
+
+int read_block_vector(FILE *disk, IOStats *stats, u64 block, u32 block_size, struct iovec *vector,
+    int count, IOClass io_class) {
+    if(!disk || !vector) return 1;
+
+    usize size = vector_size(vector, count);
+    if(transfer_vector(fileno(disk), vector, count, (off_t) block * block_size, 0))
+        return -1;
+
+    count_io(stats, 0, size, io_class);
+    if(stats && __atomic_load_n(&trace_stats, __ATOMIC_RELAXED) == stats)
+        trace_record(TRACE_OP_READ, block, block_size, size / block_size, io_class);
+    return 0;
+}
+
+int write_block_vector(FILE *disk, IOStats *stats, u64 block, u32 block_size, struct iovec *vector,
+    int count, IOClass io_class) {
+    if(!disk || !vector) return 1;
+
+    usize size = vector_size(vector, count);
+    if(transfer_vector(fileno(disk), vector, count, (off_t) block * block_size, 1))
+        return -1;
+
+    count_io(stats, 1, size, io_class);
+    if(stats && __atomic_load_n(&trace_stats, __ATOMIC_RELAXED) == stats)
+        trace_record(TRACE_OP_WRITE, block, block_size, size / block_size, io_class);
+    return 0;
+}
+
+/* the counters are only ever added to, so each one is cleared on its own and
+ * I/O racing with the reset lands on either side of it */
+void reset_io_stats(IOStats *stats) {
+    u64 *counters = (u64 *) stats;
+    for(usize i = 0; i < sizeof(IOStats) / sizeof(u64); i++)
+        __atomic_store_n(&counters[i], 0, __ATOMIC_RELAXED);
+}
+
+/* the superblock is kept with a zero checksum in memory, which is how the
+ * checksum is computed in the first place */
+int write_superblock(Mountpoint *mp) {
+    if(!mp || !mp->superblock) return 1;
+
+    SuperBlock *superblock = mp->superblock;
+    superblock->checksum = 0;
+    superblock->checksum = hash64(superblock, superblock->superblock_size, 0);
+
+    int status = write_block(mp->disk, &mp->io_stats, SUPERBLOCK_BLOCK_NUMBER,
+        mp->block_size, 1, superblock, IO_SUPERBLOCK);
+
+    superblock->checksum = 0;
+    return status;
+}
+
 int read_bit(u8 *bitmap, u64 bit) {
     return (bitmap[bit / 8] >> (bit % 8)) & 1;
 }
@@ -69,187 +222,724 @@ int write_bit(u8 *bitmap, u64 bit, int value) {
     return 0;
 }
 
+/* whole words at a time, bit i of a bitmap is bit i % 64 of its little
+ * endian word */
 u64 find_lowest_free_bit(u8 *bitmap, u64 size_bits) {
-    u8 byte;
-    for(u64 i = 0; i < size_bits; i++) {
-        if(i % 8 == 0) byte = bitmap[i / 8];
-        if(!(byte & (1 << (i % 8))))
-            return i;
+    u64 i = 0;
+    for(; i + 64 <= size_bits; i += 64) {
+        u64 word;
+        memcpy(&word, bitmap + i / 8, sizeof(u64));
+        if(~word) return i + __builtin_ctzll(~word);
+    }
+
+    for(; i < size_bits; i++) {
+        if(!read_bit(bitmap, i)) return i;
     }
+
     return -1;
 }
 
-int block_status(u64 block) {
-    if(!mountpoint || !mountpoint->superblock || !mountpoint->bitmap_block)
-        return -1;
-    if(block >= mountpoint->superblock->volume_size) return -1;
+/* the layers of the hierarchical bitmap are stored top (smallest) first and
+ * every layer starts on a 64-bit boundary - bits past the end of a layer are
+ * padding and are always set, so a group of children that hangs off the end of
+ * the volume can still be marked full in its parent layer
+ * returns the number of layers, the arrays may be NULL to only count them */
+u32 bitmap_layout(u64 volume_size, u32 fanout, u32 bitmap_limit, u64 *layer_starts,
+    u64 *layer_sizes) {
+    u64 sizes[BITMAP_MAX_LAYERS];
+    u32 layers = 1;
+
+    sizes[0] = volume_size;
+    while(sizes[layers-1] > bitmap_limit && layers < BITMAP_MAX_LAYERS) {
+        sizes[layers] = (sizes[layers-1] + fanout - 1) / fanout;
+        layers++;
+    }
+
+    u64 start = 0;
+    for(int i = layers-1; i >= 0; i--) {
+        if(layer_starts) layer_starts[i] = start;
+        if(layer_sizes) layer_sizes[i] = sizes[i];
+        start += BITMAP_LAYER_SPAN(sizes[i]);
+    }
 
-    u64 bit_offset = block + mountpoint->layer_starts[0];
-    u64 bitmap_block = (bit_offset / 8 / mountpoint->block_size) + mountpoint->superblock->bitmap_block;
-    u64 bit_offset_in_block = bit_offset % (mountpoint->block_size * 8);
+    return layers;
+}
 
-    if(read_block(mountpoint->disk, bitmap_block,
-        mountpoint->block_size, 1, mountpoint->bitmap_block)) {
-        return -1;
+void bitmap_set_range(u64 *bitmap, u64 bit, u64 count) {
+    while(count && (bit % 64)) {
+        bitmap[bit / 64] |= 1ULL << (bit % 64);
+        bit++;
+        count--;
+    }
+
+    while(count >= 64) {
+        bitmap[bit / 64] = ~0ULL;
+        bit += 64;
+        count -= 64;
+    }
+
+    while(count) {
+        bitmap[bit / 64] |= 1ULL << (bit % 64);
+        bit++;
+        count--;
     }
+}
+
+/* rebuilds every layer above the bottom one from the layer below it in a
+ * single pass over 64-bit words - a parent bit is set only if all of its
+ * children are set, and since the fanout always divides 64 a group of children
+ * never straddles two words */
+void bitmap_build_parents(u64 *bitmap, u32 layers, const u64 *layer_starts,
+    const u64 *layer_sizes, u32 fanout) {
+    u64 group_mask = (fanout == 64) ? ~0ULL : (1ULL << fanout) - 1;
+    u32 groups_per_word = 64 / fanout;
+
+    for(u32 i = 1; i < layers; i++) {
+        const u64 *child = bitmap + layer_starts[i-1] / 64;
+        u64 child_words = BITMAP_LAYER_SPAN(layer_sizes[i-1]) / 64;
+        u64 parent_start = layer_starts[i];
+
+        for(u64 w = 0; w < child_words; w++) {
+            u64 word = child[w];
+            if(!word) continue;
+
+            for(u32 k = 0; k < groups_per_word; k++) {
+                if(((word >> (k * fanout)) & group_mask) == group_mask) {
+                    u64 bit = parent_start + w * groups_per_word + k;
+                    bitmap[bit / 64] |= 1ULL << (bit % 64);
+                }
+            }
+        }
+    }
+}
+
+/* the allocator keeps its state in the bitmap itself plus the cached top
+ * layer, all of it is guarded by the bitmap lock and every caller passes in
+ * its own scratch block */
 
-    return read_bit(mountpoint->bitmap_block, bit_offset_in_block);
+/* the walks that every single block allocation and free goes through are
+ * written once with the fanout and block size as parameters and then stamped
+ * out for every pair a volume can have - with both known at compile time the
+ * divides turn into shifts and masks and a group of children is one load.
+ * the generic set reads them from the volume instead and is what the
+ * specialized ones are measured against */
+
+#define BITMAP_INLINE static inline __attribute__((always_inline))
+
+/* the lowest free bit in a group of fanout bits, groups are byte aligned */
+BITMAP_INLINE u64 group_free_bit(const u8 *group, u32 fanout) {
+    u64 word = 0;
+    memcpy(&word, group, fanout / 8);
+
+    u64 full = fanout == 64 ? ~0ULL : (1ULL << fanout) - 1;
+    word = ~word & full;
+    return word ? __builtin_ctzll(word) : -1;
 }
 
-u64 allocate_block() {
-    if(!mountpoint || !mountpoint->superblock || !mountpoint->bitmap_block)
+BITMAP_INLINE int status_with(Mountpoint *mp, u8 *bitmap, u64 block, u32 block_size) {
+    u64 bits_per_block = (u64) block_size * 8;
+    u64 bit = block + mp->layer_starts[0];
+    u64 bitmap_block = bit / bits_per_block + mp->superblock->bitmap_block;
+
+    if(read_block(mp->disk, &mp->io_stats, bitmap_block, block_size, 1, bitmap, IO_BITMAP))
         return -1;
 
-    u64 bit_offset = find_lowest_free_bit(mountpoint->highest_layer_bitmap,
-        mountpoint->highest_layer_size);
-    if(bit_offset == -1) return -1;
+    return read_bit(bitmap, bit % bits_per_block);
+}
 
-    if(mountpoint->bitmap_layers == 1) {
-        write_bit(mountpoint->bitmap_block, bit_offset, 1);
-        return bit_offset;
-    }
+BITMAP_INLINE int mark_with(Mountpoint *mp, u8 *bitmap, u64 block, u32 fanout, u32 block_size) {
+    u64 bits_per_block = (u64) block_size * 8;
+    u64 bit_offset = block;
 
-    // avoids recursion so we have predictable stack usage
-    u64 final_block = -1;
-    for(int i = mountpoint->bitmap_layers - 2; i >= 0; i--) {
-        bit_offset *= mountpoint->fanout;
+    // mark the block in the bottom layer and keep marking parents for as long
+    // as their group of children is full
+    for(int i = 0; i < mp->bitmap_layers; i++) {
+        u64 bit = mp->layer_starts[i] + bit_offset;
+        u64 bitmap_block = bit / bits_per_block + mp->superblock->bitmap_block;
+        u64 in_block = bit % bits_per_block;
 
-        u64 bit_offset_into_bitmap = mountpoint->layer_starts[i] + bit_offset;
+        if(read_block(mp->disk, &mp->io_stats, bitmap_block, block_size, 1, bitmap, IO_BITMAP + i))
+            return -1;
 
-        u64 byte_offset = bit_offset_into_bitmap / 8;
-        u64 bitmap_block = (byte_offset / mountpoint->block_size) +
-            mountpoint->superblock->bitmap_block;
-        
-        u8 *offset_into_block = (u8 *) mountpoint->bitmap_block +
-            byte_offset % mountpoint->block_size;
+        write_bit(bitmap, in_block, 1);
 
-        if(read_block(mountpoint->disk, bitmap_block,
-            mountpoint->block_size, 1, mountpoint->bitmap_block)) {
+        if(write_block(mp->disk, &mp->io_stats, bitmap_block, block_size, 1, bitmap, IO_BITMAP + i))
             return -1;
+
+        if(i == mp->bitmap_layers - 1) {
+            memcpy(mp->highest_layer_bitmap, bitmap, block_size);
+            break;
         }
 
-        u64 old_bit_offset = bit_offset;
-        bit_offset = find_lowest_free_bit(offset_into_block, 
-            mountpoint->fanout);
-        if(bit_offset == -1) return -1;
+        // groups are byte-aligned and never cross a block because layers
+        // start on 64-bit boundaries and the fanout is a multiple of 8
+        u64 group_start = in_block - (bit_offset % fanout);
+        if(group_free_bit(bitmap + group_start / 8, fanout) != -1)
+            break; // there are still free bits, no need to bubble up anymore
 
-        if(!i) {
-            write_bit(offset_into_block, bit_offset, 1);
-            if(write_block(mountpoint->disk, bitmap_block,
-                mountpoint->block_size, 1, mountpoint->bitmap_block)) {
-                return -1;
-            }
+        bit_offset /= fanout;
+    }
 
-            final_block = bit_offset + old_bit_offset;
+    return 0;
+}
 
-            if(find_lowest_free_bit(offset_into_block, mountpoint->fanout) == -1) {
-                // need to update parent layers
-                break;
-            }
+/* walks down from a free bit in the given layer to the lowest free block
+ * under it */
+BITMAP_INLINE u64 descend_with(Mountpoint *mp, u8 *bitmap, int layer, u64 bit_offset, u32 fanout,
+    u32 block_size) {
+    // avoids recursion so we have predictable stack usage
+    for(int i = layer - 1; i >= 0; i--) {
+        bit_offset *= fanout;
 
-            return final_block;
-        }
+        u64 byte_offset = (mp->layer_starts[i] + bit_offset) / 8;
+        u64 bitmap_block = byte_offset / block_size + mp->superblock->bitmap_block;
+
+        if(read_block(mp->disk, &mp->io_stats, bitmap_block, block_size, 1, bitmap, IO_BITMAP + i))
+            return -1;
+
+        u64 child = group_free_bit(bitmap + byte_offset % block_size, fanout);
+        if(child == -1) return -1;
 
-        bit_offset += old_bit_offset;
+        bit_offset += child;
     }
 
-    // if we reach here, we have to update the parents
-    bit_offset = final_block;
-    for(int i = 1; i < mountpoint->bitmap_layers; i++) {
-        bit_offset /= mountpoint->fanout;
+    return bit_offset;
+}
+
+BITMAP_INLINE int release_with(Mountpoint *mp, u8 *bitmap, u64 block, u32 fanout, u32 block_size) {
+    u64 bits_per_block = (u64) block_size * 8;
+    u64 bit_offset = block;
 
-        u64 bit_offset_into_bitmap = mountpoint->layer_starts[i] + bit_offset;
-        u64 byte_offset = bit_offset_into_bitmap / 8;
-        u64 bitmap_block = (byte_offset / mountpoint->block_size) +
-            mountpoint->superblock->bitmap_block;
-        u64 bit_offset_into_block = bit_offset_into_bitmap % (mountpoint->block_size * 8);
+    // clear the block in the bottom layer, then every parent up to the first
+    // one that was already clear
+    for(int i = 0; i < mp->bitmap_layers; i++) {
+        u64 bit = mp->layer_starts[i] + bit_offset;
+        u64 bitmap_block = bit / bits_per_block + mp->superblock->bitmap_block;
+        u64 in_block = bit % bits_per_block;
 
-        if(read_block(mountpoint->disk, bitmap_block,
-            mountpoint->block_size, 1, mountpoint->bitmap_block)) {
+        if(read_block(mp->disk, &mp->io_stats, bitmap_block, block_size, 1, bitmap, IO_BITMAP + i))
             return -1;
-        }
 
-        write_bit(mountpoint->bitmap_block, bit_offset_into_block, 1);
+        if(i && !read_bit(bitmap, in_block))
+            break; // nothing to do, parent layer bit is already free
 
-        if(write_block(mountpoint->disk, bitmap_block,
-            mountpoint->block_size, 1, mountpoint->bitmap_block)) {
+        write_bit(bitmap, in_block, 0);
+        if(write_block(mp->disk, &mp->io_stats, bitmap_block, block_size, 1, bitmap, IO_BITMAP + i))
             return -1;
-        }
 
-        if(i == mountpoint->bitmap_layers - 1) {
-            memcpy(mountpoint->highest_layer_bitmap,
-                mountpoint->bitmap_block, mountpoint->block_size);
-        }
+        // update cache of the highest layer
+        if(i == mp->bitmap_layers - 1)
+            memcpy(mp->highest_layer_bitmap, bitmap, block_size);
 
-        u64 offset = ((bit_offset_into_block / 8) % (mountpoint->fanout % 8));
-        offset -= (offset % (mountpoint->fanout / 8));
+        bit_offset /= fanout;
+    }
 
-        u64 lowest_bit = find_lowest_free_bit(
-            mountpoint->bitmap_block + offset,
-            mountpoint->fanout);
+    return 0;
+}
 
-        if(lowest_bit != -1)
-            break; // there are still free bits, no need to bubble up anymore
+static int status_generic(Mountpoint *mp, u8 *bitmap, u64 block) {
+    return status_with(mp, bitmap, block, mp->block_size);
+}
+
+static int mark_generic(Mountpoint *mp, u8 *bitmap, u64 block) {
+    return mark_with(mp, bitmap, block, mp->fanout, mp->block_size);
+}
+
+static u64 descend_generic(Mountpoint *mp, u8 *bitmap, int layer, u64 bit_offset) {
+    return descend_with(mp, bitmap, layer, bit_offset, mp->fanout, mp->block_size);
+}
+
+static int release_generic(Mountpoint *mp, u8 *bitmap, u64 block) {
+    return release_with(mp, bitmap, block, mp->fanout, mp->block_size);
+}
+
+const BitmapMath bitmap_math_generic = {
+    0, 0, status_generic, mark_generic, descend_generic, release_generic
+};
+
+#define BITMAP_MATH(fanout, size)                                                               \
+    static int status_##fanout##_##size(Mountpoint *mp, u8 *bitmap, u64 block) {                \
+        return status_with(mp, bitmap, block, size << 10);                                      \
+    }                                                                                           \
+    static int mark_##fanout##_##size(Mountpoint *mp, u8 *bitmap, u64 block) {                  \
+        return mark_with(mp, bitmap, block, fanout, size << 10);                                \
+    }                                                                                           \
+    static u64 descend_##fanout##_##size(Mountpoint *mp, u8 *bitmap, int layer, u64 bit) {      \
+        return descend_with(mp, bitmap, layer, bit, fanout, size << 10);                        \
+    }                                                                                           \
+    static int release_##fanout##_##size(Mountpoint *mp, u8 *bitmap, u64 block) {               \
+        return release_with(mp, bitmap, block, fanout, size << 10);                             \
+    }                                                                                           \
+    static const BitmapMath bitmap_math_##fanout##_##size = {                                   \
+        fanout, size << 10, status_##fanout##_##size, mark_##fanout##_##size,                   \
+        descend_##fanout##_##size, release_##fanout##_##size                                    \
+    };
+
+#define BITMAP_MATH_SIZES(fanout)                                                               \
+    BITMAP_MATH(fanout, 4) BITMAP_MATH(fanout, 8) BITMAP_MATH(fanout, 16)                       \
+    BITMAP_MATH(fanout, 32) BITMAP_MATH(fanout, 64) BITMAP_MATH(fanout, 128)                    \
+    BITMAP_MATH(fanout, 256) BITMAP_MATH(fanout, 512)
+
+BITMAP_MATH_SIZES(8)
+BITMAP_MATH_SIZES(16)
+BITMAP_MATH_SIZES(32)
+BITMAP_MATH_SIZES(64)
+
+#define BITMAP_MATH_ROW(fanout) {                                                               \
+    &bitmap_math_##fanout##_4, &bitmap_math_##fanout##_8, &bitmap_math_##fanout##_16,           \
+    &bitmap_math_##fanout##_32, &bitmap_math_##fanout##_64, &bitmap_math_##fanout##_128,        \
+    &bitmap_math_##fanout##_256, &bitmap_math_##fanout##_512 }
+
+static const BitmapMath *bitmap_math_table[4][8] = {
+    BITMAP_MATH_ROW(8), BITMAP_MATH_ROW(16), BITMAP_MATH_ROW(32), BITMAP_MATH_ROW(64)
+};
+
+/* the set made for a volume's fanout and block size, every pair mount
+ * accepts has one - anything else gets the generic set */
+const BitmapMath *bitmap_math_select(u32 fanout, u32 block_size) {
+    if(fanout < 8 || fanout > 64 || (fanout & (fanout - 1)) || block_size < 4096 ||
+        block_size > 512 * 1024 || (block_size & (block_size - 1)))
+        return &bitmap_math_generic;
+
+    return bitmap_math_table[__builtin_ctz(fanout) - 3][__builtin_ctz(block_size) - 12];
+}
+
+int block_status(Mountpoint *mp, u64 block) {
+    if(!mp || !mp->superblock) return -1;
+    if(block >= mp->superblock->volume_size) return -1;
+
+    u8 *bitmap = scratch_buffer(SCRATCH_BITMAP, mp->block_size);
+    if(!bitmap) return -1;
+
+    pthread_mutex_lock(&mp->bitmap_lock);
+    int status = mp->bitmap_math->status(mp, bitmap, block);
+    pthread_mutex_unlock(&mp->bitmap_lock);
+    return status;
+}
+
+/* walks down the layers to the lowest free block without taking it */
+static u64 lowest_free_locked(Mountpoint *mp, u8 *bitmap) {
+    u64 bit_offset = find_lowest_free_bit(mp->highest_layer_bitmap, mp->highest_layer_size);
+    if(bit_offset == -1) return -1;
+
+    return mp->bitmap_math->descend(mp, bitmap, mp->bitmap_layers - 1, bit_offset);
+}
+
+/* finds the lowest free block at or after from - climbs while the rest of the
+ * group around the current bit is full, then walks down from the first free
+ * bit found. falls back to the lowest free block if there is none past from */
+static u64 free_from_locked(Mountpoint *mp, u8 *bitmap, u64 from) {
+    u64 bits_per_block = mp->block_size * 8;
+    u64 bit_offset = from;
+    int layer = 0;
+
+    if(!from || from >= mp->superblock->volume_size)
+        return lowest_free_locked(mp, bitmap);
+
+    for(; layer < mp->bitmap_layers - 1; layer++) {
+        u64 group_end = (bit_offset / mp->fanout + 1) * mp->fanout;
+        u64 bit = mp->layer_starts[layer] + bit_offset;
+        u64 bitmap_block = bit / bits_per_block + mp->superblock->bitmap_block;
+
+        if(read_block(mp->disk, &mp->io_stats, bitmap_block, mp->block_size, 1, bitmap, IO_BITMAP + layer))
+            return -1;
+
+        // groups never cross a bitmap block
+        u64 in_block = bit % bits_per_block;
+        while(bit_offset < group_end && read_bit(bitmap, in_block)) {
+            bit_offset++;
+            in_block++;
+        }
+
+        if(bit_offset < group_end) break;
+        bit_offset = group_end / mp->fanout;
     }
 
-    return final_block;
+    if(layer == mp->bitmap_layers - 1) {
+        while(bit_offset < mp->highest_layer_size && read_bit(mp->highest_layer_bitmap, bit_offset))
+            bit_offset++;
+        if(bit_offset == mp->highest_layer_size)
+            return lowest_free_locked(mp, bitmap);
+    }
+
+    u64 block = mp->bitmap_math->descend(mp, bitmap, layer, bit_offset);
+    return block < mp->superblock->volume_size ? block : lowest_free_locked(mp, bitmap);
 }
 
-int free_block(u64 block) {
-    if(!mountpoint || !mountpoint->superblock || !mountpoint->bitmap_block)
-        return -1;
+/* counts the blocks in use in segment s with one popcount per word of the
+ * bottom layer, segments are a multiple of 64 blocks and so is the start of
+ * the layer - words past the end of the layer count as full, the same as the
+ * padding inside it. loaded is the bitmap block already in the buffer */
+static int usage_locked(Mountpoint *mp, u8 *bitmap, u64 s, u64 *loaded, u64 *used) {
+    u64 segment = mp->log_segment;
+    u64 span = BITMAP_LAYER_SPAN(mp->superblock->volume_size);
+    u64 bits_per_block = mp->block_size * 8;
+
+    *used = 0;
+    for(u64 b = s * segment; b < (s + 1) * segment; b += 64) {
+        if(b >= span) {
+            *used += 64;
+            continue;
+        }
 
-    u64 bit_offset = block + mountpoint->layer_starts[0];
-    u64 bitmap_block = (bit_offset / 8 / mountpoint->block_size) +
-        mountpoint->superblock->bitmap_block;
-    u64 bit_offset_in_block = bit_offset % (mountpoint->block_size * 8);
+        u64 bit = mp->layer_starts[0] + b;
+        u64 bitmap_block = bit / bits_per_block + mp->superblock->bitmap_block;
+        if(bitmap_block != *loaded) {
+            if(read_block(mp->disk, &mp->io_stats, bitmap_block, mp->block_size, 1, bitmap, IO_BITMAP))
+                return -1;
+            *loaded = bitmap_block;
+        }
 
-    if(read_block(mountpoint->disk, bitmap_block,
-        mountpoint->block_size, 1, mountpoint->bitmap_block)) {
-        return -1;
+        *used += __builtin_popcountll(((u64 *) bitmap)[(bit % bits_per_block) / 64]);
     }
 
-    write_bit(mountpoint->bitmap_block, bit_offset_in_block, 0);
+    return 0;
+}
 
-    if(write_block(mountpoint->disk, bitmap_block,
-        mountpoint->block_size, 1, mountpoint->bitmap_block)) {
-        return -1;
+/* picks the segment the head moves to once the one it is in is full - the
+ * first empty one from the head on, or if none turns up within
+ * ALLOCATE_SCAN_BLOCKS bitmap blocks the emptiest one seen, whose holes the
+ * head then fills in order until the cleaner frees whole segments again */
+static u64 log_segment_locked(Mountpoint *mp, u8 *bitmap) {
+    u64 segment = mp->log_segment;
+    u64 first = mp->log_start / segment;
+    u64 count = (mp->superblock->volume_size + segment - 1) / segment - first;
+    u64 current = mp->log_head / segment;
+    if(current < first) current = first;
+
+    u64 limit = ALLOCATE_SCAN_BLOCKS * mp->block_size * 8 / segment;
+    u64 loaded = -1, best = -1, best_used = segment;
+
+    for(u64 i = 0; i < count && i < limit; i++) {
+        u64 s = first + (current - first + i) % count;
+        u64 used;
+        if(usage_locked(mp, bitmap, s, &loaded, &used)) return -1;
+
+        if(used < best_used) {
+            best = s;
+            best_used = used;
+            if(!used) break;
+        }
     }
 
-    // check the immediate higher layer, and if needs to be updated then
-    // repeatedly update all the higher layers
-    if(mountpoint->bitmap_layers == 1) return 0;
+    return best == -1 ? -1 : best * segment;
+}
+
+/* takes the run of free blocks at the log head, up to count of them and never
+ * past the end of its segment, and moves the head past it - fails if no
+ * segment has room, the caller then allocates like any other volume */
+static u64 log_run_locked(Mountpoint *mp, u8 *bitmap, u64 count, u64 *found) {
+    u64 volume_size = mp->superblock->volume_size;
+    u64 segment = mp->log_segment;
+    u64 head = mp->log_head;
+    u64 block = -1;
+
+    // the head carries on in its segment past anything still in use there
+    if(head % segment && head < volume_size) {
+        block = free_from_locked(mp, bitmap, head);
+        if(block != -1 && (block < head || block / segment != head / segment))
+            block = -1;
+    }
 
-    bit_offset = block;
-    for(int i = 1; i < mountpoint->bitmap_layers; i++) {
-        bit_offset /= mountpoint->fanout;
-        u64 bit_offset_into_bitmap = mountpoint->layer_starts[i] + bit_offset;
-        u64 byte_offset_into_bitmap = bit_offset_into_bitmap / 8;
-        u64 bitmap_block = (byte_offset_into_bitmap / mountpoint->block_size) +
-            mountpoint->superblock->bitmap_block;
-        u64 bit_offset_into_block = bit_offset_into_bitmap % (mountpoint->block_size * 8);
+    if(block == -1) {
+        u64 start = log_segment_locked(mp, bitmap);
+        if(start == -1) return -1;
 
-        if(read_block(mountpoint->disk, bitmap_block,
-            mountpoint->block_size, 1, mountpoint->bitmap_block)) {
+        block = free_from_locked(mp, bitmap, start);
+        if(block == -1 || block < start || block / segment != start / segment)
             return -1;
+    }
+
+    u64 end = (block / segment + 1) * segment;
+    if(end > volume_size) end = volume_size;
+
+    u64 bits_per_block = mp->block_size * 8;
+    u64 loaded = -1, length = 0;
+
+    while(length < count && block + length < end) {
+        u64 bit = mp->layer_starts[0] + block + length;
+        u64 bitmap_block = bit / bits_per_block + mp->superblock->bitmap_block;
+
+        if(bitmap_block != loaded) {
+            if(read_block(mp->disk, &mp->io_stats, bitmap_block, mp->block_size, 1, bitmap, IO_BITMAP))
+                return -1;
+            loaded = bitmap_block;
         }
 
-        u8 bit = read_bit(mountpoint->bitmap_block, bit_offset_into_block);
-        if(!bit)
-            break; // nothing to do, parent layer bit is already free
+        if(read_bit(bitmap, bit % bits_per_block)) break;
+        length++;
+    }
 
-        write_bit(mountpoint->bitmap_block, bit_offset_into_block, 0);
-        if(write_block(mountpoint->disk, bitmap_block,
-            mountpoint->block_size, 1, mountpoint->bitmap_block)) {
-            return -1;
+    mp->log_head = block + length;
+    *found = length;
+    return block;
+}
+
+/* fills used with how many blocks are in use in every segment of the volume,
+ * the cleaner goes by this to pick the ones worth emptying */
+int log_usage(Mountpoint *mp, u64 *used) {
+    if(!mp || !mp->superblock || !used) return -1;
+
+    u8 *bitmap = scratch_buffer(SCRATCH_BITMAP, mp->block_size);
+    if(!bitmap) return -1;
+
+    u64 segments = (mp->superblock->volume_size + mp->log_segment - 1) / mp->log_segment;
+    u64 loaded = -1;
+    int status = 0;
+
+    pthread_mutex_lock(&mp->bitmap_lock);
+    for(u64 s = 0; s < segments && !status; s++)
+        status = usage_locked(mp, bitmap, s, &loaded, &used[s]);
+    pthread_mutex_unlock(&mp->bitmap_lock);
+    return status;
+}
+
+u64 allocate_block(Mountpoint *mp) {
+    if(!mp || !mp->superblock) return -1;
+
+    u8 *bitmap = scratch_buffer(SCRATCH_BITMAP, mp->block_size);
+    if(!bitmap) return -1;
+
+    pthread_mutex_lock(&mp->bitmap_lock);
+    u64 block = lowest_free_locked(mp, bitmap);
+    if(block != -1 && mp->bitmap_math->mark(mp, bitmap, block)) block = -1;
+    pthread_mutex_unlock(&mp->bitmap_lock);
+    return block;
+}
+
+/* allocates one specific block, used to grow a run of blocks in place -
+ * fails if the block is already in use */
+int claim_block(Mountpoint *mp, u64 block) {
+    if(!mp || !mp->superblock) return -1;
+    if(block >= mp->superblock->volume_size) return -1;
+
+    u8 *bitmap = scratch_buffer(SCRATCH_BITMAP, mp->block_size);
+    if(!bitmap) return -1;
+
+    pthread_mutex_lock(&mp->bitmap_lock);
+    int status = mp->bitmap_math->status(mp, bitmap, block);
+    if(!status) status = mp->bitmap_math->mark(mp, bitmap, block);
+    else status = -1;
+    pthread_mutex_unlock(&mp->bitmap_lock);
+    return status;
+}
+
+/* marks a whole run as allocated writing every bitmap block it touches once,
+ * then moves up with the range of parents whose groups are now full - groups
+ * inside the run are full by definition so only the two edges are checked */
+static int mark_range_allocated(Mountpoint *mp, u8 *bitmap, u64 start, u64 count) {
+    u64 lo = start, hi = start + count;
+    u64 bits_per_block = mp->block_size * 8;
+
+    for(int i = 0; i < mp->bitmap_layers && lo < hi; i++) {
+        for(u64 b = lo; b < hi;) {
+            u64 bit = mp->layer_starts[i] + b;
+            u64 bitmap_block = bit / bits_per_block + mp->superblock->bitmap_block;
+            u64 in_block = bit % bits_per_block;
+            u64 n = bits_per_block - in_block;
+            if(n > hi - b) n = hi - b;
+
+            if(read_block(mp->disk, &mp->io_stats, bitmap_block, mp->block_size, 1, bitmap, IO_BITMAP + i))
+                return -1;
+
+            bitmap_set_range((u64 *) bitmap, in_block, n);
+
+            if(write_block(mp->disk, &mp->io_stats, bitmap_block, mp->block_size, 1, bitmap, IO_BITMAP + i))
+                return -1;
+
+            if(i == mp->bitmap_layers - 1)
+                memcpy(mp->highest_layer_bitmap, bitmap, mp->block_size);
+
+            b += n;
         }
 
-        // update cache of the highest layer
-        if(i == mountpoint->bitmap_layers - 1) {
-            memcpy(mountpoint->highest_layer_bitmap,
-                mountpoint->bitmap_block, mountpoint->block_size);
+        if(i == mp->bitmap_layers - 1)
+            break;
+
+        u64 parent_lo = lo / mp->fanout;
+        u64 parent_hi = (hi - 1) / mp->fanout + 1;
+
+        for(int edge = 0; edge < 2 && parent_lo < parent_hi; edge++) {
+            u64 group = edge ? parent_hi - 1 : parent_lo;
+            u64 bit = mp->layer_starts[i] + group * mp->fanout;
+            u64 bitmap_block = bit / bits_per_block + mp->superblock->bitmap_block;
+
+            if(group * mp->fanout >= lo && (group + 1) * mp->fanout <= hi)
+                continue; // entirely inside the run
+
+            if(read_block(mp->disk, &mp->io_stats, bitmap_block, mp->block_size, 1, bitmap, IO_BITMAP + i))
+                return -1;
+
+            if(find_lowest_free_bit(bitmap + (bit % bits_per_block) / 8, mp->fanout) != -1) {
+                if(edge) parent_hi--;
+                else parent_lo++;
+            }
         }
+
+        lo = parent_lo;
+        hi = parent_hi;
     }
 
     return 0;
 }
+
+/* scans the bottom layer from the lowest free block at or after from for a
+ * run of count free blocks - gives up after ALLOCATE_SCAN_BLOCKS bitmap blocks
+ * and settles for the longest run it has seen, which is at least one block */
+static u64 find_free_run(Mountpoint *mp, u8 *bitmap, u64 count, u64 from, u64 *found) {
+    u64 first = free_from_locked(mp, bitmap, from);
+    if(first == -1) return -1;
+
+    u64 volume_size = mp->superblock->volume_size;
+    u64 bits_per_block = mp->block_size * 8;
+    u64 loaded = -1, scanned = 0;
+    u64 best_start = first, best_length = 0;
+    u64 run_start = first, run_length = 0;
+
+    for(u64 b = first; b < volume_size;) {
+        u64 bit = mp->layer_starts[0] + b;
+        u64 bitmap_block = bit / bits_per_block + mp->superblock->bitmap_block;
+        u64 in_block = bit % bits_per_block;
+
+        if(bitmap_block != loaded) {
+            if(scanned++ == ALLOCATE_SCAN_BLOCKS) break;
+            if(read_block(mp->disk, &mp->io_stats, bitmap_block, mp->block_size, 1, bitmap, IO_BITMAP))
+                return -1;
+            loaded = bitmap_block;
+        }
+
+        // whole bytes at a time where possible
+        u8 byte = bitmap[in_block / 8];
+        u64 step = 1, free = 0;
+        if(!(in_block % 8) && b + 8 <= volume_size && (byte == 0x00 || byte == 0xFF)) {
+            step = 8;
+            free = byte == 0x00;
+        } else {
+            free = !read_bit(bitmap, in_block);
+        }
+
+        if(free) {
+            if(!run_length) run_start = b;
+            run_length += step;
+            if(run_length >= count) {
+                *found = count;
+                return run_start;
+            }
+        } else {
+            if(run_length > best_length) {
+                best_start = run_start;
+                best_length = run_length;
+            }
+            run_length = 0;
+        }
+
+        b += step;
+    }
+
+    if(run_length > best_length) {
+        best_start = run_start;
+        best_length = run_length;
+    }
+
+    *found = best_length ? best_length : 1;
+    return best_start;
+}
+
+/* allocates up to count contiguous blocks in one go, the number actually
+ * allocated is returned through allocated - used to give delayed writes a
+ * single extent. metadata takes the lowest free blocks, data starts looking
+ * at the data zone and only comes back below it once that is full - on a
+ * log-structured volume data comes from the log head instead */
+u64 allocate_blocks(Mountpoint *mp, u64 count, u64 *allocated, AllocClass alloc_class) {
+    if(!mp || !mp->superblock || !count || !allocated) return -1;
+
+    u8 *bitmap = scratch_buffer(SCRATCH_BITMAP, mp->block_size);
+    if(!bitmap) return -1;
+
+    pthread_mutex_lock(&mp->bitmap_lock);
+
+    u64 found = 0;
+    u64 start = -1;
+    if(mp->log_mode && alloc_class == ALLOC_DATA)
+        start = log_run_locked(mp, bitmap, count, &found);
+
+    if(start == -1) {
+        u64 from = alloc_class == ALLOC_DATA ? mp->data_zone : 0;
+        start = find_free_run(mp, bitmap, count, from, &found);
+    }
+
+    if(start != -1 && mark_range_allocated(mp, bitmap, start, found))
+        start = -1;
+
+    pthread_mutex_unlock(&mp->bitmap_lock);
+
+    if(start != -1) *allocated = found;
+    return start;
+}
+
+/* claims the free blocks directly following block, up to count of them, and
+ * returns how many it got - used to grow an extent in place. in the log a
+ * run can only grow if it ends right at the head, and only to the end of the
+ * head's segment */
+u64 claim_blocks(Mountpoint *mp, u64 block, u64 count) {
+    if(!mp || !mp->superblock || !count) return 0;
+
+    u8 *bitmap = scratch_buffer(SCRATCH_BITMAP, mp->block_size);
+    if(!bitmap) return 0;
+
+    u64 volume_size = mp->superblock->volume_size;
+    u64 bits_per_block = mp->block_size * 8;
+    u64 loaded = -1, claimed = 0;
+
+    pthread_mutex_lock(&mp->bitmap_lock);
+
+    int log = mp->log_mode && block >= mp->data_zone;
+    if(log) {
+        u64 end = (block / mp->log_segment + 1) * mp->log_segment;
+        if(block != mp->log_head || !(block % mp->log_segment)) count = 0;
+        else if(count > end - block) count = end - block;
+    }
+
+    while(claimed < count && block + claimed < volume_size) {
+        u64 bit = mp->layer_starts[0] + block + claimed;
+        u64 bitmap_block = bit / bits_per_block + mp->superblock->bitmap_block;
+
+        if(bitmap_block != loaded) {
+            if(read_block(mp->disk, &mp->io_stats, bitmap_block, mp->block_size, 1, bitmap, IO_BITMAP)) {
+                claimed = 0;
+                break;
+            }
+            loaded = bitmap_block;
+        }
+
+        if(read_bit(bitmap, bit % bits_per_block)) break;
+        claimed++;
+    }
+
+    if(claimed && mark_range_allocated(mp, bitmap, block, claimed))
+        claimed = 0;
+    if(log) mp->log_head += claimed;
+
+    pthread_mutex_unlock(&mp->bitmap_lock);
+    return claimed;
+}
+
+int free_block(Mountpoint *mp, u64 block) {
+    if(!mp || !mp->superblock) return -1;
+
+    u8 *bitmap = scratch_buffer(SCRATCH_BITMAP, mp->block_size);
+    if(!bitmap) return -1;
+
+    // a block shared by cloned files stays allocated until its last owner frees it
+    pthread_mutex_lock(&mp->bitmap_lock);
+    int status = refcount_release(mp, block);
+    if(!status) {
+        dedup_forget(mp, block);
+        status = mp->bitmap_math->release(mp, bitmap, block);
+        if(!status) status = discard_add(mp, block, 1);
+    } else if(status > 0) {
+        status = 0;
+    }
+    pthread_mutex_unlock(&mp->bitmap_lock);
+    return status;
+}
@@ -0,0 +1,879 @@
+/*
+ * pulse - a highly scalable SSD-first file system with predictable logarithmic
+ * bounds across all operations
+ * 
+ * Copyright (c) 2025 Omar Elghoul
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <pulse/pulse.h>
+#include <pulse/cli.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+/* the checker runs in three phases, each spread over a pool of threads:
+ * 1. walk the inode/directory/extent graph from the root and build a reference
+ *    bitmap of every block that is actually in use
+ * 2. read the on-disk hierarchical bitmap, split into regions
+ * 3. compare both bitmaps word by word, and check every parent layer against
+ *    the layer below it, again split into regions */
+
+#define CHECK_REGION_BLOCKS     64      /* bitmap blocks handed to a thread at once */
+#define CHECK_MAX_MESSAGES      32      /* problems printed before going quiet */
+#define CHECK_PROGRESS_NS       250000000ULL    /* how often progress is redrawn */
+#define CHECK_POLL_NS           1000000         /* how often workers are polled */
+
+typedef struct CheckExtent {
+    u64 offset;
+    u64 length;
+    u64 block;
+    u64 block_count;
+} CheckExtent;
+
+typedef struct CheckJob {
+    u32 layer;
+    u64 first_word;
+    u64 word_count;
+} CheckJob;
+
+typedef struct CheckContext {
+    FILE *disk;
+    IOStats *stats;
+    u32 block_size;
+    u32 fanout;
+    u64 volume_size;
+    u32 layers;
+    const u64 *layer_starts;
+    const u64 *layer_sizes;
+    u64 bitmap_start;
+
+    u64 *reference;         // bottom layer as derived from the inode graph
+    u64 *inodes;            // inodes reached so far by block and slot, tells hard links from cross-links
+    u64 *tables;            // inode table blocks already marked, each one holds many inodes
+    u32 inode_size;
+    u8 inode_shift;
+    u64 *bitmap;            // the on-disk hierarchical bitmap
+    u64 bitmap_blocks;
+
+    const SharedExtent *shared;     // blocks that cloned files may reference together
+    u64 shared_count;
+    u64 *shared_seen;       // references found per entry, summed over its blocks
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    u64 *queue;
+    usize queue_length;
+    usize queue_capacity;
+    u64 pending;            // inodes queued or being checked
+
+    CheckJob *jobs;
+    u64 job_count;
+    u64 next_job;           // shared cursor for phases 2 and 3
+
+    u64 workers_done;
+    u64 messages;
+    CheckReport *report;    // counters are updated atomically
+} CheckContext;
+
+typedef struct CheckInodeWalk {
+    CheckContext *ctx;
+    u64 inode;
+    u64 next_offset;
+    CheckExtent *extents;
+    usize extent_count;
+    usize extent_capacity;
+} CheckInodeWalk;
+
+static inline void check_add(u64 *counter, u64 value) {
+    __atomic_fetch_add(counter, value, __ATOMIC_RELAXED);
+}
+
+static void check_problem(CheckContext *ctx, u64 *counter, const char *fmt, ...) {
+    check_add(counter, 1);
+
+    if(__atomic_fetch_add(&ctx->messages, 1, __ATOMIC_RELAXED) >= CHECK_MAX_MESSAGES)
+        return;
+
+    va_list args;
+    va_start(args, fmt);
+    pthread_mutex_lock(&ctx->lock);
+    printf("\r    ⚠️  ");
+    vprintf(fmt, args);
+    printf("\n");
+    pthread_mutex_unlock(&ctx->lock);
+    va_end(args);
+}
+
+static int check_read(CheckContext *ctx, u64 block, usize count, void *buffer, IOClass io_class) {
+    if(read_block(ctx->disk, ctx->stats, block, ctx->block_size, count, buffer, io_class))
+        return -1;
+
+    check_add(&ctx->report->bytes_read, (u64) count * ctx->block_size);
+    return 0;
+}
+
+/* marks blocks as referenced a word at a time, anything that was already set
+ * is referenced twice */
+static int check_mark(CheckContext *ctx, u64 block, u64 count, const char *what, u64 owner) {
+    if(block >= ctx->volume_size || count > ctx->volume_size - block) {
+        check_problem(ctx, &ctx->report->structure_errors,
+            "%s of inode %" PRIu64 " points outside the volume (block %" PRIu64 ", %" PRIu64 " blocks)",
+            what, owner, block, count);
+        return -1;
+    }
+
+    u64 duplicates = 0;
+    while(count) {
+        u64 bit = block % 64;
+        u64 span = (64 - bit < count) ? 64 - bit : count;
+        u64 mask = (span == 64) ? ~0ULL : ((1ULL << span) - 1) << bit;
+
+        u64 old = __atomic_fetch_or(&ctx->reference[block / 64], mask, __ATOMIC_RELAXED);
+        duplicates += __builtin_popcountll(old & mask);
+
+        block += span;
+        count -= span;
+    }
+
+    if(duplicates) {
+        check_problem(ctx, &ctx->report->cross_linked_blocks,
+            "%" PRIu64 " block%s of %s of inode %" PRIu64 " %s also in use elsewhere", duplicates,
+            duplicates > 1 ? "s" : "", what, owner, duplicates > 1 ? "are" : "is");
+        check_add(&ctx->report->cross_linked_blocks, duplicates - 1);
+    }
+
+    return 0;
+}
+
+/* file data can be shared between clones, those blocks are marked without
+ * counting duplicates and their references are tallied per table entry to be
+ * compared with the counts once the walk is done */
+static void check_mark_data(CheckContext *ctx, u64 block, u64 count, u64 owner) {
+    if(block >= ctx->volume_size || count > ctx->volume_size - block) {
+        check_mark(ctx, block, count, "file data", owner);
+        return;
+    }
+
+    u64 low = 0, high = ctx->shared_count;
+    while(low < high) {
+        u64 mid = (low + high) / 2;
+        if(ctx->shared[mid].block + ctx->shared[mid].count <= block) low = mid + 1;
+        else high = mid;
+    }
+
+    u64 end = block + count;
+    for(u64 i = low; block < end;) {
+        if(i == ctx->shared_count || ctx->shared[i].block >= end) {
+            check_mark(ctx, block, end - block, "file data", owner);
+            return;
+        }
+
+        const SharedExtent *entry = &ctx->shared[i];
+        if(block < entry->block) {
+            check_mark(ctx, block, entry->block - block, "file data", owner);
+            block = entry->block;
+        }
+
+        u64 span_end = entry->block + entry->count < end ? entry->block + entry->count : end;
+        for(u64 b = block; b < span_end; b++)
+            __atomic_fetch_or(&ctx->reference[b / 64], 1ULL << (b % 64), __ATOMIC_RELAXED);
+
+        check_add(&ctx->shared_seen[i], span_end - block);
+        block = span_end;
+        i++;
+    }
+}
+
+static void check_enqueue(CheckContext *ctx, u64 inode) {
+    pthread_mutex_lock(&ctx->lock);
+
+    if(ctx->queue_length == ctx->queue_capacity) {
+        usize capacity = ctx->queue_capacity ? ctx->queue_capacity * 2 : 1024;
+        u64 *queue = realloc(ctx->queue, capacity * sizeof(u64));
+        if(!queue) {
+            pthread_mutex_unlock(&ctx->lock);
+            check_problem(ctx, &ctx->report->structure_errors,
+                "out of memory, inode %" PRIu64 " was not checked", inode);
+            return;
+        }
+
+        ctx->queue = queue;
+        ctx->queue_capacity = capacity;
+    }
+
+    ctx->queue[ctx->queue_length++] = inode;
+    ctx->pending++;
+    pthread_cond_signal(&ctx->cond);
+    pthread_mutex_unlock(&ctx->lock);
+}
+
+static int check_extent_node(const ExtentNode *node, u64 node_block, void *context) {
+    CheckInodeWalk *walk = (CheckInodeWalk *) context;
+    CheckContext *ctx = walk->ctx;
+
+    check_mark(ctx, node_block, 1, "an extent node", walk->inode);
+    if(node->children) return 0;
+
+    if(node->start_offset < walk->next_offset) {
+        check_problem(ctx, &ctx->report->structure_errors,
+            "extents of inode %" PRIu64 " overlap at offset %" PRIu64 "", walk->inode, node->start_offset);
+    }
+
+    if((node->flags & ~EXTENT_UNWRITTEN) ||
+        ((node->flags & EXTENT_UNWRITTEN) && node->compressed_length)) {
+        check_problem(ctx, &ctx->report->structure_errors,
+            "extent of inode %" PRIu64 " at offset %" PRIu64 " has invalid flags %" PRIu64 "",
+            walk->inode, node->start_offset, node->flags);
+    }
+
+    if(node->compressed_length) {
+        // a cluster of at most COMPRESS_CLUSTER_BLOCKS squeezed into fewer blocks
+        if(node->compressed_length > node->block_count * ctx->block_size ||
+            node->length > COMPRESS_CLUSTER_BLOCKS * ctx->block_size) {
+            check_problem(ctx, &ctx->report->structure_errors,
+                "compressed extent of inode %" PRIu64 " at offset %" PRIu64 " holds %" PRIu64 " bytes in %" PRIu64 " blocks",
+                walk->inode, node->start_offset, node->compressed_length, node->block_count);
+        }
+    } else if(node->length > node->block_count * ctx->block_size) {
+        check_problem(ctx, &ctx->report->structure_errors,
+            "extent of inode %" PRIu64 " at offset %" PRIu64 " maps %" PRIu64 " bytes onto %" PRIu64 " blocks",
+            walk->inode, node->start_offset, node->length, node->block_count);
+    }
+
+    walk->next_offset = node->start_offset + node->length;
+    if(node->block_count)
+        check_mark_data(ctx, node->block, node->block_count, walk->inode);
+
+    if(walk->extent_count == walk->extent_capacity) {
+        usize capacity = walk->extent_capacity ? walk->extent_capacity * 2 : 16;
+        CheckExtent *extents = realloc(walk->extents, capacity * sizeof(CheckExtent));
+        if(!extents) return -1;
+        walk->extents = extents;
+        walk->extent_capacity = capacity;
+    }
+
+    CheckExtent *extent = &walk->extents[walk->extent_count++];
+    extent->offset = node->start_offset;
+    extent->length = node->length;
+    extent->block = node->block;
+    extent->block_count = node->block_count;
+    return 0;
+}
+
+/* reads file data through the extents collected while walking the tree,
+ * anything not covered by an extent is a hole and reads as zero */
+static int check_read_data(CheckContext *ctx, const Inode *inode, const CheckInodeWalk *walk,
+    u64 offset, u64 size, void *buffer, u8 *scratch) {
+    u8 *out = (u8 *) buffer;
+
+    if(!inode->extent_tree_root) {
+        if(offset + size > inode->inline_size) return -1;
+        memcpy(out, inode->payload + offset, size);
+        return 0;
+    }
+
+    while(size) {
+        // binary search for the last extent starting at or before offset
+        usize low = 0, high = walk->extent_count;
+        while(low < high) {
+            usize mid = (low + high) / 2;
+            if(walk->extents[mid].offset <= offset) low = mid + 1;
+            else high = mid;
+        }
+
+        const CheckExtent *extent = low ? &walk->extents[low - 1] : NULL;
+        u64 in_block = offset % ctx->block_size;
+        u64 chunk = ctx->block_size - in_block;
+        if(chunk > size) chunk = size;
+
+        if(extent && offset < extent->offset + extent->length) {
+            u64 block = extent->block + (offset - extent->offset) / ctx->block_size;
+            if(check_read(ctx, block, 1, scratch, IO_DIRECTORY)) return -1;
+            memcpy(out, scratch + in_block, chunk);
+        } else {
+            memset(out, 0, chunk);
+        }
+
+        out += chunk;
+        offset += chunk;
+        size -= chunk;
+    }
+
+    return 0;
+}
+
+static void check_directory(CheckContext *ctx, u64 ino, const Inode *inode,
+    const CheckInodeWalk *walk, u8 *scratch) {
+    if(!inode->size) return; // the hash map is allocated on first write
+
+    Directory dir;
+    if(inode->size < sizeof(Directory) ||
+        check_read_data(ctx, inode, walk, 0, sizeof(Directory), &dir, scratch)) {
+        check_problem(ctx, &ctx->report->structure_errors,
+            "directory %" PRIu64 " is too small for its header", ino);
+        return;
+    }
+
+    if(!dir.hashmap_size || sizeof(Directory) + dir.hashmap_size * sizeof(u64) > inode->size) {
+        check_problem(ctx, &ctx->report->structure_errors,
+            "directory %" PRIu64 " has an invalid hash map size %" PRIu64 "", ino, dir.hashmap_size);
+        return;
+    }
+
+    u64 *hashmap = malloc(dir.hashmap_size * sizeof(u64));
+    DirectoryEntry *entry = malloc(sizeof(DirectoryEntry));
+    if(!hashmap || !entry) {
+        free(hashmap);
+        free(entry);
+        check_problem(ctx, &ctx->report->structure_errors,
+            "out of memory while checking directory %" PRIu64 "", ino);
+        return;
+    }
+
+    if(check_read_data(ctx, inode, walk, sizeof(Directory), dir.hashmap_size * sizeof(u64),
+        hashmap, scratch)) {
+        check_problem(ctx, &ctx->report->structure_errors,
+            "failed to read the hash map of directory %" PRIu64 "", ino);
+        free(hashmap);
+        free(entry);
+        return;
+    }
+
+    // a chain can't have more nests than fit in the directory, which also
+    // stops us from following a cycle forever
+    u64 max_nests = inode->size / sizeof(DirectoryHashNest);
+    u64 files = 0;
+
+    for(u64 i = 0; i < dir.hashmap_size; i++) {
+        u64 offset = hashmap[i];
+        u64 nests = 0;
+
+        while(offset) {
+            DirectoryHashNest nest;
+            if(++nests > max_nests || offset + sizeof(nest) > inode->size ||
+                check_read_data(ctx, inode, walk, offset, sizeof(nest), &nest, scratch) ||
+                offset + sizeof(nest) + nest.count * sizeof(DirectoryEntry) > inode->size) {
+                check_problem(ctx, &ctx->report->structure_errors,
+                    "directory %" PRIu64 " has a broken hash nest at offset %" PRIu64 "", ino, offset);
+                break;
+            }
+
+            for(u64 j = 0; j < nest.count; j++) {
+                u64 entry_offset = offset + sizeof(nest) + j * sizeof(DirectoryEntry);
+                if(check_read_data(ctx, inode, walk, entry_offset, sizeof(DirectoryEntry),
+                    entry, scratch))
+                    break;
+
+                if(!entry->inode) continue; // free slot
+
+                if(!memchr(entry->name, 0, DIR_MAX_FILE_NAME) || !entry->name[0]) {
+                    check_problem(ctx, &ctx->report->structure_errors,
+                        "directory %" PRIu64 " has an entry with an invalid name at offset %" PRIu64 "",
+                        ino, entry_offset);
+                    continue;
+                }
+
+                if((entry->inode >> ctx->inode_shift) >= ctx->volume_size) {
+                    check_problem(ctx, &ctx->report->structure_errors,
+                        "directory %" PRIu64 " entry '%s' points to invalid inode %" PRIu64 "",
+                        ino, entry->name, entry->inode);
+                    continue;
+                }
+
+                files++;
+                check_enqueue(ctx, entry->inode);
+            }
+
+            offset = nest.next;
+        }
+    }
+
+    if(files != dir.file_count) {
+        check_problem(ctx, &ctx->report->structure_errors,
+            "directory %" PRIu64 " claims %" PRIu64 " entries but has %" PRIu64 "", ino, dir.file_count, files);
+    }
+
+    check_add(&ctx->report->entries, files);
+    free(hashmap);
+    free(entry);
+}
+
+/* sets the bit of an inode, returns nonzero if it was set already or the
+ * inode number can't be valid */
+static int check_visit(CheckContext *ctx, u64 ino) {
+    u64 block = ino >> ctx->inode_shift;
+    u64 slot = ino & ((1ULL << ctx->inode_shift) - 1);
+    u64 slots = ctx->block_size / ctx->inode_size;
+    if(!ino || block >= ctx->volume_size || slot >= slots) return -1;
+
+    u64 index = block * slots + slot;
+    u64 mask = 1ULL << (index % 64);
+    return (__atomic_fetch_or(&ctx->inodes[index / 64], mask, __ATOMIC_RELAXED) & mask) ? 1 : 0;
+}
+
+/* a table is marked by the first of its inodes that is found */
+static void check_table(CheckContext *ctx, u64 block, u64 ino) {
+    u64 mask = 1ULL << (block % 64);
+    if(!(__atomic_fetch_or(&ctx->tables[block / 64], mask, __ATOMIC_RELAXED) & mask))
+        check_mark(ctx, block, 1, "an inode table", ino);
+}
+
+static void check_inode(CheckContext *ctx, u64 ino, u8 *inode_block, u8 *scratch) {
+    // a second visit is a hard link and its blocks were already accounted for
+    int visited = check_visit(ctx, ino);
+    if(visited < 0) {
+        check_problem(ctx, &ctx->report->structure_errors, "invalid inode number %" PRIu64 "", ino);
+        return;
+    } else if(visited) {
+        return;
+    }
+
+    u64 block = ino >> ctx->inode_shift;
+    check_add(&ctx->report->inodes, 1);
+    if(ctx->inode_shift) check_table(ctx, block, ino);
+    else check_mark(ctx, block, 1, "the inode block", ino);
+
+    if(check_read(ctx, block, 1, inode_block, IO_INODE)) {
+        check_problem(ctx, &ctx->report->structure_errors, "failed to read inode %" PRIu64 "", ino);
+        return;
+    }
+
+    u64 slot = ino & ((1ULL << ctx->inode_shift) - 1);
+    Inode *inode = (Inode *) (inode_block + slot * ctx->inode_size);
+    if(inode->inline_size > ctx->inode_size - sizeof(Inode)) {
+        check_problem(ctx, &ctx->report->structure_errors,
+            "inode %" PRIu64 " has an inline size of %u bytes", ino, inode->inline_size);
+        return;
+    }
+
+    CheckInodeWalk walk;
+    memset(&walk, 0, sizeof(walk));
+    walk.ctx = ctx;
+    walk.inode = ino;
+
+    if(inode->extent_tree_root &&
+        extent_walk(ctx->disk, ctx->stats, ctx->block_size, inode->extent_tree_root, scratch,
+        check_extent_node, &walk)) {
+        check_problem(ctx, &ctx->report->structure_errors,
+            "inode %" PRIu64 " has a broken extent tree", ino);
+        free(walk.extents);
+        return;
+    }
+
+    if(INODE_MODE_TYPE_IS_DIR(inode->mode)) {
+        check_add(&ctx->report->directories, 1);
+        check_directory(ctx, ino, inode, &walk, scratch);
+    }
+
+    free(walk.extents);
+}
+
+static void *check_graph_worker(void *arg) {
+    CheckContext *ctx = (CheckContext *) arg;
+    u8 *inode_block = malloc(ctx->block_size);
+    u8 *scratch = malloc(ctx->block_size);
+
+    pthread_mutex_lock(&ctx->lock);
+    for(;;) {
+        while(!ctx->queue_length && ctx->pending)
+            pthread_cond_wait(&ctx->cond, &ctx->lock);
+
+        if(!ctx->queue_length) break;
+
+        u64 ino = ctx->queue[--ctx->queue_length];
+        pthread_mutex_unlock(&ctx->lock);
+
+        if(inode_block && scratch) check_inode(ctx, ino, inode_block, scratch);
+
+        pthread_mutex_lock(&ctx->lock);
+        if(!--ctx->pending) pthread_cond_broadcast(&ctx->cond);
+    }
+    pthread_mutex_unlock(&ctx->lock);
+
+    free(inode_block);
+    free(scratch);
+    __atomic_fetch_add(&ctx->workers_done, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+static void *check_load_worker(void *arg) {
+    CheckContext *ctx = (CheckContext *) arg;
+    u64 regions = (ctx->bitmap_blocks + CHECK_REGION_BLOCKS - 1) / CHECK_REGION_BLOCKS;
+
+    for(;;) {
+        u64 region = __atomic_fetch_add(&ctx->next_job, 1, __ATOMIC_RELAXED);
+        if(region >= regions) break;
+
+        u64 first = region * CHECK_REGION_BLOCKS;
+        u64 count = ctx->bitmap_blocks - first;
+        if(count > CHECK_REGION_BLOCKS) count = CHECK_REGION_BLOCKS;
+
+        if(check_read(ctx, ctx->bitmap_start + first, count,
+            (u8 *) ctx->bitmap + first * ctx->block_size, IO_BITMAP)) {
+            check_problem(ctx, &ctx->report->structure_errors,
+                "failed to read bitmap blocks %" PRIu64 " -> %" PRIu64 "", first, first + count - 1);
+        }
+    }
+
+    __atomic_fetch_add(&ctx->workers_done, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+/* padding bits past the end of a layer must always be set */
+static inline u64 check_padding_mask(u64 layer_size, u64 word) {
+    u64 first_bit = word * 64;
+    if(first_bit + 64 <= layer_size) return 0;
+    if(first_bit >= layer_size) return ~0ULL;
+    return ~0ULL << (layer_size - first_bit);
+}
+
+static void check_compare_bottom(CheckContext *ctx, const CheckJob *job) {
+    const u64 *disk = ctx->bitmap + ctx->layer_starts[0] / 64;
+    u64 leaked = 0, missing = 0, allocated = 0;
+
+    for(u64 w = job->first_word; w < job->first_word + job->word_count; w++) {
+        u64 padding = check_padding_mask(ctx->volume_size, w);
+        u64 expected = ctx->reference[w] | padding;
+
+        allocated += __builtin_popcountll(disk[w] & ~padding);
+        if(disk[w] == expected) continue;
+
+        u64 extra = disk[w] & ~expected;
+        u64 lost = expected & ~disk[w];
+        leaked += __builtin_popcountll(extra);
+        missing += __builtin_popcountll(lost & ~padding);
+
+        if(lost & padding) {
+            check_problem(ctx, &ctx->report->layer_errors,
+                "padding bits of the bottom layer are clear in word %" PRIu64 "", w);
+        }
+
+        if(extra) {
+            check_problem(ctx, &ctx->report->leaked_blocks,
+                "block %" PRIu64 " is allocated but not in use", w * 64 + __builtin_ctzll(extra));
+            leaked--;
+        }
+
+        if(lost & ~padding) {
+            check_problem(ctx, &ctx->report->missing_blocks,
+                "block %" PRIu64 " is in use but free in the bitmap",
+                w * 64 + __builtin_ctzll(lost & ~padding));
+            missing--;
+        }
+    }
+
+    check_add(&ctx->report->leaked_blocks, leaked);
+    check_add(&ctx->report->missing_blocks, missing);
+    check_add(&ctx->report->allocated_blocks, allocated);
+}
+
+static void check_compare_parents(CheckContext *ctx, const CheckJob *job) {
+    u32 layer = job->layer;
+    const u64 *child = ctx->bitmap + ctx->layer_starts[layer-1] / 64;
+    const u64 *parent = ctx->bitmap + ctx->layer_starts[layer] / 64;
+    u64 child_words = BITMAP_LAYER_SPAN(ctx->layer_sizes[layer-1]) / 64;
+    u64 group_mask = (ctx->fanout == 64) ? ~0ULL : (1ULL << ctx->fanout) - 1;
+    u32 groups_per_word = 64 / ctx->fanout;
+    u64 errors = 0;
+
+    for(u64 w = job->first_word; w < job->first_word + job->word_count; w++) {
+        u64 expected = check_padding_mask(ctx->layer_sizes[layer], w);
+
+        // each parent word summarizes exactly fanout child words
+        for(u32 c = 0; c < ctx->fanout; c++) {
+            u64 child_word = w * ctx->fanout + c;
+            u64 value = (child_word < child_words) ? child[child_word] : ~0ULL;
+
+            for(u32 k = 0; k < groups_per_word; k++) {
+                if(((value >> (k * ctx->fanout)) & group_mask) == group_mask)
+                    expected |= 1ULL << (c * groups_per_word + k);
+            }
+        }
+
+        u64 diff = parent[w] ^ expected;
+        if(!diff) continue;
+
+        errors += __builtin_popcountll(diff);
+        check_problem(ctx, &ctx->report->layer_errors,
+            "layer %u bit %" PRIu64 " is %s but its children are %s", layer,
+            w * 64 + __builtin_ctzll(diff), (parent[w] & diff & -diff) ? "set" : "clear",
+            (expected & diff & -diff) ? "all set" : "not all set");
+        errors--;
+    }
+
+    check_add(&ctx->report->layer_errors, errors);
+}
+
+static void *check_compare_worker(void *arg) {
+    CheckContext *ctx = (CheckContext *) arg;
+
+    for(;;) {
+        u64 index = __atomic_fetch_add(&ctx->next_job, 1, __ATOMIC_RELAXED);
+        if(index >= ctx->job_count) break;
+
+        const CheckJob *job = &ctx->jobs[index];
+        if(!job->layer) check_compare_bottom(ctx, job);
+        else check_compare_parents(ctx, job);
+    }
+
+    __atomic_fetch_add(&ctx->workers_done, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+static u64 check_time_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void check_progress(CheckContext *ctx, const char *phase, u64 start, u64 done, u64 total) {
+    double seconds = (check_time_ns() - start) / 1e9;
+    u64 bytes = __atomic_load_n(&ctx->report->bytes_read, __ATOMIC_RELAXED);
+
+    pthread_mutex_lock(&ctx->lock);
+    printf("\r    🔍 %-10s ", phase);
+    if(total) printf("%3" PRIu64 "%% ", done * 100 / total);
+    else printf("%" PRIu64 " inodes ", __atomic_load_n(&ctx->report->inodes, __ATOMIC_RELAXED));
+    printf("| %" PRIu64 " MB read, %.1f MB/s   ", bytes >> 20,
+        seconds > 0 ? (bytes / (1024.0 * 1024)) / seconds : 0);
+    fflush(stdout);
+    pthread_mutex_unlock(&ctx->lock);
+}
+
+/* runs one phase on every thread and reports progress from the calling thread
+ * until all of them are done */
+static int check_run_phase(CheckContext *ctx, u32 threads, void *(*worker)(void *),
+    const char *phase, u64 start, u64 total) {
+    pthread_t *pool = calloc(threads, sizeof(pthread_t));
+    if(!pool) return -1;
+
+    ctx->workers_done = 0;
+    ctx->next_job = 0;
+
+    u32 started = 0;
+    for(; started < threads; started++) {
+        if(pthread_create(&pool[started], NULL, worker, ctx)) break;
+    }
+
+    if(!started) {
+        free(pool);
+        return -1;
+    }
+
+    int tty = isatty(fileno(stdout));
+    u64 last_progress = check_time_ns();
+    while(__atomic_load_n(&ctx->workers_done, __ATOMIC_ACQUIRE) < started) {
+        if(tty && check_time_ns() - last_progress >= CHECK_PROGRESS_NS) {
+            u64 done = __atomic_load_n(&ctx->next_job, __ATOMIC_RELAXED);
+            check_progress(ctx, phase, start, done > total ? total : done, total);
+            last_progress = check_time_ns();
+        }
+
+        struct timespec delay = { 0, CHECK_POLL_NS };
+        nanosleep(&delay, NULL);
+    }
+
+    for(u32 i = 0; i < started; i++)
+        pthread_join(pool[i], NULL);
+
+    check_progress(ctx, phase, start, total, total);
+    printf("\n");
+
+    free(pool);
+    return 0;
+}
+
+int check_volume(Mountpoint *mp, u32 threads, CheckReport *report) {
+    if(!mp || !mp->superblock || !report)
+        return -1;
+
+    // the walk reads inodes and the shared extent table straight from the disk
+    if(sync_volume(mp)) return -1;
+
+    if(!threads) threads = 1;
+
+    memset(report, 0, sizeof(CheckReport));
+    u64 start = check_time_ns();
+
+    CheckContext ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.disk = mp->disk;
+    ctx.stats = &mp->io_stats;
+    ctx.block_size = mp->block_size;
+    ctx.fanout = mp->fanout;
+    ctx.volume_size = mp->superblock->volume_size;
+    ctx.inode_size = mp->inode_size;
+    ctx.inode_shift = mp->inode_shift;
+    ctx.layers = mp->bitmap_layers;
+    ctx.layer_starts = mp->layer_starts;
+    ctx.layer_sizes = mp->layer_sizes;
+    ctx.bitmap_start = mp->superblock->bitmap_block;
+    ctx.report = report;
+
+    u64 bitmap_bits = ctx.layer_starts[0] + BITMAP_LAYER_SPAN(ctx.layer_sizes[0]);
+    ctx.bitmap_blocks = ((bitmap_bits + 7) / 8 + ctx.block_size - 1) / ctx.block_size;
+
+    u64 reference_words = BITMAP_LAYER_SPAN(ctx.volume_size) / 64;
+    u64 inode_words = BITMAP_LAYER_SPAN(ctx.volume_size * (ctx.block_size / ctx.inode_size)) / 64;
+    ctx.reference = calloc(reference_words, sizeof(u64));
+    ctx.inodes = calloc(inode_words, sizeof(u64));
+    ctx.tables = calloc(reference_words, sizeof(u64));
+    ctx.bitmap = calloc(ctx.bitmap_blocks, ctx.block_size);
+    ctx.shared = mp->shared;
+    ctx.shared_count = mp->shared_count;
+    ctx.shared_seen = calloc(ctx.shared_count + 1, sizeof(u64));
+
+    if(!ctx.reference || !ctx.inodes || !ctx.tables || !ctx.bitmap || !ctx.shared_seen) {
+        free(ctx.reference);
+        free(ctx.inodes);
+        free(ctx.tables);
+        free(ctx.bitmap);
+        free(ctx.shared_seen);
+        return -1;
+    }
+
+    pthread_mutex_init(&ctx.lock, NULL);
+    pthread_cond_init(&ctx.cond, NULL);
+
+    // everything in front of the root directory is the superblock and bitmap
+    SuperBlock *superblock = mp->superblock;
+    check_mark(&ctx, 0, superblock->root_inode >> ctx.inode_shift, "reserved space", 0);
+    if(superblock->journal_block && superblock->journal_size)
+        check_mark(&ctx, superblock->journal_block, superblock->journal_size, "the journal", 0);
+
+    u8 *chain = malloc(ctx.block_size);
+    u64 links = 0;
+    for(u64 block = superblock->refcount_block; chain && block; links++) {
+        if(links >= ctx.volume_size || check_mark(&ctx, block, 1, "the shared extent table", 0) ||
+            check_read(&ctx, block, 1, chain, IO_TABLE)) {
+            check_problem(&ctx, &report->structure_errors, "the shared extent table is broken");
+            break;
+        }
+
+        block = ((RefcountBlock *) chain)->next;
+    }
+
+    links = 0;
+    for(u64 block = superblock->dedup_block; chain && block; links++) {
+        if(links >= ctx.volume_size || check_mark(&ctx, block, 1, "the fingerprint index", 0) ||
+            check_read(&ctx, block, 1, chain, IO_TABLE)) {
+            check_problem(&ctx, &report->structure_errors, "the fingerprint index is broken");
+            break;
+        }
+
+        block = ((DedupBlock *) chain)->next;
+    }
+
+    links = 0;
+    for(u64 block = superblock->path_index_block; chain && block; links++) {
+        if(links >= ctx.volume_size || check_mark(&ctx, block, 1, "the path index", 0) ||
+            check_read(&ctx, block, 1, chain, IO_TABLE)) {
+            check_problem(&ctx, &report->structure_errors, "the path index is broken");
+            break;
+        }
+
+        block = ((PathBlock *) chain)->next;
+    }
+
+    links = 0;
+    for(u64 block = superblock->inode_slot_block; chain && block; links++) {
+        if(links >= ctx.volume_size || check_mark(&ctx, block, 1, "the free inode list", 0) ||
+            check_read(&ctx, block, 1, chain, IO_TABLE)) {
+            check_problem(&ctx, &report->structure_errors, "the free inode list is broken");
+            break;
+        }
+
+        block = ((InodeSlotBlock *) chain)->next;
+    }
+    free(chain);
+
+    check_enqueue(&ctx, superblock->root_inode);
+
+    int status = check_run_phase(&ctx, threads, check_graph_worker, "inodes", start, 0);
+
+    // free slots keep their tables allocated even when no inode there is in use
+    for(u64 i = 0; !status && i < mp->inode_slot_count; i++) {
+        u64 ino = mp->inode_slots[i];
+        if(check_visit(&ctx, ino)) {
+            check_problem(&ctx, &report->structure_errors,
+                "free inode slot %" PRIu64 " is invalid, in use or listed twice", ino);
+            continue;
+        }
+
+        check_table(&ctx, ino >> ctx.inode_shift, 0);
+    }
+
+    for(u64 i = 0; !status && i < ctx.shared_count; i++) {
+        const SharedExtent *entry = &ctx.shared[i];
+        if(entry->refs < 2 || ctx.shared_seen[i] != entry->refs * entry->count) {
+            check_problem(&ctx, &report->structure_errors,
+                "blocks %" PRIu64 " -> %" PRIu64 " are shared %" PRIu64 " times but referenced %" PRIu64 " times", entry->block,
+                entry->block + entry->count - 1, entry->refs, ctx.shared_seen[i] / entry->count);
+        }
+    }
+
+    if(!status) {
+        status = check_run_phase(&ctx, threads, check_load_worker, "bitmap", start,
+            (ctx.bitmap_blocks + CHECK_REGION_BLOCKS - 1) / CHECK_REGION_BLOCKS);
+    }
+
+    // split every layer into regions of the same size as the bitmap reads
+    u64 region_words = CHECK_REGION_BLOCKS * ctx.block_size / sizeof(u64);
+    for(u32 i = 0; !status && i < ctx.layers; i++)
+        ctx.job_count += (BITMAP_LAYER_SPAN(ctx.layer_sizes[i]) / 64 + region_words - 1) / region_words;
+
+    if(!status) {
+        ctx.jobs = calloc(ctx.job_count, sizeof(CheckJob));
+        if(!ctx.jobs) status = -1;
+    }
+
+    for(u32 i = 0, j = 0; !status && i < ctx.layers; i++) {
+        u64 words = BITMAP_LAYER_SPAN(ctx.layer_sizes[i]) / 64;
+        for(u64 w = 0; w < words; w += region_words) {
+            ctx.jobs[j].layer = i;
+            ctx.jobs[j].first_word = w;
+            ctx.jobs[j].word_count = (words - w < region_words) ? words - w : region_words;
+            j++;
+        }
+    }
+
+    if(!status)
+        status = check_run_phase(&ctx, threads, check_compare_worker, "compare", start, ctx.job_count);
+
+    for(u64 w = 0; w < reference_words; w++)
+        report->referenced_blocks += __builtin_popcountll(ctx.reference[w]);
+
+    report->seconds = (check_time_ns() - start) / 1e9;
+
+    pthread_cond_destroy(&ctx.cond);
+    pthread_mutex_destroy(&ctx.lock);
+    free(ctx.jobs);
+    free(ctx.queue);
+    free(ctx.reference);
+    free(ctx.inodes);
+    free(ctx.tables);
+    free(ctx.bitmap);
+    free(ctx.shared_seen);
+    return status;
+}
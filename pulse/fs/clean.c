@@ -0,0 +1,112 @@
+/*
+ * pulse - a highly scalable SSD-first file system with predictable logarithmic
+ * bounds across all operations
+ * 
+ * Copyright (c) 2025 Omar Elghoul
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <pulse/pulse.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* the cleaner empties the least used segments behind the log head so the head
+ * keeps finding empty ones to fill - there is no map from blocks back to the
+ * files that own them, so it picks its segments from the occupancy of the
+ * bottom bitmap layer, walks the namespace once and moves whatever the files
+ * keep in those segments to the head. metadata never goes in the log */
+
+typedef struct CleanCandidate {
+    u64 segment;
+    u64 used;
+} CleanCandidate;
+
+static int candidate_compare(const void *a, const void *b) {
+    const CleanCandidate *x = a, *y = b;
+    if(x->used != y->used) return x->used < y->used ? -1 : 1;
+    return x->segment < y->segment ? -1 : x->segment > y->segment;
+}
+
+typedef struct CleanWalk {
+    const u8 *victims;
+    u64 moved;
+} CleanWalk;
+
+static int clean_file(Mountpoint *mp, u64 inode, const Inode *buffer, void *context) {
+    CleanWalk *walk = context;
+    return relocate_inode(mp, inode, walk->victims, &walk->moved) ? -1 : 0;
+}
+
+/* empties up to segments of the least used segments of the log that still
+ * hold something, the one the head is filling excepted */
+int clean_log(Mountpoint *mp, u64 segments, CleanReport *report) {
+    if(!mp || !mp->superblock || !report) return -1;
+
+    memset(report, 0, sizeof(CleanReport));
+    if(!mp->log_mode) return -1;
+
+    u64 segment = mp->log_segment;
+    u64 total = (mp->superblock->volume_size + segment - 1) / segment;
+    u64 first = mp->log_start / segment;
+    u64 head = mp->log_head / segment;
+
+    u64 *used = malloc(total * sizeof(u64));
+    u8 *victims = calloc(total, 1);
+    CleanCandidate *candidates = malloc(total * sizeof(CleanCandidate));
+    int status = -1;
+    if(!used || !victims || !candidates || log_usage(mp, used)) goto done;
+
+    u64 count = 0;
+    for(u64 s = first; s < total; s++) {
+        if(s != head && used[s] && used[s] < segment) {
+            candidates[count].segment = s;
+            candidates[count].used = used[s];
+            count++;
+        }
+    }
+
+    qsort(candidates, count, sizeof(CleanCandidate), candidate_compare);
+    if(count > segments) count = segments;
+
+    for(u64 i = 0; i < count; i++)
+        victims[candidates[i].segment] = 1;
+
+    // there is no map from blocks back to the files that own them, so every
+    // file is asked to move whatever it keeps in the victims
+    CleanWalk walk = { victims, 0 };
+    report->segments = count;
+    if(count && dir_walk(mp, mp->superblock->root_inode, clean_file, &walk)) goto done;
+    report->moved_blocks = walk.moved;
+    if(log_usage(mp, used)) goto done;
+
+    for(u64 s = first; s < total; s++) {
+        if(used[s]) continue;
+        report->free_segments++;
+        if(victims[s]) report->emptied++;
+    }
+
+    status = 0;
+
+done:
+    free(used);
+    free(victims);
+    free(candidates);
+    return status;
+}
@@ -0,0 +1,375 @@
+/*
+ * pulse - a highly scalable SSD-first file system with predictable logarithmic
+ * bounds across all operations
+ * 
+ * Copyright (c) 2025 Omar Elghoul
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <pulse/pulse.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* blocks written while dedup is on are fingerprinted and indexed here, so a
+ * later write of the same data can take another reference to the block with
+ * the shared extent table instead of storing it again. the index is a pair of
+ * linear probing tables sized by the memory budget - once it is full new
+ * blocks simply aren't indexed anymore. it is allocation state like the
+ * shared extent table, so the bitmap lock guards it and freed blocks leave it
+ * in free_block(), and it is written out as a chain of blocks on sync */
+
+static u64 dedup_home(const Mountpoint *mp, const DedupEntry *entry, int by_block) {
+    u64 mask = mp->dedup_capacity - 1;
+    if(!by_block) return entry->hash.low & mask;
+
+    // block numbers are dense, spread them with a multiplicative hash
+    return (entry->block * 0x9E3779B97F4A7C15ULL >> 32) & mask;
+}
+
+static void dedup_place(Mountpoint *mp, DedupEntry *table, const DedupEntry *entry, int by_block) {
+    u64 mask = mp->dedup_capacity - 1;
+    u64 slot = dedup_home(mp, entry, by_block);
+    while(table[slot].block) slot = (slot + 1) & mask;
+    memcpy(&table[slot], entry, sizeof(DedupEntry));
+}
+
+/* empties a slot and shifts the rest of its probe sequence back over it, so
+ * lookups never need tombstones */
+static void dedup_remove(Mountpoint *mp, DedupEntry *table, u64 slot, int by_block) {
+    u64 mask = mp->dedup_capacity - 1;
+    u64 hole = slot;
+
+    for(u64 next = (hole + 1) & mask; table[next].block; next = (next + 1) & mask) {
+        u64 home = dedup_home(mp, &table[next], by_block);
+        if(((next - home) & mask) >= ((next - hole) & mask)) {
+            memcpy(&table[hole], &table[next], sizeof(DedupEntry));
+            hole = next;
+        }
+    }
+
+    table[hole].block = 0;
+}
+
+static DedupEntry *dedup_find_hash(Mountpoint *mp, const Hash128 *hash) {
+    u64 mask = mp->dedup_capacity - 1;
+    for(u64 slot = hash->low & mask; mp->dedup_by_hash[slot].block; slot = (slot + 1) & mask) {
+        DedupEntry *entry = &mp->dedup_by_hash[slot];
+        if(entry->hash.low == hash->low && entry->hash.high == hash->high)
+            return entry;
+    }
+
+    return NULL;
+}
+
+static int dedup_insert_locked(Mountpoint *mp, const Hash128 *hash, u64 block) {
+    if(!mp->dedup_capacity || !block) return -1;
+    if(mp->dedup_count * 100 >= mp->dedup_capacity * DEDUP_LOAD_FACTOR) return 0;
+    if(dedup_find_hash(mp, hash)) return 0;
+
+    DedupEntry entry;
+    entry.hash = *hash;
+    entry.block = block;
+    dedup_place(mp, mp->dedup_by_hash, &entry, 0);
+    dedup_place(mp, mp->dedup_by_block, &entry, 1);
+    mp->dedup_count++;
+    mp->dedup_dirty = 1;
+    return 0;
+}
+
+/* the largest power of two of slots whose two tables fit in the budget */
+static u64 dedup_slots(u64 budget) {
+    u64 slots = 64;
+    if(budget < slots * 2 * sizeof(DedupEntry)) return 0;
+
+    while(slots * 4 * sizeof(DedupEntry) <= budget) slots *= 2;
+    return slots;
+}
+
+/* moves the index into tables for a new budget, entries that don't fit the
+ * smaller tables are dropped - a budget of zero turns dedup off */
+static int dedup_resize(Mountpoint *mp, u64 budget) {
+    u64 capacity = dedup_slots(budget);
+    DedupEntry *by_hash = NULL, *by_block = NULL;
+
+    if(capacity) {
+        by_hash = calloc(capacity, sizeof(DedupEntry));
+        by_block = calloc(capacity, sizeof(DedupEntry));
+        if(!by_hash || !by_block) {
+            free(by_hash);
+            free(by_block);
+            return -1;
+        }
+    }
+
+    DedupEntry *old = mp->dedup_by_hash;
+    u64 old_capacity = mp->dedup_capacity;
+    u64 old_count = mp->dedup_count;
+
+    free(mp->dedup_by_block);
+    mp->dedup_by_hash = by_hash;
+    mp->dedup_by_block = by_block;
+    __atomic_store_n(&mp->dedup_capacity, capacity, __ATOMIC_RELAXED);
+    mp->dedup_count = 0;
+
+    for(u64 i = 0; capacity && i < old_capacity; i++) {
+        Hash128 hash = old[i].hash;
+        if(old[i].block) dedup_insert_locked(mp, &hash, old[i].block);
+    }
+
+    if(mp->dedup_count != old_count || mp->superblock->dedup_budget != budget)
+        mp->dedup_dirty = 1;
+
+    mp->superblock->dedup_budget = budget;
+    free(old);
+    return 0;
+}
+
+int dedup_set_budget(Mountpoint *mp, u64 budget) {
+    if(!mp || !mp->superblock) return -1;
+
+    pthread_mutex_lock(&mp->bitmap_lock);
+    int status = dedup_resize(mp, budget);
+    pthread_mutex_unlock(&mp->bitmap_lock);
+    return status;
+}
+
+/* looks for a block that already holds data and takes a reference to it for
+ * the caller - the fingerprint only finds a candidate, it is compared byte for
+ * byte since blocks can be overwritten in place after they were indexed.
+ * returns the block or zero if the data has to be written */
+u64 dedup_share(Mountpoint *mp, const Hash128 *hash, const void *data) {
+    if(!mp || !hash || !data) return 0;
+
+    u8 *existing = scratch_buffer(SCRATCH_DATA, mp->block_size);
+    if(!existing) return 0;
+
+    // the bitmap lock is held across the read so the block can't be freed
+    // under us, and the share lock so no writer overwrites it in place while
+    // it still looks like it belongs to one file only
+    pthread_rwlock_wrlock(&mp->share_lock);
+    pthread_mutex_lock(&mp->bitmap_lock);
+
+    u64 block = 0;
+    DedupEntry *entry = mp->dedup_capacity ? dedup_find_hash(mp, hash) : NULL;
+    if(entry && !read_block(mp->disk, &mp->io_stats, entry->block, mp->block_size, 1, existing, IO_DATA) &&
+        !memcmp(existing, data, mp->block_size) && !refcount_share_locked(mp, entry->block, 1))
+        block = entry->block;
+
+    mp->dedup_checked++;
+    if(block) mp->dedup_matched++;
+    pthread_mutex_unlock(&mp->bitmap_lock);
+    pthread_rwlock_unlock(&mp->share_lock);
+    return block;
+}
+
+int dedup_insert(Mountpoint *mp, const Hash128 *hash, u64 block) {
+    if(!mp || !hash) return -1;
+
+    pthread_mutex_lock(&mp->bitmap_lock);
+    int status = dedup_insert_locked(mp, hash, block);
+    pthread_mutex_unlock(&mp->bitmap_lock);
+    return status;
+}
+
+/* drops the fingerprint of a block on behalf of free_block(), which holds the
+ * bitmap lock - the block may be reused for anything after this */
+void dedup_forget(Mountpoint *mp, u64 block) {
+    if(!mp->dedup_count) return;
+
+    u64 mask = mp->dedup_capacity - 1;
+    DedupEntry key;
+    key.block = block;
+
+    u64 slot = dedup_home(mp, &key, 1);
+    while(mp->dedup_by_block[slot].block && mp->dedup_by_block[slot].block != block)
+        slot = (slot + 1) & mask;
+    if(!mp->dedup_by_block[slot].block) return;
+
+    Hash128 hash = mp->dedup_by_block[slot].hash;
+    dedup_remove(mp, mp->dedup_by_block, slot, 1);
+
+    for(slot = hash.low & mask; mp->dedup_by_hash[slot].block; slot = (slot + 1) & mask) {
+        if(mp->dedup_by_hash[slot].block == block) {
+            dedup_remove(mp, mp->dedup_by_hash, slot, 0);
+            break;
+        }
+    }
+
+    mp->dedup_count--;
+    mp->dedup_dirty = 1;
+}
+
+int dedup_report(Mountpoint *mp, DedupReport *report) {
+    if(!mp || !mp->superblock || !report) return -1;
+
+    memset(report, 0, sizeof(DedupReport));
+    pthread_mutex_lock(&mp->bitmap_lock);
+
+    report->budget = mp->superblock->dedup_budget;
+    report->entries = mp->dedup_count;
+    report->capacity = mp->dedup_capacity * DEDUP_LOAD_FACTOR / 100;
+    report->checked = mp->dedup_checked;
+    report->matched = mp->dedup_matched;
+
+    for(u64 i = 0; i < mp->shared_count; i++) {
+        report->shared_blocks += mp->shared[i].count;
+        report->saved_blocks += mp->shared[i].count * (mp->shared[i].refs - 1);
+    }
+
+    pthread_mutex_unlock(&mp->bitmap_lock);
+    return 0;
+}
+
+int dedup_load(Mountpoint *mp) {
+    if(!mp || !mp->superblock) return -1;
+
+    u64 budget = mp->superblock->dedup_budget;
+    if(dedup_resize(mp, budget)) return -1;
+
+    u64 block = mp->superblock->dedup_block;
+    if(!block) return 0;
+
+    // an index left behind with dedup off goes away on the next sync
+    if(!mp->dedup_capacity) {
+        mp->dedup_dirty = 1;
+        return 0;
+    }
+
+    DedupBlock *chain = malloc(mp->block_size);
+    if(!chain) return -1;
+
+    u64 per_block = (mp->block_size - sizeof(DedupBlock)) / sizeof(DedupEntry);
+
+    // a chain longer than the volume has a cycle in it
+    for(u64 links = 0; block; links++) {
+        if(links >= mp->superblock->volume_size || block >= mp->superblock->volume_size ||
+            read_block(mp->disk, &mp->io_stats, block, mp->block_size, 1, chain, IO_TABLE) ||
+            chain->count > per_block)
+            goto fail;
+
+        for(u64 i = 0; i < chain->count; i++) {
+            Hash128 hash = chain->entries[i].hash;
+            u64 indexed = chain->entries[i].block;
+            if(indexed >= mp->superblock->volume_size || dedup_insert_locked(mp, &hash, indexed))
+                goto fail;
+        }
+
+        block = chain->next;
+    }
+
+    mp->dedup_dirty = 0;
+    free(chain);
+    return 0;
+
+fail:
+    free(chain);
+    dedup_destroy(mp);
+    return -1;
+}
+
+/* writes the index to a fresh chain and only then lets go of the old one, the
+ * superblock points at whichever of the two is complete */
+int dedup_store(Mountpoint *mp) {
+    if(!mp || !mp->superblock) return -1;
+
+    pthread_mutex_lock(&mp->bitmap_lock);
+    int dirty = mp->dedup_dirty;
+    pthread_mutex_unlock(&mp->bitmap_lock);
+    if(!dirty) return 0;
+
+    DedupBlock *chain = calloc(1, mp->block_size);
+    if(!chain) return -1;
+
+    // the chain blocks are allocated first, which can't touch the index
+    u64 per_block = (mp->block_size - sizeof(DedupBlock)) / sizeof(DedupEntry);
+    u64 blocks = (mp->dedup_count + per_block - 1) / per_block;
+    u64 *chain_blocks = blocks ? malloc(blocks * sizeof(u64)) : NULL;
+    if(blocks && !chain_blocks) {
+        free(chain);
+        return -1;
+    }
+
+    u64 allocated = 0;
+    for(; allocated < blocks; allocated++) {
+        chain_blocks[allocated] = allocate_block(mp);
+        if(chain_blocks[allocated] == -1) goto fail;
+    }
+
+    u64 slot = 0;
+    for(u64 b = 0; b < blocks; b++) {
+        chain->next = b + 1 < blocks ? chain_blocks[b + 1] : 0;
+        chain->count = 0;
+
+        pthread_mutex_lock(&mp->bitmap_lock);
+        for(; slot < mp->dedup_capacity && chain->count < per_block; slot++) {
+            if(mp->dedup_by_hash[slot].block)
+                memcpy(&chain->entries[chain->count++], &mp->dedup_by_hash[slot], sizeof(DedupEntry));
+        }
+        pthread_mutex_unlock(&mp->bitmap_lock);
+
+        if(write_block(mp->disk, &mp->io_stats, chain_blocks[b], mp->block_size, 1, chain, IO_TABLE))
+            goto fail;
+    }
+
+    u64 old = mp->superblock->dedup_block;
+    mp->superblock->dedup_block = blocks ? chain_blocks[0] : 0;
+    mp->superblock->superblock_size = sizeof(SuperBlock);
+    if(write_superblock(mp)) {
+        mp->superblock->dedup_block = old;
+        goto fail;
+    }
+
+    mp->dedup_dirty = 0;
+    free(chain_blocks);
+
+    int status = 0;
+    for(u64 links = 0; old && links < mp->superblock->volume_size; links++) {
+        if(read_block(mp->disk, &mp->io_stats, old, mp->block_size, 1, chain, IO_TABLE)) {
+            status = -1;
+            break;
+        }
+
+        u64 next = chain->next;
+        if(free_block(mp, old)) status = -1;
+        old = next;
+    }
+
+    free(chain);
+    return status;
+
+fail:
+    for(u64 b = 0; b < allocated; b++)
+        free_block(mp, chain_blocks[b]);
+
+    free(chain_blocks);
+    free(chain);
+    return -1;
+}
+
+void dedup_destroy(Mountpoint *mp) {
+    if(!mp) return;
+
+    free(mp->dedup_by_hash);
+    free(mp->dedup_by_block);
+    mp->dedup_by_hash = NULL;
+    mp->dedup_by_block = NULL;
+    mp->dedup_capacity = 0;
+    mp->dedup_count = 0;
+}
@@ -0,0 +1,198 @@
+/*
+ * pulse - a highly scalable SSD-first file system with predictable logarithmic
+ * bounds across all operations
+ * 
+ * Copyright (c) 2025 Omar Elghoul
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <pulse/pulse.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* a fragmented file is copied into as few runs as the allocator finds and
+ * gets a new extent tree built on fresh nodes - the inode is written out once
+ * to switch over to it, so the disk holds either the old file or the new one
+ * and the old blocks are only freed after that. clusters of compressed files
+ * have to stay where they are and blocks shared with other files would stop
+ * being shared, files with either are left alone */
+
+typedef struct DefragRun {
+    u64 block;
+    u64 count;
+} DefragRun;
+
+/* copies the written parts of a leaf piece to its new place, a chunk at a time */
+static int defrag_copy(Mountpoint *mp, u64 from, u64 to, u64 count, u8 *data, u64 chunk) {
+    for(u64 done = 0; done < count; done += chunk) {
+        u64 blocks = count - done < chunk ? count - done : chunk;
+        if(read_block(mp->disk, &mp->io_stats, from + done, mp->block_size, blocks, data, IO_DATA) ||
+            write_data(mp, to + done, blocks, data, IO_DATA))
+            return -1;
+    }
+
+    return 0;
+}
+
+/* rewrites the file if it has at least threshold extents and its data lies in
+ * more pieces on the disk than the allocator can now give it, the report is
+ * added to */
+int defrag_inode(Mountpoint *mp, u64 inode, u64 threshold, DefragReport *report) {
+    if(!mp || !mp->superblock || !inode || !report)
+        return -1;
+
+    // delayed data gets its blocks first, so it moves along with the rest
+    CachedInode *cached = icache_get(mp, inode, 1);
+    if(!cached) return -1;
+
+    int status = flush_inode(mp, cached);
+    icache_put(mp, cached);
+    if(status) return -1;
+
+    u32 block_size = mp->block_size;
+    Inode *inode_buf = scratch_buffer(SCRATCH_METADATA, block_size);
+    if(!inode_buf || read_inode(mp, inode, inode_buf))
+        return -1;
+
+    report->files++;
+    if(INODE_MODE_TYPE_IS_DIR(inode_buf->mode) || (inode_buf->mode & INODE_MODE_COMPRESSED) ||
+        !inode_buf->extent_tree_root || inode_buf->extent_count < threshold)
+        return 0;
+
+    ExtentNode *leaves, *fresh = NULL;
+    DefragRun *runs = NULL;
+    u8 *data = NULL;
+    u64 count, runs_taken = 0;
+    if(extent_collect(mp, inode_buf->extent_tree_root, &leaves, &count))
+        return -1;
+
+    // extents that follow each other on the disk read as one, holes included
+    u64 total = 0, fragments = 0;
+    int shared = __atomic_load_n(&mp->shared_count, __ATOMIC_RELAXED) != 0;
+    for(u64 i = 0; i < count; i++) {
+        if(leaves[i].compressed_length) goto done;
+
+        for(u64 b = 0, run; shared && b < leaves[i].block_count; b += run) {
+            if(refcount_query(mp, leaves[i].block + b, &run) >= 2) goto done;
+        }
+
+        if(!i || leaves[i - 1].block + leaves[i - 1].block_count != leaves[i].block)
+            fragments++;
+        total += leaves[i].block_count;
+    }
+
+    if(fragments < threshold) goto done;
+
+    status = -1;
+    // as many runs as there are fragments would gain nothing
+    runs = malloc(fragments * sizeof(DefragRun));
+    if(!runs) goto done;
+
+    for(u64 got = 0; got < total;) {
+        u64 allocated;
+        u64 block = allocate_blocks(mp, total - got, &allocated, ALLOC_DATA);
+        if(block == -1) goto give_back;
+
+        runs[runs_taken].block = block;
+        runs[runs_taken].count = allocated;
+        got += allocated;
+
+        if(++runs_taken == fragments) {
+            status = 0;
+            goto give_back;
+        }
+    }
+
+    u64 chunk = DEFRAG_CHUNK_SIZE / block_size ? DEFRAG_CHUNK_SIZE / block_size : 1;
+    fresh = malloc((count + runs_taken) * sizeof(ExtentNode));
+    data = malloc(chunk * block_size);
+    if(!fresh || !data) goto give_back;
+
+    // lay the leaves out over the runs in file order, a leaf that crosses
+    // from one run into the next is split in two
+    u64 pieces = 0, run = 0, used = 0;
+    for(u64 i = 0; i < count; i++) {
+        for(u64 done = 0; done < leaves[i].block_count;) {
+            u64 take = leaves[i].block_count - done;
+            if(take > runs[run].count - used) take = runs[run].count - used;
+
+            ExtentNode *piece = &fresh[pieces++];
+            memcpy(piece, &leaves[i], sizeof(ExtentNode));
+            piece->start_offset = leaves[i].start_offset + done * block_size;
+            piece->length = leaves[i].length - done * block_size;
+            if(piece->length > take * block_size) piece->length = take * block_size;
+            piece->block = runs[run].block + used;
+            piece->block_count = take;
+
+            // unwritten blocks read as zeros whatever they hold
+            if(!(leaves[i].flags & EXTENT_UNWRITTEN) &&
+                defrag_copy(mp, leaves[i].block + done, piece->block, take, data, chunk))
+                goto give_back;
+
+            done += take;
+            used += take;
+            if(used == runs[run].count) {
+                run++;
+                used = 0;
+            }
+        }
+    }
+
+    pieces = extent_merge(fresh, pieces, block_size);
+
+    u64 old_root = inode_buf->extent_tree_root;
+    u64 old_count = inode_buf->extent_count;
+    if(extent_build(mp, inode_buf, fresh, pieces)) {
+        inode_buf->extent_tree_root = old_root;
+        inode_buf->extent_count = old_count;
+        goto give_back;
+    }
+
+    // the switch has to be on the disk before the old blocks can be reused
+    if(write_inode(mp, inode, inode_buf) || icache_commit(mp, inode))
+        goto done;
+
+    if(extent_free_tree(mp, old_root)) goto done;
+    for(u64 i = 0; i < count; i++) {
+        for(u64 b = 0; b < leaves[i].block_count; b++) {
+            if(free_block(mp, leaves[i].block + b)) goto done;
+        }
+    }
+
+    report->defragmented++;
+    report->extents_before += count;
+    report->extents_after += pieces;
+    report->moved_blocks += total;
+    status = 0;
+    goto done;
+
+give_back:
+    for(u64 r = 0; r < runs_taken; r++) {
+        for(u64 b = 0; b < runs[r].count; b++)
+            free_block(mp, runs[r].block + b);
+    }
+
+done:
+    free(leaves);
+    free(fresh);
+    free(runs);
+    free(data);
+    return status;
+}
@@ -0,0 +1,743 @@
+/*
+ * pulse - a highly scalable SSD-first file system with predictable logarithmic
+ * bounds across all operations
+ * 
+ * Copyright (c) 2025 Omar Elghoul
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <pulse/pulse.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* a directory is a file that starts with its header and hash map, followed by
+ * the hash nests - every bucket is a chain of nests, and every nest holds a
+ * fixed number of entry slots where a zero inode number marks a free slot
+ * new entries reuse a free slot in their chain or prepend a nest with a single
+ * slot, and resizing rewrites the whole directory with one packed nest per
+ * bucket */
+
+#define DIR_HASHMAP_OFFSET(bucket)  (sizeof(Directory) + (bucket) * sizeof(u64))
+
+typedef struct DirSearch {
+    u64 entry_offset;       // offset of the matching entry
+    u64 inode;              // and its inode, zero if not found
+    u64 free_slot;          // first free slot in the chain, zero if none
+    u64 live_entries;       // entries in the bucket, including the match
+    u64 bucket;
+    u64 head;               // offset of the first nest in the bucket
+} DirSearch;
+
+static u64 dir_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int dir_valid_name(const char *name) {
+    usize len = strlen(name);
+    return len && len < DIR_MAX_FILE_NAME && !strchr(name, '/') &&
+        strcmp(name, ".") && strcmp(name, "..");
+}
+
+static int dir_size(Mountpoint *mp, u64 dir, u64 *size) {
+    Inode *inode = scratch_buffer(SCRATCH_METADATA, mp->block_size);
+    if(!inode || read_inode(mp, dir, inode) || !INODE_MODE_TYPE_IS_DIR(inode->mode))
+        return -1;
+
+    *size = inode->size;
+    return 0;
+}
+
+static int dir_init(Mountpoint *mp, u64 dir) {
+    usize size = DIR_HASHMAP_OFFSET(DIR_HASH_DEFAULT_SIZE);
+    Directory *header = calloc(1, size);
+    if(!header) return -1;
+
+    header->hashmap_size = DIR_HASH_DEFAULT_SIZE;
+    int status = write_to_inode(mp, dir, header, 0, size);
+    free(header);
+    return status;
+}
+
+/* walks one bucket looking for name, every nest is read in a single call */
+static int dir_search(Mountpoint *mp, u64 dir, const Directory *header, const char *name,
+    DirSearch *search) {
+    memset(search, 0, sizeof(DirSearch));
+    search->bucket = hash64(name, strlen(name), 0) % header->hashmap_size;
+
+    if(read_from_inode(mp, dir, &search->head, DIR_HASHMAP_OFFSET(search->bucket), sizeof(u64)))
+        return -1;
+
+    u64 offset = search->head;
+    while(offset) {
+        DirectoryHashNest nest;
+        if(read_from_inode(mp, dir, &nest, offset, sizeof(DirectoryHashNest)))
+            return -1;
+
+        DirectoryEntry *entries = malloc(nest.count * sizeof(DirectoryEntry));
+        if(!entries) return -1;
+
+        if(read_from_inode(mp, dir, entries, offset + sizeof(DirectoryHashNest),
+            nest.count * sizeof(DirectoryEntry))) {
+            free(entries);
+            return -1;
+        }
+
+        for(u64 i = 0; i < nest.count; i++) {
+            u64 entry_offset = offset + sizeof(DirectoryHashNest) + i * sizeof(DirectoryEntry);
+
+            if(!entries[i].inode) {
+                if(!search->free_slot) search->free_slot = entry_offset;
+                continue;
+            }
+
+            search->live_entries++;
+            if(!search->inode && !strncmp((const char *) entries[i].name, name, DIR_MAX_FILE_NAME)) {
+                search->inode = entries[i].inode;
+                search->entry_offset = entry_offset;
+            }
+        }
+
+        free(entries);
+        offset = nest.next;
+    }
+
+    return 0;
+}
+
+static int dir_collect(Mountpoint *mp, u64 dir, const Directory *header, DirectoryEntry **list,
+    u64 *count) {
+    DirectoryEntry *entries = malloc((header->file_count ? header->file_count : 1) *
+        sizeof(DirectoryEntry));
+    if(!entries) return -1;
+
+    u64 found = 0;
+    for(u64 bucket = 0; bucket < header->hashmap_size; bucket++) {
+        u64 offset;
+        if(read_from_inode(mp, dir, &offset, DIR_HASHMAP_OFFSET(bucket), sizeof(u64)))
+            goto fail;
+
+        while(offset) {
+            DirectoryHashNest nest;
+            if(read_from_inode(mp, dir, &nest, offset, sizeof(DirectoryHashNest)))
+                goto fail;
+
+            for(u64 i = 0; i < nest.count; i++) {
+                DirectoryEntry entry;
+                if(read_from_inode(mp, dir, &entry, offset + sizeof(DirectoryHashNest) +
+                    i * sizeof(DirectoryEntry), sizeof(DirectoryEntry)))
+                    goto fail;
+
+                if(!entry.inode) continue;
+                if(found == header->file_count) goto fail; // more entries than the header says
+
+                memcpy(&entries[found++], &entry, sizeof(DirectoryEntry));
+            }
+
+            offset = nest.next;
+        }
+    }
+
+    *list = entries;
+    *count = found;
+    return 0;
+
+fail:
+    free(entries);
+    return -1;
+}
+
+/* rewrites the directory with a new hash map size and one nest per bucket */
+static int dir_resize(Mountpoint *mp, u64 dir, Directory *header, u64 hashmap_size) {
+    DirectoryEntry *entries;
+    u64 count;
+    if(dir_collect(mp, dir, header, &entries, &count))
+        return -1;
+
+    u64 *buckets = malloc(count * sizeof(u64) + 1);
+    u64 *bucket_sizes = calloc(hashmap_size, sizeof(u64));
+    if(!buckets || !bucket_sizes) {
+        free(entries);
+        free(buckets);
+        free(bucket_sizes);
+        return -1;
+    }
+
+    u64 size = DIR_HASHMAP_OFFSET(hashmap_size);
+    for(u64 i = 0; i < count; i++) {
+        buckets[i] = hash64(entries[i].name, strlen((const char *) entries[i].name), 0) % hashmap_size;
+        if(!bucket_sizes[buckets[i]]++) size += sizeof(DirectoryHashNest);
+        size += sizeof(DirectoryEntry);
+    }
+
+    u8 *data = calloc(1, size);
+    if(!data) {
+        free(entries);
+        free(buckets);
+        free(bucket_sizes);
+        return -1;
+    }
+
+    // lay the nests out bucket by bucket, then fill them in entry order
+    Directory *new_header = (Directory *) data;
+    u64 offset = DIR_HASHMAP_OFFSET(hashmap_size);
+    u64 collisions = 0;
+
+    for(u64 bucket = 0; bucket < hashmap_size; bucket++) {
+        if(!bucket_sizes[bucket]) continue;
+
+        DirectoryHashNest *nest = (DirectoryHashNest *) (data + offset);
+        nest->next = 0;
+        nest->count = 0;
+        new_header->hashmap[bucket] = offset;
+
+        collisions += bucket_sizes[bucket] - 1;
+        offset += sizeof(DirectoryHashNest) + bucket_sizes[bucket] * sizeof(DirectoryEntry);
+    }
+
+    for(u64 i = 0; i < count; i++) {
+        DirectoryHashNest *nest = (DirectoryHashNest *) (data + new_header->hashmap[buckets[i]]);
+        memcpy(&nest->file[nest->count++], &entries[i], sizeof(DirectoryEntry));
+    }
+
+    u64 time_ns = dir_now();
+    int expand = hashmap_size > header->hashmap_size;
+
+    memcpy(new_header, header, sizeof(Directory));
+    new_header->hashmap_size = hashmap_size;
+    new_header->file_count = count;
+    new_header->collision_count = collisions;
+    new_header->last_resize_time = time_ns;
+    new_header->total_resizes++;
+
+    if(expand) {
+        new_header->last_expand_time = time_ns;
+        new_header->total_expands++;
+    } else {
+        new_header->last_shrink_time = time_ns;
+        new_header->total_shrinks++;
+    }
+
+    int status = write_to_inode(mp, dir, data, 0, size);
+    if(!status) status = truncate_inode(mp, dir, size);
+    if(!status) memcpy(header, new_header, sizeof(Directory));
+
+    free(data);
+    free(entries);
+    free(buckets);
+    free(bucket_sizes);
+    return status;
+}
+
+u64 dir_lookup(Mountpoint *mp, u64 dir, const char *name) {
+    if(!mp || !dir || !name || !*name)
+        return 0;
+
+    u64 size;
+    if(dir_size(mp, dir, &size) || !size)
+        return 0;
+
+    Directory header;
+    if(read_from_inode(mp, dir, &header, 0, sizeof(Directory)) || !header.hashmap_size)
+        return 0;
+
+    DirSearch search;
+    if(dir_search(mp, dir, &header, name, &search))
+        return 0;
+
+    return search.inode;
+}
+
+/* hands back every entry of the directory in a list the caller frees, an
+ * empty directory gives an empty list */
+int dir_list(Mountpoint *mp, u64 dir, DirectoryEntry **list, u64 *count) {
+    if(!mp || !dir || !list || !count)
+        return -1;
+
+    u64 size;
+    if(dir_size(mp, dir, &size))
+        return -1;
+
+    Directory header;
+    memset(&header, 0, sizeof(Directory));
+    if(size && read_from_inode(mp, dir, &header, 0, sizeof(Directory)))
+        return -1;
+
+    return dir_collect(mp, dir, &header, list, count);
+}
+
+static u64 dir_reverse(u64 x) {
+    x = ((x >> 1) & 0x5555555555555555ULL) | ((x & 0x5555555555555555ULL) << 1);
+    x = ((x >> 2) & 0x3333333333333333ULL) | ((x & 0x3333333333333333ULL) << 2);
+    x = ((x >> 4) & 0x0F0F0F0F0F0F0F0FULL) | ((x & 0x0F0F0F0F0F0F0F0FULL) << 4);
+    return __builtin_bswap64(x);
+}
+
+/* a directory is read in the order of its names' hashes with the bits
+ * reversed - a bucket holds the names that share the low bits of their hash,
+ * so at any power of two hash map size every bucket covers one contiguous
+ * range of positions and a position stays put when the directory resizes.
+ * the lowest bit is dropped to keep one past the last position clear of
+ * DIR_COOKIE_END */
+static u64 dir_position(const s8 *name) {
+    return dir_reverse(hash64(name, strlen((const char *) name), 0)) >> 1;
+}
+
+typedef struct DirPosition {
+    u64 position;
+    u64 index;              // into the entries of the bucket
+} DirPosition;
+
+static int position_compare(const void *a, const void *b) {
+    u64 x = ((const DirPosition *) a)->position;
+    u64 y = ((const DirPosition *) b)->position;
+    return x < y ? -1 : x > y;
+}
+
+/* the live entries of one bucket in a list the caller frees */
+static int dir_bucket(Mountpoint *mp, u64 dir, u64 bucket, DirectoryEntry **list, u64 *count) {
+    DirectoryEntry *entries = NULL;
+    u64 found = 0, capacity = 0, offset;
+    if(read_from_inode(mp, dir, &offset, DIR_HASHMAP_OFFSET(bucket), sizeof(u64)))
+        return -1;
+
+    while(offset) {
+        DirectoryHashNest nest;
+        if(read_from_inode(mp, dir, &nest, offset, sizeof(DirectoryHashNest)))
+            goto fail;
+
+        if(found + nest.count > capacity) {
+            capacity = found + nest.count;
+            DirectoryEntry *grown = realloc(entries, capacity * sizeof(DirectoryEntry));
+            if(!grown) goto fail;
+            entries = grown;
+        }
+
+        if(nest.count && read_from_inode(mp, dir, &entries[found], offset + sizeof(DirectoryHashNest),
+            nest.count * sizeof(DirectoryEntry)))
+            goto fail;
+
+        u64 kept = found;
+        for(u64 i = found; i < found + nest.count; i++) {
+            if(!entries[i].inode) continue;
+            if(i != kept) memcpy(&entries[kept], &entries[i], sizeof(DirectoryEntry));
+            kept++;
+        }
+
+        found = kept;
+
+        offset = nest.next;
+    }
+
+    *list = entries;
+    *count = found;
+    return 0;
+
+fail:
+    free(entries);
+    return -1;
+}
+
+/* reads the directory a batch at a time - the cookie starts at zero, comes
+ * back as the position to go on from and ends up DIR_COOKIE_END once every
+ * entry has been handed out. entries added or removed between calls may or
+ * may not show up, every other entry shows up exactly once */
+int dir_read(Mountpoint *mp, u64 dir, u64 *cookie, DirectoryEntry *entries, u64 max, u64 *count) {
+    if(!mp || !dir || !cookie || !entries || !count)
+        return -1;
+
+    *count = 0;
+    if(*cookie == DIR_COOKIE_END || !max)
+        return 0;
+
+    u64 size;
+    if(dir_size(mp, dir, &size))
+        return -1;
+
+    Directory header;
+    if(!size) {
+        *cookie = DIR_COOKIE_END;
+        return 0;
+    }
+
+    if(read_from_inode(mp, dir, &header, 0, sizeof(Directory)) || !header.hashmap_size ||
+        (header.hashmap_size & (header.hashmap_size - 1)))
+        return -1;
+
+    // the top bits of a position pick its range, and the range's bits
+    // reversed are its bucket
+    u64 bits = __builtin_ctzll(header.hashmap_size);
+    u64 shift = 63 - bits;
+
+    for(u64 range = *cookie >> shift; range < header.hashmap_size; range++) {
+        u64 bucket = bits ? dir_reverse(range) >> (64 - bits) : 0;
+
+        DirectoryEntry *found;
+        u64 live;
+        if(dir_bucket(mp, dir, bucket, &found, &live))
+            return -1;
+
+        DirPosition *order = malloc(live * sizeof(DirPosition) + 1);
+        if(!order) {
+            free(found);
+            return -1;
+        }
+
+        u64 pending = 0;
+        for(u64 i = 0; i < live; i++) {
+            u64 position = dir_position(found[i].name);
+            if(position < *cookie) continue;
+
+            order[pending].position = position;
+            order[pending++].index = i;
+        }
+
+        qsort(order, pending, sizeof(DirPosition), position_compare);
+
+        u64 taken = 0;
+        while(taken < pending && *count < max)
+            memcpy(&entries[(*count)++], &found[order[taken++].index], sizeof(DirectoryEntry));
+
+        if(taken < pending) {
+            // names sharing a position can't be split across batches, the
+            // cookie couldn't tell them apart
+            u64 position = order[taken].position;
+            while(taken && order[taken - 1].position == position) {
+                taken--;
+                (*count)--;
+            }
+
+            free(order);
+            free(found);
+            if(!*count) return -1; // the batch is too small for them
+
+            *cookie = position;
+            return 0;
+        }
+
+        free(order);
+        free(found);
+
+        *cookie = range + 1 < header.hashmap_size ? (range + 1) << shift : DIR_COOKIE_END;
+        if(*count == max) return 0;
+    }
+
+    *cookie = DIR_COOKIE_END;
+    return 0;
+}
+
+/* calls back for every file below dir, the directories are visited with an
+ * explicit stack so deep trees don't cost any call stack - a non-zero return
+ * from the callback stops the walk and is handed back */
+int dir_walk(Mountpoint *mp, u64 dir, FileCallback callback, void *context) {
+    if(!mp || !dir || !callback)
+        return -1;
+
+    Inode *inode = malloc(mp->block_size);
+    u64 *stack = malloc(64 * sizeof(u64));
+    u64 depth = 0, capacity = 64;
+    int status = -1;
+    if(!inode || !stack) goto done;
+
+    stack[depth++] = dir;
+    while(depth) {
+        DirectoryEntry *entries;
+        u64 count;
+        if(dir_list(mp, stack[--depth], &entries, &count)) goto done;
+
+        for(u64 i = 0; i < count; i++) {
+            if(read_inode(mp, entries[i].inode, inode)) {
+                free(entries);
+                goto done;
+            }
+
+            if(!INODE_MODE_TYPE_IS_DIR(inode->mode)) {
+                status = callback(mp, entries[i].inode, inode, context);
+                if(status) {
+                    free(entries);
+                    goto done;
+                }
+
+                status = -1;
+                continue;
+            }
+
+            if(depth == capacity) {
+                u64 *grown = realloc(stack, capacity * 2 * sizeof(u64));
+                if(!grown) {
+                    free(entries);
+                    goto done;
+                }
+
+                stack = grown;
+                capacity *= 2;
+            }
+
+            stack[depth++] = entries[i].inode;
+        }
+
+        free(entries);
+    }
+
+    status = 0;
+
+done:
+    free(inode);
+    free(stack);
+    return status;
+}
+
+int dir_add(Mountpoint *mp, u64 dir, const char *name, u64 inode) {
+    if(!mp || !dir || !name || !inode || !dir_valid_name(name))
+        return -1;
+
+    u64 size;
+    if(dir_size(mp, dir, &size)) return -1;
+
+    if(!size) {
+        if(dir_init(mp, dir) || dir_size(mp, dir, &size)) return -1;
+    }
+
+    Directory header;
+    if(read_from_inode(mp, dir, &header, 0, sizeof(Directory)) || !header.hashmap_size)
+        return -1;
+
+    DirSearch search;
+    if(dir_search(mp, dir, &header, name, &search) || search.inode)
+        return -1;
+
+    DirectoryEntry entry;
+    memset(&entry, 0, sizeof(DirectoryEntry));
+    entry.inode = inode;
+    strcpy((char *) entry.name, name);
+
+    if(search.free_slot) {
+        if(write_to_inode(mp, dir, &entry, search.free_slot, sizeof(DirectoryEntry)))
+            return -1;
+    } else {
+        // prepend a new nest with one slot, written at the end of the directory
+        struct {
+            DirectoryHashNest nest;
+            DirectoryEntry entry;
+        } __attribute__((packed)) nest;
+
+        nest.nest.next = search.head;
+        nest.nest.count = 1;
+        memcpy(&nest.entry, &entry, sizeof(DirectoryEntry));
+
+        if(write_to_inode(mp, dir, &nest, size, sizeof(nest)) ||
+            write_to_inode(mp, dir, &size, DIR_HASHMAP_OFFSET(search.bucket), sizeof(u64)))
+            return -1;
+    }
+
+    header.file_count++;
+    if(search.live_entries) header.collision_count++;
+
+    if(write_to_inode(mp, dir, &header, 0, sizeof(Directory)))
+        return -1;
+
+    // the collision rate means little until the directory has a few entries
+    if(header.file_count * 100 >= header.hashmap_size * DIR_HASH_GROW_LOAD_FACTOR ||
+        (header.file_count >= DIR_HASH_DEFAULT_SIZE &&
+        header.collision_count * 100 >= header.file_count * DIR_HASH_GROW_COLLISION_RATE))
+        return dir_resize(mp, dir, &header, header.hashmap_size * 2);
+
+    return 0;
+}
+
+/* sizes the hash map for entries names up front, so that filling the
+ * directory never stops to resize it - at half load the collision rate
+ * stays under DIR_HASH_GROW_COLLISION_RATE. the map only ever grows here */
+int dir_reserve(Mountpoint *mp, u64 dir, u64 entries) {
+    if(!mp || !dir)
+        return -1;
+
+    u64 size;
+    if(dir_size(mp, dir, &size)) return -1;
+
+    if(!size) {
+        if(dir_init(mp, dir)) return -1;
+    }
+
+    Directory header;
+    if(read_from_inode(mp, dir, &header, 0, sizeof(Directory)) || !header.hashmap_size)
+        return -1;
+
+    u64 hashmap_size = header.hashmap_size;
+    while(hashmap_size < entries * 2)
+        hashmap_size <<= 1;
+
+    if(hashmap_size == header.hashmap_size)
+        return 0;
+
+    return dir_resize(mp, dir, &header, hashmap_size);
+}
+
+int dir_remove(Mountpoint *mp, u64 dir, const char *name) {
+    if(!mp || !dir || !name || !*name)
+        return -1;
+
+    u64 size;
+    if(dir_size(mp, dir, &size) || !size) return -1;
+
+    Directory header;
+    if(read_from_inode(mp, dir, &header, 0, sizeof(Directory)) || !header.hashmap_size)
+        return -1;
+
+    DirSearch search;
+    if(dir_search(mp, dir, &header, name, &search) || !search.inode)
+        return -1;
+
+    DirectoryEntry entry;
+    memset(&entry, 0, sizeof(DirectoryEntry));
+    if(write_to_inode(mp, dir, &entry, search.entry_offset, sizeof(DirectoryEntry)))
+        return -1;
+
+    header.file_count--;
+    if(search.live_entries > 1) header.collision_count--;
+
+    if(write_to_inode(mp, dir, &header, 0, sizeof(Directory)))
+        return -1;
+
+    if(header.hashmap_size > DIR_HASH_DEFAULT_SIZE &&
+        header.file_count * 100 < header.hashmap_size * DIR_HASH_SHRINK_LOAD_FACTOR &&
+        (!header.file_count ||
+        header.collision_count * 100 < header.file_count * DIR_HASH_SHRINK_COLLISION_RATE))
+        return dir_resize(mp, dir, &header, header.hashmap_size / 2);
+
+    return 0;
+}
+
+u64 create_file(Mountpoint *mp, const char *path, u32 mode) {
+    char name[DIR_MAX_FILE_NAME];
+    u64 parent = resolve_parent(mp, path, name);
+    if(!parent || dir_lookup(mp, parent, name))
+        return 0;
+
+    u64 inode = create_inode(mp, mode);
+    if(!inode) return 0;
+
+    if(dir_add(mp, parent, name, inode)) {
+        free_inode(mp, inode);
+        return 0;
+    }
+
+    return inode;
+}
+
+/* drops the link from the parent, and the inode with all of its blocks once
+ * nothing links to it anymore - directories have to be empty */
+int remove_file(Mountpoint *mp, const char *path) {
+    char name[DIR_MAX_FILE_NAME];
+    u64 parent = resolve_parent(mp, path, name);
+    if(!parent) return -1;
+
+    u64 inode = dir_lookup(mp, parent, name);
+    if(!inode) return -1;
+
+    Inode *buf = scratch_buffer(SCRATCH_METADATA, mp->block_size);
+    if(!buf || read_inode(mp, inode, buf)) return -1;
+
+    if(INODE_MODE_TYPE_IS_DIR(buf->mode) && buf->size) {
+        Directory header;
+        if(read_from_inode(mp, inode, &header, 0, sizeof(Directory)) || header.file_count)
+            return -1;
+    }
+
+    if(path_index_forget(mp, path) || dir_remove(mp, parent, name) || read_inode(mp, inode, buf))
+        return -1;
+
+    if(buf->link_count > 1) {
+        buf->link_count--;
+        buf->changed_time = dir_now();
+        return write_inode(mp, inode, buf);
+    }
+
+    if(truncate_inode(mp, inode, 0)) return -1;
+    return free_inode(mp, inode);
+}
+
+/* makes path a copy of source that shares all of its data blocks, so only the
+ * new inode and its extent tree are written - a shared block is copied the
+ * first time either file writes to it */
+u64 clone_file(Mountpoint *mp, const char *source, const char *path) {
+    u64 original = resolve(mp, source);
+    if(!original) return 0;
+
+    // delayed data has to be on disk before it can be shared
+    CachedInode *cached = icache_get(mp, original, 1);
+    if(!cached) return 0;
+
+    int status = flush_inode(mp, cached);
+    icache_put(mp, cached);
+    if(status) return 0;
+
+    Inode *from = malloc(mp->block_size);
+    Inode *to = malloc(mp->block_size);
+    ExtentNode *leaves = NULL;
+    u64 count = 0, shared = 0, inode = 0;
+
+    if(!from || !to || read_inode(mp, original, from) || !INODE_MODE_TYPE_IS_REG(from->mode))
+        goto done;
+
+    if(from->extent_tree_root && extent_collect(mp, from->extent_tree_root, &leaves, &count))
+        goto done;
+
+    inode = create_file(mp, path, from->mode);
+    if(!inode || read_inode(mp, inode, to)) {
+        inode = 0;
+        goto done;
+    }
+
+    for(; shared < count; shared++) {
+        if(leaves[shared].block_count &&
+            refcount_share(mp, leaves[shared].block, leaves[shared].block_count))
+            goto fail;
+    }
+
+    to->size = from->size;
+    to->inline_size = from->inline_size;
+    memcpy(to->payload, from->payload, from->inline_size);
+
+    if(extent_rebuild(mp, to, leaves, count) || write_inode(mp, inode, to))
+        goto fail;
+
+    goto done;
+
+fail:
+    // hand back the references taken so far, the blocks stay with the source
+    for(u64 i = 0; i < shared; i++) {
+        for(u64 b = 0; b < leaves[i].block_count; b++)
+            free_block(mp, leaves[i].block + b);
+    }
+
+    to->extent_tree_root = 0;
+    write_inode(mp, inode, to);
+    remove_file(mp, path);
+    inode = 0;
+
+done:
+    free(leaves);
+    free(from);
+    free(to);
+    return inode;
+}
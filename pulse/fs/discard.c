@@ -0,0 +1,224 @@
+/*
+ * pulse - a highly scalable SSD-first file system with predictable logarithmic
+ * bounds across all operations
+ * 
+ * Copyright (c) 2025 Omar Elghoul
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+#include <pulse/pulse.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
+
+/* freed blocks are handed back to the device so an SSD stops carrying data
+ * that nobody references - image files get holes punched instead, which also
+ * keeps them sparse. in batched mode freed ranges are merged in memory and go
+ * out on sync, everything here runs under the bitmap lock because a range is
+ * only safe to discard while it is still free */
+
+int discard_init(Mountpoint *mp) {
+    if(!mp || !mp->disk) return -1;
+
+    struct stat st;
+    if(fstat(fileno(mp->disk), &st))
+        return -1;
+
+    mp->discard_device = S_ISBLK(st.st_mode);
+    mp->discard_mode = DISCARD_BATCHED;
+    return 0;
+}
+
+void discard_destroy(Mountpoint *mp) {
+    if(!mp) return;
+
+    free(mp->discards);
+    mp->discards = NULL;
+    mp->discard_count = 0;
+    mp->discard_capacity = 0;
+}
+
+/* a device or file system that can't discard turns discarding off for the
+ * volume, it only ever was a hint */
+static int discard_issue(Mountpoint *mp, u64 block, u64 count) {
+    int fd = fileno(mp->disk);
+    u64 range[2] = { block * mp->block_size, count * mp->block_size };
+    int status;
+
+    if(mp->discard_device)
+        status = ioctl(fd, BLKDISCARD, range);
+    else
+        status = fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, range[0], range[1]);
+
+    if(status) {
+        if(errno == EOPNOTSUPP || errno == ENOTTY || errno == ENOSYS) {
+            mp->discard_mode = DISCARD_OFF;
+            return 0;
+        }
+
+        perror(mp->discard_device ? "ioctl" : "fallocate");
+        return -1;
+    }
+
+    __atomic_fetch_add(&mp->io_stats.discards, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&mp->io_stats.bytes_discarded, range[1], __ATOMIC_RELAXED);
+    return 0;
+}
+
+static int range_compare(const void *a, const void *b) {
+    u64 x = ((const DiscardRange *) a)->block;
+    u64 y = ((const DiscardRange *) b)->block;
+    return x < y ? -1 : x > y;
+}
+
+/* blocks freed since they were queued may have been allocated again, so each
+ * merged range is split on the current bitmap and only the free parts go out */
+static int flush_locked(Mountpoint *mp) {
+    if(!mp->discard_count) return 0;
+
+    u8 *bitmap = scratch_buffer(SCRATCH_BITMAP, mp->block_size);
+    if(!bitmap) return -1;
+
+    qsort(mp->discards, mp->discard_count, sizeof(DiscardRange), range_compare);
+
+    u64 merged = 0;
+    for(u64 i = 1; i < mp->discard_count; i++) {
+        DiscardRange *last = &mp->discards[merged];
+        DiscardRange *next = &mp->discards[i];
+
+        if(next->block <= last->block + last->count) {
+            u64 end = next->block + next->count;
+            if(end > last->block + last->count)
+                last->count = end - last->block;
+        } else {
+            mp->discards[++merged] = *next;
+        }
+    }
+
+    u64 ranges = merged + 1;
+    u64 bits_per_block = mp->block_size * 8;
+    u64 loaded = -1;
+    int status = 0;
+
+    for(u64 i = 0; i < ranges && mp->discard_mode != DISCARD_OFF && !status; i++) {
+        u64 block = mp->discards[i].block;
+        u64 end = block + mp->discards[i].count;
+        u64 run_start = block, run_length = 0;
+
+        for(; block < end; block++) {
+            u64 bit = mp->layer_starts[0] + block;
+            u64 bitmap_block = bit / bits_per_block + mp->superblock->bitmap_block;
+
+            if(bitmap_block != loaded) {
+                if(read_block(mp->disk, &mp->io_stats, bitmap_block, mp->block_size, 1, bitmap,
+                    IO_BITMAP)) {
+                    status = -1;
+                    break;
+                }
+                loaded = bitmap_block;
+            }
+
+            if(!read_bit(bitmap, bit % bits_per_block)) {
+                if(!run_length) run_start = block;
+                run_length++;
+                continue;
+            }
+
+            if(run_length && discard_issue(mp, run_start, run_length)) {
+                status = -1;
+                break;
+            }
+            run_length = 0;
+        }
+
+        if(!status && run_length && discard_issue(mp, run_start, run_length))
+            status = -1;
+    }
+
+    mp->discard_count = 0;
+    return status;
+}
+
+/* queues a freed range, the caller holds the bitmap lock - blocks are freed
+ * one at a time when a file goes away, so a range that continues the last
+ * one just grows it */
+int discard_add(Mountpoint *mp, u64 block, u64 count) {
+    if(!mp || !count) return -1;
+
+    switch(mp->discard_mode) {
+    case DISCARD_OFF:
+        return 0;
+    case DISCARD_ONLINE:
+        return discard_issue(mp, block, count);
+    }
+
+    if(mp->discard_count) {
+        DiscardRange *last = &mp->discards[mp->discard_count - 1];
+        if(last->block + last->count == block) {
+            last->count += count;
+            return 0;
+        }
+    }
+
+    if(mp->discard_count == DISCARD_BATCH_RANGES && flush_locked(mp))
+        return -1;
+
+    if(mp->discard_count == mp->discard_capacity) {
+        u64 capacity = mp->discard_capacity ? mp->discard_capacity * 2 : 64;
+        DiscardRange *discards = realloc(mp->discards, capacity * sizeof(DiscardRange));
+        if(!discards) return -1;
+
+        mp->discards = discards;
+        mp->discard_capacity = capacity;
+    }
+
+    mp->discards[mp->discard_count].block = block;
+    mp->discards[mp->discard_count].count = count;
+    mp->discard_count++;
+    return 0;
+}
+
+int discard_flush(Mountpoint *mp) {
+    if(!mp || !mp->superblock) return -1;
+
+    pthread_mutex_lock(&mp->bitmap_lock);
+    int status = flush_locked(mp);
+    pthread_mutex_unlock(&mp->bitmap_lock);
+    return status;
+}
+
+/* ranges queued under the old mode still go out when leaving batched mode */
+int discard_set_mode(Mountpoint *mp, DiscardMode mode) {
+    if(!mp || !mp->superblock) return -1;
+    if(mode != DISCARD_OFF && mode != DISCARD_ONLINE && mode != DISCARD_BATCHED)
+        return -1;
+
+    pthread_mutex_lock(&mp->bitmap_lock);
+    int status = flush_locked(mp);
+    mp->discard_mode = mode;
+    pthread_mutex_unlock(&mp->bitmap_lock);
+    return status;
+}
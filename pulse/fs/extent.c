@@ -0,0 +1,680 @@
+/*
+ * pulse - a highly scalable SSD-first file system with predictable logarithmic
+ * bounds across all operations
+ * 
+ * Copyright (c) 2025 Omar Elghoul
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <pulse/pulse.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* every extent tree node occupies its own block - leaves map a run of file
+ * bytes to a run of contiguous blocks, internal nodes point at their leftmost
+ * child and the remaining children are reached through right_sibling_block */
+
+static int extent_walk_node(FILE *disk, IOStats *stats, u32 block_size, u64 node_block, u64 parent_block,
+    void *scratch, int depth, ExtentCallback callback, void *context, u64 *right_sibling) {
+    if(depth >= EXTENT_MAX_DEPTH) return -1;
+
+    if(read_block(disk, stats, node_block, block_size, 1, scratch, IO_EXTENT))
+        return -1;
+
+    // scratch is reused by the children so keep our own copy of the node
+    ExtentNode node;
+    memcpy(&node, scratch, sizeof(ExtentNode));
+
+    if(node.parent_block != parent_block)
+        return -1;
+
+    if(right_sibling) *right_sibling = node.right_sibling_block;
+
+    int status = callback(&node, node_block, context);
+    if(status) return status;
+
+    u64 child = node.block;
+    for(u64 i = 0; i < node.children; i++) {
+        if(!child) return -1;
+
+        status = extent_walk_node(disk, stats, block_size, child, node_block, scratch,
+            depth + 1, callback, context, &child);
+        if(status) return status;
+    }
+
+    return 0;
+}
+
+/* depth-first walk over every node of an extent tree, leaves are visited in
+ * file order - scratch must hold one block, and nothing else is shared so this
+ * can run on several threads for different trees */
+int extent_walk(FILE *disk, IOStats *stats, u32 block_size, u64 root, void *scratch,
+    ExtentCallback callback, void *context) {
+    if(!disk || !scratch || !callback) return -1;
+    if(!root) return 0;
+
+    return extent_walk_node(disk, stats, block_size, root, 0, scratch, 0, callback, context, NULL);
+}
+
+/* the operations below share the thread's extent scratch block, nodes are
+ * always copied out before anything else is read - callers hold the lock of
+ * the inode that owns the tree */
+
+int extent_read(Mountpoint *mp, u64 block, ExtentNode *node) {
+    u8 *scratch = scratch_buffer(SCRATCH_EXTENT, mp->block_size);
+    if(!scratch || read_block(mp->disk, &mp->io_stats, block, mp->block_size, 1, scratch, IO_EXTENT))
+        return -1;
+
+    memcpy(node, scratch, sizeof(ExtentNode));
+    return 0;
+}
+
+static int extent_write(Mountpoint *mp, u64 block, const ExtentNode *node) {
+    u8 *scratch = scratch_buffer(SCRATCH_EXTENT, mp->block_size);
+    if(!scratch) return -1;
+
+    memset(scratch, 0, mp->block_size);
+    memcpy(scratch, node, sizeof(ExtentNode));
+    return write_block(mp->disk, &mp->io_stats, block, mp->block_size, 1, scratch, IO_EXTENT);
+}
+
+/* finds the leaf with the highest start offset at or below offset, or the
+ * first leaf if offset comes before all of them - the caller decides whether
+ * offset is actually mapped by it */
+int extent_find(Mountpoint *mp, u64 root, u64 offset, ExtentNode *leaf, u64 *leaf_block) {
+    if(!mp || !root || !leaf) return -1;
+
+    u64 block = root;
+    for(int depth = 0; depth < EXTENT_MAX_DEPTH; depth++) {
+        ExtentNode node;
+        if(extent_read(mp, block, &node)) return -1;
+
+        if(!node.children) {
+            memcpy(leaf, &node, sizeof(ExtentNode));
+            if(leaf_block) *leaf_block = block;
+            return 0;
+        }
+
+        u64 chosen = node.block;
+        u64 child = node.block;
+        for(u64 i = 0; i < node.children && child; i++) {
+            ExtentNode next;
+            if(extent_read(mp, child, &next)) return -1;
+            if(i && next.start_offset > offset) break;
+
+            chosen = child;
+            child = next.right_sibling_block;
+        }
+
+        block = chosen;
+    }
+
+    return -1;
+}
+
+/* writes a node back after it changed - an internal node starts where its
+ * first child does, which lookups rely on, and covers at least the end of
+ * every child, so the ancestors follow along as far as they need to */
+int extent_update(Mountpoint *mp, u64 leaf_block, const ExtentNode *leaf) {
+    if(extent_write(mp, leaf_block, leaf)) return -1;
+
+    u64 block = leaf_block;
+    u64 start = leaf->start_offset;
+    u64 end = leaf->start_offset + leaf->length;
+    u64 parent = leaf->parent_block;
+
+    for(int depth = 0; parent && depth < EXTENT_MAX_DEPTH; depth++) {
+        ExtentNode node;
+        if(extent_read(mp, parent, &node)) return -1;
+
+        u64 node_end = node.start_offset + node.length;
+        int first = node.block == block;
+        if((!first || node.start_offset == start) && node_end >= end) break;
+
+        if(first) node.start_offset = start;
+        if(node_end < end) node_end = end;
+        node.length = node_end - node.start_offset;
+
+        if(extent_write(mp, parent, &node)) return -1;
+
+        block = parent;
+        start = node.start_offset;
+        end = node_end;
+        parent = node.parent_block;
+    }
+
+    return 0;
+}
+
+static u64 extent_rightmost(Mountpoint *mp, u64 root) {
+    u64 block = root;
+
+    for(int depth = 0; depth < EXTENT_MAX_DEPTH; depth++) {
+        ExtentNode node;
+        if(extent_read(mp, block, &node)) return 0;
+        if(!node.children) return block;
+
+        block = node.block;
+        for(u64 i = 1; i < node.children; i++) {
+            ExtentNode child;
+            if(extent_read(mp, block, &child) || !child.right_sibling_block) return 0;
+            block = child.right_sibling_block;
+        }
+    }
+
+    return 0;
+}
+
+/* adds a leaf after the last one, which is how files grow - full nodes along
+ * the right edge are split by starting a new sibling, so this only touches
+ * one node per level and the tree stays balanced
+ * leaf_block may already be allocated by the caller, zero allocates it here */
+int extent_append(Mountpoint *mp, Inode *inode, const ExtentNode *leaf, u64 leaf_block) {
+    ExtentNode child;
+    memcpy(&child, leaf, sizeof(ExtentNode));
+    child.children = 0;
+    child.parent_block = 0;
+    child.left_sibling_block = 0;
+    child.right_sibling_block = 0;
+
+    u64 child_block = leaf_block ? leaf_block : allocate_block(mp);
+    if(child_block == -1) return -1;
+
+    if(!inode->extent_tree_root) {
+        if(extent_write(mp, child_block, &child)) return -1;
+        inode->extent_tree_root = child_block;
+        inode->extent_count = 1;
+        return 0;
+    }
+
+    u64 left_block = extent_rightmost(mp, inode->extent_tree_root);
+    if(!left_block) return -1;
+
+    for(int depth = 0; depth < EXTENT_MAX_DEPTH; depth++) {
+        ExtentNode left;
+        if(extent_read(mp, left_block, &left)) return -1;
+
+        left.right_sibling_block = child_block;
+        child.left_sibling_block = left_block;
+        u64 end = child.start_offset + child.length;
+
+        if(!left.parent_block) {
+            // the left node was the root, so the tree grows by one level
+            u64 root_block = allocate_block(mp);
+            if(root_block == -1) return -1;
+
+            ExtentNode root;
+            memset(&root, 0, sizeof(ExtentNode));
+            root.children = 2;
+            root.start_offset = left.start_offset;
+            root.length = end - left.start_offset;
+            root.block = left_block;
+
+            left.parent_block = root_block;
+            child.parent_block = root_block;
+
+            if(extent_write(mp, left_block, &left) || extent_write(mp, child_block, &child) ||
+                extent_write(mp, root_block, &root))
+                return -1;
+
+            inode->extent_tree_root = root_block;
+            break;
+        }
+
+        ExtentNode parent;
+        u64 parent_block = left.parent_block;
+        if(extent_write(mp, left_block, &left) || extent_read(mp, parent_block, &parent))
+            return -1;
+
+        if(parent.children < EXTENT_FANOUT) {
+            parent.children++;
+            child.parent_block = parent_block;
+            parent.length = end - parent.start_offset;
+
+            if(extent_write(mp, child_block, &child) || extent_update(mp, parent_block, &parent))
+                return -1;
+            break;
+        }
+
+        // the parent is full, start a new one next to it holding only the child
+        u64 sibling_block = allocate_block(mp);
+        if(sibling_block == -1) return -1;
+
+        child.parent_block = sibling_block;
+        if(extent_write(mp, child_block, &child)) return -1;
+
+        ExtentNode sibling;
+        memset(&sibling, 0, sizeof(ExtentNode));
+        sibling.children = 1;
+        sibling.start_offset = child.start_offset;
+        sibling.length = child.length;
+        sibling.block = child_block;
+
+        memcpy(&child, &sibling, sizeof(ExtentNode));
+        child_block = sibling_block;
+        left_block = parent_block;
+    }
+
+    inode->extent_count++;
+    return 0;
+}
+
+/* adds a leaf right after the one in left_block - a full parent hands the
+ * upper half of its children to a new sibling, which goes in after it one
+ * level up, so only one path and the neighbours along it are touched. the
+ * block the leaf went to is returned through leaf_block */
+int extent_insert_after(Mountpoint *mp, Inode *inode, u64 left_block, const ExtentNode *leaf,
+    u64 *leaf_block) {
+    ExtentNode child;
+    memcpy(&child, leaf, sizeof(ExtentNode));
+    child.children = 0;
+
+    u64 child_block = allocate_block(mp);
+    if(child_block == -1) return -1;
+    if(leaf_block) *leaf_block = child_block;
+
+    for(int depth = 0; depth < EXTENT_MAX_DEPTH; depth++) {
+        ExtentNode left;
+        if(extent_read(mp, left_block, &left)) return -1;
+
+        // link the new node in between left and whatever followed it
+        u64 right_block = left.right_sibling_block;
+        child.left_sibling_block = left_block;
+        child.right_sibling_block = right_block;
+        child.parent_block = left.parent_block;
+        left.right_sibling_block = child_block;
+
+        if(right_block) {
+            ExtentNode right;
+            if(extent_read(mp, right_block, &right)) return -1;
+            right.left_sibling_block = child_block;
+            if(extent_write(mp, right_block, &right)) return -1;
+        }
+
+        u64 end = child.start_offset + child.length;
+        if(!left.parent_block) {
+            // the left node was the root, so the tree grows by one level
+            u64 root_block = allocate_block(mp);
+            if(root_block == -1) return -1;
+
+            u64 left_end = left.start_offset + left.length;
+            ExtentNode root;
+            memset(&root, 0, sizeof(ExtentNode));
+            root.children = 2;
+            root.start_offset = left.start_offset;
+            root.length = (end > left_end ? end : left_end) - left.start_offset;
+            root.block = left_block;
+
+            left.parent_block = root_block;
+            child.parent_block = root_block;
+
+            if(extent_write(mp, left_block, &left) || extent_write(mp, child_block, &child) ||
+                extent_write(mp, root_block, &root))
+                return -1;
+
+            inode->extent_tree_root = root_block;
+            break;
+        }
+
+        ExtentNode parent;
+        u64 parent_block = left.parent_block;
+        if(extent_write(mp, left_block, &left) || extent_write(mp, child_block, &child) ||
+            extent_read(mp, parent_block, &parent))
+            return -1;
+
+        if(parent.children < EXTENT_FANOUT) {
+            parent.children++;
+            if(end > parent.start_offset + parent.length)
+                parent.length = end - parent.start_offset;
+
+            if(extent_update(mp, parent_block, &parent)) return -1;
+            break;
+        }
+
+        // the parent is full, the upper half of its children move to a new sibling
+        u64 sibling_block = allocate_block(mp);
+        if(sibling_block == -1) return -1;
+
+        ExtentNode sibling;
+        memset(&sibling, 0, sizeof(ExtentNode));
+        u64 total = parent.children + 1;
+        u64 keep = total / 2;
+        u64 kept_end = parent.start_offset, moved_end = 0;
+        u64 block = parent.block;
+
+        for(u64 i = 0; i < total && block; i++) {
+            ExtentNode node;
+            if(extent_read(mp, block, &node)) return -1;
+
+            u64 node_end = node.start_offset + node.length;
+            u64 next = node.right_sibling_block;
+
+            if(i < keep) {
+                if(node_end > kept_end) kept_end = node_end;
+            } else {
+                if(i == keep) {
+                    sibling.block = block;
+                    sibling.start_offset = node.start_offset;
+                }
+
+                if(node_end > moved_end) moved_end = node_end;
+                node.parent_block = sibling_block;
+                if(extent_write(mp, block, &node)) return -1;
+            }
+
+            block = next;
+        }
+
+        sibling.children = total - keep;
+        sibling.length = moved_end - sibling.start_offset;
+        parent.children = keep;
+        parent.length = kept_end - parent.start_offset;
+        if(extent_write(mp, parent_block, &parent)) return -1;
+
+        memcpy(&child, &sibling, sizeof(ExtentNode));
+        child_block = sibling_block;
+        left_block = parent_block;
+    }
+
+    inode->extent_count++;
+    return 0;
+}
+
+/* unlinks a leaf from its level and frees its node, along with any parents it
+ * leaves without children and a root down to a single child - the nodes that
+ * remain may still cover more than they hold at the end, which lookups don't
+ * mind */
+int extent_remove(Mountpoint *mp, Inode *inode, u64 leaf_block) {
+    u64 block = leaf_block;
+
+    for(int depth = 0; depth < EXTENT_MAX_DEPTH; depth++) {
+        ExtentNode node;
+        if(extent_read(mp, block, &node)) return -1;
+
+        if(node.left_sibling_block) {
+            ExtentNode left;
+            if(extent_read(mp, node.left_sibling_block, &left)) return -1;
+            left.right_sibling_block = node.right_sibling_block;
+            if(extent_write(mp, node.left_sibling_block, &left)) return -1;
+        }
+
+        ExtentNode right;
+        if(node.right_sibling_block) {
+            if(extent_read(mp, node.right_sibling_block, &right)) return -1;
+            right.left_sibling_block = node.left_sibling_block;
+            if(extent_write(mp, node.right_sibling_block, &right)) return -1;
+        }
+
+        if(free_block(mp, block)) return -1;
+
+        if(!node.parent_block) {
+            inode->extent_tree_root = 0;
+            break;
+        }
+
+        ExtentNode parent;
+        if(extent_read(mp, node.parent_block, &parent)) return -1;
+
+        if(--parent.children) {
+            // the next child takes over as the first one if this one was
+            if(parent.block == block) {
+                u64 parent_end = parent.start_offset + parent.length;
+                parent.block = node.right_sibling_block;
+                parent.start_offset = right.start_offset;
+                parent.length = parent_end > right.start_offset ? parent_end - right.start_offset : 0;
+            }
+
+            if(extent_update(mp, node.parent_block, &parent)) return -1;
+            break;
+        }
+
+        block = node.parent_block;
+    }
+
+    // a root left with a single child hands the tree over to it
+    for(int depth = 0; inode->extent_tree_root && depth < EXTENT_MAX_DEPTH; depth++) {
+        ExtentNode root, child;
+        if(extent_read(mp, inode->extent_tree_root, &root)) return -1;
+        if(root.children != 1) break;
+
+        if(extent_read(mp, root.block, &child)) return -1;
+        child.parent_block = 0;
+
+        if(extent_write(mp, root.block, &child) || free_block(mp, inode->extent_tree_root))
+            return -1;
+
+        inode->extent_tree_root = root.block;
+    }
+
+    if(inode->extent_count) inode->extent_count--;
+    return 0;
+}
+
+static int extent_collect_node(const ExtentNode *node, u64 node_block, void *context) {
+    struct {
+        ExtentNode *leaves;
+        u64 count;
+        u64 capacity;
+    } *list = context;
+
+    if(node->children) return 0;
+
+    if(list->count == list->capacity) {
+        u64 capacity = list->capacity ? list->capacity * 2 : 16;
+        ExtentNode *leaves = realloc(list->leaves, capacity * sizeof(ExtentNode));
+        if(!leaves) return -1;
+        list->leaves = leaves;
+        list->capacity = capacity;
+    }
+
+    memcpy(&list->leaves[list->count++], node, sizeof(ExtentNode));
+    return 0;
+}
+
+/* copies every leaf out of a tree in file order, the caller frees the list */
+int extent_collect(Mountpoint *mp, u64 root, ExtentNode **leaves, u64 *count) {
+    struct {
+        ExtentNode *leaves;
+        u64 count;
+        u64 capacity;
+    } list = { NULL, 0, 0 };
+
+    if(extent_walk(mp->disk, &mp->io_stats, mp->block_size, root,
+        scratch_buffer(SCRATCH_EXTENT, mp->block_size), extent_collect_node, &list)) {
+        free(list.leaves);
+        return -1;
+    }
+
+    *leaves = list.leaves;
+    *count = list.count;
+    return 0;
+}
+
+static int extent_free_node(const ExtentNode *node, u64 node_block, void *context) {
+    return free_block((Mountpoint *) context, node_block);
+}
+
+/* frees the nodes of a tree, not the data blocks its leaves map */
+int extent_free_tree(Mountpoint *mp, u64 root) {
+    if(!root) return 0;
+    return extent_walk(mp->disk, &mp->io_stats, mp->block_size, root,
+        scratch_buffer(SCRATCH_EXTENT, mp->block_size), extent_free_node, mp);
+}
+
+/* replaces the whole tree with one built bottom-up from a sorted list of
+ * leaves, data blocks are left alone and only the nodes are reallocated */
+int extent_rebuild(Mountpoint *mp, Inode *inode, const ExtentNode *leaves, u64 count) {
+    if(extent_free_tree(mp, inode->extent_tree_root))
+        return -1;
+
+    inode->extent_tree_root = 0;
+    return extent_build(mp, inode, leaves, count);
+}
+
+/* builds a tree for an inode that has none, on freshly allocated nodes - the
+ * nodes of a tree the inode had before are left to the caller */
+int extent_build(Mountpoint *mp, Inode *inode, const ExtentNode *leaves, u64 count) {
+    inode->extent_tree_root = 0;
+    inode->extent_count = count;
+    if(!count) return 0;
+
+    ExtentNode *level = malloc(count * sizeof(ExtentNode));
+    u64 *blocks = malloc(count * sizeof(u64));
+    if(!level || !blocks) {
+        free(level);
+        free(blocks);
+        return -1;
+    }
+
+    memcpy(level, leaves, count * sizeof(ExtentNode));
+    for(u64 i = 0; i < count; i++) {
+        level[i].children = 0;
+        blocks[i] = allocate_block(mp);
+        if(blocks[i] == -1) goto fail;
+    }
+
+    u64 n = count;
+    for(int depth = 0; ; depth++) {
+        for(u64 i = 0; i < n; i++) {
+            level[i].left_sibling_block = i ? blocks[i-1] : 0;
+            level[i].right_sibling_block = (i + 1 < n) ? blocks[i+1] : 0;
+            level[i].parent_block = 0;
+        }
+
+        if(n == 1 || depth >= EXTENT_MAX_DEPTH) break;
+
+        // every parent takes the next EXTENT_FANOUT children, and the parents
+        // overwrite the front of the same arrays as we go
+        u64 parents = (n + EXTENT_FANOUT - 1) / EXTENT_FANOUT;
+        for(u64 p = 0; p < parents; p++) {
+            u64 first = p * EXTENT_FANOUT;
+            u64 last = (first + EXTENT_FANOUT < n) ? first + EXTENT_FANOUT - 1 : n - 1;
+
+            u64 parent_block = allocate_block(mp);
+            if(parent_block == -1) goto fail;
+
+            for(u64 i = first; i <= last; i++) {
+                level[i].parent_block = parent_block;
+                if(extent_write(mp, blocks[i], &level[i])) goto fail;
+            }
+
+            ExtentNode parent;
+            memset(&parent, 0, sizeof(ExtentNode));
+            parent.children = last - first + 1;
+            parent.start_offset = level[first].start_offset;
+            parent.length = level[last].start_offset + level[last].length - parent.start_offset;
+            parent.block = blocks[first];
+
+            memcpy(&level[p], &parent, sizeof(ExtentNode));
+            blocks[p] = parent_block;
+        }
+
+        n = parents;
+    }
+
+    if(extent_write(mp, blocks[0], &level[0])) goto fail;
+
+    inode->extent_tree_root = blocks[0];
+    free(level);
+    free(blocks);
+    return 0;
+
+fail:
+    free(level);
+    free(blocks);
+    return -1;
+}
+
+/* whether right continues left both in the file and on disk with the same
+ * flags, so the two could be a single leaf */
+int extent_continues(const ExtentNode *left, const ExtentNode *right, u32 block_size) {
+    return !left->compressed_length && !right->compressed_length &&
+        left->flags == right->flags && left->length == left->block_count * block_size &&
+        left->start_offset + left->length == right->start_offset &&
+        left->block + left->block_count == right->block;
+}
+
+/* joins neighbours in a sorted list of leaves that continue each other,
+ * returns how many are left */
+u64 extent_merge(ExtentNode *leaves, u64 count, u32 block_size) {
+    u64 kept = 0;
+    for(u64 i = 0; i < count; i++) {
+        ExtentNode *left = kept ? &leaves[kept - 1] : NULL;
+        ExtentNode *right = &leaves[i];
+
+        if(left && extent_continues(left, right, block_size)) {
+            left->block_count += right->block_count;
+            left->length += right->length;
+            continue;
+        }
+
+        if(kept != i) memcpy(&leaves[kept], right, sizeof(ExtentNode));
+        kept++;
+    }
+
+    return kept;
+}
+
+/* inserts a leaf anywhere in the file, filling a hole or going in front of
+ * the existing extents - a leaf that continues the one before it joins it,
+ * otherwise it goes in right after it. leaf_block is set to the node that
+ * now maps the leaf */
+int extent_insert(Mountpoint *mp, Inode *inode, const ExtentNode *leaf, u64 *leaf_block) {
+    if(!inode->extent_tree_root) {
+        if(extent_append(mp, inode, leaf, 0)) return -1;
+        if(leaf_block) *leaf_block = inode->extent_tree_root;
+        return 0;
+    }
+
+    ExtentNode left;
+    u64 left_block;
+    if(extent_find(mp, inode->extent_tree_root, leaf->start_offset, &left, &left_block))
+        return -1;
+
+    if(left.start_offset > leaf->start_offset) {
+        // in front of everything, the first leaf moves to a new node right
+        // after its own and the new leaf takes its place
+        if(extent_insert_after(mp, inode, left_block, &left, NULL) ||
+            extent_read(mp, left_block, &left))
+            return -1;
+
+        ExtentNode first;
+        memcpy(&first, leaf, sizeof(ExtentNode));
+        first.children = 0;
+        first.parent_block = left.parent_block;
+        first.left_sibling_block = 0;
+        first.right_sibling_block = left.right_sibling_block;
+
+        if(extent_update(mp, left_block, &first)) return -1;
+        if(leaf_block) *leaf_block = left_block;
+        return 0;
+    }
+
+    if(extent_continues(&left, leaf, mp->block_size)) {
+        left.block_count += leaf->block_count;
+        left.length += leaf->length;
+
+        if(extent_update(mp, left_block, &left)) return -1;
+        if(leaf_block) *leaf_block = left_block;
+        return 0;
+    }
+
+    return extent_insert_after(mp, inode, left_block, leaf, leaf_block);
+}
@@ -29,14 +29,124 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+/* the bitmap is cut into chunks at multiples of FORMAT_WRITE_CHUNK on the
+ * disk and a pool of threads takes them in turn, so every write is large and
+ * aligned and no two threads touch the same blocks. on a sparse image file
+ * only runs with bits set are written, anything else has to be zeroed */
+typedef struct FormatWriter {
+    FILE *disk;
+    const u8 *bitmap;
+    u64 first;              // first block of the bitmap on the disk
+    u64 blocks;             // bitmap blocks
+    u64 chunk_blocks;
+    u32 block_size;
+    int sparse;
+    u64 next_chunk;
+    u64 written;
+    int failed;
+} FormatWriter;
+
+static int format_write_chunk(FormatWriter *writer, u64 chunk) {
+    u64 words_per_block = writer->block_size / sizeof(u64);
+    u64 start = chunk * writer->chunk_blocks;
+    u64 end = start + writer->chunk_blocks;
+    if(start < writer->first) start = writer->first;
+    if(end > writer->first + writer->blocks) end = writer->first + writer->blocks;
+
+    // block numbers on the disk from here on, i is the one in the bitmap
+    for(u64 i = start - writer->first; i < end - writer->first;) {
+        u64 run = 0;
+        while(i + run < end - writer->first) {
+            const u64 *words = (const u64 *) (writer->bitmap + (i + run) * writer->block_size);
+            u64 j = 0;
+
+            if(writer->sparse) {
+                while(j < words_per_block && !words[j]) j++;
+                if(j == words_per_block) break;
+            }
+
+            run++;
+        }
+
+        if(!run) {
+            i++;
+            continue;
+        }
+
+        if(write_block(writer->disk, NULL, writer->first + i, writer->block_size, run,
+            writer->bitmap + i * writer->block_size, IO_BITMAP))
+            return -1;
+
+        __atomic_fetch_add(&writer->written, run, __ATOMIC_RELAXED);
+        i += run;
+    }
+
+    return 0;
+}
+
+static void *format_main(void *arg) {
+    FormatWriter *writer = arg;
+    u64 last = (writer->first + writer->blocks - 1) / writer->chunk_blocks;
+
+    while(!__atomic_load_n(&writer->failed, __ATOMIC_RELAXED)) {
+        u64 chunk = __atomic_fetch_add(&writer->next_chunk, 1, __ATOMIC_RELAXED);
+        if(chunk > last) break;
+
+        if(format_write_chunk(writer, chunk))
+            __atomic_store_n(&writer->failed, 1, __ATOMIC_RELAXED);
+    }
+
+    return NULL;
+}
+
+/* writes the bitmap with a thread per cpu up to FORMAT_MAX_THREADS and never
+ * more threads than chunks, the calling thread is one of them */
+static int format_write_bitmap(FormatWriter *writer) {
+    u64 chunks = (writer->first + writer->blocks - 1) / writer->chunk_blocks -
+        writer->first / writer->chunk_blocks + 1;
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if(threads > FORMAT_MAX_THREADS) threads = FORMAT_MAX_THREADS;
+    if(threads > chunks) threads = chunks;
+    if(threads < 1) threads = 1;
+
+    writer->next_chunk = writer->first / writer->chunk_blocks;
+
+    pthread_t pool[FORMAT_MAX_THREADS];
+    long started = 0;
+    while(started < threads - 1 && !pthread_create(&pool[started], NULL, format_main, writer))
+        started++;
+
+    format_main(writer);
+    for(long i = 0; i < started; i++)
+        pthread_join(pool[i], NULL);
+
+    return writer->failed ? -1 : 0;
+}
 
 int format(const char *path, usize size, usize block_size, usize fanout) {
+    return format_volume(path, size, block_size, fanout, 0, SUPER_TUNING_ALLOCATOR_LOWEST);
+}
+
+/* with an inode size, inodes are packed into tables of several per block and
+ * the root directory takes the first slot of the first table. the allocator
+ * is one of SUPER_TUNING_ALLOCATOR_* and stays with the volume */
+int format_volume(const char *path, usize size, usize block_size, usize fanout,
+    usize inode_size, usize allocator) {
     usize block_count = size / block_size;
 
-    void *data = malloc(block_size);
-    if(!data) return -1;
+    if(inode_size && (inode_size < INODE_MIN_SIZE || inode_size > block_size / 2 ||
+        (inode_size & (inode_size - 1)) || block_size / inode_size > (1ULL << INODE_SLOT_SHIFT)))
+        return 1;
 
-    memset(data, 0, block_size);
+    if(allocator & ~SUPER_TUNING_ALLOCATOR_MASK)
+        return 1;
+
+    void *data = calloc(1, block_size);
+    if(!data) return -1;
 
     FILE *disk = fopen(path, "wb+");
     if(!disk) {
@@ -44,12 +154,24 @@ int format(const char *path, usize size, usize block_size, usize fanout) {
         return 1;
     }
 
-    for(usize i = 0; i < block_count; i++) {
-        if(fwrite(data, block_size, 1, disk) != 1) {
-            fclose(disk);
-            free(data);
-            return 1;
-        }
+    // image files are sized with ftruncate() so everything we never write stays
+    // a hole - only the superblock, the bitmap and the root inode are written,
+    // so formatting costs the same for any volume size
+    // block devices already have a size and can't be assumed to read as zero
+    struct stat st;
+    if(fstat(fileno(disk), &st)) {
+        perror("fstat");
+        fclose(disk);
+        free(data);
+        return 1;
+    }
+
+    int sparse = S_ISREG(st.st_mode);
+    if(sparse && ftruncate(fileno(disk), (off_t) block_count * block_size)) {
+        perror("ftruncate");
+        fclose(disk);
+        free(data);
+        return 1;
     }
 
     struct timespec ts;
@@ -67,6 +189,7 @@ int format(const char *path, usize size, usize block_size, usize fanout) {
 
     superblock->tuning = SUPER_TUNING_ENDIAN_NATIVE;
     superblock->tuning |= SUPER_TUNING_JOURNAL_NONE; // TODO
+    superblock->tuning |= allocator;
 
     // switch case and not bit arithmetic so we can validate the config here
     switch(block_size) {
@@ -144,143 +267,112 @@ int format(const char *path, usize size, usize block_size, usize fanout) {
 
     // calculate the size and structure of the hierarchical bitmap so we know
     // how many blocks to allocate for it
-    usize bitmap_size_bits = block_count;
-    usize highest_layer = bitmap_size_bits;
-    u8 layer_count = 1;
-
-    while(highest_layer > DEFAULT_BITMAP_LIMIT) {
-        highest_layer /= fanout;
-        bitmap_size_bits += highest_layer;
-        layer_count++;
-    }
+    u64 layer_starts[BITMAP_MAX_LAYERS];    // starting bit offset
+    u64 layer_sizes[BITMAP_MAX_LAYERS];     // size in bits
+    u32 layer_count = bitmap_layout(block_count, fanout, DEFAULT_BITMAP_LIMIT,
+        layer_starts, layer_sizes);
 
+    // the bottom layer is stored last so it also marks the end of the bitmap
+    u64 bitmap_size_bits = layer_starts[0] + BITMAP_LAYER_SPAN(layer_sizes[0]);
     u64 bitmap_blocks = (((bitmap_size_bits + 7) / 8) + block_size - 1) / block_size;
     u64 root_inode = SUPERBLOCK_BLOCK_NUMBER + 1 + bitmap_blocks;
-    superblock->root_inode = root_inode;
-    superblock->checksum = xxhash64(superblock, sizeof(SuperBlock));
-
-    if(write_block(disk, SUPERBLOCK_BLOCK_NUMBER, block_size, 1, superblock))
+    superblock->root_inode = inode_size ? root_inode << INODE_SLOT_SHIFT : root_inode;
+    superblock->inode_size = inode_size;
+
+    // the rest of the root directory's table starts out on the free list,
+    // which takes the block right after it
+    if(inode_size) superblock->inode_slot_block = root_inode + 1;
+    superblock->checksum = hash64(superblock, sizeof(SuperBlock), 0);
+
+    // the superblock is written last and is what makes the rest a volume, so
+    // whatever a device held there before has to go before anything else
+    void *block = calloc(1, block_size);
+    if(!block || (!sparse && write_block(disk, NULL, SUPERBLOCK_BLOCK_NUMBER, block_size, 1, block,
+        IO_SUPERBLOCK))) {
+        fclose(disk);
+        free(data);
+        free(block);
         return 1;
+    }
 
     // now we need to update the status of all the blocks up to the root inode
     // to be allocated - on the lowest level of the bitmap, this is simply setting
     // the corresponding bit to 1
     // for higher levels on the bitmap, the bit is only set to 1 if all its children
     // are set to 1
-    // we also need to track where each layer starts and ends because they are
-    // contiguous and not block-aligned nor are they the same size
     // the first layer pointed to by the superblock is the topmost (smallest) layer
     // and the last layer is the bottommost (largest) layer
 
     printf("    🛠️  building %u layer%s of hierarchical bitmap with fanout factor %zu\n",
         layer_count, layer_count > 1 ? "s" : "", fanout);
 
-    u64 *layer_sizes = calloc(layer_count, sizeof(u64)); // size in bits
-    u64 *layer_starts = calloc(layer_count, sizeof(u64));   // starting bit offset
-    if(!layer_starts) {
-        fclose(disk);
-        free(data);
-        return 1;
-    }
-
-    for(int i = layer_count-1; i >= 0; i--) {
-        if(i == layer_count-1) {
-            layer_starts[i] = 0;
-            layer_sizes[i] = highest_layer;
-        } else  {
-            if(i == layer_count-2) layer_starts[i] = highest_layer;
-            else layer_starts[i] = layer_starts[i+1] * fanout;
-
-            layer_sizes[i] = layer_sizes[i+1] * fanout;
-        }
-    }
-
-    u64 *layer_mapping_size = calloc(layer_count, sizeof(u64));
-    if(!layer_mapping_size) {
-        fclose(disk);
-        free(data);
-        free(layer_starts);
-        return 1;
-    }
-
+    u64 mapping_size = block_size;
     for(int i = 0; i < layer_count; i++) {
-        if(i == 0) layer_mapping_size[i] = 1;
-        else layer_mapping_size[i] = layer_mapping_size[i-1] * fanout;
-    }
-
-    for(int i = 0; i < layer_count; i++) {
-        printf("    🛠️  layer %d%s: bits %llu -> %llu (%d bits, each maps ", i,
+        printf("    🛠️  layer %d%s: bits %" PRIu64 " -> %" PRIu64 " (%" PRIu64 " bits, each maps ", i,
             !i ? " (bottom)" : (i == layer_count-1) ? " (top)" : "",
-            layer_starts[i],
-            (i > 0) ? layer_starts[i-1]-1 : layer_starts[i]+block_count-1,
-            (int)layer_sizes[i]);
-
-        u64 size = layer_mapping_size[i] * block_size;
-        if(size >> 40)
-            printf("%llu TB", size >> 40);
-        else if(size >> 30)
-            printf("%llu GB", size >> 30);
-        else if(size >> 20)
-            printf("%llu MB", size >> 20);
-        else if(size >> 10)
-            printf("%llu KB", size >> 10);
+            layer_starts[i], layer_starts[i] + layer_sizes[i] - 1, layer_sizes[i]);
+
+        if(mapping_size >> 40)
+            printf("%" PRIu64 " TB", mapping_size >> 40);
+        else if(mapping_size >> 30)
+            printf("%" PRIu64 " GB", mapping_size >> 30);
+        else if(mapping_size >> 20)
+            printf("%" PRIu64 " MB", mapping_size >> 20);
+        else if(mapping_size >> 10)
+            printf("%" PRIu64 " KB", mapping_size >> 10);
         else
-            printf("%llu B", size);
+            printf("%" PRIu64 " B", mapping_size);
         printf(")\n");
+
+        mapping_size *= fanout;
     }
 
     // now check how many total blocks we just allocated, including
-    // preallocating the root inode block
-    u64 allocated_blocks = root_inode + 1;
-    u8 *bitmap = calloc(bitmap_blocks, block_size);
+    // preallocating the root inode block and the free inode list
+    u64 allocated_blocks = root_inode + (inode_size ? 2 : 1);
+    u64 *bitmap = calloc(bitmap_blocks, block_size);
     if(!bitmap) {
         fclose(disk);
         free(data);
-        free(layer_mapping_size);
-        free(layer_starts);
+        free(block);
         return 1;
     }
 
-    // build the hierarchy
-    for(int i = 0; i < allocated_blocks; i++) {
-        write_bit(bitmap, layer_starts[0] + i, 1);
-
-        for(int j = 1; j < layer_count; j++) {
-            u64 sum = 0;
-            u64 factor = 1;
-            for(int k = 0; k < j; k++) {
-                factor *= fanout;
-            }
-
-            u64 bit = (i / factor);
-            u64 start = bit * fanout;
-
-            for(int k = 0; k < fanout; k++) {
-                sum += read_bit(bitmap, layer_starts[j-1] + start + k);
-            }
-
-            if(sum == fanout) {
-                write_bit(bitmap, layer_starts[j] + bit, 1);
-            }
-        }
+    // build the hierarchy bottom-up: mark the used prefix and the padding at
+    // the end of every layer, then derive each parent layer in one pass
+    bitmap_set_range(bitmap, layer_starts[0], allocated_blocks);
+    for(int i = 0; i < layer_count; i++) {
+        bitmap_set_range(bitmap, layer_starts[i] + layer_sizes[i],
+            BITMAP_LAYER_SPAN(layer_sizes[i]) - layer_sizes[i]);
     }
 
-    printf("    🛠️  writing %llu blocks of bitmap data\n", bitmap_blocks);
-    if(write_block(disk, superblock->bitmap_block, block_size, bitmap_blocks, bitmap)) {
+    bitmap_build_parents(bitmap, layer_count, layer_starts, layer_sizes, fanout);
+
+    // on a fresh image file the unwritten bitmap blocks are holes that already
+    // read as zero, so only runs of blocks that have bits set are written
+    FormatWriter writer;
+    memset(&writer, 0, sizeof(FormatWriter));
+    writer.disk = disk;
+    writer.bitmap = (const u8 *) bitmap;
+    writer.first = superblock->bitmap_block;
+    writer.blocks = bitmap_blocks;
+    writer.chunk_blocks = FORMAT_WRITE_CHUNK > block_size ? FORMAT_WRITE_CHUNK / block_size : 1;
+    writer.block_size = block_size;
+    writer.sparse = sparse;
+
+    if(format_write_bitmap(&writer)) {
         fclose(disk);
         free(data);
+        free(block);
         free(bitmap);
-        free(layer_mapping_size);
-        free(layer_starts);
         return 1;
     }
 
+    printf("    🛠️  wrote %" PRIu64 " of %" PRIu64 " blocks of bitmap data\n", writer.written, bitmap_blocks);
     free(bitmap);
-    free(layer_mapping_size);
-    free(layer_starts);
 
     // now we need to write the root inode
-    Inode *inode = (Inode *)data;
+    Inode *inode = (Inode *)block;
     memset(inode, 0, block_size);
 
     inode->mode = INODE_MODE_TYPE_DIR | INODE_MODE_U_RWX | INODE_MODE_G_R;
@@ -302,17 +394,45 @@ int format(const char *path, usize size, usize block_size, usize fanout) {
     inode->extent_tree_root = 0;
     inode->inline_size = 0;
 
-    if(write_block(disk, root_inode, block_size, 1, inode)) {
+    if(write_block(disk, NULL, root_inode, block_size, 1, inode, IO_INODE)) {
         fclose(disk);
         free(data);
+        free(block);
         return 1;
     }
 
-    printf("    🛠️  created root directory at inode %llu\n", root_inode);
+    if(inode_size) {
+        InodeSlotBlock *list = (InodeSlotBlock *) block;
+        memset(list, 0, block_size);
+        for(u64 slot = block_size / inode_size - 1; slot; slot--)
+            list->slots[list->count++] = (root_inode << INODE_SLOT_SHIFT) | slot;
+
+        if(write_block(disk, NULL, root_inode + 1, block_size, 1, list, IO_TABLE)) {
+            fclose(disk);
+            free(data);
+            free(block);
+            return 1;
+        }
+
+        printf("    🛠️  created root directory at inode %" PRIu64 ", in a table of %zu inodes of %zu bytes\n",
+            root_inode << INODE_SLOT_SHIFT, block_size / inode_size, inode_size);
+    } else {
+        printf("    🛠️  created root directory at inode %" PRIu64 "\n", root_inode);
+    }
+
+    // everything the superblock points to is on the disk before it is
+    free(block);
+    if(fdatasync(fileno(disk)) ||
+        write_block(disk, NULL, SUPERBLOCK_BLOCK_NUMBER, block_size, 1, superblock, IO_SUPERBLOCK) ||
+        fdatasync(fileno(disk))) {
+        fclose(disk);
+        free(data);
+        return 1;
+    }
 
     u64 overhead = allocated_blocks * block_size;
 
-    printf("    ✅ formatted disk image %s with size %zu %s, overhead space %llu %s (%.2f%%)\n",
+    printf("    ✅ formatted disk image %s with size %zu %s, overhead space %" PRIu64 " %s (%.2f%%)\n",
         path,
         size >> 40 ? size >> 40 : size >> 30 ? size >> 30 : size >> 20 ? size >> 20 : size >> 10 ? size >> 10 : size,
         size >> 40 ? "TB" : size >> 30 ? "GB" : size >> 20 ? "MB" : size >> 10 ? "KB" : "B",
@@ -0,0 +1,585 @@
+/*
+ * pulse - a highly scalable SSD-first file system with predictable logarithmic
+ * bounds across all operations
+ * 
+ * Copyright (c) 2025 Omar Elghoul
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <pulse/pulse.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+
+/* inodes are kept in memory by inode number so that reading one is a copy
+ * and changing one only marks it dirty - dirty inodes are written back when
+ * they are evicted or the cache is synced, so a run of small writes to one
+ * file costs a single inode write
+ *
+ * entries that somebody holds a reference to are never evicted, the rest
+ * sit on a list in the order they were released and the oldest go first
+ * once the cache is over capacity */
+
+static inline CachedInode **icache_bucket(Mountpoint *mp, u64 inode) {
+    return &mp->icache[inode & (mp->icache_buckets - 1)];
+}
+
+static void lru_remove(Mountpoint *mp, CachedInode *cached) {
+    if(cached->lru_prev) cached->lru_prev->lru_next = cached->lru_next;
+    else mp->icache_lru = cached->lru_next;
+
+    if(cached->lru_next) cached->lru_next->lru_prev = cached->lru_prev;
+    else mp->icache_mru = cached->lru_prev;
+
+    cached->lru_prev = NULL;
+    cached->lru_next = NULL;
+}
+
+static void lru_append(Mountpoint *mp, CachedInode *cached) {
+    cached->lru_prev = mp->icache_mru;
+    cached->lru_next = NULL;
+
+    if(mp->icache_mru) mp->icache_mru->lru_next = cached;
+    else mp->icache_lru = cached;
+    mp->icache_mru = cached;
+}
+
+static void icache_unlink(Mountpoint *mp, CachedInode *cached) {
+    CachedInode **link = icache_bucket(mp, cached->inode);
+    while(*link && *link != cached)
+        link = &(*link)->next;
+
+    if(*link) *link = cached->next;
+    cached->next = NULL;
+    mp->icache_count--;
+}
+
+static void icache_free(Mountpoint *mp, CachedInode *cached) {
+    __atomic_sub_fetch(&mp->pending_bytes, cached->pending_capacity, __ATOMIC_RELAXED);
+    pthread_rwlock_destroy(&cached->lock);
+    free(cached->pending);
+    free(cached->data);
+    free(cached);
+}
+
+/* an inode in a table shares its block with others, so it is written back by
+ * reading the table and putting it in its slot - the cache lock keeps two of
+ * them from doing that to the same table at once */
+static int icache_write(Mountpoint *mp, CachedInode *cached) {
+    if(!mp->inode_shift) {
+        if(write_block(mp->disk, &mp->io_stats, cached->inode, mp->block_size, 1, cached->data, IO_INODE))
+            return -1;
+    } else {
+        u64 block = INODE_BLOCK(mp, cached->inode);
+        u8 *table = scratch_buffer(SCRATCH_INODES, mp->block_size);
+        if(!table || read_block(mp->disk, &mp->io_stats, block, mp->block_size, 1, table, IO_INODE))
+            return -1;
+
+        memcpy(table + INODE_SLOT(mp, cached->inode) * mp->inode_size, cached->data, mp->inode_size);
+        if(write_block(mp->disk, &mp->io_stats, block, mp->block_size, 1, table, IO_INODE))
+            return -1;
+    }
+
+    cached->flags &= ~(ICACHE_DIRTY | ICACHE_TIMES);
+    return 0;
+}
+
+static int cached_compare(const void *a, const void *b) {
+    u64 x = (*(CachedInode *const *) a)->inode, y = (*(CachedInode *const *) b)->inode;
+    return x < y ? -1 : x > y;
+}
+
+/* writes back the longest run at the start of a sorted list of dirty inodes
+ * whose blocks follow each other on the disk and returns its length, zero if
+ * the write failed. an inode with a block of its own goes out straight from
+ * the cache, so a run is one vectored write of scattered copies - a run of
+ * inode table blocks is read, patched and written back whole instead */
+static u64 icache_write_run(Mountpoint *mp, CachedInode **list, u64 count) {
+    u32 block_size = mp->block_size;
+    u64 first = INODE_BLOCK(mp, list[0]->inode);
+    u64 run = 1;
+    while(run < count) {
+        u64 block = INODE_BLOCK(mp, list[run]->inode);
+        u64 previous = INODE_BLOCK(mp, list[run - 1]->inode);
+        if(block > previous + 1 || block - first >= ICACHE_FLUSH_RUN) break;
+        run++;
+    }
+
+    if(!mp->inode_shift) {
+        struct iovec vector[ICACHE_FLUSH_RUN];
+        for(u64 i = 0; i < run; i++)
+            vector[i] = (struct iovec) { list[i]->data, block_size };
+
+        if(write_block_vector(mp->disk, &mp->io_stats, first, block_size, vector, run, IO_INODE))
+            return 0;
+    } else {
+        u64 blocks = INODE_BLOCK(mp, list[run - 1]->inode) - first + 1;
+        u8 *tables = scratch_buffer(SCRATCH_INODES, blocks * block_size);
+        if(!tables || read_block(mp->disk, &mp->io_stats, first, block_size, blocks, tables, IO_INODE))
+            return 0;
+
+        for(u64 i = 0; i < run; i++) {
+            u64 block = INODE_BLOCK(mp, list[i]->inode) - first;
+            memcpy(tables + block * block_size + INODE_SLOT(mp, list[i]->inode) * mp->inode_size,
+                list[i]->data, mp->inode_size);
+        }
+
+        if(write_block(mp->disk, &mp->io_stats, first, block_size, blocks, tables, IO_INODE))
+            return 0;
+    }
+
+    for(u64 i = 0; i < run; i++)
+        list[i]->flags &= ~(ICACHE_DIRTY | ICACHE_TIMES);
+    return run;
+}
+
+/* inodes holding delayed data are passed over, flushing them needs the cache
+ * itself - they leave once the data has been written */
+static void icache_evict(Mountpoint *mp) {
+    CachedInode *victim = mp->icache_lru;
+
+    while(mp->icache_count > mp->icache_capacity && victim) {
+        CachedInode *next = victim->lru_next;
+        if(victim->pending_size) {
+            victim = next;
+            continue;
+        }
+
+        if((victim->flags & (ICACHE_DIRTY | ICACHE_TIMES)) && icache_write(mp, victim))
+            return; // keep it around rather than lose the changes
+
+        lru_remove(mp, victim);
+        icache_unlink(mp, victim);
+        icache_free(mp, victim);
+        victim = next;
+    }
+}
+
+int icache_init(Mountpoint *mp, u64 capacity) {
+    u64 buckets = 1;
+    while(buckets < capacity) buckets <<= 1;
+
+    mp->icache = calloc(buckets, sizeof(CachedInode *));
+    if(!mp->icache) return -1;
+
+    mp->icache_buckets = buckets;
+    mp->icache_capacity = capacity;
+    mp->icache_count = 0;
+    mp->icache_lru = NULL;
+    mp->icache_mru = NULL;
+    return 0;
+}
+
+/* everything still cached is thrown away, sync first to keep the changes */
+void icache_destroy(Mountpoint *mp) {
+    if(!mp->icache) return;
+
+    for(u64 i = 0; i < mp->icache_buckets; i++) {
+        CachedInode *cached = mp->icache[i];
+        while(cached) {
+            CachedInode *next = cached->next;
+            icache_free(mp, cached);
+            cached = next;
+        }
+    }
+
+    free(mp->icache);
+    mp->icache = NULL;
+    mp->icache_count = 0;
+}
+
+static CachedInode *icache_insert(Mountpoint *mp, u64 inode, u32 references) {
+    CachedInode *cached = calloc(1, sizeof(CachedInode));
+    if(cached) cached->data = calloc(1, mp->inode_size);
+
+    if(!cached || !cached->data) {
+        if(cached) free(cached->data);
+        free(cached);
+        return NULL;
+    }
+
+    cached->inode = inode;
+    cached->references = references;
+    pthread_rwlock_init(&cached->lock, NULL);
+
+    CachedInode **bucket = icache_bucket(mp, inode);
+    cached->next = *bucket;
+    *bucket = cached;
+    mp->icache_count++;
+    return cached;
+}
+
+static CachedInode *icache_find(Mountpoint *mp, u64 inode) {
+    CachedInode *cached = *icache_bucket(mp, inode);
+    while(cached && cached->inode != inode)
+        cached = cached->next;
+
+    return cached;
+}
+
+/* reading a table brings in all of its inodes for the price of one, the ones
+ * in use that aren't cached yet are added unreferenced while there is room so
+ * that a walk over a directory finds its neighbours already loaded */
+static int icache_load(Mountpoint *mp, CachedInode *cached) {
+    if(!mp->inode_shift)
+        return read_block(mp->disk, &mp->io_stats, cached->inode, mp->block_size, 1, cached->data,
+            IO_INODE);
+
+    u64 block = INODE_BLOCK(mp, cached->inode);
+    u8 *table = scratch_buffer(SCRATCH_INODES, mp->block_size);
+    if(!table || read_block(mp->disk, &mp->io_stats, block, mp->block_size, 1, table, IO_INODE))
+        return -1;
+
+    u64 slots = mp->block_size / mp->inode_size;
+    memcpy(cached->data, table + INODE_SLOT(mp, cached->inode) * mp->inode_size, mp->inode_size);
+
+    for(u64 slot = 0; slot < slots && mp->icache_count < mp->icache_capacity; slot++) {
+        Inode *neighbour = (Inode *) (table + slot * mp->inode_size);
+        u64 inode = (block << mp->inode_shift) | slot;
+        if(!neighbour->link_count || icache_find(mp, inode))
+            continue;
+
+        CachedInode *loaded = icache_insert(mp, inode, 0);
+        if(!loaded) break;
+
+        memcpy(loaded->data, neighbour, mp->inode_size);
+        lru_append(mp, loaded);
+    }
+
+    return 0;
+}
+
+/* returns the cached inode with a reference held, loading it from disk if it
+ * isn't cached yet - without load a missing inode starts out zeroed, for
+ * callers that are about to overwrite all of it */
+CachedInode *icache_get(Mountpoint *mp, u64 inode, int load) {
+    if(!mp || !mp->icache || !inode ||
+        INODE_BLOCK(mp, inode) >= mp->superblock->volume_size ||
+        INODE_SLOT(mp, inode) >= mp->block_size / mp->inode_size)
+        return NULL;
+
+    pthread_mutex_lock(&mp->icache_lock);
+
+    CachedInode *cached = icache_find(mp, inode);
+    if(cached) {
+        if(!cached->references) lru_remove(mp, cached);
+        cached->references++;
+        pthread_mutex_unlock(&mp->icache_lock);
+        return cached;
+    }
+
+    // misses are loaded with the cache locked so two threads can never load
+    // the same inode twice
+    cached = icache_insert(mp, inode, 1);
+    if(!cached || (load && icache_load(mp, cached))) {
+        if(cached) {
+            icache_unlink(mp, cached);
+            icache_free(mp, cached);
+        }
+
+        pthread_mutex_unlock(&mp->icache_lock);
+        return NULL;
+    }
+
+    icache_evict(mp);
+    pthread_mutex_unlock(&mp->icache_lock);
+    return cached;
+}
+
+void icache_put(Mountpoint *mp, CachedInode *cached) {
+    if(!mp || !cached) return;
+
+    pthread_mutex_lock(&mp->icache_lock);
+
+    if(--cached->references) {
+        pthread_mutex_unlock(&mp->icache_lock);
+        return;
+    }
+
+    if(cached->flags & ICACHE_DROPPED) {
+        icache_free(mp, cached);
+    } else {
+        lru_append(mp, cached);
+        icache_evict(mp);
+    }
+
+    pthread_mutex_unlock(&mp->icache_lock);
+}
+
+/* forgets an inode whose block or slot is about to be freed, any pending changes are
+ * discarded - holders of a reference keep a stale copy until they put it */
+void icache_drop(Mountpoint *mp, u64 inode) {
+    if(!mp || !mp->icache) return;
+
+    pthread_mutex_lock(&mp->icache_lock);
+
+    CachedInode *cached = icache_find(mp, inode);
+    if(cached) {
+        icache_unlink(mp, cached);
+        if(cached->references) {
+            cached->flags = ICACHE_DROPPED;
+        } else {
+            lru_remove(mp, cached);
+            icache_free(mp, cached);
+        }
+    }
+
+    pthread_mutex_unlock(&mp->icache_lock);
+}
+
+/* writes out all delayed data and every dirty inode, and the ones with only
+ * new timestamps too if asked - the caller must make sure nobody is changing
+ * inodes meanwhile */
+int icache_sync(Mountpoint *mp, int times) {
+    if(!mp || !mp->icache) return -1;
+
+    u8 mask = ICACHE_DIRTY | (times ? ICACHE_TIMES : 0);
+    int status = 0;
+
+    // delayed data goes first since flushing it dirties the inodes, each one
+    // is flushed with the cache unlocked and a reference keeping it around
+    for(u64 i = 0; i < mp->icache_buckets;) {
+        pthread_mutex_lock(&mp->icache_lock);
+
+        CachedInode *cached = mp->icache[i];
+        while(cached && !cached->pending_size)
+            cached = cached->next;
+
+        if(!cached) {
+            pthread_mutex_unlock(&mp->icache_lock);
+            i++;
+            continue;
+        }
+
+        if(!cached->references++) lru_remove(mp, cached);
+        pthread_mutex_unlock(&mp->icache_lock);
+
+        int flushed = flush_inode(mp, cached);
+        icache_put(mp, cached);
+        if(flushed) {
+            status = -1;
+            i++; // don't retry it forever
+        }
+    }
+
+    pthread_mutex_lock(&mp->icache_lock);
+
+    u64 dirty = 0;
+    for(u64 i = 0; i < mp->icache_buckets; i++) {
+        for(CachedInode *cached = mp->icache[i]; cached; cached = cached->next)
+            dirty += (cached->flags & mask) != 0;
+    }
+
+    CachedInode **list = dirty ? malloc(dirty * sizeof(CachedInode *)) : NULL;
+    if(list) {
+        u64 count = 0;
+        for(u64 i = 0; i < mp->icache_buckets; i++) {
+            for(CachedInode *cached = mp->icache[i]; cached; cached = cached->next) {
+                if(cached->flags & mask) list[count++] = cached;
+            }
+        }
+
+        qsort(list, count, sizeof(CachedInode *), cached_compare);
+        for(u64 i = 0; i < count;) {
+            u64 run = icache_write_run(mp, list + i, count - i);
+            if(!run) {
+                status = -1;
+                run = 1; // the rest may still make it
+            }
+
+            i += run;
+        }
+
+        free(list);
+    } else {
+        // one at a time is all that is left without memory for the list
+        for(u64 i = 0; dirty && i < mp->icache_buckets; i++) {
+            for(CachedInode *cached = mp->icache[i]; cached; cached = cached->next) {
+                if((cached->flags & mask) && icache_write(mp, cached))
+                    status = -1;
+            }
+        }
+    }
+
+    pthread_mutex_unlock(&mp->icache_lock);
+    return status;
+}
+
+/* writes one inode out now if it has changed, for callers that are about to
+ * free blocks its old copy on the disk still points to */
+int icache_commit(Mountpoint *mp, u64 inode) {
+    if(!mp || !mp->icache) return -1;
+
+    pthread_mutex_lock(&mp->icache_lock);
+
+    int status = 0;
+    CachedInode *cached = icache_find(mp, inode);
+    if(cached && (cached->flags & (ICACHE_DIRTY | ICACHE_TIMES)))
+        status = icache_write(mp, cached);
+
+    pthread_mutex_unlock(&mp->icache_lock);
+    return status;
+}
+
+static int inode_compare(const void *a, const void *b) {
+    u64 x = *(const u64 *) a;
+    u64 y = *(const u64 *) b;
+    return x < y ? -1 : x > y;
+}
+
+static u64 prefetch_limit(Mountpoint *mp) {
+    u64 limit = ICACHE_PREFETCH_RUN / mp->block_size;
+    return limit ? limit : 1;
+}
+
+/* the sorted inodes from start whose blocks are close enough to be read in
+ * one go, skipping over at most ICACHE_PREFETCH_GAP blocks at a time and up
+ * to a run of ICACHE_PREFETCH_RUN bytes */
+static u64 prefetch_run(Mountpoint *mp, const u64 *inodes, u64 start, u64 count) {
+    u64 limit = prefetch_limit(mp);
+    u64 first = INODE_BLOCK(mp, inodes[start]);
+    u64 end = start + 1;
+
+    while(end < count) {
+        u64 block = INODE_BLOCK(mp, inodes[end]);
+        if(block > INODE_BLOCK(mp, inodes[end - 1]) + ICACHE_PREFETCH_GAP + 1 || block - first >= limit)
+            break;
+        end++;
+    }
+
+    return end;
+}
+
+/* brings a batch of inodes into the cache with as few reads as it can - the
+ * ones that are missing are sorted by block, blocks close to each other are
+ * read as one run, and the kernel hears about every run before the first is
+ * read so they can be in flight together. nothing is referenced, the batch
+ * only goes in while there is room and icache_get() finds it there */
+int icache_prefetch(Mountpoint *mp, const u64 *inodes, u64 count) {
+    if(!mp || !mp->icache || !inodes) return -1;
+
+    u64 *missing = malloc(count * sizeof(u64) + 1);
+    if(!missing) return -1;
+
+    pthread_mutex_lock(&mp->icache_lock);
+
+    u64 room = mp->icache_capacity > mp->icache_count ? mp->icache_capacity - mp->icache_count : 0;
+    u64 found = 0;
+    for(u64 i = 0; i < count; i++) {
+        if(!inodes[i] || INODE_BLOCK(mp, inodes[i]) >= mp->superblock->volume_size ||
+            INODE_SLOT(mp, inodes[i]) >= mp->block_size / mp->inode_size)
+            continue;
+
+        if(!icache_find(mp, inodes[i])) missing[found++] = inodes[i];
+    }
+
+    qsort(missing, found, sizeof(u64), inode_compare);
+    if(found > room) found = room;
+
+    int fd = fileno(mp->disk);
+    for(u64 i = 0; i < found;) {
+        u64 end = prefetch_run(mp, missing, i, found);
+        u64 first = INODE_BLOCK(mp, missing[i]);
+        u64 blocks = INODE_BLOCK(mp, missing[end - 1]) - first + 1;
+        posix_fadvise(fd, (off_t) first * mp->block_size, (off_t) blocks * mp->block_size,
+            POSIX_FADV_WILLNEED);
+        i = end;
+    }
+
+    int status = 0;
+    u8 *buffer = found ? malloc(prefetch_limit(mp) * mp->block_size) : NULL;
+    if(found && !buffer) status = -1;
+
+    for(u64 i = 0; i < found && !status;) {
+        u64 end = prefetch_run(mp, missing, i, found);
+        u64 first = INODE_BLOCK(mp, missing[i]);
+        u64 blocks = INODE_BLOCK(mp, missing[end - 1]) - first + 1;
+        if(read_block(mp->disk, &mp->io_stats, first, mp->block_size, blocks, buffer, IO_INODE)) {
+            status = -1;
+            break;
+        }
+
+        for(; i < end; i++) {
+            if(icache_find(mp, missing[i])) continue; // named twice in the batch
+
+            CachedInode *loaded = icache_insert(mp, missing[i], 0);
+            if(!loaded) {
+                status = -1;
+                break;
+            }
+
+            u64 offset = (INODE_BLOCK(mp, missing[i]) - first) * mp->block_size +
+                INODE_SLOT(mp, missing[i]) * mp->inode_size;
+            memcpy(loaded->data, buffer + offset, mp->inode_size);
+            lru_append(mp, loaded);
+        }
+    }
+
+    pthread_mutex_unlock(&mp->icache_lock);
+    free(buffer);
+    free(missing);
+    return status;
+}
+
+/* flushes the delayed data that has waited WRITEBACK_TIMEOUT by now, for the
+ * writeback thread - it holds the volume lock shared, so every inode is
+ * locked like any writer would before its data goes out */
+int icache_flush_expired(Mountpoint *mp, u64 now) {
+    if(!mp || !mp->icache) return -1;
+
+    int status = 0;
+    for(u64 i = 0; i < mp->icache_buckets;) {
+        pthread_mutex_lock(&mp->icache_lock);
+
+        // writers set the time under the inode lock only
+        CachedInode *cached = mp->icache[i];
+        while(cached) {
+            u64 started = __atomic_load_n(&cached->pending_time, __ATOMIC_RELAXED);
+            if(started && now - started >= WRITEBACK_TIMEOUT) break;
+            cached = cached->next;
+        }
+
+        if(!cached) {
+            pthread_mutex_unlock(&mp->icache_lock);
+            i++;
+            continue;
+        }
+
+        if(!cached->references++) lru_remove(mp, cached);
+        pthread_mutex_unlock(&mp->icache_lock);
+
+        // it may have been flushed or removed while we waited for the lock
+        pthread_rwlock_wrlock(&cached->lock);
+        int flushed = 0;
+        if(!(cached->flags & ICACHE_DROPPED) && cached->pending_size)
+            flushed = flush_inode(mp, cached);
+        else
+            __atomic_store_n(&cached->pending_time, 0, __ATOMIC_RELAXED);
+        pthread_rwlock_unlock(&cached->lock);
+
+        icache_put(mp, cached);
+        if(flushed) {
+            status = -1;
+            i++; // don't retry it forever
+        }
+    }
+
+    return status;
+}
@@ -26,36 +26,118 @@
 #include <pulse/pulse.h>
 #include <pulse/cli.h>
 #include <string.h>
+#include <time.h>
 
-int read_inode(u64 inode, Inode *buffer) {
-    if(!mountpoint || !mountpoint->superblock || !inode || !buffer)
+/* allocates a block or a table slot for a new inode and sets it up empty,
+ * owned by root like the root directory - it reaches the disk whenever the
+ * cache writes it back, returns the inode number or zero */
+u64 create_inode(Mountpoint *mp, u32 mode) {
+    if(!mp || !mp->superblock)
+        return 0;
+
+    u64 inode;
+    if(mp->inode_shift) {
+        inode = itable_allocate(mp);
+        if(!inode) return 0;
+    } else {
+        inode = allocate_block(mp);
+        if(inode == -1) return 0;
+    }
+
+    CachedInode *cached = icache_get(mp, inode, 0);
+    if(!cached) {
+        if(mp->inode_shift) itable_release(mp, inode);
+        else free_block(mp, inode);
+        return 0;
+    }
+
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    u64 time_ns = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+
+    Inode *buf = cached->data;
+    memset(buf, 0, mp->inode_size);
+
+    // only regular files have data worth compressing
+    if(!INODE_MODE_TYPE_IS_REG(mode))
+        mode &= ~INODE_MODE_COMPRESSED;
+
+    buf->mode = mode;
+    buf->link_count = 1;
+    buf->created_time = time_ns;
+    buf->modified_time = time_ns;
+    buf->accessed_time = time_ns;
+    buf->changed_time = time_ns;
+
+    cached->flags |= ICACHE_DIRTY;
+    icache_put(mp, cached);
+    return inode;
+}
+
+/* lets go of an inode that nothing links to anymore and whose data is already
+ * gone - a slot in a table is zeroed through the cache so the table reads as
+ * free there once it is written back */
+int free_inode(Mountpoint *mp, u64 inode) {
+    if(!mp || !mp->superblock || !inode)
         return -1;
 
-    if(read_block(mountpoint->disk, inode, mountpoint->block_size, 1, mountpoint->metadata_block))
+    if(!mp->inode_shift) {
+        // the cached copy must not be written back over whatever reuses the block
+        icache_drop(mp, inode);
+        return free_block(mp, inode);
+    }
+
+    CachedInode *cached = icache_get(mp, inode, 0);
+    if(!cached) return -1;
+
+    memset(cached->data, 0, mp->inode_size);
+    cached->flags |= ICACHE_DIRTY;
+    icache_put(mp, cached);
+    return itable_release(mp, inode);
+}
+
+int read_inode(Mountpoint *mp, u64 inode, Inode *buffer) {
+    if(!mp || !mp->superblock || !inode || !buffer)
         return -1;
-    
-    Inode *temp_inode = (Inode *) mountpoint->metadata_block;
-    memcpy(buffer, temp_inode, temp_inode->inline_size + sizeof(Inode));
-    return 0;
+
+    CachedInode *cached = icache_get(mp, inode, 1);
+    if(!cached) return -1;
+
+    int status = -1;
+    if(cached->data->inline_size <= mp->inode_size - sizeof(Inode)) {
+        memcpy(buffer, cached->data, cached->data->inline_size + sizeof(Inode));
+        status = 0;
+    }
+
+    icache_put(mp, cached);
+    return status;
 }
 
-int write_inode(u64 inode, const Inode *buffer) {
-    if(!mountpoint || !mountpoint->superblock || !inode || !buffer)
+/* only updates the cached copy, the inode is written back later */
+int write_inode(Mountpoint *mp, u64 inode, const Inode *buffer) {
+    if(!mp || !mp->superblock || !inode || !buffer)
         return -1;
 
-    memcpy(mountpoint->metadata_block, buffer, buffer->inline_size + sizeof(Inode));
-    if(write_block(mountpoint->disk, inode, mountpoint->block_size, 1, mountpoint->metadata_block))
+    if(buffer->inline_size > mp->inode_size - sizeof(Inode))
         return -1;
 
+    CachedInode *cached = icache_get(mp, inode, 0);
+    if(!cached) return -1;
+
+    if(cached->data != buffer)
+        memcpy(cached->data, buffer, buffer->inline_size + sizeof(Inode));
+
+    cached->flags |= ICACHE_DIRTY;
+    icache_put(mp, cached);
     return 0;
 }
 
-int dump_inode(u64 inode) {
-    Inode *buf = (Inode *) mountpoint->metadata_block;
-    if(read_inode(inode, buf))
+int dump_inode(Mountpoint *mp, u64 inode) {
+    Inode *buf = scratch_buffer(SCRATCH_DATA, mp->block_size);
+    if(!buf || read_inode(mp, inode, buf))
         return -1;
     
-    printf(ESC_CYAN ESC_BOLD "Inode %llu\n" ESC_RESET, inode);
+    printf(ESC_CYAN ESC_BOLD "Inode %" PRIu64 "\n" ESC_RESET, inode);
     printf("  Mode: 0x%04X (%c%c%c%c%c%c%c%c%c%c)\n", buf->mode,
         (buf->mode & INODE_MODE_TYPE_DIR) ? 'd' :
         (buf->mode & INODE_MODE_TYPE_LNK) ? 'l' : '-',
@@ -73,14 +155,14 @@ int dump_inode(u64 inode) {
     printf("  UID: %u\n", buf->uid);
     printf("  GID: %u\n", buf->gid);
     printf("  Link count: %u\n", buf->link_count);
-    printf("  Created time: %llu\n", buf->created_time);
-    printf("  Modified time: %llu\n", buf->modified_time);
-    printf("  Accessed time: %llu\n", buf->accessed_time);
-    printf("  Changed time: %llu\n", buf->changed_time);
-    printf("  Size: %llu bytes\n", buf->size);
+    printf("  Created time: %" PRIu64 "\n", buf->created_time);
+    printf("  Modified time: %" PRIu64 "\n", buf->modified_time);
+    printf("  Accessed time: %" PRIu64 "\n", buf->accessed_time);
+    printf("  Changed time: %" PRIu64 "\n", buf->changed_time);
+    printf("  Size: %" PRIu64 " bytes\n", buf->size);
     printf("  Inline size: %u bytes\n", buf->inline_size);
-    printf("  Extent count: %llu\n", buf->extent_count);
-    printf("  Extent tree root: %llu\n", buf->extent_tree_root);
+    printf("  Extent count: %" PRIu64 "\n", buf->extent_count);
+    printf("  Extent tree root: %" PRIu64 "\n", buf->extent_tree_root);
 
     if(buf->inline_size > 0) {
         printf("  Inline data (first 64 bytes or up to inline size):\n    ");
@@ -0,0 +1,227 @@
+/*
+ * pulse - a highly scalable SSD-first file system with predictable logarithmic
+ * bounds across all operations
+ * 
+ * Copyright (c) 2025 Omar Elghoul
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <pulse/pulse.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* volumes formatted with an inode size pack that many bytes per inode into
+ * tables of one block each, and an inode is numbered by its table block and
+ * its slot in there. tables are allocated as they are needed and stay inode
+ * tables for good - their free slots are kept on a stack that lives in memory
+ * under the icache lock, and is written out as a chain of blocks on sync */
+
+static int slot_push(Mountpoint *mp, u64 inode) {
+    if(mp->inode_slot_count == mp->inode_slot_capacity) {
+        u64 capacity = mp->inode_slot_capacity ? mp->inode_slot_capacity * 2 : 256;
+        u64 *slots = realloc(mp->inode_slots, capacity * sizeof(u64));
+        if(!slots) return -1;
+
+        mp->inode_slots = slots;
+        mp->inode_slot_capacity = capacity;
+    }
+
+    mp->inode_slots[mp->inode_slot_count++] = inode;
+    mp->inode_slots_dirty = 1;
+    return 0;
+}
+
+/* returns a free inode number, starting a new table when every slot is taken
+ * - the new table is zeroed on disk so that its free slots read as such, and
+ * its first slot is handed out right away. returns zero on failure */
+u64 itable_allocate(Mountpoint *mp) {
+    if(!mp || !mp->inode_shift) return 0;
+
+    pthread_mutex_lock(&mp->icache_lock);
+    if(mp->inode_slot_count) {
+        u64 inode = mp->inode_slots[--mp->inode_slot_count];
+        mp->inode_slots_dirty = 1;
+        pthread_mutex_unlock(&mp->icache_lock);
+        return inode;
+    }
+    pthread_mutex_unlock(&mp->icache_lock);
+
+    u64 block = allocate_block(mp);
+    if(block == -1) return 0;
+
+    void *table = scratch_buffer(SCRATCH_INODES, mp->block_size);
+    if(!table) {
+        free_block(mp, block);
+        return 0;
+    }
+
+    memset(table, 0, mp->block_size);
+    if(write_block(mp->disk, &mp->io_stats, block, mp->block_size, 1, table, IO_INODE)) {
+        free_block(mp, block);
+        return 0;
+    }
+
+    // pushed in reverse so the table fills up front to back
+    u64 slots = mp->block_size / mp->inode_size;
+    pthread_mutex_lock(&mp->icache_lock);
+    for(u64 slot = slots - 1; slot; slot--) {
+        if(slot_push(mp, (block << mp->inode_shift) | slot))
+            break; // the rest of the table is wasted but nothing is lost
+    }
+    pthread_mutex_unlock(&mp->icache_lock);
+
+    return block << mp->inode_shift;
+}
+
+/* gives a slot back, the caller has already zeroed the inode in it */
+int itable_release(Mountpoint *mp, u64 inode) {
+    if(!mp || !mp->inode_shift) return -1;
+
+    pthread_mutex_lock(&mp->icache_lock);
+    int status = slot_push(mp, inode);
+    pthread_mutex_unlock(&mp->icache_lock);
+    return status;
+}
+
+int itable_load(Mountpoint *mp) {
+    if(!mp || !mp->superblock) return -1;
+
+    u64 block = mp->superblock->inode_slot_block;
+    if(!block) return 0;
+
+    InodeSlotBlock *chain = malloc(mp->block_size);
+    if(!chain) return -1;
+
+    u64 per_block = (mp->block_size - sizeof(InodeSlotBlock)) / sizeof(u64);
+
+    // a chain longer than the volume has a cycle in it
+    for(u64 links = 0; block; links++) {
+        if(links >= mp->superblock->volume_size || block >= mp->superblock->volume_size ||
+            read_block(mp->disk, &mp->io_stats, block, mp->block_size, 1, chain, IO_TABLE) ||
+            chain->count > per_block)
+            goto fail;
+
+        for(u64 i = 0; i < chain->count; i++) {
+            if(slot_push(mp, chain->slots[i]))
+                goto fail;
+        }
+
+        block = chain->next;
+    }
+
+    mp->inode_slots_dirty = 0;
+    free(chain);
+    return 0;
+
+fail:
+    free(chain);
+    itable_destroy(mp);
+    return -1;
+}
+
+/* writes the list to a fresh chain and only then lets go of the old one, the
+ * superblock points at whichever of the two is complete */
+int itable_store(Mountpoint *mp) {
+    if(!mp || !mp->superblock) return -1;
+
+    // the list is small next to the tables it describes, so it is written
+    // with the cache locked rather than copied out first
+    pthread_mutex_lock(&mp->icache_lock);
+    if(!mp->inode_slots_dirty) {
+        pthread_mutex_unlock(&mp->icache_lock);
+        return 0;
+    }
+
+    InodeSlotBlock *chain = calloc(1, mp->block_size);
+    if(!chain) {
+        pthread_mutex_unlock(&mp->icache_lock);
+        return -1;
+    }
+
+    u64 per_block = (mp->block_size - sizeof(InodeSlotBlock)) / sizeof(u64);
+    u64 blocks = (mp->inode_slot_count + per_block - 1) / per_block;
+    u64 *chain_blocks = blocks ? malloc(blocks * sizeof(u64)) : NULL;
+    if(blocks && !chain_blocks) {
+        pthread_mutex_unlock(&mp->icache_lock);
+        free(chain);
+        return -1;
+    }
+
+    u64 allocated = 0;
+    for(; allocated < blocks; allocated++) {
+        chain_blocks[allocated] = allocate_block(mp);
+        if(chain_blocks[allocated] == -1) goto fail;
+    }
+
+    for(u64 b = 0; b < blocks; b++) {
+        u64 first = b * per_block;
+        chain->next = b + 1 < blocks ? chain_blocks[b + 1] : 0;
+        chain->count = mp->inode_slot_count - first < per_block ? mp->inode_slot_count - first : per_block;
+        memcpy(chain->slots, &mp->inode_slots[first], chain->count * sizeof(u64));
+
+        if(write_block(mp->disk, &mp->io_stats, chain_blocks[b], mp->block_size, 1, chain, IO_TABLE))
+            goto fail;
+    }
+
+    u64 old = mp->superblock->inode_slot_block;
+    mp->superblock->inode_slot_block = blocks ? chain_blocks[0] : 0;
+    mp->superblock->superblock_size = sizeof(SuperBlock);
+    if(write_superblock(mp)) {
+        mp->superblock->inode_slot_block = old;
+        goto fail;
+    }
+
+    mp->inode_slots_dirty = 0;
+    pthread_mutex_unlock(&mp->icache_lock);
+    free(chain_blocks);
+
+    int status = 0;
+    for(u64 links = 0; old && links < mp->superblock->volume_size; links++) {
+        if(read_block(mp->disk, &mp->io_stats, old, mp->block_size, 1, chain, IO_TABLE)) {
+            status = -1;
+            break;
+        }
+
+        u64 next = chain->next;
+        if(free_block(mp, old)) status = -1;
+        old = next;
+    }
+
+    free(chain);
+    return status;
+
+fail:
+    pthread_mutex_unlock(&mp->icache_lock);
+    for(u64 b = 0; b < allocated; b++)
+        free_block(mp, chain_blocks[b]);
+
+    free(chain_blocks);
+    free(chain);
+    return -1;
+}
+
+void itable_destroy(Mountpoint *mp) {
+    if(!mp) return;
+
+    free(mp->inode_slots);
+    mp->inode_slots = NULL;
+    mp->inode_slot_count = 0;
+    mp->inode_slot_capacity = 0;
+}
@@ -0,0 +1,325 @@
+/*
+ * pulse - a highly scalable SSD-first file system with predictable logarithmic
+ * bounds across all operations
+ * 
+ * Copyright (c) 2025 Omar Elghoul
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <pulse/pulse.h>
+#include <pulse/cli.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+/* frees everything a mountpoint owns, safe on partially set up mountpoints
+ * because they start out zeroed */
+static int mount_release(Mountpoint *mp, int locks) {
+    int status = 0;
+    if(mp->disk && fclose(mp->disk))
+        status = -1;
+
+    if(locks) {
+        pthread_rwlock_destroy(&mp->volume_lock);
+        pthread_rwlock_destroy(&mp->namespace_lock);
+        pthread_rwlock_destroy(&mp->share_lock);
+        pthread_mutex_destroy(&mp->icache_lock);
+        pthread_mutex_destroy(&mp->bitmap_lock);
+        pthread_mutex_destroy(&mp->path_lock);
+    }
+
+    trace_release(mp);
+    icache_destroy(mp);
+    discard_destroy(mp);
+    refcount_destroy(mp);
+    dedup_destroy(mp);
+    path_index_destroy(mp);
+    itable_destroy(mp);
+    free(mp->superblock);
+    free(mp->name);
+    free(mp->highest_layer_bitmap);
+    free(mp->layer_starts);
+    free(mp->layer_sizes);
+    free(mp);
+    return status;
+}
+
+/* delayed data goes out before the discards, it may land on blocks that were
+ * freed since the last sync and those must not be discarded anymore */
+int sync_volume(Mountpoint *mp) {
+    if(!mp) return -1;
+
+    int status = icache_sync(mp, 1);
+    if(itable_store(mp)) status = -1;
+    if(refcount_store(mp)) status = -1;
+    if(dedup_store(mp)) status = -1;
+    if(path_index_store(mp)) status = -1;
+    if(discard_flush(mp)) status = -1;
+
+    // the log carries on where it stopped on the next mount
+    if(mp->log_mode && mp->superblock->log_head != mp->log_head) {
+        mp->superblock->log_head = mp->log_head;
+        if(write_superblock(mp)) status = -1;
+    }
+
+    return status;
+}
+
+int unmount(Mountpoint *mp) {
+    if(!mp) return -1;
+
+    int status = sync_volume(mp);
+    if(mount_release(mp, 1)) status = -1;
+    return status;
+}
+
+/* opens an image and returns a new handle for it, any number of images can
+ * be mounted at once - errors are printed and NULL is returned */
+Mountpoint *mount_image(const char *path) {
+    Mountpoint *mp = calloc(1, sizeof(Mountpoint));
+    if(!mp) {
+        printf(ESC_BOLD_RED "mount:" ESC_RESET " failed to allocate memory for mountpoint\n");
+        return NULL;
+    }
+
+    mp->superblock = malloc(512*1024); // max block size
+    if(!mp->superblock) {
+        printf(ESC_BOLD_RED "mount:" ESC_RESET " failed to allocate memory for superblock\n");
+        mount_release(mp, 0);
+        return NULL;
+    }
+
+    char *duplicate = strdup(path);
+    if(!duplicate) {
+        printf(ESC_BOLD_RED "mount:" ESC_RESET " failed to allocate memory for image name\n");
+        mount_release(mp, 0);
+        return NULL;
+    }
+
+    char *token = strtok(duplicate, "/");
+    while(token) {
+        char *next = strtok(NULL, "/");
+        if(!next) break;
+        token = next;
+    }
+
+    mp->name = strdup(token ? token : path);
+    free(duplicate);
+    if(!mp->name) {
+        printf(ESC_BOLD_RED "mount:" ESC_RESET " failed to allocate memory for image name\n");
+        mount_release(mp, 0);
+        return NULL;
+    }
+
+    /* open the disk image */
+    mp->disk = fopen(path, "rb+");
+    if(!mp->disk) {
+        printf(ESC_BOLD_RED "mount:" ESC_RESET " failed to open disk image %s\n", path);
+        mount_release(mp, 0);
+        return NULL;
+    }
+
+    if(discard_init(mp)) {
+        printf(ESC_BOLD_RED "mount:" ESC_RESET " failed to stat disk image %s\n", path);
+        mount_release(mp, 0);
+        return NULL;
+    }
+
+    /* search for the superblock according to the block sizes */
+    mp->block_size = 4096; // smallest block size
+    while(mp->block_size <= 512*1024) {
+        if(!read_block(mp->disk, &mp->io_stats, SUPERBLOCK_BLOCK_NUMBER, mp->block_size, 1,
+            mp->superblock, IO_SUPERBLOCK)) {
+            u8 *magic = (u8 *)&mp->superblock->magic;
+
+            if((!memcmp(&mp->superblock->magic, SUPER_MAGIC_STRING, 7) &&
+                magic[7] == SUPER_MAGIC_VERSION) &&
+                mp->superblock->major_revision == SUPER_MAJOR_REVISION &&
+                mp->superblock->minor_revision == SUPER_MINOR_REVISION &&
+                mp->superblock->patch == SUPER_PATCH_REVISION) {
+
+                break;
+            }
+        } else {
+            printf(ESC_BOLD_RED "mount:" ESC_RESET " failed to read superblock on %s\n", path);
+            mount_release(mp, 0);
+            return NULL;
+        }
+
+        mp->block_size *= 2;
+    }
+
+    if(mp->block_size > 512*1024) {
+        printf(ESC_BOLD_RED "mount:" ESC_RESET " failed to find superblock in %s\n", path);
+        mount_release(mp, 0);
+        return NULL;
+    }
+
+    u64 checksum = mp->superblock->checksum;
+    mp->superblock->checksum = 0;
+    u64 calculated = hash64(mp->superblock, mp->superblock->superblock_size, 0);
+    if(calculated != checksum) {
+        printf(ESC_BOLD_RED "mount:" ESC_RESET " invalid superblock checksum on %s\n", path);
+        mount_release(mp, 0);
+        return NULL;
+    }
+
+    // fields added since the image was formatted read as zero
+    if(mp->superblock->superblock_size < sizeof(SuperBlock)) {
+        memset((u8 *) mp->superblock + mp->superblock->superblock_size, 0,
+            sizeof(SuperBlock) - mp->superblock->superblock_size);
+    }
+
+    mp->highest_layer_bitmap = malloc(mp->block_size);
+    if(!mp->highest_layer_bitmap) {
+        printf(ESC_BOLD_RED "mount:" ESC_RESET " failed to allocate memory for disk image %s\n", path);
+        mount_release(mp, 0);
+        return NULL;
+    }
+
+    // find the fanout and bitmap depth
+    u16 bitmap_limit;
+
+    switch(mp->superblock->tuning & SUPER_TUNING_FANOUT_FACTOR_MASK) {
+    case SUPER_TUNING_FANOUT_FACTOR_8:
+        mp->fanout = 8;
+        break;
+    case SUPER_TUNING_FANOUT_FACTOR_16:
+        mp->fanout = 16;
+        break;
+    case SUPER_TUNING_FANOUT_FACTOR_32:
+        mp->fanout = 32;
+        break;
+    case SUPER_TUNING_FANOUT_FACTOR_64:
+        mp->fanout = 64;
+        break;
+    default:
+        printf(ESC_BOLD_RED "mount:" ESC_RESET " invalid fanout factor on %s\n", path);
+        mount_release(mp, 0);
+        return NULL;
+    }
+
+    mp->bitmap_math = bitmap_math_select(mp->fanout, mp->block_size);
+
+    switch(mp->superblock->tuning & SUPER_TUNING_BITMAP_LIMIT_MASK) {
+    case SUPER_TUNING_BITMAP_LIMIT_4096:
+        bitmap_limit = 4096;
+        break;
+    case SUPER_TUNING_BITMAP_LIMIT_8192:
+        bitmap_limit = 8192;
+        break;
+    case SUPER_TUNING_BITMAP_LIMIT_16384:
+        bitmap_limit = 16384;
+        break;
+    case SUPER_TUNING_BITMAP_LIMIT_32768:
+        bitmap_limit = 32768;
+        break;
+    default:
+        printf(ESC_BOLD_RED "mount:" ESC_RESET " invalid bitmap limit on %s\n", path);
+        mount_release(mp, 0);
+        return NULL;
+    }
+
+    mp->bitmap_layers = bitmap_layout(mp->superblock->volume_size, mp->fanout, bitmap_limit,
+        NULL, NULL);
+
+    // inodes either have a block each or share tables of fixed size slots
+    u32 inode_size = mp->superblock->inode_size;
+    if(inode_size && (inode_size < INODE_MIN_SIZE || inode_size > mp->block_size / 2 ||
+        (inode_size & (inode_size - 1)) || mp->block_size / inode_size > (1U << INODE_SLOT_SHIFT))) {
+        printf(ESC_BOLD_RED "mount:" ESC_RESET " invalid inode size on %s\n", path);
+        mount_release(mp, 0);
+        return NULL;
+    }
+
+    mp->inode_size = inode_size ? inode_size : mp->block_size;
+    mp->inode_shift = inode_size ? INODE_SLOT_SHIFT : 0;
+
+    // cache the highest layer bitmap
+    if(read_block(mp->disk, &mp->io_stats, mp->superblock->bitmap_block, mp->block_size, 1,
+        mp->highest_layer_bitmap, IO_BITMAP + mp->bitmap_layers - 1)) {
+        printf(ESC_BOLD_RED "mount:" ESC_RESET " failed to read bitmap on %s\n", path);
+        mount_release(mp, 0);
+        return NULL;
+    }
+
+    // and the starting offset and sizes of each layer
+    mp->layer_starts = calloc(mp->bitmap_layers, sizeof(u64));
+    mp->layer_sizes = calloc(mp->bitmap_layers, sizeof(u64));
+    if(!mp->layer_starts || !mp->layer_sizes) {
+        printf(ESC_BOLD_RED "mount:" ESC_RESET " failed to allocate memory for disk image %s\n", path);
+        mount_release(mp, 0);
+        return NULL;
+    }
+
+    bitmap_layout(mp->superblock->volume_size, mp->fanout, bitmap_limit, mp->layer_starts,
+        mp->layer_sizes);
+    mp->highest_layer_size = mp->layer_sizes[mp->bitmap_layers-1];
+    mp->data_zone = mp->superblock->volume_size / ALLOCATE_METADATA_SHARE;
+
+    mp->log_mode = (mp->superblock->tuning & SUPER_TUNING_ALLOCATOR_MASK) == SUPER_TUNING_ALLOCATOR_LOG;
+    mp->log_segment = 1;
+    for(int i = 0; i < LOG_SEGMENT_LAYER; i++) mp->log_segment *= mp->fanout;
+    mp->log_head = mp->superblock->log_head;
+
+    // the log only covers the segments above the data zone, metadata stays
+    // below it where inode numbers and extent nodes can find it again
+    mp->log_start = (mp->data_zone + mp->log_segment - 1) / mp->log_segment * mp->log_segment;
+    if(mp->log_start >= mp->superblock->volume_size) mp->log_start = 0;
+
+    if(icache_init(mp, ICACHE_DEFAULT_CAPACITY)) {
+        printf(ESC_BOLD_RED "mount:" ESC_RESET " failed to allocate inode cache for %s\n", path);
+        mount_release(mp, 0);
+        return NULL;
+    }
+
+    if(itable_load(mp)) {
+        printf(ESC_BOLD_RED "mount:" ESC_RESET " failed to read the free inode list on %s\n", path);
+        mount_release(mp, 0);
+        return NULL;
+    }
+
+    if(refcount_load(mp)) {
+        printf(ESC_BOLD_RED "mount:" ESC_RESET " failed to read the shared extent table on %s\n", path);
+        mount_release(mp, 0);
+        return NULL;
+    }
+
+    if(dedup_load(mp)) {
+        printf(ESC_BOLD_RED "mount:" ESC_RESET " failed to read the fingerprint index on %s\n", path);
+        mount_release(mp, 0);
+        return NULL;
+    }
+
+    if(path_index_load(mp)) {
+        printf(ESC_BOLD_RED "mount:" ESC_RESET " failed to read the path index on %s\n", path);
+        mount_release(mp, 0);
+        return NULL;
+    }
+
+    pthread_rwlock_init(&mp->volume_lock, NULL);
+    pthread_rwlock_init(&mp->namespace_lock, NULL);
+    pthread_rwlock_init(&mp->share_lock, NULL);
+    pthread_mutex_init(&mp->icache_lock, NULL);
+    pthread_mutex_init(&mp->bitmap_lock, NULL);
+    pthread_mutex_init(&mp->path_lock, NULL);
+
+    return mp;
+}
@@ -0,0 +1,409 @@
+/*
+ * pulse - a highly scalable SSD-first file system with predictable logarithmic
+ * bounds across all operations
+ * 
+ * Copyright (c) 2025 Omar Elghoul
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <pulse/pulse.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* paths that were resolved by walking the tree are hashed into a linear
+ * probing table, so the next lookup of the same deep path is one probe and
+ * one directory lookup to check the hit instead of one lookup per component.
+ * entries only go stale when a file is removed, which drops them - and drops
+ * the copy on the disk too, that copy is written on sync and a crash before
+ * the next one must not bring back an entry for a path that has since gone.
+ * there is no rename to take care of */
+
+/* writes path without empty or "." components and with single slashes into
+ * out, which has room for all of path, and points last at its last component
+ * - returns how many components there are */
+static u64 path_normalize(const char *path, char *out, usize *length, const char **last) {
+    u64 components = 0;
+    usize at = 0;
+
+    for(const char *p = path; *p;) {
+        while(*p == '/') p++;
+        if(!*p) break;
+
+        const char *end = strchr(p, '/');
+        usize len = end ? (usize) (end - p) : strlen(p);
+        if(len != 1 || *p != '.') {
+            if(at) out[at++] = '/';
+            *last = out + at;
+            memcpy(out + at, p, len);
+            at += len;
+            components++;
+        }
+
+        p += len;
+    }
+
+    out[at] = 0;
+    *length = at;
+    return components;
+}
+
+static void path_place(PathEntry *table, u64 capacity, const PathEntry *entry) {
+    u64 mask = capacity - 1;
+    u64 slot = entry->hash.low & mask;
+    while(table[slot].inode) slot = (slot + 1) & mask;
+    memcpy(&table[slot], entry, sizeof(PathEntry));
+}
+
+static PathEntry *path_find_locked(Mountpoint *mp, const Hash128 *hash) {
+    u64 mask = mp->path_capacity - 1;
+    for(u64 slot = hash->low & mask; mp->path_index[slot].inode; slot = (slot + 1) & mask) {
+        PathEntry *entry = &mp->path_index[slot];
+        if(entry->hash.low == hash->low && entry->hash.high == hash->high)
+            return entry;
+    }
+
+    return NULL;
+}
+
+/* empties a slot and shifts the rest of its probe sequence back over it, so
+ * lookups never need tombstones */
+static void path_remove_locked(Mountpoint *mp, PathEntry *entry) {
+    u64 mask = mp->path_capacity - 1;
+    u64 hole = entry - mp->path_index;
+
+    for(u64 next = (hole + 1) & mask; mp->path_index[next].inode; next = (next + 1) & mask) {
+        u64 home = mp->path_index[next].hash.low & mask;
+        if(((next - home) & mask) >= ((next - hole) & mask)) {
+            memcpy(&mp->path_index[hole], &mp->path_index[next], sizeof(PathEntry));
+            hole = next;
+        }
+    }
+
+    mp->path_index[hole].inode = 0;
+    mp->path_count--;
+}
+
+/* moves the entries into a table of capacity slots, zero frees the table */
+static int path_resize_locked(Mountpoint *mp, u64 capacity) {
+    PathEntry *table = NULL;
+    if(capacity && !(table = calloc(capacity, sizeof(PathEntry))))
+        return -1;
+
+    for(u64 i = 0; table && i < mp->path_capacity; i++) {
+        if(mp->path_index[i].inode) path_place(table, capacity, &mp->path_index[i]);
+    }
+
+    free(mp->path_index);
+    mp->path_index = table;
+    __atomic_store_n(&mp->path_capacity, capacity, __ATOMIC_RELAXED);
+    if(!capacity) mp->path_count = 0;
+    return 0;
+}
+
+static int path_insert_locked(Mountpoint *mp, const PathEntry *entry) {
+    if(!mp->path_capacity) return -1;
+
+    Hash128 hash = entry->hash;
+    PathEntry *existing = path_find_locked(mp, &hash);
+    if(existing) {
+        memcpy(existing, entry, sizeof(PathEntry));
+        mp->path_dirty = 1;
+        return 0;
+    }
+
+    // a full index keeps what it has, the paths it can't take are walked
+    if((mp->path_count + 1) * 100 >= mp->path_capacity * PATH_INDEX_LOAD_FACTOR) {
+        if(mp->path_capacity >= PATH_INDEX_MAX_SLOTS) return 0;
+        if(path_resize_locked(mp, mp->path_capacity * 2)) return -1;
+    }
+
+    path_place(mp->path_index, mp->path_capacity, entry);
+    mp->path_count++;
+    mp->path_dirty = 1;
+    return 0;
+}
+
+static int path_free_chain(Mountpoint *mp, u64 block) {
+    PathBlock *chain = malloc(mp->block_size);
+    if(!chain) return -1;
+
+    int status = 0;
+    for(u64 links = 0; block && links < mp->superblock->volume_size; links++) {
+        if(read_block(mp->disk, &mp->io_stats, block, mp->block_size, 1, chain, IO_TABLE)) {
+            status = -1;
+            break;
+        }
+
+        u64 next = chain->next;
+        if(free_block(mp, block)) status = -1;
+        block = next;
+    }
+
+    free(chain);
+    return status;
+}
+
+/* lets go of the copy on the disk, the superblock lets go of it first so a
+ * crash halfway leaves at worst a few leaked blocks */
+static int path_drop_chain(Mountpoint *mp) {
+    u64 block = mp->superblock->path_index_block;
+    if(!block) return 0;
+
+    mp->superblock->path_index_block = 0;
+    mp->superblock->superblock_size = sizeof(SuperBlock);
+    if(write_superblock(mp)) {
+        mp->superblock->path_index_block = block;
+        return -1;
+    }
+
+    return path_free_chain(mp, block);
+}
+
+/* the inode path resolves to according to the index, checked against the
+ * directory that holds it - zero if the path has to be walked */
+u64 path_index_find(Mountpoint *mp, const char *path) {
+    if(!mp || !path || !__atomic_load_n(&mp->path_capacity, __ATOMIC_RELAXED))
+        return 0;
+
+    char normal[strlen(path) + 1];
+    const char *last = NULL;
+    usize length;
+
+    // a single component is one lookup anyway
+    if(path_normalize(path, normal, &length, &last) < 2) return 0;
+
+    Hash128 hash = hash128(normal, length, 0);
+    PathEntry found = { .inode = 0 };
+
+    pthread_mutex_lock(&mp->path_lock);
+    PathEntry *entry = mp->path_capacity ? path_find_locked(mp, &hash) : NULL;
+    if(entry) memcpy(&found, entry, sizeof(PathEntry));
+    pthread_mutex_unlock(&mp->path_lock);
+
+    if(found.inode && dir_lookup(mp, found.parent, last) == found.inode) {
+        __atomic_fetch_add(&mp->path_hits, 1, __ATOMIC_RELAXED);
+        return found.inode;
+    }
+
+    __atomic_fetch_add(&mp->path_misses, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+/* remembers what a walk over path found, failing to is never an error */
+void path_index_add(Mountpoint *mp, const char *path, u64 parent, u64 inode) {
+    if(!mp || !path || !inode || !__atomic_load_n(&mp->path_capacity, __ATOMIC_RELAXED))
+        return;
+
+    char normal[strlen(path) + 1];
+    const char *last = NULL;
+    usize length;
+    if(path_normalize(path, normal, &length, &last) < 2) return;
+
+    PathEntry entry;
+    entry.hash = hash128(normal, length, 0);
+    entry.parent = parent;
+    entry.inode = inode;
+
+    pthread_mutex_lock(&mp->path_lock);
+    if(mp->path_capacity) path_insert_locked(mp, &entry);
+    pthread_mutex_unlock(&mp->path_lock);
+}
+
+/* called with the namespace locked for a path that is about to go away, in
+ * the same operation that removes it */
+int path_index_forget(Mountpoint *mp, const char *path) {
+    if(!mp || !path || !__atomic_load_n(&mp->path_capacity, __ATOMIC_RELAXED))
+        return 0;
+
+    char normal[strlen(path) + 1];
+    const char *last = NULL;
+    usize length;
+    if(path_normalize(path, normal, &length, &last) < 2) return 0;
+
+    Hash128 hash = hash128(normal, length, 0);
+
+    pthread_mutex_lock(&mp->path_lock);
+    PathEntry *entry = mp->path_capacity ? path_find_locked(mp, &hash) : NULL;
+    if(entry) {
+        path_remove_locked(mp, entry);
+        mp->path_dirty = 1;
+    }
+    pthread_mutex_unlock(&mp->path_lock);
+
+    // the copy on the disk would still have it after a crash
+    return entry ? path_drop_chain(mp) : 0;
+}
+
+/* turning the index off drops it, on the disk too - turning it on starts an
+ * empty one that fills up as paths are resolved */
+int path_index_enable(Mountpoint *mp, int enabled) {
+    if(!mp || !mp->superblock) return -1;
+
+    pthread_mutex_lock(&mp->path_lock);
+    int status = path_resize_locked(mp, enabled ? (mp->path_capacity ? mp->path_capacity :
+        PATH_INDEX_MIN_SLOTS) : 0);
+    pthread_mutex_unlock(&mp->path_lock);
+    if(status) return -1;
+
+    u16 tuning = mp->superblock->tuning & ~SUPER_TUNING_PATH_INDEX;
+    if(enabled) tuning |= SUPER_TUNING_PATH_INDEX;
+
+    if(!enabled && path_drop_chain(mp)) return -1;
+    if(tuning == mp->superblock->tuning) return 0;
+
+    mp->superblock->tuning = tuning;
+    return write_superblock(mp);
+}
+
+int path_index_report(Mountpoint *mp, PathIndexReport *report) {
+    if(!mp || !mp->superblock || !report) return -1;
+
+    memset(report, 0, sizeof(PathIndexReport));
+    pthread_mutex_lock(&mp->path_lock);
+    report->enabled = (mp->superblock->tuning & SUPER_TUNING_PATH_INDEX) != 0;
+    report->entries = mp->path_count;
+    report->capacity = report->enabled ? PATH_INDEX_MAX_SLOTS * PATH_INDEX_LOAD_FACTOR / 100 : 0;
+    pthread_mutex_unlock(&mp->path_lock);
+
+    // lookups count outside path_lock
+    report->hits = __atomic_load_n(&mp->path_hits, __ATOMIC_RELAXED);
+    report->misses = __atomic_load_n(&mp->path_misses, __ATOMIC_RELAXED);
+    return 0;
+}
+
+int path_index_load(Mountpoint *mp) {
+    if(!mp || !mp->superblock) return -1;
+    if(!(mp->superblock->tuning & SUPER_TUNING_PATH_INDEX)) {
+        // an index left behind with the index off goes away on the next sync
+        mp->path_dirty = mp->superblock->path_index_block != 0;
+        return 0;
+    }
+
+    if(path_resize_locked(mp, PATH_INDEX_MIN_SLOTS)) return -1;
+
+    u64 block = mp->superblock->path_index_block;
+    PathBlock *chain = malloc(mp->block_size);
+    if(!chain) return -1;
+
+    u64 per_block = (mp->block_size - sizeof(PathBlock)) / sizeof(PathEntry);
+
+    // a chain longer than the volume has a cycle in it
+    for(u64 links = 0; block; links++) {
+        if(links >= mp->superblock->volume_size || block >= mp->superblock->volume_size ||
+            read_block(mp->disk, &mp->io_stats, block, mp->block_size, 1, chain, IO_TABLE) ||
+            chain->count > per_block)
+            goto fail;
+
+        for(u64 i = 0; i < chain->count; i++) {
+            PathEntry *entry = &chain->entries[i];
+            if(!entry->inode || INODE_BLOCK(mp, entry->inode) >= mp->superblock->volume_size ||
+                INODE_BLOCK(mp, entry->parent) >= mp->superblock->volume_size ||
+                path_insert_locked(mp, entry))
+                goto fail;
+        }
+
+        block = chain->next;
+    }
+
+    mp->path_dirty = 0;
+    free(chain);
+    return 0;
+
+fail:
+    free(chain);
+    path_index_destroy(mp);
+    return -1;
+}
+
+/* writes the index to a fresh chain and only then lets go of the old one, the
+ * superblock points at whichever of the two is complete */
+int path_index_store(Mountpoint *mp) {
+    if(!mp || !mp->superblock) return -1;
+
+    pthread_mutex_lock(&mp->path_lock);
+    int dirty = mp->path_dirty;
+    u64 count = mp->path_count;
+    pthread_mutex_unlock(&mp->path_lock);
+    if(!dirty) return 0;
+
+    PathBlock *chain = calloc(1, mp->block_size);
+    if(!chain) return -1;
+
+    u64 per_block = (mp->block_size - sizeof(PathBlock)) / sizeof(PathEntry);
+    u64 blocks = (count + per_block - 1) / per_block;
+    u64 *chain_blocks = blocks ? malloc(blocks * sizeof(u64)) : NULL;
+    if(blocks && !chain_blocks) {
+        free(chain);
+        return -1;
+    }
+
+    u64 allocated = 0;
+    for(; allocated < blocks; allocated++) {
+        chain_blocks[allocated] = allocate_block(mp);
+        if(chain_blocks[allocated] == -1) goto fail;
+    }
+
+    // sync runs alone, so nothing adds paths while they are copied out
+    u64 slot = 0;
+    for(u64 b = 0; b < blocks; b++) {
+        chain->next = b + 1 < blocks ? chain_blocks[b + 1] : 0;
+        chain->count = 0;
+
+        for(; slot < mp->path_capacity && chain->count < per_block; slot++) {
+            if(mp->path_index[slot].inode)
+                memcpy(&chain->entries[chain->count++], &mp->path_index[slot], sizeof(PathEntry));
+        }
+
+        if(write_block(mp->disk, &mp->io_stats, chain_blocks[b], mp->block_size, 1, chain, IO_TABLE))
+            goto fail;
+    }
+
+    // the old chain is still right as far as it goes, every removal since
+    // it was written has dropped it
+    u64 old = mp->superblock->path_index_block;
+    mp->superblock->path_index_block = blocks ? chain_blocks[0] : 0;
+    mp->superblock->superblock_size = sizeof(SuperBlock);
+    if(write_superblock(mp)) {
+        mp->superblock->path_index_block = old;
+        goto fail;
+    }
+
+    mp->path_dirty = 0;
+    free(chain_blocks);
+    free(chain);
+    return old ? path_free_chain(mp, old) : 0;
+
+fail:
+    for(u64 b = 0; b < allocated; b++)
+        free_block(mp, chain_blocks[b]);
+
+    free(chain_blocks);
+    free(chain);
+    return -1;
+}
+
+void path_index_destroy(Mountpoint *mp) {
+    if(!mp) return;
+
+    free(mp->path_index);
+    mp->path_index = NULL;
+    mp->path_capacity = 0;
+    mp->path_count = 0;
+}
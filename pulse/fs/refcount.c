@@ -0,0 +1,299 @@
+/*
+ * pulse - a highly scalable SSD-first file system with predictable logarithmic
+ * bounds across all operations
+ * 
+ * Copyright (c) 2025 Omar Elghoul
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <pulse/pulse.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* cloned files share their data blocks, and the shared ones are listed here
+ * as sorted runs of blocks with the number of files referencing them - a
+ * block that is freed while still in the table only loses a reference. the
+ * table lives in memory while mounted, it is allocation state so the bitmap
+ * lock guards it, and it is written out as a chain of blocks on sync */
+
+/* index of the first entry that ends past block */
+static u64 shared_search(Mountpoint *mp, u64 block) {
+    u64 low = 0, high = mp->shared_count;
+    while(low < high) {
+        u64 mid = (low + high) / 2;
+        if(mp->shared[mid].block + mp->shared[mid].count <= block) low = mid + 1;
+        else high = mid;
+    }
+
+    return low;
+}
+
+static int shared_insert(Mountpoint *mp, u64 index, u64 block, u64 count, u64 refs) {
+    if(mp->shared_count == mp->shared_capacity) {
+        u64 capacity = mp->shared_capacity ? mp->shared_capacity * 2 : 64;
+        SharedExtent *shared = realloc(mp->shared, capacity * sizeof(SharedExtent));
+        if(!shared) return -1;
+
+        mp->shared = shared;
+        mp->shared_capacity = capacity;
+    }
+
+    memmove(&mp->shared[index + 1], &mp->shared[index],
+        (mp->shared_count - index) * sizeof(SharedExtent));
+    mp->shared[index].block = block;
+    mp->shared[index].count = count;
+    mp->shared[index].refs = refs;
+
+    // writers peek at the count without the lock to skip the table when it's empty
+    __atomic_store_n(&mp->shared_count, mp->shared_count + 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+static void shared_remove(Mountpoint *mp, u64 index) {
+    __atomic_store_n(&mp->shared_count, mp->shared_count - 1, __ATOMIC_RELAXED);
+    memmove(&mp->shared[index], &mp->shared[index + 1],
+        (mp->shared_count - index) * sizeof(SharedExtent));
+}
+
+/* makes block the start of an entry if it falls inside one */
+static int shared_split(Mountpoint *mp, u64 block) {
+    u64 i = shared_search(mp, block);
+    if(i == mp->shared_count || mp->shared[i].block >= block)
+        return 0;
+
+    SharedExtent *entry = &mp->shared[i];
+    u64 end = entry->block + entry->count;
+    entry->count = block - entry->block;
+    return shared_insert(mp, i + 1, block, end - block, entry->refs);
+}
+
+/* joins neighbours in [from, to] that continue each other with equal counts */
+static void shared_merge(Mountpoint *mp, u64 from, u64 to) {
+    if(!from) from = 1;
+
+    for(u64 i = from; i <= to && i < mp->shared_count;) {
+        SharedExtent *left = &mp->shared[i - 1];
+        SharedExtent *right = &mp->shared[i];
+
+        if(left->block + left->count == right->block && left->refs == right->refs) {
+            left->count += right->count;
+            shared_remove(mp, i);
+            to--;
+        } else {
+            i++;
+        }
+    }
+}
+
+/* same as refcount_share() for callers that already hold the bitmap lock */
+int refcount_share_locked(Mountpoint *mp, u64 block, u64 count) {
+    if(!mp || !count) return -1;
+
+    u64 end = block + count;
+    if(shared_split(mp, block) || shared_split(mp, end))
+        return -1;
+
+    u64 first = shared_search(mp, block), i = first;
+    for(u64 cursor = block; cursor < end;) {
+        if(i < mp->shared_count && mp->shared[i].block == cursor) {
+            mp->shared[i].refs++;
+            cursor += mp->shared[i].count;
+            i++;
+            continue;
+        }
+
+        u64 gap_end = (i < mp->shared_count && mp->shared[i].block < end) ? mp->shared[i].block : end;
+        if(shared_insert(mp, i, cursor, gap_end - cursor, 2))
+            return -1;
+
+        cursor = gap_end;
+        i++;
+    }
+
+    shared_merge(mp, first ? first - 1 : 0, i);
+    mp->shared_dirty = 1;
+    return 0;
+}
+
+/* adds a reference to every block in the range, blocks that weren't shared
+ * before go from one owner to two */
+int refcount_share(Mountpoint *mp, u64 block, u64 count) {
+    if(!mp || !count) return -1;
+
+    pthread_mutex_lock(&mp->bitmap_lock);
+    int status = refcount_share_locked(mp, block, count);
+    pthread_mutex_unlock(&mp->bitmap_lock);
+    return status;
+}
+
+/* drops one reference to a block on behalf of free_block(), which holds the
+ * bitmap lock - returns one if the block is still in use by another file and
+ * must stay allocated, zero if the caller was its only owner */
+int refcount_release(Mountpoint *mp, u64 block) {
+    u64 i = shared_search(mp, block);
+    if(i == mp->shared_count || mp->shared[i].block > block)
+        return 0;
+
+    if(shared_split(mp, block) || shared_split(mp, block + 1))
+        return -1;
+
+    i = shared_search(mp, block);
+    if(--mp->shared[i].refs == 1) shared_remove(mp, i);
+    else shared_merge(mp, i, i + 1);
+
+    mp->shared_dirty = 1;
+    return 1;
+}
+
+/* returns how many files reference block, and through run how many blocks
+ * from it on have that same count - all of the rest of the volume if it's an
+ * unshared block past the last entry */
+u64 refcount_query(Mountpoint *mp, u64 block, u64 *run) {
+    if(!mp) return 0;
+
+    pthread_mutex_lock(&mp->bitmap_lock);
+
+    u64 refs = 1, length = -1;
+    u64 i = shared_search(mp, block);
+    if(i < mp->shared_count && mp->shared[i].block <= block) {
+        refs = mp->shared[i].refs;
+        length = mp->shared[i].block + mp->shared[i].count - block;
+    } else if(i < mp->shared_count) {
+        length = mp->shared[i].block - block;
+    }
+
+    pthread_mutex_unlock(&mp->bitmap_lock);
+
+    if(run) *run = length;
+    return refs;
+}
+
+int refcount_load(Mountpoint *mp) {
+    if(!mp || !mp->superblock) return -1;
+
+    u64 block = mp->superblock->refcount_block;
+    if(!block) return 0;
+
+    RefcountBlock *chain = malloc(mp->block_size);
+    if(!chain) return -1;
+
+    u64 per_block = (mp->block_size - sizeof(RefcountBlock)) / sizeof(SharedExtent);
+
+    // a chain longer than the volume has a cycle in it
+    for(u64 links = 0; block; links++) {
+        if(links >= mp->superblock->volume_size || block >= mp->superblock->volume_size ||
+            read_block(mp->disk, &mp->io_stats, block, mp->block_size, 1, chain, IO_TABLE) ||
+            chain->count > per_block)
+            goto fail;
+
+        for(u64 i = 0; i < chain->count; i++) {
+            SharedExtent *entry = &chain->entries[i];
+            if(shared_insert(mp, mp->shared_count, entry->block, entry->count, entry->refs))
+                goto fail;
+        }
+
+        block = chain->next;
+    }
+
+    free(chain);
+    return 0;
+
+fail:
+    free(chain);
+    refcount_destroy(mp);
+    return -1;
+}
+
+/* writes the table to a fresh chain and only then lets go of the old one, the
+ * superblock points at whichever of the two is complete */
+int refcount_store(Mountpoint *mp) {
+    if(!mp || !mp->superblock) return -1;
+    if(!mp->shared_dirty) return 0;
+
+    RefcountBlock *chain = calloc(1, mp->block_size);
+    if(!chain) return -1;
+
+    u64 per_block = (mp->block_size - sizeof(RefcountBlock)) / sizeof(SharedExtent);
+    u64 blocks = (mp->shared_count + per_block - 1) / per_block;
+    u64 *chain_blocks = blocks ? malloc(blocks * sizeof(u64)) : NULL;
+    if(blocks && !chain_blocks) {
+        free(chain);
+        return -1;
+    }
+
+    u64 allocated = 0;
+    for(; allocated < blocks; allocated++) {
+        chain_blocks[allocated] = allocate_block(mp);
+        if(chain_blocks[allocated] == -1) goto fail;
+    }
+
+    for(u64 b = 0; b < blocks; b++) {
+        u64 first = b * per_block;
+        chain->next = b + 1 < blocks ? chain_blocks[b + 1] : 0;
+        chain->count = mp->shared_count - first < per_block ? mp->shared_count - first : per_block;
+        memcpy(chain->entries, &mp->shared[first], chain->count * sizeof(SharedExtent));
+
+        if(write_block(mp->disk, &mp->io_stats, chain_blocks[b], mp->block_size, 1, chain, IO_TABLE))
+            goto fail;
+    }
+
+    u64 old = mp->superblock->refcount_block;
+    mp->superblock->refcount_block = blocks ? chain_blocks[0] : 0;
+    mp->superblock->superblock_size = sizeof(SuperBlock);
+    if(write_superblock(mp)) {
+        mp->superblock->refcount_block = old;
+        goto fail;
+    }
+
+    mp->shared_dirty = 0;
+    free(chain_blocks);
+
+    int status = 0;
+    for(u64 links = 0; old && links < mp->superblock->volume_size; links++) {
+        if(read_block(mp->disk, &mp->io_stats, old, mp->block_size, 1, chain, IO_TABLE)) {
+            status = -1;
+            break;
+        }
+
+        u64 next = chain->next;
+        if(free_block(mp, old)) status = -1;
+        old = next;
+    }
+
+    free(chain);
+    return status;
+
+fail:
+    for(u64 b = 0; b < allocated; b++)
+        free_block(mp, chain_blocks[b]);
+
+    free(chain_blocks);
+    free(chain);
+    return -1;
+}
+
+void refcount_destroy(Mountpoint *mp) {
+    if(!mp) return;
+
+    free(mp->shared);
+    mp->shared = NULL;
+    mp->shared_count = 0;
+    mp->shared_capacity = 0;
+}
@@ -26,14 +26,67 @@
 #include <pulse/pulse.h>
 #include <string.h>
 
-u64 resolve(const char *path) {
-    if(!mountpoint || !mountpoint->superblock || !path || !*path)
+/* paths are always relative to the root directory, a leading slash is
+ * optional and empty components or "." are skipped - a deep path that has
+ * been walked before comes out of the path index */
+u64 resolve(Mountpoint *mp, const char *path) {
+    if(!mp || !mp->superblock || !path || !*path)
         return 0;
-    
-    if(!strcmp(path, "/") || !strcmp(path, ".")) {
-        return mountpoint->superblock->root_inode;
+
+    u64 inode = path_index_find(mp, path);
+    if(inode) return inode;
+
+    inode = mp->superblock->root_inode;
+    u64 parent = 0;
+    const char *p = path;
+
+    while(*p) {
+        while(*p == '/') p++;
+        if(!*p) break;
+
+        const char *end = strchr(p, '/');
+        usize len = end ? (usize) (end - p) : strlen(p);
+        if(len >= DIR_MAX_FILE_NAME) return 0;
+
+        if(len != 1 || *p != '.') {
+            char name[DIR_MAX_FILE_NAME];
+            memcpy(name, p, len);
+            name[len] = 0;
+
+            parent = inode;
+            inode = dir_lookup(mp, inode, name);
+            if(!inode) return 0;
+        }
+
+        p += len;
     }
 
-    // todo
-    return 0;
+    if(parent) path_index_add(mp, path, parent, inode);
+    return inode;
+}
+
+/* resolves everything but the last component of path, which is copied into
+ * name - it has to be at least DIR_MAX_FILE_NAME bytes */
+u64 resolve_parent(Mountpoint *mp, const char *path, char *name) {
+    if(!mp || !mp->superblock || !path || !name)
+        return 0;
+
+    usize len = strlen(path);
+    while(len && path[len-1] == '/') len--;
+
+    usize start = len;
+    while(start && path[start-1] != '/') start--;
+
+    if(start == len || len - start >= DIR_MAX_FILE_NAME)
+        return 0;
+
+    memcpy(name, path + start, len - start);
+    name[len - start] = 0;
+
+    if(!start) return mp->superblock->root_inode;
+
+    char parent[start + 1];
+    memcpy(parent, path, start);
+    parent[start] = 0;
+    return resolve(mp, parent);
 }
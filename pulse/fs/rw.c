@@ -24,35 +24,1439 @@
  */
 
 #include <pulse/pulse.h>
+#include <kiwi/lz4.h>
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
-int write_to_inode(u64 inode, const void *buf, u64 offset, u64 size) {
-    if(!mountpoint || !mountpoint->superblock || !inode || !buf || !size)
+static u64 now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline int extent_maps(const ExtentNode *leaf, u64 offset) {
+    return offset >= leaf->start_offset &&
+        offset < leaf->start_offset + leaf->length;
+}
+
+/* directory blocks are metadata, only the contents of files count as data */
+static inline AllocClass data_class(const Inode *inode) {
+    return INODE_MODE_TYPE_IS_DIR(inode->mode) ? ALLOC_METADATA : ALLOC_DATA;
+}
+
+static inline IOClass io_class(const Inode *inode) {
+    return INODE_MODE_TYPE_IS_DIR(inode->mode) ? IO_DIRECTORY : IO_DATA;
+}
+
+/* writes count blocks of file contents and keeps track of how many writes
+ * don't pick up where the one before ended, which is how sequential the
+ * device sees the volume's data - a log-structured volume only jumps when
+ * its head moves to another segment */
+int write_data(Mountpoint *mp, u64 block, usize count, const void *data, IOClass io_class) {
+    if(write_block(mp->disk, &mp->io_stats, block, mp->block_size, count, data, io_class)) return -1;
+
+    __atomic_fetch_add(&mp->data_writes, 1, __ATOMIC_RELAXED);
+    if(__atomic_exchange_n(&mp->data_write_end, block + count, __ATOMIC_RELAXED) != block)
+        __atomic_fetch_add(&mp->data_write_jumps, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+/* moves inline data out into the first data block once it no longer fits */
+static int move_inline_data(Mountpoint *mp, Inode *inode) {
+    if(inode->extent_tree_root || !inode->inline_size)
+        return 0;
+
+    u64 allocated;
+    u64 block = allocate_blocks(mp, 1, &allocated, data_class(inode));
+    if(block == -1) return -1;
+
+    u8 *data = scratch_buffer(SCRATCH_DATA, mp->block_size);
+    if(!data) return -1;
+
+    memset(data, 0, mp->block_size);
+    memcpy(data, inode->payload, inode->inline_size);
+    if(write_data(mp, block, 1, data, io_class(inode)))
         return -1;
-    
-    u32 max_inline_size = mountpoint->block_size - sizeof(Inode);
-    Inode *inode_buf = (Inode *) mountpoint->metadata_block;
-    if(read_inode(inode, inode_buf))
+
+    ExtentNode leaf;
+    memset(&leaf, 0, sizeof(ExtentNode));
+    leaf.start_offset = 0;
+    leaf.length = mp->block_size;
+    leaf.block = block;
+    leaf.block_count = 1;
+
+    if(extent_append(mp, inode, &leaf, 0)) return -1;
+
+    inode->inline_size = 0;
+    return 0;
+}
+
+/* maps the block that holds offset, allocating a run of up to count blocks if
+ * it is a hole - a run right after the end of the last extent extends it in
+ * place, otherwise the allocator looks for a free run of the whole length and
+ * a new extent gets its node allocated before the data so the next run can
+ * still extend it */
+static u64 map_blocks(Mountpoint *mp, Inode *inode, ExtentNode *leaf, u64 *leaf_block,
+    int *have_leaf, u64 offset, u64 count, u64 *fresh_start, u64 *fresh_end) {
+    u32 block_size = mp->block_size;
+
+    if(!*have_leaf || !extent_maps(leaf, offset)) {
+        *have_leaf = inode->extent_tree_root &&
+            !extent_find(mp, inode->extent_tree_root, offset, leaf, leaf_block);
+    }
+
+    if(*have_leaf && extent_maps(leaf, offset))
+        return leaf->block + (offset - leaf->start_offset) / block_size;
+
+    u64 aligned = offset - (offset % block_size);
+    int last = *have_leaf && !leaf->right_sibling_block;
+
+    if(last && !(leaf->flags & EXTENT_UNWRITTEN) &&
+        aligned == leaf->start_offset + leaf->block_count * block_size) {
+        u64 grown = claim_blocks(mp, leaf->block + leaf->block_count, count);
+        if(grown) {
+            u64 block = leaf->block + leaf->block_count;
+            leaf->block_count += grown;
+            leaf->length += grown * block_size;
+            if(extent_update(mp, *leaf_block, leaf)) return -1;
+
+            *fresh_start = aligned;
+            *fresh_end = aligned + grown * block_size;
+            return block;
+        }
+    }
+
+    ExtentNode new_leaf;
+    memset(&new_leaf, 0, sizeof(ExtentNode));
+    new_leaf.start_offset = aligned;
+
+    int append = !inode->extent_tree_root || (last && aligned >= leaf->start_offset + leaf->length);
+    u64 node_block = 0;
+
+    if(append) {
+        node_block = allocate_block(mp);
+        if(node_block == -1) return -1;
+    } else {
+        // filling a hole, the run stops where the next extent starts
+        if(!*have_leaf) return -1;
+
+        u64 next_start = leaf->start_offset;
+        if(next_start < aligned) {
+            ExtentNode next;
+            if(extent_read(mp, leaf->right_sibling_block, &next)) return -1;
+            next_start = next.start_offset;
+        }
+
+        if(count > (next_start - aligned) / block_size)
+            count = (next_start - aligned) / block_size;
+    }
+
+    u64 allocated = 0;
+    new_leaf.block = allocate_blocks(mp, count, &allocated, data_class(inode));
+    if(new_leaf.block == -1) return -1;
+
+    new_leaf.block_count = allocated;
+
+    new_leaf.length = new_leaf.block_count * block_size;
+
+    if(append ? extent_append(mp, inode, &new_leaf, node_block) :
+        extent_insert(mp, inode, &new_leaf, NULL))
         return -1;
 
-    struct timespec ts;
-    clock_gettime(CLOCK_REALTIME, &ts);
-    u64 time_ns = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    *fresh_start = aligned;
+    *fresh_end = aligned + new_leaf.length;
+    *have_leaf = !extent_find(mp, inode->extent_tree_root, aligned, leaf, leaf_block);
+    return new_leaf.block;
+}
+
+/* reads the blocks of a compressed leaf and decodes them into a scratch
+ * buffer, which then holds leaf->length bytes of file data */
+static u8 *decode_cluster(Mountpoint *mp, const ExtentNode *leaf) {
+    u32 block_size = mp->block_size;
+    u32 cluster_size = COMPRESS_CLUSTER_BLOCKS * block_size;
+
+    if(leaf->length > cluster_size || leaf->block_count > COMPRESS_CLUSTER_BLOCKS ||
+        leaf->compressed_length > leaf->block_count * block_size)
+        return NULL;
+
+    u8 *packed = scratch_buffer(SCRATCH_PACKED, cluster_size);
+    u8 *decoded = scratch_buffer(SCRATCH_DECODED, cluster_size);
+    if(!packed || !decoded) return NULL;
+
+    if(read_block(mp->disk, &mp->io_stats, leaf->block, block_size, leaf->block_count, packed, IO_DATA))
+        return NULL;
+
+    if(lz4_decompress(packed, leaf->compressed_length, decoded, leaf->length) != leaf->length)
+        return NULL;
+
+    return decoded;
+}
+
+/* reads what is on disk or inline, holes, unwritten extents and anything past
+ * the last extent read back as zeros */
+static int read_blocks(Mountpoint *mp, const Inode *inode_buf, u8 *buf, u64 offset, u64 size) {
+    if(!inode_buf->extent_tree_root) {
+        if(offset + size > inode_buf->inline_size) {
+            // a file that was truncated upwards without ever leaving the inode
+            u64 available = offset < inode_buf->inline_size ? inode_buf->inline_size - offset : 0;
+            memcpy(buf, inode_buf->payload + offset, available);
+            memset((u8 *) buf + available, 0, size - available);
+        } else {
+            memcpy(buf, inode_buf->payload + offset, size);
+        }
+
+        return 0;
+    }
+
+    u8 *data = scratch_buffer(SCRATCH_EDGES, 2 * mp->block_size);
+    if(!data) return -1;
+
+    u32 block_size = mp->block_size;
+    u64 root = inode_buf->extent_tree_root;
+    u8 *out = (u8 *) buf;
+    u64 end = offset + size;
+
+    ExtentNode leaf;
+    int have_leaf = 0;
+    u8 *decoded = NULL;
+    u64 decoded_block = 0;
+
+    while(offset < end) {
+        u64 in_block = offset % block_size;
+        u64 chunk = block_size - in_block;
+        if(chunk > end - offset) chunk = end - offset;
+
+        if(!have_leaf || !extent_maps(&leaf, offset))
+            have_leaf = !extent_find(mp, root, offset, &leaf, NULL);
+
+        if(!have_leaf || !extent_maps(&leaf, offset) || (leaf.flags & EXTENT_UNWRITTEN)) {
+            memset(out, 0, chunk);
+        } else if(leaf.compressed_length) {
+            // a whole cluster is decoded at once and kept for the next chunks
+            if(decoded_block != leaf.block) {
+                decoded = decode_cluster(mp, &leaf);
+                if(!decoded) return -1;
+                decoded_block = leaf.block;
+            }
+
+            memcpy(out, decoded + (offset - leaf.start_offset), chunk);
+        } else {
+            // everything the leaf maps comes in one read, whole blocks go
+            // straight to the caller and partial ones at either end through
+            // scratch
+            u64 block = leaf.block + (offset - leaf.start_offset) / block_size;
+            u64 run_end = leaf.start_offset + leaf.length;
+            if(run_end > end) run_end = end;
+
+            struct iovec vector[3];
+            int count = 0;
+            u64 head = 0, tail = 0, at = offset;
+            if(in_block || run_end - offset < block_size) {
+                head = block_size - in_block;
+                if(head > run_end - offset) head = run_end - offset;
+                vector[count++] = (struct iovec) { data, block_size };
+                at += head;
+            }
+
+            u64 full = (run_end - at) / block_size;
+            if(full) {
+                vector[count++] = (struct iovec) { out + (at - offset), full * block_size };
+                at += full * block_size;
+            }
+
+            if(at < run_end) {
+                tail = run_end - at;
+                vector[count++] = (struct iovec) { data + block_size, block_size };
+            }
+
+            if(read_block_vector(mp->disk, &mp->io_stats, block, block_size, vector, count,
+                io_class(inode_buf)))
+                return -1;
+
+            if(head) memcpy(out, data + in_block, head);
+            if(tail) memcpy(out + (at - offset), data + block_size, tail);
+            chunk = run_end - offset;
+        }
+
+        out += chunk;
+        offset += chunk;
+    }
+
+    return 0;
+}
+
+/* splits the raw leaf in leaf_block into the part before block index, the
+ * count blocks from there on and the part after, with the middle part moved
+ * to block and given flags - the first part keeps the leaf's node and the
+ * others go in right after it, and parts that continue the leaf next to them
+ * are joined to it instead */
+static int split_extent(Mountpoint *mp, Inode *inode_buf, const ExtentNode *leaf, u64 leaf_block,
+    u64 index, u64 count, u64 block, u64 flags) {
+    u32 block_size = mp->block_size;
+    u64 aligned = leaf->start_offset + index * block_size;
+
+    ExtentNode parts[3];
+    u64 tail = leaf->block_count - index - count;
+    memcpy(&parts[0], leaf, sizeof(ExtentNode));
+    parts[0].block_count = index;
+    parts[0].length = index * block_size;
+
+    memcpy(&parts[1], leaf, sizeof(ExtentNode));
+    parts[1].start_offset = aligned;
+    parts[1].block = block;
+    parts[1].block_count = count;
+    parts[1].length = tail ? count * block_size : leaf->start_offset + leaf->length - aligned;
+    parts[1].flags = flags;
+
+    memcpy(&parts[2], leaf, sizeof(ExtentNode));
+    parts[2].start_offset = aligned + count * block_size;
+    parts[2].block = leaf->block + index + count;
+    parts[2].block_count = tail;
+    parts[2].length = leaf->start_offset + leaf->length - parts[2].start_offset;
+
+    u64 used = 0;
+    for(int p = 0; p < 3; p++) {
+        if(parts[p].block_count) memcpy(&parts[used++], &parts[p], sizeof(ExtentNode));
+    }
+
+    ExtentNode next;
+    if(leaf->left_sibling_block) {
+        if(extent_read(mp, leaf->left_sibling_block, &next)) return -1;
+
+        if(extent_continues(&next, &parts[0], block_size)) {
+            next.block_count += parts[0].block_count;
+            next.length += parts[0].length;
+            if(extent_update(mp, leaf->left_sibling_block, &next)) return -1;
+            memmove(&parts[0], &parts[1], --used * sizeof(ExtentNode));
+        }
+    }
+
+    if(used && leaf->right_sibling_block) {
+        if(extent_read(mp, leaf->right_sibling_block, &next)) return -1;
+
+        ExtentNode *last = &parts[used - 1];
+        if(extent_continues(last, &next, block_size)) {
+            next.start_offset = last->start_offset;
+            next.length += last->length;
+            next.block = last->block;
+            next.block_count += last->block_count;
+            if(extent_update(mp, leaf->right_sibling_block, &next)) return -1;
+            used--;
+        }
+    }
+
+    if(!used)
+        return extent_remove(mp, inode_buf, leaf_block);
+
+    if(extent_update(mp, leaf_block, &parts[0])) return -1;
+
+    u64 at = leaf_block;
+    for(u64 p = 1; p < used; p++) {
+        if(extent_insert_after(mp, inode_buf, at, &parts[p], &at)) return -1;
+    }
+
+    return 0;
+}
+
+/* turns the blocks of an unwritten leaf that a write to [offset, end) lands on
+ * into written ones - they have never been written, so they are handed back
+ * as fresh and the caller zeroes whatever the write leaves of them */
+static int convert_unwritten(Mountpoint *mp, Inode *inode_buf, const ExtentNode *leaf,
+    u64 leaf_block, u64 offset, u64 end, u64 *fresh_start, u64 *fresh_end) {
+    u32 block_size = mp->block_size;
+    u64 index = (offset - leaf->start_offset) / block_size;
+    u64 aligned = leaf->start_offset + index * block_size;
+
+    u64 count = (end - aligned + block_size - 1) / block_size;
+    if(count > leaf->block_count - index) count = leaf->block_count - index;
+
+    if(split_extent(mp, inode_buf, leaf, leaf_block, index, count, leaf->block + index,
+        leaf->flags & ~EXTENT_UNWRITTEN))
+        return -1;
+
+    *fresh_start = aligned;
+    *fresh_end = aligned + count * block_size;
+    return 0;
+}
+
+/* gives the file its own copy of the shared blocks that a write to [offset,
+ * end) lands on in leaf, as one new run spliced into the extent tree - only
+ * blocks the write covers partially are copied, the rest is about to be
+ * overwritten anyway. a log-structured volume never overwrites in place, so
+ * there every block is moved this way. returns one if the tree changed and
+ * sets owned to how many blocks were moved, zero if the block at offset can
+ * be written where it is - owned is then set to how many blocks from it on
+ * can */
+static int cow_blocks(Mountpoint *mp, Inode *inode_buf, const ExtentNode *leaf, u64 leaf_block,
+    u64 offset, u64 end, u64 *owned) {
+    u32 block_size = mp->block_size;
+    u64 index = (offset - leaf->start_offset) / block_size;
+    u64 old_block = leaf->block + index;
+
+    u64 run = leaf->block_count - index;
+    if(!mp->log_mode && refcount_query(mp, old_block, &run) < 2) {
+        *owned = run;
+        return 0;
+    }
+
+    u64 aligned = leaf->start_offset + index * block_size;
+    u64 count = (end - aligned + block_size - 1) / block_size;
+    if(count > leaf->block_count - index) count = leaf->block_count - index;
+    if(count > run) count = run;
+
+    u64 allocated;
+    u64 new_block = allocate_blocks(mp, count, &allocated, data_class(inode_buf));
+    if(new_block == -1) return -1;
+    count = allocated;
+
+    u8 *data = scratch_buffer(SCRATCH_DATA, block_size);
+    if(!data) return -1;
+
+    for(u64 b = 0; b < count; b++) {
+        u64 from = aligned + b * block_size;
+        if(from >= offset && from + block_size <= end) continue;
+
+        if(read_block(mp->disk, &mp->io_stats, old_block + b, block_size, 1, data, io_class(inode_buf)) ||
+            write_data(mp, new_block + b, 1, data, io_class(inode_buf)))
+            return -1;
+    }
+
+    if(split_extent(mp, inode_buf, leaf, leaf_block, index, count, new_block, leaf->flags))
+        return -1;
+
+    // the other owners keep the old blocks
+    for(u64 b = 0; b < count; b++) {
+        if(free_block(mp, old_block + b)) return -1;
+    }
+
+    *owned = count;
+    return 1;
+}
+
+/* puts fresh leaves in place of everything the tree maps in [start, end) and
+ * frees the blocks they replace - raw leaves that stick out are trimmed, the
+ * caller makes sure compressed ones never do */
+static int replace_extents(Mountpoint *mp, Inode *inode_buf, u64 start, u64 end,
+    const ExtentNode *fresh, u64 fresh_count) {
+    u32 block_size = mp->block_size;
+
+    ExtentNode last;
+    if(inode_buf->extent_tree_root &&
+        extent_find(mp, inode_buf->extent_tree_root, -1, &last, NULL))
+        return -1;
+
+    if(!inode_buf->extent_tree_root || last.start_offset + last.length <= start) {
+        // appending, which is how compressed files usually grow
+        for(u64 i = 0; i < fresh_count; i++) {
+            if(extent_append(mp, inode_buf, &fresh[i], 0)) return -1;
+        }
+
+        return 0;
+    }
+
+    ExtentNode leaf;
+    u64 leaf_block;
+    if(extent_find(mp, inode_buf->extent_tree_root, start, &leaf, &leaf_block))
+        return -1;
+
+    // stale holds (first block, block count) pairs to free once the tree is done,
+    // prev is the last leaf in front of the range and tail what sticks out of it
+    u64 *stale = NULL;
+    u64 stale_count = 0, stale_capacity = 0;
+    u64 prev = 0;
+    ExtentNode tail;
+    int have_tail = 0, status = -1;
+
+    while(leaf.start_offset < end) {
+        u64 leaf_end = leaf.start_offset + leaf.length;
+        u64 next = leaf.right_sibling_block;
+
+        if(leaf_end <= start) {
+            prev = leaf_block;
+        } else {
+            // compressed leaves go whole, raw ones that overlap are split around it
+            u64 head = 0, tail_start = leaf.block_count;
+            if(!leaf.compressed_length) {
+                head = leaf.start_offset < start ? (start - leaf.start_offset) / block_size : 0;
+                tail_start = (end - leaf.start_offset) / block_size;
+                if(tail_start > leaf.block_count) tail_start = leaf.block_count;
+            }
+
+            if(stale_count == stale_capacity) {
+                stale_capacity = stale_capacity ? stale_capacity * 2 : 16;
+                u64 *grown = realloc(stale, stale_capacity * sizeof(u64) * 2);
+                if(!grown) goto done;
+                stale = grown;
+            }
+
+            stale[stale_count * 2] = leaf.block + head;
+            stale[stale_count * 2 + 1] = tail_start - head;
+            stale_count++;
+
+            have_tail = tail_start < leaf.block_count;
+            if(have_tail) {
+                memcpy(&tail, &leaf, sizeof(ExtentNode));
+                tail.start_offset = leaf.start_offset + tail_start * block_size;
+                tail.block = leaf.block + tail_start;
+                tail.block_count = leaf.block_count - tail_start;
+                tail.length = leaf_end - tail.start_offset;
+            }
+
+            if(head) {
+                leaf.block_count = head;
+                leaf.length = head * block_size;
+                if(extent_update(mp, leaf_block, &leaf)) goto done;
+                prev = leaf_block;
+            } else if(have_tail) {
+                // only the tail is left and it keeps the leaf's node
+                if(extent_update(mp, leaf_block, &tail)) goto done;
+                have_tail = 0;
+                break;
+            } else if(extent_remove(mp, inode_buf, leaf_block)) {
+                goto done;
+            }
+
+            if(have_tail) break;
+        }
+
+        if(!next) break;
+        leaf_block = next;
+        if(extent_read(mp, leaf_block, &leaf)) goto done;
+    }
+
+    // the fresh leaves go where the range was, keeping the leaves in file order
+    for(u64 i = 0; i < fresh_count; i++) {
+        if(prev ? extent_insert_after(mp, inode_buf, prev, &fresh[i], &prev) :
+            extent_insert(mp, inode_buf, &fresh[i], &prev))
+            goto done;
+    }
+
+    if(have_tail && extent_insert_after(mp, inode_buf, prev, &tail, NULL))
+        goto done;
+
+    status = 0;
+
+done:
+    for(u64 i = 0; !status && i < stale_count; i++) {
+        for(u64 b = 0; b < stale[i * 2 + 1]; b++) {
+            if(free_block(mp, stale[i * 2] + b)) status = -1;
+        }
+    }
+
+    free(stale);
+    return status;
+}
+
+/* writes length bytes of file data starting at the cluster boundary start -
+ * they go out compressed into one run of blocks if that saves at least a
+ * block and the run can be allocated contiguously, otherwise raw */
+static int store_cluster(Mountpoint *mp, Inode *inode_buf, const u8 *data, u64 start,
+    u64 length) {
+    u32 block_size = mp->block_size;
+    u32 cluster_size = COMPRESS_CLUSTER_BLOCKS * block_size;
+    u64 blocks = length / block_size;
+
+    u8 *packed = scratch_buffer(SCRATCH_PACKED, cluster_size);
+    if(!packed) return -1;
+
+    ExtentNode fresh[COMPRESS_CLUSTER_BLOCKS];
+    memset(fresh, 0, sizeof(fresh));
+    u64 fresh_count = 0;
+
+    usize packed_size = blocks > 1 ? lz4_compress(data, length, packed, (blocks - 1) * block_size) : 0;
+    if(packed_size) {
+        u64 needed = (packed_size + block_size - 1) / block_size;
+        u64 allocated;
+        u64 block = allocate_blocks(mp, needed, &allocated, ALLOC_DATA);
+        if(block == -1) return -1;
+
+        if(allocated == needed) {
+            memset(packed + packed_size, 0, needed * block_size - packed_size);
+            if(write_data(mp, block, needed, packed, io_class(inode_buf)))
+                return -1;
+
+            fresh[0].start_offset = start;
+            fresh[0].length = length;
+            fresh[0].block = block;
+            fresh[0].block_count = needed;
+            fresh[0].compressed_length = packed_size;
+            fresh_count = 1;
+        } else {
+            // too fragmented to be worth it, give the run back
+            for(u64 b = 0; b < allocated; b++) {
+                if(free_block(mp, block + b)) return -1;
+            }
+
+            packed_size = 0;
+        }
+    }
+
+    for(u64 done = 0; !packed_size && done < blocks; ) {
+        u64 allocated;
+        u64 block = allocate_blocks(mp, blocks - done, &allocated, ALLOC_DATA);
+        if(block == -1) return -1;
+
+        if(write_data(mp, block, allocated, data + done * block_size, io_class(inode_buf)))
+            return -1;
+
+        fresh[fresh_count].start_offset = start + done * block_size;
+        fresh[fresh_count].length = allocated * block_size;
+        fresh[fresh_count].block = block;
+        fresh[fresh_count].block_count = allocated;
+        fresh_count++;
+        done += allocated;
+    }
+
+    return replace_extents(mp, inode_buf, start, start + length, fresh, fresh_count);
+}
+
+/* rebuilds the cluster at start with size bytes from in at offset laid over
+ * what the file already holds there - the cluster ends at the end of the file
+ * rounded up to a block, and anything past the size reads back as zeros */
+static int pack_cluster(Mountpoint *mp, Inode *inode_buf, u64 start, const u8 *in,
+    u64 offset, u64 size) {
+    u32 block_size = mp->block_size;
+    u32 cluster_size = COMPRESS_CLUSTER_BLOCKS * block_size;
+    u64 end = offset + size;
+
+    u64 file_end = inode_buf->size > end ? inode_buf->size : end;
+    u64 length = file_end - start;
+    if(length > cluster_size) length = cluster_size;
+    length = (length + block_size - 1) / block_size * block_size;
+
+    u8 *cluster = scratch_buffer(SCRATCH_CLUSTER, cluster_size);
+    if(!cluster) return -1;
+
+    if(offset > start || end < start + length) {
+        if(read_blocks(mp, inode_buf, cluster, start, length)) return -1;
+
+        if(inode_buf->size < start + length) {
+            u64 valid = inode_buf->size > start ? inode_buf->size - start : 0;
+            memset(cluster + valid, 0, length - valid);
+        }
+    }
+
+    u64 from = offset > start ? offset : start;
+    u64 to = end < start + length ? end : start + length;
+    if(from < to)
+        memcpy(cluster + (from - start), in + (from - offset), to - from);
+
+    return store_cluster(mp, inode_buf, cluster, start, length);
+}
+
+/* compressed files are written a cluster at a time, every cluster the write
+ * touches is read, patched and stored again in new blocks */
+static int write_clusters(Mountpoint *mp, Inode *inode_buf, const u8 *in, u64 offset, u64 size) {
+    u32 cluster_size = COMPRESS_CLUSTER_BLOCKS * mp->block_size;
+    u64 end = offset + size;
+    u64 start = offset - (offset % cluster_size);
+
+    // inline data becomes the first cluster even if this write lands further out
+    if(!inode_buf->extent_tree_root && inode_buf->inline_size && start) {
+        if(pack_cluster(mp, inode_buf, 0, in, offset, 0)) return -1;
+    }
+
+    for(; start < end; start += cluster_size) {
+        if(pack_cluster(mp, inode_buf, start, in, offset, size)) return -1;
+    }
+
+    inode_buf->inline_size = 0;
+    return 0;
+}
+
+/* writes straight to the blocks of the file, allocating any that are missing
+ * - runs of whole blocks that are contiguous on disk go out in one write */
+static int write_raw_locked(Mountpoint *mp, Inode *inode_buf, const u8 *in, u64 offset,
+    u64 size) {
+    if(move_inline_data(mp, inode_buf))
+        return -1;
+
+    u8 *data = scratch_buffer(SCRATCH_DATA, mp->block_size);
+    if(!data) return -1;
+
+    u32 block_size = mp->block_size;
+    u64 end = offset + size;
+
+    ExtentNode leaf;
+    u64 leaf_block = 0;
+    int have_leaf = 0;
+    u64 fresh_start = 0, fresh_end = 0, moved_end = 0;
+
+    while(offset < end) {
+        u64 in_block = offset % block_size;
+        u64 chunk = block_size - in_block;
+        if(chunk > end - offset) chunk = end - offset;
+
+        u64 remaining = (end - offset + in_block + block_size - 1) / block_size;
+        u64 block = map_blocks(mp, inode_buf, &leaf, &leaf_block, &have_leaf, offset, remaining,
+            &fresh_start, &fresh_end);
+        if(block == -1) return -1;
+
+        // blocks this write allocated or already moved are its own, anything
+        // else that holds data is moved first if a clone shares it or the
+        // volume never overwrites in place
+        u64 owned = -1;
+        if(offset < moved_end) {
+            owned = (moved_end - offset) / block_size;
+        } else if(offset >= fresh_start && offset < fresh_end) {
+            owned = (fresh_end - offset + block_size - 1) / block_size;
+        } else if(have_leaf && extent_maps(&leaf, offset) &&
+            (__atomic_load_n(&mp->shared_count, __ATOMIC_RELAXED) ||
+            (mp->log_mode && !(leaf.flags & EXTENT_UNWRITTEN)))) {
+            int copied = cow_blocks(mp, inode_buf, &leaf, leaf_block, offset, end, &owned);
+            if(copied < 0) return -1;
+            if(copied) {
+                moved_end = offset - in_block + owned * block_size;
+                have_leaf = 0;
+                continue;
+            }
+        }
+
+        // the copy of a shared unwritten run is still unwritten
+        if(have_leaf && extent_maps(&leaf, offset) && (leaf.flags & EXTENT_UNWRITTEN)) {
+            if(convert_unwritten(mp, inode_buf, &leaf, leaf_block, offset, end, &fresh_start,
+                &fresh_end))
+                return -1;
+            have_leaf = 0;
+            continue;
+        }
+
+        if(chunk == block_size) {
+            u64 run = (end - offset) / block_size;
+            if(have_leaf && extent_maps(&leaf, offset)) {
+                u64 mapped = (leaf.start_offset + leaf.length - offset) / block_size;
+                if(run > mapped) run = mapped;
+                if(run > owned) run = owned;
+            } else {
+                run = 1;
+            }
+
+            if(write_data(mp, block, run, in, io_class(inode_buf)))
+                return -1;
+
+            chunk = run * block_size;
+        } else {
+            // blocks allocated by this write have never been written
+            if(offset >= fresh_start && offset < fresh_end)
+                memset(data, 0, block_size);
+            else if(read_block(mp->disk, &mp->io_stats, block, block_size, 1, data, io_class(inode_buf)))
+                return -1;
+
+            memcpy(data + in_block, in, chunk);
+            if(write_data(mp, block, 1, data, io_class(inode_buf)))
+                return -1;
+        }
+
+        in += chunk;
+        offset += chunk;
+    }
+
+    return 0;
+}
+
+/* blocks that aren't shared are overwritten in place, so dedup must not give
+ * one of them a second owner between the check and the write - on a volume
+ * without dedup nothing this file owns is indexed and there is nothing to
+ * hold off */
+static int write_raw(Mountpoint *mp, Inode *inode_buf, const u8 *in, u64 offset, u64 size) {
+    int locked = __atomic_load_n(&mp->dedup_capacity, __ATOMIC_RELAXED) != 0;
+    if(locked) pthread_rwlock_rdlock(&mp->share_lock);
+
+    int status = write_raw_locked(mp, inode_buf, in, offset, size);
+
+    if(locked) pthread_rwlock_unlock(&mp->share_lock);
+    return status;
+}
+
+/* maps the block at offset, right past the end of the file, to a block that
+ * another file already references - it continues the last extent if that
+ * ends right in front of the block on disk */
+static int map_shared(Mountpoint *mp, Inode *inode_buf, u64 block, u64 offset) {
+    u32 block_size = mp->block_size;
+    ExtentNode leaf;
+    u64 leaf_block;
+
+    if(inode_buf->extent_tree_root &&
+        extent_find(mp, inode_buf->extent_tree_root, -1, &leaf, &leaf_block))
+        return -1;
+
+    if(inode_buf->extent_tree_root && !leaf.compressed_length && !leaf.flags &&
+        leaf.start_offset + leaf.length == offset && leaf.length == leaf.block_count * block_size &&
+        leaf.block + leaf.block_count == block) {
+        leaf.block_count++;
+        leaf.length += block_size;
+        return extent_update(mp, leaf_block, &leaf);
+    }
+
+    memset(&leaf, 0, sizeof(ExtentNode));
+    leaf.start_offset = offset;
+    leaf.length = block_size;
+    leaf.block = block;
+    leaf.block_count = 1;
+    return extent_append(mp, inode_buf, &leaf, 0);
+}
+
+/* adds the blocks that now hold [offset, offset + count blocks) to the
+ * fingerprint index */
+static int index_blocks(Mountpoint *mp, Inode *inode_buf, const Hash128 *hashes, u64 offset,
+    u64 count) {
+    u32 block_size = mp->block_size;
+    ExtentNode leaf;
+    int have_leaf = 0;
+
+    for(u64 i = 0; i < count; i++, offset += block_size) {
+        if(!have_leaf || !extent_maps(&leaf, offset))
+            have_leaf = !extent_find(mp, inode_buf->extent_tree_root, offset, &leaf, NULL);
+        if(!have_leaf || !extent_maps(&leaf, offset)) return -1;
+
+        u64 block = leaf.block + (offset - leaf.start_offset) / block_size;
+        if(dedup_insert(mp, &hashes[i], block)) return -1;
+    }
+
+    return 0;
+}
+
+/* with dedup on, whole blocks written past the end of the mapped data are
+ * fingerprinted first - a block whose data is already on disk gets another
+ * reference to it, runs of new data are written as usual and indexed. the
+ * rest of the write, and overwrites in particular, go the usual way */
+static int write_dedup(Mountpoint *mp, Inode *inode_buf, const u8 *in, u64 offset, u64 size) {
+    u32 block_size = mp->block_size;
+    u64 end = offset + size;
+
+    if(move_inline_data(mp, inode_buf))
+        return -1;
+
+    u64 mapped_end = 0;
+    if(inode_buf->extent_tree_root) {
+        ExtentNode last;
+        if(extent_find(mp, inode_buf->extent_tree_root, -1, &last, NULL)) return -1;
+        mapped_end = last.start_offset + last.length;
+    }
+
+    u64 first = offset > mapped_end ? offset : mapped_end;
+    first = (first + block_size - 1) / block_size * block_size;
+    u64 stop = end - (end % block_size);
+    if(first >= stop)
+        return write_raw(mp, inode_buf, in, offset, size);
+
+    if(first > offset && write_raw(mp, inode_buf, in, offset, first - offset))
+        return -1;
+
+    Hash128 *hashes = malloc((stop - first) / block_size * sizeof(Hash128));
+    if(!hashes) return -1;
+
+    for(u64 at = first; at < stop;) {
+        // gather a run of blocks with nothing to share, a block equal to the
+        // one before it ends the run so it can share the one just written
+        u64 run = at, shared = 0;
+        Hash128 *run_hashes = &hashes[(at - first) / block_size];
+
+        for(; run < stop; run += block_size) {
+            const u8 *data = in + (run - offset);
+            u64 i = (run - at) / block_size;
+            run_hashes[i] = hash128(data, block_size, 0);
+
+            if(i && run_hashes[i].low == run_hashes[i - 1].low &&
+                run_hashes[i].high == run_hashes[i - 1].high)
+                break;
+
+            if((shared = dedup_share(mp, &run_hashes[i], data))) break;
+        }
+
+        if(run > at && (write_raw(mp, inode_buf, in + (at - offset), at, run - at) ||
+            index_blocks(mp, inode_buf, run_hashes, at, (run - at) / block_size)))
+            goto fail;
+
+        if(shared) {
+            if(map_shared(mp, inode_buf, shared, run)) {
+                free_block(mp, shared);
+                goto fail;
+            }
+
+            run += block_size;
+        }
+
+        at = run;
+    }
+
+    free(hashes);
+    return stop < end ? write_raw(mp, inode_buf, in + (stop - offset), stop, end - stop) : 0;
+
+fail:
+    free(hashes);
+    return -1;
+}
+
+/* every write to file data comes through here and takes the path the file
+ * and the volume ask for */
+static int write_blocks(Mountpoint *mp, Inode *inode_buf, const u8 *in, u64 offset, u64 size) {
+    if(inode_buf->mode & INODE_MODE_COMPRESSED)
+        return write_clusters(mp, inode_buf, in, offset, size);
+
+    // directories change their blocks in place, they can't share them
+    if(INODE_MODE_TYPE_IS_REG(inode_buf->mode) && __atomic_load_n(&mp->dedup_capacity, __ATOMIC_RELAXED))
+        return write_dedup(mp, inode_buf, in, offset, size);
+
+    return write_raw(mp, inode_buf, in, offset, size);
+}
+
+static int pending_reserve(Mountpoint *mp, CachedInode *cached, u64 size) {
+    if(size <= cached->pending_capacity)
+        return 0;
+
+    u64 capacity = cached->pending_capacity ? cached->pending_capacity * 2 : mp->block_size;
+    while(capacity < size) capacity *= 2;
+    if(capacity > WRITEBACK_INODE_LIMIT) capacity = WRITEBACK_INODE_LIMIT;
+
+    u8 *pending = realloc(cached->pending, capacity);
+    if(!pending) return -1;
+
+    __atomic_add_fetch(&mp->pending_bytes, capacity - cached->pending_capacity, __ATOMIC_RELAXED);
+    cached->pending = pending;
+    cached->pending_capacity = capacity;
+    return 0;
+}
+
+/* buffers a write as delayed data if it lands at or past the last mapped
+ * block, returns one if it did and zero if the write has to go to disk */
+static int delay_write(Mountpoint *mp, CachedInode *cached, Inode *inode_buf, const u8 *in,
+    u64 offset, u64 size, u64 time_ns) {
+    u32 block_size = mp->block_size;
+    u64 end = offset + size;
+
+    if(!cached->pending_size) {
+        u64 start = offset - (offset % block_size);
+        if(end - start > WRITEBACK_INODE_LIMIT) return 0;
+
+        if(inode_buf->extent_tree_root) {
+            ExtentNode last;
+            if(extent_find(mp, inode_buf->extent_tree_root, -1, &last, NULL)) return -1;
+            if(last.start_offset + last.length > start + block_size)
+                return 0; // an overwrite in the middle of the file
+        }
+
+        if(pending_reserve(mp, cached, end - start)) return -1;
+        cached->pending_offset = start;
+        __atomic_store_n(&cached->pending_time, time_ns, __ATOMIC_RELAXED);
+
+        // the first block may already hold data, on disk or inline
+        if(inode_buf->size > start) {
+            u64 loaded = inode_buf->size - start;
+            if(loaded > block_size) loaded = block_size;
+            if(read_blocks(mp, inode_buf, cached->pending, start, loaded)) return -1;
+            cached->pending_size = loaded;
+        }
+
+        if(!inode_buf->extent_tree_root && !start)
+            inode_buf->inline_size = 0;
+    } else if(offset < cached->pending_offset ||
+        end - cached->pending_offset > WRITEBACK_INODE_LIMIT) {
+        return 0;
+    } else if(offset - offset % block_size >
+        cached->pending_offset + (cached->pending_size + block_size - 1) / block_size * block_size) {
+        return 0; // a whole block of nothing in between stays a hole
+    } else if(pending_reserve(mp, cached, end - cached->pending_offset)) {
+        return -1;
+    }
+
+    u64 at = offset - cached->pending_offset;
+    if(at > cached->pending_size)
+        memset(cached->pending + cached->pending_size, 0, at - cached->pending_size);
+
+    memcpy(cached->pending + at, in, size);
+    if(at + size > cached->pending_size)
+        cached->pending_size = at + size;
+
+    return 1;
+}
+
+static void pending_release(Mountpoint *mp, CachedInode *cached) {
+    __atomic_sub_fetch(&mp->pending_bytes, cached->pending_capacity, __ATOMIC_RELAXED);
+    free(cached->pending);
+    cached->pending = NULL;
+    cached->pending_offset = 0;
+    cached->pending_size = 0;
+    cached->pending_capacity = 0;
+    __atomic_store_n(&cached->pending_time, 0, __ATOMIC_RELAXED);
+}
+
+/* allocates blocks for the delayed data of an inode and writes it out, the
+ * whole buffer is known by now so it usually becomes a single extent */
+int flush_inode(Mountpoint *mp, CachedInode *cached) {
+    if(!mp || !cached) return -1;
+    if(!cached->pending_size) return 0;
+
+    Inode *inode_buf = scratch_buffer(SCRATCH_METADATA, mp->block_size);
+    if(!inode_buf || read_inode(mp, cached->inode, inode_buf))
+        return -1;
+
+    if(write_blocks(mp, inode_buf, cached->pending, cached->pending_offset, cached->pending_size) ||
+        write_inode(mp, cached->inode, inode_buf))
+        return -1;
+
+    pending_release(mp, cached);
+    return 0;
+}
+
+/* writes that extend a file are buffered in the inode cache and only get
+ * blocks once they are flushed - when the buffer is full, the volume holds too
+ * much delayed data, the cache is synced, or the buffer has been around for
+ * WRITEBACK_TIMEOUT, which the next write checks and the writeback thread of
+ * a volume mounted through the library catches otherwise - everything else
+ * goes straight to disk */
+int write_to_inode(Mountpoint *mp, u64 inode, const void *buf, u64 offset, u64 size) {
+    if(!mp || !mp->superblock || !inode || !buf || !size)
+        return -1;
+
+    CachedInode *cached = icache_get(mp, inode, 1);
+    if(!cached) return -1;
+
+    int status = -1;
+    u32 max_inline_size = mp->inode_size - sizeof(Inode);
+    Inode *inode_buf = scratch_buffer(SCRATCH_METADATA, mp->block_size);
+    if(!inode_buf || read_inode(mp, inode, inode_buf))
+        goto done;
+
+    u64 time_ns = now_ns();
+    u64 end = offset + size;
+
+    if(!inode_buf->extent_tree_root && !cached->pending_size && end <= max_inline_size) {
+        if(offset > inode_buf->inline_size)
+            memset(inode_buf->payload + inode_buf->inline_size, 0, offset - inode_buf->inline_size);
 
-    if((!inode_buf->extent_tree_root) && (offset + size <= max_inline_size)) {
         memcpy(inode_buf->payload + offset, buf, size);
-        if(offset + size > inode_buf->inline_size)
-            inode_buf->inline_size = offset + size;
+        if(end > inode_buf->inline_size)
+            inode_buf->inline_size = end;
+    } else {
+        int delayed = delay_write(mp, cached, inode_buf, buf, offset, size, time_ns);
+        if(delayed < 0) goto done;
+
+        if(!delayed) {
+            // the delayed data goes first, it may share a block with this write
+            if(flush_inode(mp, cached) || read_inode(mp, inode, inode_buf) ||
+                write_blocks(mp, inode_buf, buf, offset, size))
+                goto done;
+        }
+    }
+
+    if(end > inode_buf->size)
+        inode_buf->size = end;
+
+    inode_buf->modified_time = time_ns;
+    inode_buf->changed_time = time_ns;
+    if(write_inode(mp, inode, inode_buf))
+        goto done;
+
+    status = 0;
+    if(cached->pending_size && (cached->pending_size >= WRITEBACK_INODE_LIMIT ||
+        time_ns - cached->pending_time >= WRITEBACK_TIMEOUT ||
+        __atomic_load_n(&mp->pending_bytes, __ATOMIC_RELAXED) > WRITEBACK_VOLUME_LIMIT))
+        status = flush_inode(mp, cached);
+
+done:
+    icache_put(mp, cached);
+    return status;
+}
+
+int read_from_inode(Mountpoint *mp, u64 inode, void *buf, u64 offset, u64 size) {
+    if(!mp || !mp->superblock || !inode || !buf)
+        return -1;
+
+    CachedInode *cached = icache_get(mp, inode, 1);
+    if(!cached) return -1;
+
+    int status = -1;
+    Inode *inode_buf = scratch_buffer(SCRATCH_METADATA, mp->block_size);
+    if(!inode_buf || read_inode(mp, inode, inode_buf) || offset > inode_buf->size ||
+        size > inode_buf->size - offset || read_blocks(mp, inode_buf, buf, offset, size))
+        goto done;
+
+    // delayed data is newer than anything on disk
+    u64 pending_end = cached->pending_offset + cached->pending_size;
+    if(cached->pending_size && offset < pending_end && offset + size > cached->pending_offset) {
+        u64 from = offset > cached->pending_offset ? offset : cached->pending_offset;
+        u64 to = offset + size < pending_end ? offset + size : pending_end;
+        memcpy((u8 *) buf + (from - offset), cached->pending + (from - cached->pending_offset),
+            to - from);
+    }
+
+    status = 0;
+
+done:
+    icache_put(mp, cached);
+    return status;
+}
+
+/* growing only changes the size and leaves a hole, shrinking frees every
+ * block past the new end of the file */
+int truncate_inode(Mountpoint *mp, u64 inode, u64 size) {
+    if(!mp || !mp->superblock || !inode)
+        return -1;
+
+    u32 block_size = mp->block_size;
+    u32 max_inline_size = mp->inode_size - sizeof(Inode);
+    Inode *inode_buf = scratch_buffer(SCRATCH_METADATA, mp->block_size);
+    if(!inode_buf || read_inode(mp, inode, inode_buf))
+        return -1;
+
+    // delayed data past the new end is simply forgotten
+    CachedInode *cached = icache_get(mp, inode, 1);
+    if(!cached) return -1;
+
+    if(cached->pending_size && size <= cached->pending_offset)
+        pending_release(mp, cached);
+    else if(cached->pending_size && size < cached->pending_offset + cached->pending_size)
+        cached->pending_size = size - cached->pending_offset;
+
+    icache_put(mp, cached);
+
+    if(!inode_buf->extent_tree_root) {
+        if(size <= max_inline_size) {
+            if(size > inode_buf->inline_size)
+                memset(inode_buf->payload + inode_buf->inline_size, 0, size - inode_buf->inline_size);
+            inode_buf->inline_size = size;
+        } else if(move_inline_data(mp, inode_buf)) {
+            return -1;
+        }
+    } else if(size < inode_buf->size) {
+        // every leaf from the one holding the new end on loses what lies past it
+        ExtentNode leaf;
+        u64 leaf_block;
+        u64 end_block = (size + block_size - 1) / block_size;
+        if(extent_find(mp, inode_buf->extent_tree_root, size, &leaf, &leaf_block))
+            return -1;
+
+        for(;;) {
+            u64 next = leaf.right_sibling_block;
+
+            // a compressed leaf holding the new end is stored again below
+            if(!leaf.compressed_length || leaf.start_offset >= size) {
+                u64 first = leaf.start_offset / block_size;
+                u64 keep = (end_block > first) ? end_block - first : 0;
+                if(keep > leaf.block_count) keep = leaf.block_count;
+
+                for(u64 b = keep; b < leaf.block_count; b++)
+                    free_block(mp, leaf.block + b);
+
+                if(!keep) {
+                    if(extent_remove(mp, inode_buf, leaf_block)) return -1;
+                } else if(keep < leaf.block_count) {
+                    leaf.block_count = keep;
+                    leaf.length = keep * block_size;
+                    if(extent_update(mp, leaf_block, &leaf)) return -1;
+                }
+            }
+
+            if(!next) break;
+            leaf_block = next;
+            if(extent_read(mp, leaf_block, &leaf)) return -1;
+        }
 
-        inode_buf->size = inode_buf->inline_size;
-        inode_buf->modified_time = time_ns;
-        inode_buf->changed_time = time_ns;
-        return write_inode(inode, inode_buf);
+        if(inode_buf->mode & INODE_MODE_COMPRESSED) {
+            // the cluster holding the new end keeps its data up to there only
+            u64 cluster_size = COMPRESS_CLUSTER_BLOCKS * block_size;
+            inode_buf->size = size;
+            if(inode_buf->extent_tree_root &&
+                !extent_find(mp, inode_buf->extent_tree_root, size - 1, &leaf, NULL) &&
+                extent_maps(&leaf, size - 1) && leaf.start_offset + leaf.length > size &&
+                pack_cluster(mp, inode_buf, size - size % cluster_size, NULL, size, 0))
+                return -1;
+        }
+
+        // the rest of the last block must read back as zeros if the file grows
+        // again, and the block gets copied first if a clone shares it
+        u64 in_block = size % block_size;
+        if(!(inode_buf->mode & INODE_MODE_COMPRESSED) && in_block && inode_buf->extent_tree_root &&
+            !extent_find(mp, inode_buf->extent_tree_root, size, &leaf, NULL) &&
+            extent_maps(&leaf, size) && !(leaf.flags & EXTENT_UNWRITTEN)) {
+            u8 *zeros = calloc(1, block_size - in_block);
+            int status = !zeros || write_blocks(mp, inode_buf, zeros, size, block_size - in_block);
+            free(zeros);
+            if(status) return -1;
+        }
+    }
+
+    u64 time_ns = now_ns();
+    inode_buf->size = size;
+    inode_buf->modified_time = time_ns;
+    inode_buf->changed_time = time_ns;
+    return write_inode(mp, inode, inode_buf);
+}
+
+/* gives [offset, offset + size) blocks that read back as zeros until they are
+ * first written - holes in the range become unwritten extents, blocks that
+ * are already mapped stay as they are, and the file grows to cover the range */
+int preallocate_inode(Mountpoint *mp, u64 inode, u64 offset, u64 size) {
+    if(!mp || !mp->superblock || !inode || !size || offset + size < offset)
+        return -1;
+
+    u32 block_size = mp->block_size;
+    u32 max_inline_size = mp->inode_size - sizeof(Inode);
+    u64 end = offset + size;
+
+    // delayed data gets its blocks first, the range may cover it
+    CachedInode *cached = icache_get(mp, inode, 1);
+    if(!cached) return -1;
+
+    int status = flush_inode(mp, cached);
+    icache_put(mp, cached);
+    if(status) return -1;
+
+    Inode *inode_buf = scratch_buffer(SCRATCH_METADATA, mp->block_size);
+    if(!inode_buf || read_inode(mp, inode, inode_buf))
+        return -1;
+
+    // clusters are allocated as they are compressed, there is nothing to reserve
+    if(inode_buf->mode & INODE_MODE_COMPRESSED)
+        return -1;
+
+    if(!inode_buf->extent_tree_root && end <= max_inline_size) {
+        if(end > inode_buf->inline_size) {
+            memset(inode_buf->payload + inode_buf->inline_size, 0, end - inode_buf->inline_size);
+            inode_buf->inline_size = end;
+        }
     } else {
-        printf("todo: write to extent\n");
+        if(move_inline_data(mp, inode_buf)) return -1;
+
+        // fill every hole in the range with runs of unwritten blocks, going
+        // through the leaves from the one the range starts in
+        u64 at = offset - (offset % block_size);
+        u64 last = (end + block_size - 1) / block_size * block_size;
+
+        ExtentNode leaf;
+        int have_leaf = 0;
+        if(inode_buf->extent_tree_root) {
+            if(extent_find(mp, inode_buf->extent_tree_root, at, &leaf, NULL)) return -1;
+            have_leaf = 1;
+        }
+
+        while(at < last) {
+            if(have_leaf && leaf.start_offset <= at) {
+                u64 leaf_end = leaf.start_offset + leaf.block_count * block_size;
+                if(leaf_end > at) at = leaf_end;
+
+                if(!leaf.right_sibling_block) have_leaf = 0;
+                else if(extent_read(mp, leaf.right_sibling_block, &leaf)) goto fail;
+                continue;
+            }
+
+            u64 gap_end = have_leaf && leaf.start_offset < last ? leaf.start_offset : last;
+            u64 allocated;
+            u64 block = allocate_blocks(mp, (gap_end - at) / block_size, &allocated, ALLOC_DATA);
+            if(block == -1) goto fail;
+
+            ExtentNode fresh;
+            memset(&fresh, 0, sizeof(ExtentNode));
+            fresh.start_offset = at;
+            fresh.length = allocated * block_size;
+            fresh.block = block;
+            fresh.block_count = allocated;
+            fresh.flags = EXTENT_UNWRITTEN;
+
+            if(extent_insert(mp, inode_buf, &fresh, NULL)) {
+                for(u64 b = 0; b < allocated; b++)
+                    free_block(mp, block + b);
+                goto fail;
+            }
+
+            at += fresh.length;
+        }
+
+        goto done;
+
+    fail:
+        // the runs that did go in stay, the tree they are in has to be kept
+        write_inode(mp, inode, inode_buf);
         return -1;
     }
 
+done:
+    if(end > inode_buf->size)
+        inode_buf->size = end;
+
+    inode_buf->changed_time = now_ns();
+    return write_inode(mp, inode, inode_buf);
+}
+
+/* zeros [from, to) where it is backed by written data, going a block or a
+ * cluster at a time so holes and unwritten extents are left alone */
+static int zero_range(Mountpoint *mp, Inode *inode_buf, u64 from, u64 to, u64 unit) {
+    u8 *zeros = calloc(1, unit);
+    if(!zeros) return -1;
+
+    ExtentNode leaf;
+    while(from < to) {
+        u64 chunk = unit - (from % unit);
+        if(chunk > to - from) chunk = to - from;
+
+        if(!extent_find(mp, inode_buf->extent_tree_root, from, &leaf, NULL) &&
+            extent_maps(&leaf, from) && !(leaf.flags & EXTENT_UNWRITTEN) &&
+            write_blocks(mp, inode_buf, zeros, from, chunk)) {
+            free(zeros);
+            return -1;
+        }
+
+        from += chunk;
+    }
+
+    free(zeros);
     return 0;
 }
+
+/* frees the blocks, or clusters, that lie wholly inside [offset, offset +
+ * size) and zeros what the range covers of the ones at its edges - the file
+ * keeps its size and the range reads back as zeros */
+int punch_inode(Mountpoint *mp, u64 inode, u64 offset, u64 size) {
+    if(!mp || !mp->superblock || !inode || offset + size < offset)
+        return -1;
+
+    CachedInode *cached = icache_get(mp, inode, 1);
+    if(!cached) return -1;
+
+    int status = flush_inode(mp, cached);
+    icache_put(mp, cached);
+    if(status) return -1;
+
+    Inode *inode_buf = scratch_buffer(SCRATCH_METADATA, mp->block_size);
+    if(!inode_buf || read_inode(mp, inode, inode_buf))
+        return -1;
+
+    u64 end = offset + size;
+    if(end > inode_buf->size) end = inode_buf->size;
+
+    if(offset < end && !inode_buf->extent_tree_root) {
+        if(offset < inode_buf->inline_size) {
+            u64 stop = end < inode_buf->inline_size ? end : inode_buf->inline_size;
+            memset(inode_buf->payload + offset, 0, stop - offset);
+        }
+    } else if(offset < end) {
+        u64 unit = mp->block_size;
+        if(inode_buf->mode & INODE_MODE_COMPRESSED)
+            unit *= COMPRESS_CLUSTER_BLOCKS;
+
+        // the block holding the end of the file goes too if the range reaches it
+        u64 first = (offset + unit - 1) / unit * unit;
+        u64 last = end == inode_buf->size ? (end + unit - 1) / unit * unit : end - (end % unit);
+
+        if(first < last) {
+            if(replace_extents(mp, inode_buf, first, last, NULL, 0) ||
+                (offset < first && zero_range(mp, inode_buf, offset, first, unit)) ||
+                (last < end && zero_range(mp, inode_buf, last, end, unit)))
+                return -1;
+        } else if(zero_range(mp, inode_buf, offset, end, unit)) {
+            return -1;
+        }
+    }
+
+    u64 time_ns = now_ns();
+    inode_buf->modified_time = time_ns;
+    inode_buf->changed_time = time_ns;
+    return write_inode(mp, inode, inode_buf);
+}
+
+/* moves the blocks of a file that lie in the segments marked in victims to
+ * new ones, which on a log-structured volume come from the log head - raw
+ * runs are split off their leaf like a copy on write, a compressed leaf moves
+ * as a whole, and blocks a clone shares stay where they are since the other
+ * owners point at them. moved counts the blocks copied */
+int relocate_inode(Mountpoint *mp, u64 inode, const u8 *victims, u64 *moved) {
+    if(!mp || !mp->superblock || !inode || !victims || !moved)
+        return -1;
+
+    u32 block_size = mp->block_size;
+    u64 segment = mp->log_segment;
+    Inode *inode_buf = scratch_buffer(SCRATCH_METADATA, mp->block_size);
+    u8 *data = scratch_buffer(SCRATCH_CLUSTER, COMPRESS_CLUSTER_BLOCKS * block_size);
+    if(!inode_buf || !data || read_inode(mp, inode, inode_buf))
+        return -1;
+
+    if(INODE_MODE_TYPE_IS_DIR(inode_buf->mode) || !inode_buf->extent_tree_root)
+        return 0;
+
+    ExtentNode leaf;
+    u64 leaf_block;
+    u64 offset = 0;
+    if(extent_find(mp, inode_buf->extent_tree_root, 0, &leaf, &leaf_block))
+        return -1;
+
+    for(;;) {
+        // the first block at or past offset that has to move
+        u64 index = offset > leaf.start_offset ? (offset - leaf.start_offset) / block_size : 0;
+        u64 count = 0;
+        while(index < leaf.block_count) {
+            u64 run = 1;
+            if(victims[(leaf.block + index) / segment] &&
+                (!__atomic_load_n(&mp->shared_count, __ATOMIC_RELAXED) ||
+                refcount_query(mp, leaf.block + index, &run) < 2))
+                break;
+
+            index += run;
+        }
+
+        if(index >= leaf.block_count) {
+            if(!leaf.right_sibling_block) break;
+
+            leaf_block = leaf.right_sibling_block;
+            if(extent_read(mp, leaf_block, &leaf)) return -1;
+            continue;
+        }
+
+        if(leaf.compressed_length) {
+            index = 0;
+            count = leaf.block_count;
+        } else {
+            while(index + count < leaf.block_count && count < COMPRESS_CLUSTER_BLOCKS &&
+                victims[(leaf.block + index + count) / segment]) {
+                u64 run = 1;
+                if(__atomic_load_n(&mp->shared_count, __ATOMIC_RELAXED) &&
+                    refcount_query(mp, leaf.block + index + count, &run) >= 2)
+                    break;
+                count++;
+            }
+        }
+
+        u64 allocated;
+        u64 block = allocate_blocks(mp, count, &allocated, ALLOC_DATA);
+        if(block == -1) return -1;
+
+        // a compressed cluster has to stay in one run, it waits for a longer one
+        if(allocated < count && leaf.compressed_length) {
+            for(u64 b = 0; b < allocated; b++) {
+                if(free_block(mp, block + b)) return -1;
+            }
+
+            offset = leaf.start_offset + leaf.length;
+            continue;
+        }
+
+        // unwritten blocks read as zeros whatever they hold
+        count = allocated;
+        if(!(leaf.flags & EXTENT_UNWRITTEN) &&
+            (read_block(mp->disk, &mp->io_stats, leaf.block + index, block_size, count, data, IO_DATA) ||
+            write_data(mp, block, count, data, IO_DATA)))
+            return -1;
+
+        u64 old_block = leaf.block + index;
+        if(leaf.compressed_length) {
+            leaf.block = block;
+            if(extent_update(mp, leaf_block, &leaf)) return -1;
+            offset = leaf.start_offset + leaf.length;
+        } else {
+            if(split_extent(mp, inode_buf, &leaf, leaf_block, index, count, block, leaf.flags))
+                return -1;
+            offset = leaf.start_offset + (index + count) * block_size;
+        }
+
+        for(u64 b = 0; b < count; b++) {
+            if(free_block(mp, old_block + b)) return -1;
+        }
+
+        *moved += count;
+        if(extent_find(mp, inode_buf->extent_tree_root, offset, &leaf, &leaf_block))
+            return -1;
+    }
+
+    return write_inode(mp, inode, inode_buf);
+}
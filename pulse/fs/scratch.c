@@ -0,0 +1,72 @@
+/*
+ * pulse - a highly scalable SSD-first file system with predictable logarithmic
+ * bounds across all operations
+ * 
+ * Copyright (c) 2025 Omar Elghoul
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <pulse/pulse.h>
+#include <pthread.h>
+#include <stdlib.h>
+
+/* every thread gets its own set of scratch buffers, each one grows to the
+ * largest size the thread has asked of it and they are all released when the
+ * thread exits - growing one buffer never moves the others, so a caller can
+ * hold several kinds at once, and nothing in here is shared so no locking is
+ * needed */
+
+static __thread void *buffers[SCRATCH_BUFFERS];
+static __thread u32 sizes[SCRATCH_BUFFERS];
+
+static pthread_key_t scratch_key;
+static pthread_once_t scratch_once = PTHREAD_ONCE_INIT;
+
+static void scratch_release(void *unused) {
+    for(int i = 0; i < SCRATCH_BUFFERS; i++) {
+        free(buffers[i]);
+        buffers[i] = NULL;
+        sizes[i] = 0;
+    }
+}
+
+static void scratch_init(void) {
+    pthread_key_create(&scratch_key, scratch_release);
+}
+
+static int scratch_grow(ScratchBuffer which, u32 size) {
+    pthread_once(&scratch_once, scratch_init);
+
+    void *buffer = realloc(buffers[which], size);
+    if(!buffer) return -1;
+    buffers[which] = buffer;
+    sizes[which] = size;
+
+    // the value only has to be non-NULL for the destructor to run
+    pthread_setspecific(scratch_key, buffers);
+    return 0;
+}
+
+void *scratch_buffer(ScratchBuffer which, u32 size) {
+    if(size > sizes[which] && scratch_grow(which, size))
+        return NULL;
+
+    return buffers[which];
+}
@@ -0,0 +1,341 @@
+/*
+ * pulse - a highly scalable SSD-first file system with predictable logarithmic
+ * bounds across all operations
+ * 
+ * Copyright (c) 2025 Omar Elghoul
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <pulse/pulse.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+/* a trace is every block read and write in the order they completed, kept in
+ * a ring of two halves - the I/O paths only append to one half under a lock
+ * while a thread of its own writes the other half out, so recording costs a
+ * copy of 24 bytes and the file is written in large pieces. the disabled path
+ * is a single relaxed load in read_block() and write_block()
+ *
+ * only one volume is traced at a time. block I/O is told apart by the counters
+ * it is counted against, so the records carry no volume of their own and I/O
+ * of other volumes, format and replay never makes it into the file */
+
+typedef struct Trace {
+    pthread_mutex_t lock;
+    pthread_cond_t wake;        // a half is full, or it was written out
+    pthread_t flusher;
+    FILE *file;
+    TraceRecord *ring;
+    u64 start;
+    u64 head;                   // records in the half being filled
+    u64 pending;                // records in the other half still to be written
+    u64 records;
+    u8 filling;                 // which half is being filled
+    u8 stop;
+    u8 failed;
+} Trace;
+
+static Trace trace = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
+};
+
+// the counters of the volume being traced, NULL while nothing is
+IOStats *trace_stats;
+
+static const char *io_class_names[IO_CLASSES] = {
+    [IO_SUPERBLOCK] = "superblock",
+    [IO_INODE] = "inode",
+    [IO_DIRECTORY] = "directory",
+    [IO_EXTENT] = "extent",
+    [IO_JOURNAL] = "journal",
+    [IO_TABLE] = "table",
+    [IO_DATA] = "data",
+};
+
+const char *io_class_name(IOClass io_class) {
+    if(io_class >= IO_BITMAP && io_class < IO_BITMAP + BITMAP_MAX_LAYERS)
+        return "bitmap";
+
+    return io_class < IO_CLASSES ? io_class_names[io_class] : "unknown";
+}
+
+static u64 trace_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* must hold the lock, passes a full half to the flusher once it is idle */
+static void trace_hand_off(void) {
+    if(trace.head < TRACE_RING_RECORDS || trace.pending) return;
+
+    trace.filling ^= 1;
+    trace.pending = trace.head;
+    trace.head = 0;
+    pthread_cond_broadcast(&trace.wake);
+}
+
+static void *trace_main(void *arg) {
+    pthread_mutex_lock(&trace.lock);
+    for(;;) {
+        while(!trace.pending && !trace.stop)
+            pthread_cond_wait(&trace.wake, &trace.lock);
+        if(!trace.pending) break;
+
+        const TraceRecord *half = trace.ring + (trace.filling ^ 1) * TRACE_RING_RECORDS;
+        u64 count = trace.pending;
+        pthread_mutex_unlock(&trace.lock);
+
+        int failed = fwrite(half, sizeof(TraceRecord), count, trace.file) != count;
+
+        pthread_mutex_lock(&trace.lock);
+        trace.failed |= failed;
+        trace.pending = 0;
+        trace_hand_off();
+        pthread_cond_broadcast(&trace.wake);
+    }
+
+    pthread_mutex_unlock(&trace.lock);
+    return NULL;
+}
+
+static void trace_exit(void) {
+    trace_stop(NULL);
+}
+
+static void trace_register(void) {
+    atexit(trace_exit);
+}
+
+int trace_start(Mountpoint *mp, const char *path) {
+    static pthread_once_t exit_once = PTHREAD_ONCE_INIT;
+    if(!mp) return -1;
+
+    pthread_mutex_lock(&trace.lock);
+    if(trace.file) {
+        pthread_mutex_unlock(&trace.lock);
+        return 1;
+    }
+
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    TraceHeader header;
+    memset(&header, 0, sizeof(TraceHeader));
+    header.magic = TRACE_MAGIC;
+    header.version = TRACE_VERSION;
+    header.record_size = sizeof(TraceRecord);
+    header.start_time = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+
+    FILE *file = fopen(path, "wb");
+    TraceRecord *ring = malloc(2 * TRACE_RING_RECORDS * sizeof(TraceRecord));
+    if(!file || !ring || fwrite(&header, sizeof(TraceHeader), 1, file) != 1) {
+        if(file) fclose(file);
+        free(ring);
+        pthread_mutex_unlock(&trace.lock);
+        return -1;
+    }
+
+    trace.file = file;
+    trace.ring = ring;
+    trace.start = trace_now();
+    trace.head = trace.pending = trace.records = 0;
+    trace.filling = trace.stop = trace.failed = 0;
+
+    if(pthread_create(&trace.flusher, NULL, trace_main, NULL)) {
+        trace.file = NULL;
+        trace.ring = NULL;
+        pthread_mutex_unlock(&trace.lock);
+        fclose(file);
+        free(ring);
+        return -1;
+    }
+
+    __atomic_store_n(&trace_stats, &mp->io_stats, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&trace.lock);
+
+    // whatever is still in the ring makes it to the file when the CLI exits
+    pthread_once(&exit_once, trace_register);
+    return 0;
+}
+
+/* the last half is written out before the file is closed, returns 1 if
+ * nothing was being traced */
+int trace_stop(u64 *records) {
+    pthread_mutex_lock(&trace.lock);
+    if(!trace.file || trace.stop) {
+        pthread_mutex_unlock(&trace.lock);
+        return 1;
+    }
+
+    __atomic_store_n(&trace_stats, NULL, __ATOMIC_RELAXED);
+
+    while(trace.pending)
+        pthread_cond_wait(&trace.wake, &trace.lock);
+
+    // I/O that got past the flag before it was cleared sees stop and leaves
+    trace.filling ^= 1;
+    trace.pending = trace.head;
+    trace.head = 0;
+    trace.stop = 1;
+    pthread_cond_broadcast(&trace.wake);
+    pthread_mutex_unlock(&trace.lock);
+
+    pthread_join(trace.flusher, NULL);
+
+    pthread_mutex_lock(&trace.lock);
+    int status = fclose(trace.file) || trace.failed ? -1 : 0;
+    if(records) *records = trace.records;
+
+    free(trace.ring);
+    trace.file = NULL;
+    trace.ring = NULL;
+    trace.stop = 0;
+    pthread_mutex_unlock(&trace.lock);
+    return status;
+}
+
+/* a traced volume going away ends the recording, the file is still written
+ * out and closed by trace_stop() */
+void trace_release(Mountpoint *mp) {
+    pthread_mutex_lock(&trace.lock);
+    if(trace_stats == &mp->io_stats)
+        __atomic_store_n(&trace_stats, NULL, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&trace.lock);
+}
+
+void trace_record(u8 op, u64 block, u32 block_size, usize count, IOClass io_class) {
+    u64 now = trace_now();
+
+    pthread_mutex_lock(&trace.lock);
+
+    // both halves are full, the flusher has to catch up first
+    while(trace.file && !trace.stop && trace.head == TRACE_RING_RECORDS) {
+        trace_hand_off();
+        if(trace.head == TRACE_RING_RECORDS)
+            pthread_cond_wait(&trace.wake, &trace.lock);
+    }
+
+    if(!trace.file || trace.stop) {
+        pthread_mutex_unlock(&trace.lock);
+        return;
+    }
+
+    TraceRecord *record = trace.ring + trace.filling * TRACE_RING_RECORDS + trace.head++;
+    record->time = now > trace.start ? now - trace.start : 0;
+    record->block = block;
+    record->count = count;
+    record->op = op;
+    record->io_class = io_class;
+    record->block_shift = __builtin_ctz(block_size);
+    record->reserved = 0;
+    trace.records++;
+
+    trace_hand_off();
+    pthread_mutex_unlock(&trace.lock);
+}
+
+/* re-issues every record of a trace against the disk, as fast as it goes or
+ * at the times they were recorded. nothing but the shape of the I/O is kept,
+ * so writes put zeros where the recorded ones put data */
+int trace_replay(const char *path, FILE *disk, int paced, ReplayReport *report) {
+    memset(report, 0, sizeof(ReplayReport));
+
+    FILE *file = fopen(path, "rb");
+    if(!file) return -1;
+
+    TraceHeader header;
+    if(fread(&header, sizeof(TraceHeader), 1, file) != 1 || header.magic != TRACE_MAGIC ||
+        header.version != TRACE_VERSION || header.record_size != sizeof(TraceRecord)) {
+        fclose(file);
+        return -1;
+    }
+
+    TraceRecord *records = malloc(TRACE_RING_RECORDS * sizeof(TraceRecord));
+    u8 *buffer = NULL;
+    u64 buffer_size = 0;
+    int status = records ? 0 : -1;
+
+    u64 start = trace_now();
+    while(!status) {
+        usize count = fread(records, sizeof(TraceRecord), TRACE_RING_RECORDS, file);
+        if(!count) break;
+
+        for(usize i = 0; !status && i < count; i++) {
+            const TraceRecord *record = &records[i];
+            if(record->block_shift > 24 || record->op > TRACE_OP_WRITE ||
+                record->io_class >= IO_CLASSES) {
+                status = -1;
+                break;
+            }
+
+            u32 block_size = 1U << record->block_shift;
+            u64 size = (u64) block_size * record->count;
+            if(size > buffer_size) {
+                u8 *grown = realloc(buffer, size);
+                if(!grown) {
+                    status = -1;
+                    break;
+                }
+
+                buffer = grown;
+                buffer_size = size;
+            }
+
+            if(paced) {
+                u64 now = trace_now();
+                if(now - start < record->time) {
+                    u64 wait = record->time - (now - start);
+                    struct timespec ts = {wait / 1000000000ULL, wait % 1000000000ULL};
+                    nanosleep(&ts, NULL);
+                }
+            }
+
+            if(record->op == TRACE_OP_READ) {
+                status = read_block(disk, NULL, record->block, block_size, record->count, buffer,
+                    record->io_class);
+                report->reads++;
+                report->bytes_read += size;
+            } else {
+                // nothing a read left in the buffer goes back to the disk
+                memset(buffer, 0, size);
+                status = write_block(disk, NULL, record->block, block_size, record->count, buffer,
+                    record->io_class);
+                report->writes++;
+                report->bytes_written += size;
+            }
+
+            report->class_ops[record->io_class]++;
+            report->records++;
+        }
+
+        if(count < TRACE_RING_RECORDS) break;
+    }
+
+    report->seconds = (trace_now() - start) / 1e9;
+    free(records);
+    free(buffer);
+    fclose(file);
+    return status;
+}
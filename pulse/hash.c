@@ -24,85 +24,36 @@
  */
 
 #include <pulse/pulse.h>
-#include <string.h>
+#include <kiwi/xxhash.h>
 
-static inline u64 rotl64(u64 x, u8 r) {
-    return (x << r) | (x >> (64 - r));
-}
-
-u64 xxhash64(const void *data, usize len) {
-    const u64 prime1 = 11400714785074694791ULL;
-    const u64 prime2 = 14029467366897019727ULL;
-    const u64 prime3 = 1609587929392839161ULL;
-    const u64 prime4 = 9650029242287828579ULL;
-    const u64 prime5 = 2870177450012600261ULL;
-    const u64 seed = 0x9E3779B185EBCA87ULL;
-
-    const u8 *p = (const u8 *) data;
-    const u8 *const end = p + len;
-    u64 hash;
-
-    if (len >= 32) {
-        u64 v1 = seed + prime1 + prime2;
-        u64 v2 = seed + prime2;
-        u64 v3 = seed + 0;
-        u64 v4 = seed - prime1;
-
-        const u8 *limit = end - 32;
-        do {
-            v1 += (*(u64*)p)  *prime2;
-            v1 = rotl64(v1, 31);
-            v1 *= prime1;
-            p += 8;
-
-            v2 += (*(u64*)p)  *prime2;
-            v2 = rotl64(v2, 31);
-            v2 *= prime1;
-            p += 8;
-
-            v3 += (*(u64*)p)  *prime2;
-            v3 = rotl64(v3, 31);
-            v3 *= prime1;
-            p += 8;
-
-            v4 += (*(u64*)p)  *prime2;
-            v4 = rotl64(v4, 31);
-            v4 *= prime1;
-            p += 8;
-        } while (p <= limit);
+static const XXH3Engine *engine = NULL;
+static pthread_once_t engine_once = PTHREAD_ONCE_INIT;
 
-        hash = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
-    } else {
-        hash = seed + prime5;
+static void engine_select(void) {
+#ifdef XXH3_HAVE_AVX2
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")) {
+        engine = &xxh3_engine_avx2;
+        return;
     }
+#endif
 
-    hash += len;
-
-    while (p + 8 <= end) {
-        u64 k1 = *(u64 *)p;
-        k1 *= prime2; k1 = rotl64(k1, 31); k1 *= prime1;
-        hash ^= k1;
-        hash = rotl64(hash, 27)  *prime1 + prime4;
-        p += 8;
-    }
-
-    if (p + 4 <= end) {
-        hash ^= (*(u32 *)p) * prime1;
-        hash = rotl64(hash, 23) * prime2 + prime3;
-        p += 4;
-    }
+    engine = XXH3_ENGINE_DEFAULT;
+}
 
-    while (p < end) {
-        hash ^= (*p) * prime5;
-        hash = rotl64(hash, 11)  *prime1;
-        p++;
-    }
+/* XXH3 only uses the engine for inputs longer than 240 bytes so short keys like
+ * file names never touch it - the AVX2 path is compiled in with a target
+ * attribute so it has to be gated on the CPU we are actually running on, and
+ * hashing starts on many threads at once so the choice is made exactly once */
+const XXH3Engine *hash_engine(void) {
+    pthread_once(&engine_once, engine_select);
+    return engine;
+}
 
-    hash ^= hash >> 33;
-    hash *= prime2;
-    hash ^= hash >> 29;
-    hash *= prime3;
-    hash ^= hash >> 32;
+u64 hash64(const void *data, usize len, u64 seed) {
+    return xxh3_64_engine(data, len, seed, hash_engine());
+}
 
-    return hash;
+Hash128 hash128(const void *data, usize len, u64 seed) {
+    return xxh3_128_engine(data, len, seed, hash_engine());
 }
@@ -67,15 +67,32 @@ struct Command {
 };
 
 extern FILE *__disk;
-extern u16 __block_size;
+extern u32 __block_size;
 extern u8 __fanout;
 extern u64 __block_count;
 extern struct Command commands[];
 extern char *__image_name;
+extern Mountpoint *mountpoint;
 
 int command_line(const char *name);
 int script(int argc, char **argv);
+int mount_current(const char *path);
+int unmount_current(void);
+long default_threads(void);
 
 int mount_command(int argc, char **argv);
+int umount_command(int argc, char **argv);
+int sync_command(int argc, char **argv);
+int info_command(int argc, char **argv);
+int ls_command(int argc, char **argv);
+int dedup_command(int argc, char **argv);
+int paths_command(int argc, char **argv);
+int clean_command(int argc, char **argv);
+int defrag_command(int argc, char **argv);
 int create_command(int argc, char **argv);
 int test_command(int argc, char **argv);
+int check_command(int argc, char **argv);
+int import_command(int argc, char **argv);
+int bench_command(int argc, char **argv);
+int trace_command(int argc, char **argv);
+int replay_command(int argc, char **argv);
@@ -0,0 +1,93 @@
+/*
+ * pulse - a highly scalable SSD-first file system with predictable logarithmic
+ * bounds across all operations
+ * 
+ * Copyright (c) 2025 Omar Elghoul
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <pulse/pulse.h>
+
+/* libpulse is the thread-safe interface to pulse volumes, every call takes
+ * the handle returned by pulse_mount() and any number of volumes can be open
+ * at once - calls on the same volume from different threads are serialized
+ * only where they touch the same state:
+ *
+ *   create, remove, clone and reserve exclude each other, lookup, stat and
+ *   readdir
+ *   write, truncate, allocate and punch exclude everything else on the inode
+ *   read and stat share the inode with each other, clone locks its source
+ *   defrag locks one file at a time, like a write
+ *   check, sync, dedup, clean, the path index and unmount exclude everything
+ *   else on the volume
+ *
+ * locks are always taken in the order volume -> namespace -> inode -> share
+ * -> icache -> bitmap, the share lock keeps dedup from sharing a block that a
+ * write is overwriting in place and the bitmap lock guards allocation -
+ * lookups add to the path index under a lock of its own that is never held
+ * with another
+ *
+ * the lower level functions in pulse.h take no locks and are only safe on a
+ * volume that a single thread is using */
+
+typedef struct PulseStat {
+    u64 inode;
+    u32 mode;
+    u64 size;
+    u64 link_count;
+    u64 created_time;
+    u64 modified_time;
+    u64 accessed_time;
+    u64 changed_time;
+} PulseStat;
+
+typedef struct PulseDirEntry {
+    PulseStat stat;
+    char name[DIR_MAX_FILE_NAME];
+} PulseDirEntry;
+
+Mountpoint *pulse_mount(const char *path);
+int pulse_unmount(Mountpoint *volume);
+u64 pulse_lookup(Mountpoint *volume, const char *path);
+u64 pulse_create(Mountpoint *volume, const char *path, u32 mode);
+int pulse_remove(Mountpoint *volume, const char *path);
+int pulse_reserve_entries(Mountpoint *volume, u64 dir, u64 entries);
+u64 pulse_clone(Mountpoint *volume, const char *source, const char *path);
+int pulse_stat(Mountpoint *volume, u64 inode, PulseStat *stat);
+int pulse_readdir_plus(Mountpoint *volume, u64 dir, u64 *cookie, PulseDirEntry *entries, u64 max,
+    u64 *count);
+int pulse_read(Mountpoint *volume, u64 inode, void *buf, u64 offset, u64 size);
+int pulse_write(Mountpoint *volume, u64 inode, const void *buf, u64 offset, u64 size);
+int pulse_truncate(Mountpoint *volume, u64 inode, u64 size);
+int pulse_allocate(Mountpoint *volume, u64 inode, u64 offset, u64 size);
+int pulse_punch(Mountpoint *volume, u64 inode, u64 offset, u64 size);
+int pulse_check(Mountpoint *volume, u32 threads, CheckReport *report);
+int pulse_sync(Mountpoint *volume);
+int pulse_discard(Mountpoint *volume, DiscardMode mode);
+int pulse_dedup(Mountpoint *volume, u64 budget);
+int pulse_dedup_report(Mountpoint *volume, DedupReport *report);
+int pulse_path_index(Mountpoint *volume, int enabled);
+int pulse_path_index_report(Mountpoint *volume, PathIndexReport *report);
+int pulse_clean(Mountpoint *volume, u64 segments, CleanReport *report);
+int pulse_defrag(Mountpoint *volume, const char *path, u64 threshold, u64 rate, DefragReport *report);
+int pulse_defrag_start(Mountpoint *volume, u64 threshold, u64 rate);
+int pulse_defrag_stop(Mountpoint *volume);
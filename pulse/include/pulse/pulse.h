@@ -26,13 +26,24 @@
 #pragma once
 
 #include <kiwi/types.h>
+#include <kiwi/xxhash.h>
 #include <stdio.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <sys/uio.h>
 
 /* these are tunable at format time */
 #define DEFAULT_BLOCK_SIZE              4096    /* 3-bit value, valid range is powers of 2 from 4 to 512 KB */
 #define DEFAULT_FANOUT_FACTOR           16      /* 2-bit, valid range is powers of 2 from 8 to 64 */
 #define DEFAULT_BITMAP_LIMIT            16384   /* 2-bit, valid range is powers of 2 from 4K to 32K */
 
+/* hierarchical bitmap layout */
+#define BITMAP_MAX_LAYERS               24      /* enough for 2^64 blocks at the smallest fanout */
+#define BITMAP_LAYER_SPAN(bits)         (((bits) + 63) & ~63ULL)    /* layers are 64-bit aligned */
+#define ALLOCATE_SCAN_BLOCKS            64      /* bitmap blocks searched for a contiguous run */
+#define ALLOCATE_METADATA_SHARE         16      /* the first 1/16 of the volume is kept for metadata */
+#define LOG_SEGMENT_LAYER               2       /* a log segment spans fanout^2 blocks */
+
 /* this is hard-coded */
 #define SUPERBLOCK_BLOCK_NUMBER         64      /* superblock is always at block 64 */
 
@@ -78,6 +89,12 @@
 #define SUPER_TUNING_BITMAP_LIMIT_16384 0x0200
 #define SUPER_TUNING_BITMAP_LIMIT_32768 0x0300
 
+#define SUPER_TUNING_ALLOCATOR_MASK     0x0400
+#define SUPER_TUNING_ALLOCATOR_LOWEST   0x0000
+#define SUPER_TUNING_ALLOCATOR_LOG      0x0400
+
+#define SUPER_TUNING_PATH_INDEX         0x0800  /* full paths are hashed to the inodes they resolve to */
+
 /* superblock status field */
 #define SUPER_STATUS_MOUNTED            0x01    /* set on mount */
 #define SUPER_STATUS_DIRTY              0x02    /* set on first write BEFORE writing to journal */
@@ -136,6 +153,46 @@
 
 #define INODE_MODE_JOURNAL_OPT_OUT      0x10000 /* 1 = disable journal */
 #define INODE_MODE_IMMUTABLE            0x20000 /* nobody can change this inode */
+#define INODE_MODE_COMPRESSED           0x40000 /* file data is stored in compressed clusters */
+
+/* inode tables */
+#define INODE_MIN_SIZE                  512     /* smallest packed inode, powers of 2 up to half a block */
+#define INODE_SLOT_SHIFT                10      /* low bits of a packed inode number are its slot */
+#define INODE_BLOCK(mp, inode)          ((inode) >> (mp)->inode_shift)
+#define INODE_SLOT(mp, inode)           ((inode) & ((1ULL << (mp)->inode_shift) - 1))
+
+/* extent tree */
+#define EXTENT_MAX_DEPTH                16      /* deeper trees are treated as corrupt */
+#define EXTENT_FANOUT                   16      /* children per internal node */
+#define EXTENT_UNWRITTEN                0x01    /* leaf blocks are allocated but read as zeros */
+
+/* deduplication */
+#define DEDUP_DEFAULT_BUDGET            (32ULL << 20)   /* bytes of fingerprint index */
+#define DEDUP_LOAD_FACTOR               75      /* stop indexing new blocks at >=75% load */
+
+/* path index */
+#define PATH_INDEX_MIN_SLOTS            1024    /* slots the index starts out with */
+#define PATH_INDEX_MAX_SLOTS            (1ULL << 22)    /* slots it grows to at most */
+#define PATH_INDEX_LOAD_FACTOR          75      /* grow, or stop adding paths at the most, at >=75% load */
+
+/* compression */
+#define COMPRESS_CLUSTER_BLOCKS         16      /* blocks of file data compressed together */
+
+/* defragmentation */
+#define DEFRAG_MIN_EXTENTS              8       /* files with fewer extents are left alone */
+#define DEFRAG_CHUNK_SIZE               (1ULL << 20)    /* file data copied at a time */
+#define DEFRAG_INTERVAL                 (60ULL * 1000000000ULL)  /* ns between background passes */
+
+/* formatting */
+#define FORMAT_WRITE_CHUNK              (8ULL << 20)    /* bitmap bytes per write, chunks are aligned to this on the disk */
+#define FORMAT_MAX_THREADS              16      /* threads writing the bitmap at once */
+
+/* block I/O traces */
+#define TRACE_MAGIC                     0x63727465736C7570ULL   /* "pulsetrc" little-endian */
+#define TRACE_VERSION                   1
+#define TRACE_RING_RECORDS              8192    /* records per half of the ring, one half is written while the other fills */
+#define TRACE_OP_READ                   0
+#define TRACE_OP_WRITE                  1
 
 /* directory thresholds */
 #define DIR_HASH_DEFAULT_SIZE           4       /* directories start with 4 nests */
@@ -144,6 +201,8 @@
 #define DIR_HASH_SHRINK_LOAD_FACTOR     25      /* shrink at <25% load factor */
 #define DIR_HASH_SHRINK_COLLISION_RATE  10      /* AND <10% collision rate for that load factor */
 #define DIR_MAX_FILE_NAME               1006    /* 1006 bytes INCLUDING null terminator */
+#define DIR_COOKIE_END                  (~0ULL) /* reading a directory has reached its end */
+#define DIR_PREFETCH_BATCH              256     /* inodes of directory entries fetched together */
 
 typedef struct SuperBlock {
     u64 magic;
@@ -173,9 +232,16 @@ typedef struct SuperBlock {
     u64 total_mounts;       // total number of mounts with write enabled
 
     u32 check_interval;     // seconds, zero to disable auto-check
-    u32 reserved3;
+    u32 inode_size;         // bytes per inode in an inode table, zero for a block each
 
     s8 label[256];          // UTF-8, null-terminated
+
+    u64 refcount_block;     // first block of the shared extent table, zero if nothing is shared
+    u64 dedup_block;        // first block of the fingerprint index, zero if it is empty
+    u64 dedup_budget;       // bytes of memory for the fingerprint index, zero if dedup is off
+    u64 inode_slot_block;   // first block of the free inode slot list, zero if it is empty
+    u64 log_head;           // next block the log appends to, log-structured volumes only
+    u64 path_index_block;   // first block of the path index, zero if it is empty or out of date
 }__attribute__((packed)) SuperBlock;
 
 typedef struct JournalHeader {
@@ -205,11 +271,60 @@ typedef struct ExtentNode {     /* for any node in the B+ tree */
     u64 parent_block;   // zero for the root
     u64 left_sibling_block;
     u64 right_sibling_block;
+
+    u64 compressed_length;  // bytes of LZ4 data in the blocks of a leaf, zero if stored raw
+    u64 flags;              // EXTENT_*, leaves only
 }__attribute__((packed)) ExtentNode;
 
+/* blocks referenced by more than one file after a clone - anything not in the
+ * table has exactly one owner, so the table stays as small as the sharing */
+typedef struct SharedExtent {
+    u64 block;          // first block of the run
+    u64 count;          // number of blocks, all with the same reference count
+    u64 refs;           // files referencing these blocks, always at least 2
+}__attribute__((packed)) SharedExtent;
+
+typedef struct RefcountBlock {  /* the table is stored as a chain of these */
+    u64 next;           // next block of the chain, zero for the last
+    u64 count;          // entries in this block
+    SharedExtent entries[];
+}__attribute__((packed)) RefcountBlock;
+
+/* fingerprint of a data block, a later write of the same data shares the
+ * block instead of storing it again */
+typedef struct DedupEntry {
+    Hash128 hash;       // 128-bit XXH3 of the block
+    u64 block;          // zero for an empty slot
+}__attribute__((packed)) DedupEntry;
+
+typedef struct DedupBlock {     /* the index is stored as a chain of these */
+    u64 next;           // next block of the chain, zero for the last
+    u64 count;          // entries in this block
+    DedupEntry entries[];
+}__attribute__((packed)) DedupBlock;
+
+/* a path that has been resolved before, found again in one probe - the hit is
+ * checked by looking the last component up in the parent */
+typedef struct PathEntry {
+    Hash128 hash;       // 128-bit XXH3 of the path without empty or "." components
+    u64 parent;         // directory holding the last component
+    u64 inode;          // zero for an empty slot
+}__attribute__((packed)) PathEntry;
+
+typedef struct PathBlock {      /* the index is stored as a chain of these */
+    u64 next;           // next block of the chain, zero for the last
+    u64 count;          // entries in this block
+    PathEntry entries[];
+}__attribute__((packed)) PathBlock;
+
+typedef struct InodeSlotBlock { /* free slots of inode tables are stored as a chain of these */
+    u64 next;           // next block of the chain, zero for the last
+    u64 count;          // slots in this block
+    u64 slots[];        // packed inode numbers
+}__attribute__((packed)) InodeSlotBlock;
+
 typedef struct Inode {
-    u16 mode;
-    u16 reserved1;
+    u32 mode;               // see INODE_MODE_*, pulse flags live above the low 16 bits
     u32 uid;
     u32 gid;
     u32 link_count;
@@ -274,6 +389,96 @@ typedef struct DirectoryHashNest {
     DirectoryEntry file[];
 }__attribute__((packed)) DirectoryHashNest;
 
+#define ICACHE_DEFAULT_CAPACITY         4096    /* inodes kept in memory per volume */
+#define ICACHE_DIRTY                    0x01    /* inode changed, written before eviction */
+#define ICACHE_TIMES                    0x02    /* only timestamps changed, written lazily */
+#define ICACHE_DROPPED                  0x04    /* inode was freed, gone with the last reference */
+#define ICACHE_PREFETCH_RUN             (1ULL << 20)    /* longest single read when prefetching */
+#define ICACHE_PREFETCH_GAP             8       /* unwanted blocks read to keep a prefetch run going */
+#define ICACHE_FLUSH_RUN                256     /* inode blocks written back together on sync */
+
+#define WRITEBACK_INODE_LIMIT           (8ULL << 20)    /* delayed data per inode */
+#define WRITEBACK_VOLUME_LIMIT          (64ULL << 20)   /* delayed data per volume */
+#define WRITEBACK_TIMEOUT               (5ULL * 1000000000ULL)  /* ns before delayed data is flushed */
+
+typedef enum DiscardMode {
+    DISCARD_OFF,            // freed blocks are left alone
+    DISCARD_ONLINE,         // every freed block is discarded right away
+    DISCARD_BATCHED         // freed ranges are merged and discarded on sync
+} DiscardMode;
+
+#define DISCARD_BATCH_RANGES            1024    /* freed ranges held before a batch goes out */
+
+typedef struct DiscardRange {
+    u64 block;
+    u64 count;
+} DiscardRange;
+
+typedef struct CachedInode {
+    u64 inode;
+    u32 references;
+    u8 flags;
+    pthread_rwlock_t lock;              // file contents, taken by the locked API
+    struct CachedInode *next;           // hash chain
+    struct CachedInode *lru_prev;       // unreferenced inodes, least recently used first
+    struct CachedInode *lru_next;
+    Inode *data;                        // the inode and its inline payload, inode_size bytes
+
+    // delayed file data, only blocks up to the first one of it are mapped
+    u8 *pending;
+    u64 pending_offset;                 // block aligned
+    u64 pending_size;
+    u64 pending_capacity;
+    u64 pending_time;                   // when the buffer was started, zero without one
+} CachedInode;
+
+/* what a block read or write is for, bitmap blocks carry their layer with
+ * the bottom layer at IO_BITMAP */
+typedef enum IOClass {
+    IO_SUPERBLOCK,
+    IO_BITMAP,
+    IO_INODE = IO_BITMAP + BITMAP_MAX_LAYERS,   // inodes and inode tables
+    IO_DIRECTORY,           // directory headers, hash maps and nests
+    IO_EXTENT,              // extent tree nodes
+    IO_JOURNAL,
+    IO_TABLE,               // refcount, dedup, path index and free inode chains
+    IO_DATA,                // contents of regular files
+    IO_CLASSES
+} IOClass;
+
+typedef struct IOClassStats {
+    u64 reads;
+    u64 writes;
+    u64 bytes_read;
+    u64 bytes_written;
+} IOClassStats;
+
+/* block I/O of one mounted volume, every counter is only added to atomically */
+typedef struct IOStats {
+    u64 reads;              // read_block() calls
+    u64 writes;             // write_block() calls
+    u64 bytes_read;
+    u64 bytes_written;
+    u64 discards;           // ranges handed back to the device
+    u64 bytes_discarded;
+    u64 logical_read;       // file data asked for through pulse_read()
+    u64 logical_written;    // file data handed to pulse_write()
+    IOClassStats classes[IO_CLASSES];
+} IOStats;
+
+struct Mountpoint;
+
+/* the bitmap walks behind every single block allocation and free, one set per
+ * fanout and block size - the generic set has zeros in both */
+typedef struct BitmapMath {
+    u32 fanout;
+    u32 block_size;
+    int (*status)(struct Mountpoint *mp, u8 *bitmap, u64 block);
+    int (*mark)(struct Mountpoint *mp, u8 *bitmap, u64 block);
+    u64 (*descend)(struct Mountpoint *mp, u8 *bitmap, int layer, u64 bit_offset);
+    int (*release)(struct Mountpoint *mp, u8 *bitmap, u64 block);
+} BitmapMath;
+
 typedef struct Mountpoint {
     SuperBlock *superblock;
     char *name;
@@ -281,30 +486,334 @@ typedef struct Mountpoint {
     u32 block_size;
     u32 bitmap_layers;
     u16 highest_layer_size;
-    u8 *highest_layer_bitmap;
+    u8 *highest_layer_bitmap;   // guarded by bitmap_lock
     u64 *layer_starts;
     u64 *layer_sizes;
-    void *bitmap_block;
-    void *metadata_block;
-    void *data_block;
     u8 fanout;
+    const BitmapMath *bitmap_math;      // picked at mount for the fanout and block size
+    u64 data_zone;              // file data is allocated from here up, metadata below
+
+    // a log-structured volume appends file data at the head, which fills one
+    // segment before it moves on to an empty one - guarded by bitmap_lock
+    u8 log_mode;
+    u64 log_head;
+    u64 log_start;              // first segment boundary above the data zone
+    u64 log_segment;            // blocks per segment
+
+    // where the last write of file data ended and how many did not start
+    // there, updated atomically by writers holding the volume lock
+    u64 data_write_end;
+    u64 data_writes;
+    u64 data_write_jumps;
+
+    // inodes packed into tables are numbered block << inode_shift | slot,
+    // otherwise the inode number is its block and the size is a whole block
+    u32 inode_size;
+    u8 inode_shift;
+
+    // inode cache, guarded by icache_lock
+    CachedInode **icache;
+    u64 icache_buckets;
+    u64 icache_count;
+    u64 icache_capacity;
+    CachedInode *icache_lru;
+    CachedInode *icache_mru;
+    u64 pending_bytes;                  // delayed data buffered by all inodes
+    u64 *inode_slots;                   // free slots in inode tables, a stack
+    u64 inode_slot_count;
+    u64 inode_slot_capacity;
+    u8 inode_slots_dirty;               // differs from the list on disk
+
+    // freed ranges waiting to be discarded, guarded by bitmap_lock
+    DiscardRange *discards;
+    u64 discard_count;
+    u64 discard_capacity;
+    u8 discard_mode;
+    u8 discard_device;                  // BLKDISCARD instead of punching holes in an image
+
+    // reference counts of blocks shared between files, sorted by block and
+    // guarded by bitmap_lock
+    SharedExtent *shared;
+    u64 shared_count;
+    u64 shared_capacity;
+    u8 shared_dirty;                    // differs from the table on disk
+
+    // fingerprints of data blocks, both tables hold the same entries - one is
+    // probed by hash to find duplicates, the other by block to forget freed
+    // ones - guarded by bitmap_lock
+    DedupEntry *dedup_by_hash;
+    DedupEntry *dedup_by_block;
+    u64 dedup_capacity;                 // slots per table, a power of two, zero if dedup is off
+    u64 dedup_count;
+    u8 dedup_dirty;                     // differs from the index on disk
+    u64 dedup_checked;                  // blocks fingerprinted since mount
+    u64 dedup_matched;                  // blocks shared instead of written since mount
+
+    // paths resolved before, so a deep one takes one probe instead of a lookup
+    // per component - lookups add to it holding namespace_lock shared, so it
+    // has path_lock, and nothing is locked under that
+    PathEntry *path_index;
+    u64 path_capacity;                  // slots, a power of two, zero if the index is off
+    u64 path_count;
+    u8 path_dirty;                      // differs from the index on disk
+    u64 path_hits;                      // lookups answered by the index since mount, atomic
+    u64 path_misses;                    // lookups that walked the tree since mount, atomic
+    pthread_mutex_t path_lock;
+
+    // volumes mounted through the library flush delayed data that has waited
+    // WRITEBACK_TIMEOUT from a thread of their own
+    pthread_t writeback_thread;
+    pthread_mutex_t writeback_lock;
+    pthread_cond_t writeback_wake;
+    u8 writeback_running;
+    u8 writeback_stop;
+
+    // and can rewrite fragmented files from another one every DEFRAG_INTERVAL,
+    // guarded by writeback_lock
+    pthread_t defrag_thread;
+    pthread_cond_t defrag_wake;
+    u64 defrag_threshold;               // extents a file needs to be rewritten
+    u64 defrag_rate;                    // bytes a second the copying may take, zero for no limit
+    u8 defrag_running;
+    u8 defrag_stop;
+
+    // lock order is volume -> namespace -> inode -> share -> icache -> bitmap,
+    // path_lock is only ever held on its own
+    pthread_rwlock_t volume_lock;       // shared by operations, exclusive for check and unmount
+    pthread_rwlock_t namespace_lock;    // directory contents
+    pthread_rwlock_t share_lock;        // shared by in-place writes, exclusive for dedup sharing
+    pthread_mutex_t icache_lock;        // cache structure, not the cached inodes
+    pthread_mutex_t bitmap_lock;        // allocation state
+
+    IOStats io_stats;
 } Mountpoint;
 
-extern Mountpoint *mountpoint;
+/* metadata is rewritten often and read on every lookup, so it is packed at the
+ * front of the volume away from the file data */
+typedef enum AllocClass {
+    ALLOC_METADATA,         // inodes, extent nodes, directories and the tables
+    ALLOC_DATA              // contents of regular files
+} AllocClass;
+
+typedef enum ScratchBuffer {
+    SCRATCH_METADATA,       // inodes
+    SCRATCH_DATA,           // partial data blocks
+    SCRATCH_BITMAP,         // bitmap blocks
+    SCRATCH_EXTENT,         // extent tree nodes
+    SCRATCH_CLUSTER,        // a cluster of file data being compressed
+    SCRATCH_DECODED,        // a cluster of file data being read
+    SCRATCH_PACKED,         // compressed data on its way to or from the disk
+    SCRATCH_INODES,         // inode table blocks
+    SCRATCH_EDGES,          // the partial blocks at both ends of a read
+    SCRATCH_BUFFERS
+} ScratchBuffer;
+
+typedef struct TraceHeader {
+    u64 magic;              // TRACE_MAGIC
+    u32 version;            // TRACE_VERSION
+    u32 record_size;        // sizeof(TraceRecord)
+    u64 start_time;         // Unix time, nanosecond precision
+}__attribute__((packed)) TraceHeader;
+
+typedef struct TraceRecord {
+    u64 time;               // ns since the trace started, taken when the I/O completed
+    u64 block;
+    u32 count;              // blocks
+    u8 op;                  // TRACE_OP_*
+    u8 io_class;            // IOClass
+    u8 block_shift;         // log2 of the block size
+    u8 reserved;
+}__attribute__((packed)) TraceRecord;
+
+typedef struct ReplayReport {
+    u64 records;
+    u64 reads;
+    u64 writes;
+    u64 bytes_read;
+    u64 bytes_written;
+    u64 class_ops[IO_CLASSES];  // records of every class, bitmap layers apart
+    double seconds;
+} ReplayReport;
+
+typedef struct CleanReport {
+    u64 segments;               // segments picked to be emptied
+    u64 emptied;                // of those, how many were left with nothing in them
+    u64 moved_blocks;           // live file data copied to the log head
+    u64 free_segments;          // empty segments once the cleaner is done
+} CleanReport;
+
+typedef struct DefragReport {
+    u64 files;                  // files looked at
+    u64 defragmented;           // of those, how many were rewritten
+    u64 extents_before;         // extents of the rewritten files before
+    u64 extents_after;          // and after
+    u64 moved_blocks;           // file data copied to the new runs
+} DefragReport;
+
+typedef struct PathIndexReport {
+    u8 enabled;
+    u64 entries;                // paths in the index
+    u64 capacity;               // paths the index can grow to
+    u64 hits;                   // lookups answered by the index since mount
+    u64 misses;                 // lookups that walked the tree since mount
+} PathIndexReport;
+
+typedef struct DedupReport {
+    u64 budget;                 // bytes of memory the index may use, zero if dedup is off
+    u64 entries;                // fingerprints in the index
+    u64 capacity;               // fingerprints the budget has room for
+    u64 checked;                // blocks fingerprinted since mount
+    u64 matched;                // blocks shared instead of written since mount
+    u64 shared_blocks;          // blocks on the volume with more than one owner
+    u64 saved_blocks;           // blocks the sharing saves, clones included
+} DedupReport;
+
+typedef struct CheckReport {
+    u64 inodes;                 // inodes reachable from the root
+    u64 directories;
+    u64 entries;                // directory entries, hard links counted every time
+    u64 referenced_blocks;      // blocks in use according to the inodes
+    u64 allocated_blocks;       // blocks in use according to the bitmap
+    u64 leaked_blocks;          // allocated but not referenced by anything
+    u64 missing_blocks;         // referenced but free in the bitmap
+    u64 cross_linked_blocks;    // referenced more than once
+    u64 layer_errors;           // bitmap bits that disagree with the layer below
+    u64 structure_errors;       // malformed inodes, extent trees or directories
+    u64 bytes_read;
+    double seconds;
+} CheckReport;
+
+typedef int (*ExtentCallback)(const ExtentNode *node, u64 node_block, void *context);
+typedef int (*FileCallback)(Mountpoint *mp, u64 inode, const Inode *buffer, void *context);
+
+extern IOStats *trace_stats;
+extern const BitmapMath bitmap_math_generic;
 
 int format(const char *path, usize size, usize block_size, usize fanout);
-int read_block(FILE *disk, u64 block, u16 block_size, usize count, void *buffer);
-int write_block(FILE *disk, u64 block, u16 block_size, usize count, const void *buffer);
+int format_volume(const char *path, usize size, usize block_size, usize fanout,
+    usize inode_size, usize allocator);
+Mountpoint *mount_image(const char *path);
+int unmount(Mountpoint *mp);
+int sync_volume(Mountpoint *mp);
+int read_block(FILE *disk, IOStats *stats, u64 block, u32 block_size, usize count, void *buffer,
+    IOClass io_class);
+int write_block(FILE *disk, IOStats *stats, u64 block, u32 block_size, usize count,
+    const void *buffer, IOClass io_class);
+int read_block_vector(FILE *disk, IOStats *stats, u64 block, u32 block_size, struct iovec *vector,
+    int count, IOClass io_class);
+int write_block_vector(FILE *disk, IOStats *stats, u64 block, u32 block_size, struct iovec *vector,
+    int count, IOClass io_class);
 int read_bit(u8 *bitmap, u64 bit);
 int write_bit(u8 *bitmap, u64 bit, int value);
-int block_status(u64 block);
-u64 allocate_block();
-int free_block(u64 block);
-u64 resolve(const char *path);
-int read_inode(u64 inode, Inode *buffer);
-int write_inode(u64 inode, const Inode *buffer);
-int dump_inode(u64 inode);
-int read_from_inode(u64 inode, void *buf, u64 offset, u64 size);
-int write_to_inode(u64 inode, const void *buf, u64 offset, u64 size);
-
-u64 xxhash64(const void *data, usize len);
+u32 bitmap_layout(u64 volume_size, u32 fanout, u32 bitmap_limit, u64 *layer_starts,
+    u64 *layer_sizes);
+void bitmap_set_range(u64 *bitmap, u64 bit, u64 count);
+void bitmap_build_parents(u64 *bitmap, u32 layers, const u64 *layer_starts,
+    const u64 *layer_sizes, u32 fanout);
+const BitmapMath *bitmap_math_select(u32 fanout, u32 block_size);
+int block_status(Mountpoint *mp, u64 block);
+u64 allocate_block(Mountpoint *mp);
+int claim_block(Mountpoint *mp, u64 block);
+u64 allocate_blocks(Mountpoint *mp, u64 count, u64 *allocated, AllocClass alloc_class);
+u64 claim_blocks(Mountpoint *mp, u64 block, u64 count);
+int free_block(Mountpoint *mp, u64 block);
+int log_usage(Mountpoint *mp, u64 *used);
+int refcount_load(Mountpoint *mp);
+int refcount_store(Mountpoint *mp);
+void refcount_destroy(Mountpoint *mp);
+int refcount_share(Mountpoint *mp, u64 block, u64 count);
+int refcount_share_locked(Mountpoint *mp, u64 block, u64 count);
+int refcount_release(Mountpoint *mp, u64 block);
+u64 refcount_query(Mountpoint *mp, u64 block, u64 *run);
+int dedup_load(Mountpoint *mp);
+int dedup_store(Mountpoint *mp);
+void dedup_destroy(Mountpoint *mp);
+int dedup_set_budget(Mountpoint *mp, u64 budget);
+u64 dedup_share(Mountpoint *mp, const Hash128 *hash, const void *data);
+int dedup_insert(Mountpoint *mp, const Hash128 *hash, u64 block);
+void dedup_forget(Mountpoint *mp, u64 block);
+int dedup_report(Mountpoint *mp, DedupReport *report);
+int path_index_load(Mountpoint *mp);
+int path_index_store(Mountpoint *mp);
+void path_index_destroy(Mountpoint *mp);
+int path_index_enable(Mountpoint *mp, int enabled);
+u64 path_index_find(Mountpoint *mp, const char *path);
+void path_index_add(Mountpoint *mp, const char *path, u64 parent, u64 inode);
+int path_index_forget(Mountpoint *mp, const char *path);
+int path_index_report(Mountpoint *mp, PathIndexReport *report);
+int discard_init(Mountpoint *mp);
+void discard_destroy(Mountpoint *mp);
+int discard_add(Mountpoint *mp, u64 block, u64 count);
+int discard_flush(Mountpoint *mp);
+int discard_set_mode(Mountpoint *mp, DiscardMode mode);
+u64 resolve(Mountpoint *mp, const char *path);
+u64 resolve_parent(Mountpoint *mp, const char *path, char *name);
+u64 create_inode(Mountpoint *mp, u32 mode);
+int free_inode(Mountpoint *mp, u64 inode);
+u64 itable_allocate(Mountpoint *mp);
+int itable_release(Mountpoint *mp, u64 inode);
+int itable_load(Mountpoint *mp);
+int itable_store(Mountpoint *mp);
+void itable_destroy(Mountpoint *mp);
+int read_inode(Mountpoint *mp, u64 inode, Inode *buffer);
+int write_inode(Mountpoint *mp, u64 inode, const Inode *buffer);
+int dump_inode(Mountpoint *mp, u64 inode);
+int icache_init(Mountpoint *mp, u64 capacity);
+void icache_destroy(Mountpoint *mp);
+CachedInode *icache_get(Mountpoint *mp, u64 inode, int load);
+void icache_put(Mountpoint *mp, CachedInode *cached);
+void icache_drop(Mountpoint *mp, u64 inode);
+int icache_sync(Mountpoint *mp, int times);
+int icache_flush_expired(Mountpoint *mp, u64 now);
+int icache_commit(Mountpoint *mp, u64 inode);
+int icache_prefetch(Mountpoint *mp, const u64 *inodes, u64 count);
+int read_from_inode(Mountpoint *mp, u64 inode, void *buf, u64 offset, u64 size);
+int write_to_inode(Mountpoint *mp, u64 inode, const void *buf, u64 offset, u64 size);
+int truncate_inode(Mountpoint *mp, u64 inode, u64 size);
+int preallocate_inode(Mountpoint *mp, u64 inode, u64 offset, u64 size);
+int punch_inode(Mountpoint *mp, u64 inode, u64 offset, u64 size);
+int flush_inode(Mountpoint *mp, CachedInode *cached);
+int write_data(Mountpoint *mp, u64 block, usize count, const void *data, IOClass io_class);
+int relocate_inode(Mountpoint *mp, u64 inode, const u8 *victims, u64 *moved);
+int clean_log(Mountpoint *mp, u64 segments, CleanReport *report);
+int defrag_inode(Mountpoint *mp, u64 inode, u64 threshold, DefragReport *report);
+int extent_walk(FILE *disk, IOStats *stats, u32 block_size, u64 root, void *scratch,
+    ExtentCallback callback, void *context);
+int extent_read(Mountpoint *mp, u64 block, ExtentNode *node);
+int extent_find(Mountpoint *mp, u64 root, u64 offset, ExtentNode *leaf, u64 *leaf_block);
+int extent_update(Mountpoint *mp, u64 leaf_block, const ExtentNode *leaf);
+int extent_append(Mountpoint *mp, Inode *inode, const ExtentNode *leaf, u64 leaf_block);
+int extent_insert(Mountpoint *mp, Inode *inode, const ExtentNode *leaf, u64 *leaf_block);
+int extent_insert_after(Mountpoint *mp, Inode *inode, u64 left_block, const ExtentNode *leaf,
+    u64 *leaf_block);
+int extent_remove(Mountpoint *mp, Inode *inode, u64 leaf_block);
+int extent_collect(Mountpoint *mp, u64 root, ExtentNode **leaves, u64 *count);
+int extent_rebuild(Mountpoint *mp, Inode *inode, const ExtentNode *leaves, u64 count);
+int extent_build(Mountpoint *mp, Inode *inode, const ExtentNode *leaves, u64 count);
+int extent_free_tree(Mountpoint *mp, u64 root);
+int extent_continues(const ExtentNode *left, const ExtentNode *right, u32 block_size);
+u64 extent_merge(ExtentNode *leaves, u64 count, u32 block_size);
+u64 dir_lookup(Mountpoint *mp, u64 dir, const char *name);
+int dir_list(Mountpoint *mp, u64 dir, DirectoryEntry **list, u64 *count);
+int dir_walk(Mountpoint *mp, u64 dir, FileCallback callback, void *context);
+int dir_read(Mountpoint *mp, u64 dir, u64 *cookie, DirectoryEntry *entries, u64 max, u64 *count);
+int dir_add(Mountpoint *mp, u64 dir, const char *name, u64 inode);
+int dir_remove(Mountpoint *mp, u64 dir, const char *name);
+int dir_reserve(Mountpoint *mp, u64 dir, u64 entries);
+u64 create_file(Mountpoint *mp, const char *path, u32 mode);
+int remove_file(Mountpoint *mp, const char *path);
+u64 clone_file(Mountpoint *mp, const char *source, const char *path);
+int write_superblock(Mountpoint *mp);
+void reset_io_stats(IOStats *stats);
+int trace_start(Mountpoint *mp, const char *path);
+int trace_stop(u64 *records);
+void trace_release(Mountpoint *mp);
+void trace_record(u8 op, u64 block, u32 block_size, usize count, IOClass io_class);
+int trace_replay(const char *path, FILE *disk, int paced, ReplayReport *report);
+const char *io_class_name(IOClass io_class);
+int check_volume(Mountpoint *mp, u32 threads, CheckReport *report);
+void *scratch_buffer(ScratchBuffer which, u32 size);
+
+const XXH3Engine *hash_engine(void);
+u64 hash64(const void *data, usize len, u64 seed);
+Hash128 hash128(const void *data, usize len, u64 seed);